@@ -0,0 +1,168 @@
+/**
+ * Example of using ASYNC CMD options
+ *
+ * This is the bare minimum for ASYNC CMD, the example does boiler-plate of the
+ * below tasks using SYNC CMD:
+ *
+ * - Retrieve free chunk
+ * - Erase the chunk
+ * - Write a synthetic payload to the chunk
+ *
+ * The ASYNC part is provided in the function 'ex04_async_read', doing:
+ *
+ * - Initialize a CMD context
+ * - Setup 'nvm_ret' without a callback function
+ * - Submit reads for the entire chunk
+ * - Reap batches of completions into an array and overlap with something else
+ * - Terminate the CMD context
+ *
+ * The program terminates with 0 on success and EXIT_FAILURE otherwise.
+ */
+#include <time.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <liblightnvm.h>
+
+#define SOMETHING_ELSE_USEC 10000
+
+/**
+ * One use of ASYNC IO is to have the CPU executing something useful instead of
+ * it being blocked while waiting for completion of a given IO.
+ *
+ * This is mimicked in the following function which just sleeps 'usec'
+ * microseconds
+ *
+ * Try running this with different values of the 'SOMETHING_ELSE_USEC' to see
+ * the effect on completions per call to 'nvm_async_reap'
+ */
+static void do_something_else(int usec)
+{
+	struct timespec nap = { .tv_sec = 0, .tv_nsec = usec * 1000 };
+
+	nanosleep(&nap, NULL);
+}
+
+/**
+ * Here you process a batch of completed IO, 'rets' holds the 'nvm_ret' of
+ * each completed command with its return status
+ */
+static void process(struct nvm_ret *rets[], int nrets)
+{
+	for (int i = 0; i < nrets; ++i) {
+		printf("# process: ret: %p, status: %u,\n", (void*)rets[i],
+		       rets[i]->status);
+	}
+}
+
+int ex04_async_read(struct nvm_bp *bp)
+{
+	const uint32_t depth = bp->geo->l.nsectr / bp->ws_opt;
+	struct nvm_ret rets[depth];
+	struct nvm_ret *done[depth];
+	struct nvm_async_ctx *ctx;
+	int outstanding = 0;
+	size_t diff;
+	ssize_t res;
+
+	// Initialize ASYNC CMD context
+	ctx = nvm_async_init(bp->dev, depth, 0x0);
+	if (!ctx) {
+		perror("could not initialize async context");
+		return -1;
+	}
+
+	printf("# nvm_vblk_write\n");
+	res = nvm_vblk_write(bp->vblk, bp->bufs->write, bp->bufs->nbytes);
+	if (res < 0) {
+		perror("nvm_vblk_write");
+		return -1;
+	}
+
+	// Submit read commands
+	printf("# nvm_cmd_read - submit ...\n");
+	for (size_t sectr = 0; sectr < bp->geo->l.nsectr; sectr += bp->ws_opt) {
+		const size_t offset = sectr * bp->geo->l.nbytes;
+		struct nvm_ret *ret = &rets[outstanding];
+		struct nvm_addr addrs[bp->ws_opt];
+		int err;
+
+		for (size_t idx = 0; idx < bp->ws_opt; ++idx) {
+			addrs[idx].val = bp->addrs[0].val;
+			addrs[idx].l.sectr = sectr + idx;
+		}
+
+		// Setup pr-command ASYNC properties, completions are reaped
+		ret->async.ctx = ctx;			// Assign sub/cmpl context
+		ret->async.cb = NULL;			// No completion cb
+		ret->async.cb_arg = NULL;
+
+		++outstanding;
+
+		err = nvm_cmd_read(bp->dev, addrs, bp->ws_opt,
+				   bp->bufs->read + offset, NULL,
+				   NVM_CMD_VECTOR | NVM_CMD_ASYNC, ret);
+		if (err) {
+			--outstanding;
+			perror("# nvm_cmd_write failed");
+			return -1;
+		}
+	}
+
+	// Process completions while doing something else
+	printf("# nvm_cmd_read - outstanding: %d\n", outstanding);
+	while (outstanding) {
+		res = nvm_async_reap(bp->dev, ctx, done, depth);
+		if (res < 0) {
+			perror("nvm_async_reap");
+			break;
+		} else if (res) {
+			outstanding -= res;
+			process(done, res);
+			printf("# nvm_async_reap: completed: %zd,"
+			       " outstanding: %d\n", res, outstanding);
+		}
+
+		do_something_else(SOMETHING_ELSE_USEC);
+	}
+
+	// Tear down the ASYNC context
+	printf("# nvm_async_term\n");
+	if (nvm_async_term(bp->dev, ctx)) {
+		perror("# nvm_async_term");
+		return -1;
+	}
+
+	// Sanity check: did we actually read from device
+	diff = nvm_buf_diff(bp->bufs->write, bp->bufs->read,
+				   bp->bufs->nbytes);
+	if (diff) {
+		nvm_buf_diff_pr(bp->bufs->write, bp->bufs->read,
+				bp->bufs->nbytes);
+		errno = EIO;
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct nvm_bp *bp;
+	int err = EXIT_FAILURE;
+
+	bp = nvm_bp_init_from_args(argc, argv);
+	if (!bp) {
+		perror("nvm_bp_init");
+		return err;
+	}
+
+	err = ex04_async_read(bp);
+	if (err) {
+		perror("ex04_async_read");
+		err = EXIT_FAILURE;
+	}
+
+	nvm_bp_term(bp);
+	return err;
+}
@@ -50,70 +50,81 @@ static void callback(struct nvm_ret *ret, void *cb_arg)
 */
 
 /**
- * Perform horizontal tiling with a maximum of 'nchunks' outstanding
+ * Perform horizontal tiling with a maximum of 'nchunks' outstanding, the
+ * 'nchunks' commands of a round are submitted as one batch
  */
 int horz(struct nvm_bp *bp, struct nvm_async_ctx *ctx, enum nvm_dio_opcodes opc)
 {
-	struct nvm_addr *chunk_addrs = bp->addrs;
 	const size_t nchunks = bp->naddrs;
 	const size_t tsectr = nchunks * bp->geo->l.nsectr;
 	const size_t stripe_nsectr = bp->ws_opt;
 	const size_t tstripe = tsectr / stripe_nsectr;
 	struct nvm_ret rets[tstripe];
+	struct nvm_addr addrs[nchunks][stripe_nsectr];
+	struct nvm_cmd_desc cmds[nchunks];
+	struct nvm_addr_pat pat;
+	enum nvm_cmd_desc_opc desc_opc;
+	char *buf;
+
+	switch(opc) {
+	case NVM_DOPC_VECTOR_WRITE:
+	case NVM_DOPC_SCALAR_WRITE:
+		desc_opc = NVM_CMD_DESC_WRITE;
+		buf = bp->bufs->write;
+		break;
+
+	case NVM_DOPC_SCALAR_READ:
+	case NVM_DOPC_VECTOR_READ:
+		desc_opc = NVM_CMD_DESC_READ;
+		buf = bp->bufs->read;
+		break;
+
+	default:
+		errno = EINVAL;
+		return -1;
+	}
 
-	int err;
-
-	for (size_t stripe = 0; stripe < tstripe; ++stripe) {
-		size_t cidx = stripe % nchunks;
-		size_t c_ofz = (stripe / nchunks) * stripe_nsectr;
-		size_t b_ofz = bp->geo->l.nbytes * stripe_nsectr * stripe;
+	// Stripes of 'stripe_nsectr' sectors, round-robin over the chunks
+	if (nvm_addr_pat_horz(&pat, bp->dev, bp->addrs, nchunks)) {
+		perror("nvm_addr_pat_horz");
+		return -1;
+	}
 
-		struct nvm_addr addrs[stripe_nsectr];
-		struct nvm_ret *ret = &rets[stripe];
+	for (size_t stripe = 0; stripe < tstripe; stripe += nchunks) {
+		for (size_t cidx = 0; cidx < nchunks; ++cidx) {
+			size_t b_ofz = bp->geo->l.nbytes * stripe_nsectr *
+				       (stripe + cidx);
+			struct nvm_ret *ret = &rets[stripe + cidx];
 
-		for (size_t aidx = 0; aidx < stripe_nsectr; ++aidx ) {
-			addrs[aidx].val = chunk_addrs[cidx].val;
-			addrs[aidx].l.sectr = c_ofz + aidx;
-		}
-
-		// Setup pr-command ASYNC properties
-		ret->async.ctx = ctx;		// Assign sub/cmpl context
-		ret->async.cb = callback;	// Assign completion cb
-		ret->async.cb_arg = NULL;	// Assign completion cb arg
-
-		switch(opc) {
-		case NVM_DOPC_VECTOR_WRITE:
-		case NVM_DOPC_SCALAR_WRITE:
-			err = nvm_cmd_write(bp->dev, addrs, stripe_nsectr,
-					    bp->bufs->write + b_ofz, NULL,
-					    NVM_CMD_ASYNC | NVM_CMD_VECTOR, ret);
-			if (err) {
-				perror("nvm_cmd_write");
-				return -1;
-			}
-			break;
-
-		case NVM_DOPC_SCALAR_READ:
-		case NVM_DOPC_VECTOR_READ:
-			err = nvm_cmd_read(bp->dev, addrs, stripe_nsectr,
-					   bp->bufs->read + b_ofz, NULL,
-					   NVM_CMD_ASYNC | NVM_CMD_VECTOR, ret);
-			if (err) {
-				perror("nvm_cmd_read");
+			if (nvm_addr_pat_next(&pat, addrs[cidx],
+					      stripe_nsectr) < 0) {
+				perror("nvm_addr_pat_next");
 				return -1;
 			}
-			break;
 
-		default:
-			break;
+			// Setup pr-command ASYNC properties, the batch
+			// assigns the sub/cmpl context
+			ret->async.cb = callback;	// Assign completion cb
+			ret->async.cb_arg = NULL;	// Assign completion cb arg
+
+			cmds[cidx].opc = desc_opc;
+			cmds[cidx].addrs = addrs[cidx];
+			cmds[cidx].dst = NULL;
+			cmds[cidx].naddrs = stripe_nsectr;
+			cmds[cidx].data = buf + b_ofz;
+			cmds[cidx].meta = NULL;
+			cmds[cidx].ret = ret;
 		}
 
-		// SYNC after 'nchunk' submissions
-		if (!((stripe + 1) % nchunks)) {
-			if (nvm_async_wait(bp->dev, ctx) < 0) {
-				perror("nvm_async_wait");
-				return -1;
-			}
+		// Submit 'nchunk' commands at once and SYNC after them
+		if (nvm_cmd_submit_batch(bp->dev, ctx, cmds, nchunks,
+					 NVM_CMD_VECTOR) != (int)nchunks) {
+			perror("nvm_cmd_submit_batch");
+			return -1;
+		}
+		if (nvm_async_wait(bp->dev, ctx) < 0) {
+			perror("nvm_async_wait");
+			return -1;
 		}
 	}
 
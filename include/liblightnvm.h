@@ -78,6 +78,9 @@ enum nvm_cmd_opts {
 
 	NVM_CMD_PIOC		= 0x1 << 11,
 	NVM_CMD_PADC		= 0x1 << 12,
+
+	NVM_CMD_ADDR_DEV	= 0x1 << 13,	///< Addresses in device-format
+	NVM_CMD_PRIO_HIGH	= 0x1 << 14,	///< See NVM_ASYNC_PRIO_HIGH
 };
 
 #define NVM_CMD_MASK_IOMD (NVM_CMD_SYNC | NVM_CMD_ASYNC)
@@ -87,6 +90,12 @@ enum nvm_cmd_opts {
 #define NVM_CMD_MASK (NVM_CMD_MASK_IOMD | NVM_CMD_MASK_ADDR | \
 			NVM_CMD_MASK_PLOD | NVM_CMD_MASK_PASS)
 
+/**
+ * Command options acted on by the library alone, these are never encoded in
+ * the control word of a command as its bits mean e.g. FUA to the device
+ */
+#define NVM_CMD_MASK_LIB (NVM_CMD_ADDR_DEV | NVM_CMD_PRIO_HIGH)
+
 #define NVM_CMD_DEF_IOMD NVM_CMD_SYNC
 #define NVM_CMD_DEF_ADDR NVM_CMD_VECTOR
 #define NVM_CMD_DEF_PLOD NVM_CMD_PRP
@@ -129,8 +138,8 @@ struct nvm_dev;
 struct nvm_sgl;
 
 /**
- * Opaque handle for a Scatter Gather List (SGL) pool. A seperate pool should
- * be used for each asynchronous context.
+ * Opaque handle for a Scatter Gather List (SGL) pool. A pool is thread-safe,
+ * each thread allocates from and frees to a magazine of its own.
  *
  * @struct nvm_sgl_pool
  */
@@ -146,6 +155,20 @@ struct nvm_sgl_pool;
  */
 struct nvm_sgl_pool *nvm_sgl_pool_create(struct nvm_dev *dev);
 
+/**
+ * Create an SGL pool pre-populated with 'nsgls' SGLs.
+ *
+ * @see nvm_sgl_pool_create
+ *
+ * @param dev Associated device.
+ * @param nsgls Number of SGLs to pre-populate the pool with.
+ *
+ * @return On success, an initialized pool is returned. On error, NULL is
+ *  returned and `errno` is set to indicate the error.
+ */
+struct nvm_sgl_pool *nvm_sgl_pool_create_nsgls(struct nvm_dev *dev,
+					       int nsgls);
+
 /**
  * Destroy an SGL pool (and all SGLs in the pool).
  *
@@ -212,7 +235,9 @@ void nvm_sgl_free(struct nvm_sgl_pool *pool, struct nvm_sgl *sgl);
 void nvm_sgl_reset(struct nvm_sgl *sgl);
 
 /**
- * Add an entry to the SGL
+ * Add an entry to the SGL, the entry extends the previous one when they are
+ * physically contiguous and the SGL is chained into multiple segments when
+ * its descriptors exceed a single segment
  *
  * @see nvm_sgl_alloc
  * @see nvm_buf_alloc
@@ -221,6 +246,9 @@ void nvm_sgl_reset(struct nvm_sgl *sgl);
  * @param sgl Pointer to sgl as allocated by `nvm_sgl_alloc`
  * @param buf Pointer to buffer as allocated with `nvm_buf_alloc`
  * @param nbytes Size of the given buffer in bytes
+ *
+ * @return On success, 0 is returned. On error, -1 is returned and `errno` set
+ * to indicate the error.
  */
 int nvm_sgl_add(struct nvm_dev *dev, struct nvm_sgl *sgl, void *buf, size_t nbytes);
 
@@ -298,6 +326,59 @@ struct nvm_async_cmd_ctx {
 	struct nvm_async_ctx *ctx;	///< from nvm_async_init
 	nvm_async_cb cb;		///< User provided callback function
 	void *cb_arg;			///< User provided callback arguments
+	uint64_t deadline;		///< See NVM_ASYNC_DEADLINE, 0: none
+	void *tag;			///< Backend handle, set by the library
+};
+
+/**
+ * Status of a command completed by the library instead of by the device, as
+ * its deadline passed or it was cancelled. This is the NVMe generic status
+ * "Command Abort Requested"
+ *
+ * @see nvm_async_cancel
+ */
+#define NVM_RET_STATUS_ABORTED 0x7
+
+/**
+ * Enumeration of ASYNC context flags
+ */
+enum nvm_async_flags {
+	/**
+	 * Honor 'ret->async.deadline' of commands submitted on the context.
+	 * The deadline is in nanoseconds on CLOCK_MONOTONIC, see
+	 * `nvm_async_deadline`. When it passes, the command is completed with
+	 * status NVM_RET_STATUS_ABORTED by the poke, reap or wait looking at
+	 * the context.
+	 */
+	NVM_ASYNC_DEADLINE	= 0x1,
+
+	/**
+	 * Schedule erase, write, read and copy commands submitted on the
+	 * context by parallel unit (PU). Each PU has a software queue and a
+	 * bound on its in-flight commands, see `nvm_async_set_pu_depth`.
+	 * Commands are dispatched in order per PU, and when slots free up,
+	 * idle PUs are served first, then PUs with only reads in flight.
+	 * Commands are attributed to the PU of their first address, addresses
+	 * given with NVM_CMD_ADDR_DEV are decoded to find it.
+	 *
+	 * Commands with NVM_CMD_PRIO_HIGH have their own queue per PU which is
+	 * dispatched ahead of the normal one, and writes, copies and erases
+	 * are admitted to a PU within a bound of their own, see
+	 * `nvm_async_set_pu_depth_wr`, leaving room for reads. After a burst
+	 * of high-priority commands a waiting normal one is let through.
+	 */
+	NVM_ASYNC_SCHED		= 0x2,
+
+	/**
+	 * Submit all commands on the context with high priority, as if they
+	 * had NVM_CMD_PRIO_HIGH. Use it for foreground work, e.g. user reads,
+	 * and a normal context for background work, e.g. garbage collection.
+	 * On NVM_BE_SPDK the qpair of the context gets high priority when the
+	 * controller is set up for weighted round robin arbitration, see
+	 * NVM_BE_SPDK_WRR, other contexts then get medium priority. On
+	 * NVM_BE_LBD the commands get the highest best-effort I/O priority.
+	 */
+	NVM_ASYNC_PRIO_HIGH	= 0x4,
 };
 
 /**
@@ -307,7 +388,7 @@ struct nvm_async_cmd_ctx {
  * @param dev Associated device
  * @param depth Maximum iodepth / qdepth, maximum number of outstanding commands
  * of the returned context
- * @param flags TBD
+ * @param flags Bitwise OR of `enum nvm_async_flags`
  *
  * @return On success, pointer to async. context is returned. On error, NULL is
  * returned and `errno` set to indicate the error
@@ -315,6 +396,106 @@ struct nvm_async_cmd_ctx {
 struct nvm_async_ctx *nvm_async_init(struct nvm_dev *dev, uint32_t depth,
 				     uint16_t flags);
 
+/**
+ * Set the bound on in-flight commands per parallel unit for the given
+ * context, commands beyond it are queued until the PU completes others
+ *
+ * @param ctx ASYNC context created with NVM_ASYNC_SCHED
+ * @param depth Maximum number of in-flight commands per PU, the default is 2
+ *
+ * @return On success, 0 is returned. On error, -1 is returned and `errno` set
+ * to indicate the error, ENOSYS when 'ctx' has no scheduler
+ */
+int nvm_async_set_pu_depth(struct nvm_async_ctx *ctx, uint32_t depth);
+
+/**
+ * Set the bound on in-flight writes, copies and erases per parallel unit for
+ * the given context, it is capped by the bound set with
+ * `nvm_async_set_pu_depth`
+ *
+ * @param ctx ASYNC context created with NVM_ASYNC_SCHED
+ * @param depth Maximum number of in-flight writes, copies and erases per PU,
+ * the default is 1
+ *
+ * @return On success, 0 is returned. On error, -1 is returned and `errno` set
+ * to indicate the error, ENOSYS when 'ctx' has no scheduler
+ */
+int nvm_async_set_pu_depth_wr(struct nvm_async_ctx *ctx, uint32_t depth);
+
+/**
+ * Get the deadline for a command which must complete within 'usec'
+ * microseconds from now, for use with 'ret->async.deadline'
+ *
+ * @see NVM_ASYNC_DEADLINE
+ */
+uint64_t nvm_async_deadline(uint64_t usec);
+
+/**
+ * Cancel the outstanding command of 'ret' on the given context
+ *
+ * A command still queued by the scheduler of a context created with
+ * NVM_ASYNC_SCHED is removed from its queue, completed with status
+ * NVM_RET_STATUS_ABORTED and its callback, when it has one, is invoked before
+ * returning.
+ *
+ * A command already handed to the device is cancelled as follows. With a
+ * deadline on a context created with NVM_ASYNC_DEADLINE, it is completed as
+ * above and its completion by the device is dropped when it arrives, the data
+ * buffer of the command must thus stay valid until the context is terminated.
+ * Otherwise, the command completes through the next poke, reap or wait, with
+ * status NVM_RET_STATUS_ABORTED or, when the device completed it first, its
+ * own.
+ *
+ * On NVM_BE_SPDK and NVM_BE_NOCD, in both cases and likewise when a deadline
+ * expires, the device is asked to abort the command with the NVMe Abort
+ * command. When the device does not report it aborted within a second, the
+ * queue pair of the context is reset, completing every command outstanding on
+ * it with the NVMe status "Command Aborted due to SQ Deletion". Other
+ * backends cannot cancel commands they have handed to the device.
+ *
+ * @param dev Associated device
+ * @param ctx ASYNC context the command was submitted on
+ * @param ret The 'nvm_ret' the command was submitted with
+ *
+ * @return On success, 0 is returned. On error, -1 is returned and `errno` set
+ * to indicate the error, ENOENT when the command is not outstanding or its
+ * backend cannot cancel it
+ */
+int nvm_async_cancel(struct nvm_dev *dev, struct nvm_async_ctx *ctx,
+		     struct nvm_ret *ret);
+
+/**
+ * Enumeration of the ways to wait for completions on an ASYNC context
+ *
+ * @see nvm_async_set_wait_mode
+ */
+enum nvm_async_wait_mode {
+	NVM_ASYNC_WAIT_POLL	= 0x0,	///< Poll continuously, the default
+	NVM_ASYNC_WAIT_HYBRID	= 0x1,	///< Poll briefly, then back off
+	NVM_ASYNC_WAIT_SLEEP	= 0x2,	///< Sleep between polls
+};
+
+/**
+ * Set how `nvm_async_wait` waits for completions on the given context
+ *
+ * With NVM_ASYNC_WAIT_POLL the backend waits its own way, e.g. NVM_BE_SPDK
+ * keeps a core busy polling the qpair and NVM_BE_LBD blocks in io_getevents.
+ * With NVM_ASYNC_WAIT_HYBRID polling is done for a few microseconds, then the
+ * thread sleeps for half of the expected latency of the shortest outstanding
+ * command, e.g. read vs. write vs. erase, and afterwards polls with growing
+ * sleeps in between.
+ * With NVM_ASYNC_WAIT_SLEEP the thread sleeps a fraction of the expected
+ * latency between every poll. CPU is thus traded against completion latency.
+ *
+ * @param ctx ASYNC context obtained with `nvm_async_init`
+ * @param mode The wait-mode to use
+ *
+ * @return On success, 0 is returned. On error, -1 is returned and `errno` set
+ * to indicate the error
+ */
+int nvm_async_set_wait_mode(struct nvm_async_ctx *ctx,
+			    enum nvm_async_wait_mode mode);
+
 /**
  * Get the I/O depth of the context.
  *
@@ -328,7 +509,8 @@ struct nvm_async_ctx *nvm_async_init(struct nvm_dev *dev, uint32_t depth,
 uint32_t nvm_async_get_depth(struct nvm_async_ctx *ctx);
 
 /**
- * Get the number of outstanding I/O.
+ * Get the number of outstanding I/O, including commands queued by the
+ * scheduler of the context.
  *
  * TODO: Fix calling convention
  *
@@ -339,6 +521,23 @@ uint32_t nvm_async_get_depth(struct nvm_async_ctx *ctx);
  */
 uint32_t nvm_async_get_outstanding(struct nvm_async_ctx *ctx);
 
+/**
+ * Get a file descriptor which becomes readable when completions are pending on
+ * the given context, for use with e.g. epoll, poll or select
+ *
+ * The descriptor is an eventfd owned by the context, do not close it. It is
+ * drained by `nvm_async_poke`, `nvm_async_reap` and `nvm_async_wait`, thus
+ * when it signals, call one of them to process the completions. A wakeup may
+ * find no completions when they were processed before the wakeup was handled.
+ *
+ * @param ctx Asynchronous context
+ *
+ * @return On success, a file descriptor is returned. On error, -1 is returned
+ * and `errno` set to indicate the error, ENOSYS when the backend cannot signal
+ * completions, e.g. NVM_BE_SPDK where completions are only found by polling
+ */
+int nvm_async_get_fd(struct nvm_async_ctx *ctx);
+
 /**
  * Tear down the given ASYNC context
  *
@@ -358,6 +557,24 @@ int nvm_async_term(struct nvm_dev *dev, struct nvm_async_ctx *ctx);
 int nvm_async_poke(struct nvm_dev *dev, struct nvm_async_ctx *ctx,
 		   uint32_t max);
 
+/**
+ * Reap completions from the given ASYNC context into 'rets'
+ *
+ * Similar to `nvm_async_poke` but instead of invoking 'ret->async.cb' the
+ * 'nvm_ret' of each completed command is stored in 'rets', with its status in
+ * 'ret->status'. Commands reaped this way need no callback. Does not block.
+ *
+ * @param dev Associated device
+ * @param ctx ASYNC context to reap completions from
+ * @param rets Array to store pointers to the completed 'nvm_ret' in
+ * @param max Maximum number of completions to reap, the length of 'rets'
+ *
+ * @return On success, number of completions stored in 'rets', may be 0. On
+ * error, -1 is returned and `errno` set to indicate the error
+ */
+int nvm_async_reap(struct nvm_dev *dev, struct nvm_async_ctx *ctx,
+		   struct nvm_ret *rets[], uint32_t max);
+
 /**
  * Wait for completion of all outstanding commands in the given 'ctx'
  *
@@ -678,6 +895,64 @@ int nvm_cmd_copy(struct nvm_dev *dev, struct nvm_addr src[],
 		 struct nvm_addr dst[], int naddrs, uint16_t flags,
 		 struct nvm_ret *ret);
 
+/**
+ * Enumeration of commands in a batch
+ *
+ * @see nvm_cmd_submit_batch
+ */
+enum nvm_cmd_desc_opc {
+	NVM_CMD_DESC_ERASE	= 0x1,	///< nvm_cmd_erase
+	NVM_CMD_DESC_WRITE	= 0x2,	///< nvm_cmd_write
+	NVM_CMD_DESC_READ	= 0x3,	///< nvm_cmd_read
+	NVM_CMD_DESC_COPY	= 0x4,	///< nvm_cmd_copy
+};
+
+/**
+ * Description of a command to submit with `nvm_cmd_submit_batch`
+ *
+ * @struct nvm_cmd_desc
+ */
+struct nvm_cmd_desc {
+	enum nvm_cmd_desc_opc opc;	///< Command to submit
+	struct nvm_addr *addrs;		///< Addresses, source for copy
+	struct nvm_addr *dst;		///< Destination for copy
+	int naddrs;			///< Number of addresses
+	void *data;			///< Data for write and read
+	void *meta;			///< Meta for erase, write and read
+	struct nvm_ret *ret;		///< Per-command completion
+};
+
+/**
+ * Submit 'ncmds' commands to the given ASYNC context as one batch
+ *
+ * The commands are set up one after another and handed to the device in as
+ * few submissions as the backend allows, e.g. a single `io_submit` on
+ * NVM_BE_LBD and a single doorbell write on NVM_BE_SPDK. 'flags' are used for all commands in the batch, NVM_CMD_ASYNC is
+ * implied. The 'ret->async.ctx' of each command is set to 'ctx', the caller
+ * sets up 'ret->async.cb' and 'ret->async.cb_arg', each command completes on
+ * its own callback when reaped with `nvm_async_poke` or `nvm_async_wait`.
+ *
+ * @param dev Device handle obtained with `nvm_dev_open`
+ * @param ctx ASYNC context obtained with `nvm_async_init`
+ * @param cmds Array of command descriptions
+ * @param ncmds Number of commands in 'cmds'
+ * @param flags Command options for all commands
+ *
+ * Commands are accepted in order until one fails, e.g. as the context is
+ * full. Every accepted command completes through its 'ret', also when the
+ * backend fails to hand it to the device after it was accepted, which
+ * completes it with status NVM_RET_STATUS_ABORTED. Commands after the accepted
+ * ones are left untouched.
+ *
+ * @return On success, the number of commands accepted is returned, that is,
+ * 'cmds[0]' up to but not including 'cmds[n]'. On error, -1 is returned and
+ * `errno` set to indicate the error, `errno` is EAGAIN when no commands could
+ * be accepted as the context is full
+ */
+int nvm_cmd_submit_batch(struct nvm_dev *dev, struct nvm_async_ctx *ctx,
+			 struct nvm_cmd_desc cmds[], int ncmds,
+			 uint16_t flags);
+
 /**
  * @return the "major" version of the library
  */
@@ -1010,6 +1285,59 @@ int nvm_dev_get_quirks(const struct nvm_dev *dev);
  */
 int nvm_dev_set_quirks(struct nvm_dev *dev, int quirks);
 
+/**
+ * Returns the NUMA node which the given device is attached to
+ *
+ * IO buffers are allocated on this node, and when enabled with
+ * `nvm_dev_set_numa_bind`, threads doing `nvm_vblk` IO are bound to its CPUs.
+ *
+ * @param dev Device handle obtained with `nvm_dev_open`
+ *
+ * @return The NUMA node of the device, -1 when unknown or placement is disabled
+ */
+int nvm_dev_get_numa_node(const struct nvm_dev *dev);
+
+/**
+ * Set the NUMA node used for buffer and thread placement of the given device
+ *
+ * @param dev Device handle obtained with `nvm_dev_open`
+ * @param node The NUMA node, or -1 to disable NUMA placement
+ *
+ * @return On success, 0 is returned. On error, -1 is returned and `errno` set
+ * to indicate the error
+ */
+int nvm_dev_set_numa_node(struct nvm_dev *dev, int node);
+
+/**
+ * Returns whether threads doing `nvm_vblk` IO are bound to the CPUs of the
+ * NUMA node of the given device
+ *
+ * @see nvm_dev_set_numa_bind
+ *
+ * @param dev Device handle obtained with `nvm_dev_open`
+ *
+ * @return 1 when binding is enabled, 0 otherwise
+ */
+int nvm_dev_get_numa_bind(const struct nvm_dev *dev);
+
+/**
+ * Enable or disable binding of the threads doing `nvm_vblk` IO to the CPUs of
+ * the NUMA node of the given device, disabled by default
+ *
+ * When enabled, the calling thread and the OpenMP threads serving a
+ * `nvm_vblk` read, write or erase are bound to the CPUs of the node with
+ * `sched_setaffinity` for the duration of the call. Their previous affinity is
+ * restored before the call returns. Binding does nothing when the node is
+ * unknown, see `nvm_dev_set_numa_node`, or on systems other than Linux.
+ *
+ * @param dev Device handle obtained with `nvm_dev_open`
+ * @param bind 1 to enable binding, 0 to disable it
+ *
+ * @return On success, 0 is returned. On error, -1 is returned and `errno` set
+ * to indicate the error
+ */
+int nvm_dev_set_numa_bind(struct nvm_dev *dev, int bind);
+
 
 /**
  * Returns the OCSSD 2.0 device format
@@ -1101,6 +1429,68 @@ int nvm_dev_get_bbts_cached(const struct nvm_dev *dev);
  */
 int nvm_dev_set_bbts_cached(struct nvm_dev *dev, int bbts_cached);
 
+/**
+ * Eviction policies of the sector read cache
+ *
+ * @see nvm_dev_set_rcache
+ */
+enum nvm_rcache_policy {
+	NVM_RCACHE_CLOCK = 0,	///< Second chance for sectors hit since
+	NVM_RCACHE_S3FIFO = 1,	///< Small and main FIFO, resists scans
+};
+
+/**
+ * Counters of the sector read cache
+ *
+ * @see nvm_dev_get_rcache_stats
+ *
+ * @struct nvm_rcache_stats
+ */
+struct nvm_rcache_stats {
+	uint64_t nhits;		///< Reads served from the cache
+	uint64_t nmisses;	///< Cacheable reads served by the device
+	uint64_t ninserts;	///< Sectors inserted
+	uint64_t nevicts;	///< Sectors evicted
+	uint64_t ninvals;	///< Sectors invalidated
+	uint64_t nsectrs;	///< Sectors the cache holds at most
+};
+
+/**
+ * Enable, resize or disable the sector read cache of the device
+ *
+ * Sectors read with synchronous commands without meta are kept in host
+ * memory, keyed by their device address, and later reads of only cached
+ * sectors are served without a command. Writes, erases and copies issued
+ * through the library drop the sectors they change before they are
+ * submitted, and while any of them is in flight reads do not fill the cache.
+ * Changes made by other means than this device handle are not seen by the
+ * cache.
+ *
+ * @note
+ * This is only defined in OCSSD 2.0. The cache is emptied on every call
+ *
+ * @param dev Device handle obtained with `nvm_dev_open`
+ * @param nbytes Memory budget of the cache, 0 to disable it
+ * @param policy Eviction policy
+ *
+ * @return On success, 0 is returned. On error, -1 is returned and `errno` set
+ * to indicate the error
+ */
+int nvm_dev_set_rcache(struct nvm_dev *dev, size_t nbytes,
+		       enum nvm_rcache_policy policy);
+
+/**
+ * Retrieve the counters of the sector read cache of the device
+ *
+ * @param dev Device handle obtained with `nvm_dev_open`
+ * @param stats Set to the counters
+ *
+ * @return On success, 0 is returned. On error, -1 is returned and `errno` set
+ * to indicate the error, EINVAL when the cache is disabled
+ */
+int nvm_dev_get_rcache_stats(const struct nvm_dev *dev,
+			     struct nvm_rcache_stats *stats);
+
 /**
  * Returns the 'meta-mode' of the given device
  *
@@ -1260,6 +1650,20 @@ void *nvm_buf_realloc(const struct nvm_dev *dev, void *buf, size_t nbytes,
  */
 void nvm_buf_free(const struct nvm_dev *dev, void *buf);
 
+/**
+ * Release the memory cached by the IO buffer pool of the IOCTL and LBD
+ * backends back to the OS
+ *
+ * Buffers freed with `nvm_buf_free` are kept by the pool for reuse. This
+ * returns the cached buffers of the calling thread to the pool and unmaps
+ * every pool region without buffers in use, buffers cached by other threads
+ * are left as is. It is called by `nvm_dev_close`. MAP_HUGETLB is retried on
+ * the next allocation, in case it failed before.
+ *
+ * @return The number of bytes released
+ */
+size_t nvm_buf_pool_trim(void);
+
 /**
  * Retrieve the physical address of the given buffer
  *
@@ -1287,6 +1691,27 @@ int nvm_buf_vtophys(const struct nvm_dev *dev, void *buf, uint64_t *phys);
  */
 void *nvm_buf_virt_alloc(size_t alignment, size_t nbytes);
 
+/**
+ * Reallocate a buffer of virtual memory to the given 'nbytes' and 'alignment'
+ *
+ * The buffer grows to the next power-of-two size-class, so repeated growth
+ * only reallocates and copies a logarithmic number of times. When the buffer
+ * already holds 'nbytes' at 'alignment' it is returned as is, otherwise its
+ * content is moved to a buffer with the requested 'alignment', shrinking
+ * included.
+ *
+ * @note
+ * You must use `nvm_buf_virt_free` to de-allocate the buffer
+ *
+ * @param buf Pointer to a buffer allocated with `nvm_buf_virt_alloc`, or NULL
+ * @param alignment The alignment in bytes
+ * @param nbytes The size of the buffer in bytes
+ *
+ * @return A pointer to the reallocated memory. On error: NULL is returned,
+ * `errno` set appropriatly and 'buf' is left untouched
+ */
+void *nvm_buf_virt_realloc(void *buf, size_t alignment, size_t nbytes);
+
 /**
  * Free the given virtual memory buffer
  *
@@ -1302,6 +1727,29 @@ void nvm_buf_virt_free(void *buf);
  */
 void nvm_buf_fill(char *buf, size_t nbytes);
 
+/**
+ * Fills `buf` with the pseudo-random pattern derived from 'seed'
+ *
+ * Each byte is a function of the seed and its absolute offset in the pattern
+ * stream, so data written from a pattern can be verified with
+ * `nvm_buf_pattern_diff` without keeping the written buffer around.
+ *
+ * @param buf Pointer to the buffer to fill
+ * @param nbytes Amount of bytes to fill in buf
+ * @param seed Seed of the pattern stream
+ * @param offset Offset in the pattern stream of the first byte of 'buf', e.g.
+ * the byte offset on the device or in the virtual block
+ */
+void nvm_buf_pattern_fill(char *buf, size_t nbytes, uint64_t seed,
+			  uint64_t offset);
+
+/**
+ * Returns the number of bytes where `actual` is different from the pattern
+ * written by `nvm_buf_pattern_fill` with the same 'seed' and 'offset'
+ */
+size_t nvm_buf_pattern_diff(const char *actual, size_t nbytes, uint64_t seed,
+			    uint64_t offset);
+
 /**
  * Prints `buf` to stdout
  *
@@ -1363,6 +1811,9 @@ struct nvm_buf_set {
 
 	size_t nbytes;		///< # of bytes per data buffer
 	size_t nbytes_meta;	///< # of bytes per meta buffer
+
+	int pattern;		///< Read and write share a pattern buffer
+	uint64_t seed;		///< Pattern seed when 'pattern' is set
 };
 
 /**
@@ -1373,8 +1824,35 @@ void nvm_buf_set_pr(struct nvm_buf_set *bufs);
 struct nvm_buf_set *nvm_buf_set_alloc(struct nvm_dev *dev, size_t nbytes,
 				      size_t nbytes_meta);
 
+/**
+ * Allocate a buffer-set where read and write share a single buffer
+ *
+ * The shared buffer is filled with the pattern of 'seed' by `nvm_buf_set_fill`
+ * and reads are verified against the pattern with `nvm_buf_set_diff`, thus
+ * requiring half the memory of `nvm_buf_set_alloc`.
+ *
+ * @param dev The device to allocate IO buffers for
+ * @param nbytes # of bytes in the data buffer
+ * @param nbytes_meta # of bytes in the meta buffer
+ * @param seed Seed of the pattern stream
+ *
+ * @return On success, an allocated buffer-set is returned. On error, NULL is
+ * returned and `errno` set to indicate the error
+ */
+struct nvm_buf_set *nvm_buf_set_alloc_pattern(struct nvm_dev *dev,
+					      size_t nbytes,
+					      size_t nbytes_meta,
+					      uint64_t seed);
+
 void nvm_buf_set_fill(struct nvm_buf_set *bufs);
 
+/**
+ * Returns the number of bytes where the data and meta read differ from the
+ * data and meta written, for a pattern buffer-set the reads are compared to
+ * the patterns of `nvm_buf_set_fill`
+ */
+size_t nvm_buf_set_diff(const struct nvm_buf_set *bufs);
+
 void nvm_buf_set_free(struct nvm_buf_set *bufs);
 
 /**
@@ -1384,7 +1862,8 @@ void nvm_buf_set_free(struct nvm_buf_set *bufs);
  * @param addr The addr to check
  * @param dev The device of which to check geometric bounds against
  *
- * @return A mask of exceeded boundaries
+ * @return A mask of exceeded boundaries. On error, -1 is returned and `errno`
+ * set to indicate the error, EINVAL when the geometry of the device is unknown
  */
 int nvm_addr_check(struct nvm_addr addr, const struct nvm_dev *dev);
 
@@ -1398,7 +1877,8 @@ int nvm_addr_check(struct nvm_addr addr, const struct nvm_dev *dev);
  * This is a helper for function for `nvm_cmd_rprt`, as a library user you will
  * most likely not have a use for it
  *
- * @return the log page offset (lpo) for the given addr
+ * @return the log page offset (lpo) for the given addr. On error, 0 is
+ * returned and `errno` set to EINVAL when the geometry of the device is unknown
  */
 uint64_t nvm_addr_gen2lpo(struct nvm_dev *dev, struct nvm_addr addr);
 
@@ -1409,7 +1889,9 @@ uint64_t nvm_addr_gen2lpo(struct nvm_dev *dev, struct nvm_addr addr);
  * This is a helper for function for `nvm_cmd_rprt`, as a library user you will
  * most likely not have a use for it
  *
- * @return the page offset (lpo) for the given addr
+ * @return the address of the chunk at the given lpo. On error, the zero address
+ * is returned and `errno` set to EINVAL when the geometry of the device is
+ * unknown
  */
 struct nvm_addr nvm_addr_lpo2gen(struct nvm_dev *dev, uint64_t lpo);
 
@@ -1433,6 +1915,28 @@ uint64_t nvm_addr_gen2dev(struct nvm_dev *dev, struct nvm_addr addr);
  */
 struct nvm_addr nvm_addr_dev2gen(struct nvm_dev *dev, uint64_t addr);
 
+/**
+ * Converts 'naddrs' addresses, in generic-format, to device-format
+ *
+ * @param dev Device handle obtained with `nvm_dev_open`
+ * @param addrs Array of 'naddrs' addresses in generic-format
+ * @param dev_addrs Array receiving the 'naddrs' addresses in device-format
+ * @param naddrs Number of addresses to convert
+ */
+void nvm_addr_gen2dev_n(struct nvm_dev *dev, const struct nvm_addr addrs[],
+			uint64_t dev_addrs[], int naddrs);
+
+/**
+ * Converts 'naddrs' addresses, in device-format, to generic-format
+ *
+ * @param dev Device handle obtained with `nvm_dev_open`
+ * @param dev_addrs Array of 'naddrs' addresses in device-format
+ * @param addrs Array receiving the 'naddrs' addresses in generic-format
+ * @param naddrs Number of addresses to convert
+ */
+void nvm_addr_dev2gen_n(struct nvm_dev *dev, const uint64_t dev_addrs[],
+			struct nvm_addr addrs[], int naddrs);
+
 /**
  * Converts an address, in generic-format, to Linux Block Device offset
  *
@@ -1507,6 +2011,126 @@ uint64_t nvm_addr_off2dev(struct nvm_dev *dev, uint64_t addr);
 void nvm_addr_fill_crange(struct nvm_addr *addrs, struct nvm_addr addr,
 			  uint32_t naddrs);
 
+/**
+ * Address-patterns emitted by an address-pattern iterator
+ *
+ * @see nvm_addr_pat_next
+ */
+enum nvm_addr_pat_type {
+	NVM_ADDR_PAT_HORZ = 0,	///< Write-units striped round-robin on chunks
+	NVM_ADDR_PAT_VERT,	///< Chunks filled one after the other
+	NVM_ADDR_PAT_PLANE,	///< OCSSD 1.2 pages interleaved on planes
+	NVM_ADDR_PAT_STRIDE,	///< Every stride'th sector, chunk after chunk
+	NVM_ADDR_PAT_RAND,	///< Uniform-random sectors within the chunks
+};
+
+/**
+ * Address-pattern iterator, emitting the addresses of a pattern in batches,
+ * e.g. the address-list of a vector command, without materializing them
+ *
+ * Setup with one of `nvm_addr_pat_{horz|vert|plane|stride|rand}` and advance
+ * with `nvm_addr_pat_next`
+ */
+struct nvm_addr_pat {
+	enum nvm_addr_pat_type type;	///< Pattern to emit
+	const struct nvm_addr *chunks;	///< Chunks, or 1.2 blocks, to cover
+	size_t nchunks;			///< Number of chunks
+	size_t chunk_nsectr;		///< Sectors covered in each chunk
+	size_t unit_nsectr;		///< Consecutive sectors in a chunk
+	size_t stride;			///< Sectors between addresses
+	uint64_t seed;			///< Seed of the random sequence
+	size_t nplanes;			///< Planes of a 1.2 page
+	size_t nsectors;		///< Sectors of a 1.2 plane-page
+	size_t naddrs;			///< Number of addresses in the pattern
+	size_t pos;			///< Number of addresses emitted
+};
+
+/**
+ * Setup 'pat' to stripe the sectors of 'chunks' horizontally, in units of
+ * the optimal write size, that is, in the order `nvm_vblk` writes them
+ *
+ * @note The 'chunks' array is referenced, not copied, by the iterator
+ *
+ * @param pat The iterator to setup
+ * @param dev Device handle obtained with `nvm_dev_open`
+ * @param chunks Addresses of the chunks to stripe over
+ * @param nchunks Number of chunks
+ *
+ * @return On success, 0 is returned. On error, -1 is returned and `errno` set
+ * to indicate the error.
+ */
+int nvm_addr_pat_horz(struct nvm_addr_pat *pat, const struct nvm_dev *dev,
+		      const struct nvm_addr chunks[], size_t nchunks);
+
+/**
+ * Setup 'pat' to emit the sectors of 'chunks' vertically, one chunk after
+ * the other
+ *
+ * @see nvm_addr_pat_horz
+ *
+ * @return On success, 0 is returned. On error, -1 is returned and `errno` set
+ * to indicate the error.
+ */
+int nvm_addr_pat_vert(struct nvm_addr_pat *pat, const struct nvm_dev *dev,
+		      const struct nvm_addr chunks[], size_t nchunks);
+
+/**
+ * Setup 'pat' to emit the sectors of the OCSSD 1.2 blocks 'blks' as
+ * plane-pages, interleaving the planes within a page and striping the pages
+ * over the blocks
+ *
+ * @see nvm_addr_pat_horz
+ *
+ * @return On success, 0 is returned. On error, -1 is returned and `errno` set
+ * to indicate the error.
+ */
+int nvm_addr_pat_plane(struct nvm_addr_pat *pat, const struct nvm_dev *dev,
+		       const struct nvm_addr blks[], size_t nblks);
+
+/**
+ * Setup 'pat' to emit every 'stride'th sector of 'chunks', one chunk after
+ * the other, the stride carries across chunks
+ *
+ * @see nvm_addr_pat_horz
+ *
+ * @return On success, 0 is returned. On error, -1 is returned and `errno` set
+ * to indicate the error.
+ */
+int nvm_addr_pat_stride(struct nvm_addr_pat *pat, const struct nvm_dev *dev,
+			const struct nvm_addr chunks[], size_t nchunks,
+			size_t stride);
+
+/**
+ * Setup 'pat' to emit 'naddrs' uniform-random sectors of 'chunks', the
+ * sequence is determined by 'seed' and the position in it
+ *
+ * @see nvm_addr_pat_horz
+ *
+ * @return On success, 0 is returned. On error, -1 is returned and `errno` set
+ * to indicate the error.
+ */
+int nvm_addr_pat_rand(struct nvm_addr_pat *pat, const struct nvm_dev *dev,
+		      const struct nvm_addr chunks[], size_t nchunks,
+		      size_t naddrs, uint64_t seed);
+
+/**
+ * Emits the next, at most 'naddrs', addresses of the pattern into 'addrs'
+ *
+ * @param pat The iterator
+ * @param addrs Array receiving the addresses
+ * @param naddrs Maximum number of addresses to emit
+ *
+ * @return On success, the number of addresses emitted, 0 when the pattern is
+ * exhausted. On error, -1 is returned and `errno` set to indicate the error.
+ */
+int nvm_addr_pat_next(struct nvm_addr_pat *pat, struct nvm_addr addrs[],
+		      int naddrs);
+
+/**
+ * Rewinds 'pat' to the start of its pattern
+ */
+void nvm_addr_pat_rewind(struct nvm_addr_pat *pat);
+
 /**
  * Prints a hexidecimal representation of the given address value
  */
@@ -1554,13 +2178,90 @@ struct nvm_vblk *nvm_vblk_alloc_line(struct nvm_dev *dev, int ch_bgn,
  */
 int nvm_vblk_set_async(struct nvm_vblk *vblk, uint32_t depth);
 
+/**
+ * Set how the virtual block waits for completions in async mode
+ *
+ * @see nvm_async_set_wait_mode
+ *
+ * @return On success, 0 is returned. On error, -1 is returned and `errno` set
+ * to indicate the error, EINVAL when the virtual block is not in async mode
+ */
+int nvm_vblk_set_async_wait_mode(struct nvm_vblk *vblk,
+				 enum nvm_async_wait_mode mode);
+
 /**
  * Set the command mode for the virtual block to scalar.
  */
 int nvm_vblk_set_scalar(struct nvm_vblk *vblk);
 
 /**
- * Destroy a virtual block
+ * Enable or disable the write-back ring of the virtual block
+ *
+ * When enabled, the last `nvm_dev_get_mw_cunits` sectors written to each
+ * chunk of the virtual block, rounded up to the optimal write size, are kept
+ * in host memory. Reads of those sectors, which the device cannot serve yet,
+ * are served from the ring. The ring of a chunk is released when the chunk is
+ * fully written, and all rings are reset on `nvm_vblk_erase`. Only writes done
+ * via the virtual block are known to it.
+ *
+ * @note
+ * This is only defined in OCSSD 2.0. Enabling it is a no-op on devices
+ * reporting no minimal write-cache units
+ *
+ * @param vblk The virtual block to configure
+ * @param enable 1 to enable, 0 to disable and release the rings
+ *
+ * @return On success, 0 is returned. On error, -1 is returned and `errno` set
+ * to indicate the error
+ */
+int nvm_vblk_set_wcache(struct nvm_vblk *vblk, int enable);
+
+/**
+ * Enable or disable buffered writes on the virtual block
+ *
+ * When enabled, `nvm_vblk_write` takes writes of any size and alignment. They
+ * are copied into a staging stripe of one optimal write-unit per chunk, which
+ * is written asynchronously when full while the next stripe fills. Errors of
+ * a stripe are returned by the call which waits for it, the next write to
+ * fill a stripe or `nvm_vblk_flush`. The write position includes staged data,
+ * and `nvm_vblk_pwrite` fails with EINVAL while enabled.
+ *
+ * @note
+ * This is only defined in OCSSD 2.0. Backends without ASYNC support write the
+ * stripes synchronously
+ *
+ * @param vblk The virtual block to configure, its write position must be
+ * aligned to the optimal write size
+ * @param enable 1 to enable, 0 to flush and disable
+ *
+ * @return On success, 0 is returned. On error, -1 is returned and `errno` set
+ * to indicate the error
+ */
+int nvm_vblk_set_buffered(struct nvm_vblk *vblk, int enable);
+
+/**
+ * Enable or disable read-ahead on the virtual block
+ *
+ * When enabled, `nvm_vblk_read` and `nvm_vblk_read_zc` keep a window of
+ * 'nstripes' reads ahead of the read position in flight, each of one optimal
+ * write-unit per chunk, into a ring of DMA buffers. Reads of any size and
+ * alignment are served from the ring. The window restarts whenever the read
+ * position is moved by other means than these reads.
+ *
+ * @note
+ * This is only defined in OCSSD 2.0. Backends without ASYNC support read one
+ * stripe at a time, synchronously
+ *
+ * @param vblk The virtual block to configure
+ * @param nstripes Number of stripes to read ahead, 0 to disable
+ *
+ * @return On success, 0 is returned. On error, -1 is returned and `errno` set
+ * to indicate the error
+ */
+int nvm_vblk_set_readahead(struct nvm_vblk *vblk, uint32_t nstripes);
+
+/**
+ * Destroy a virtual block
  *
  * @param vblk The virtual block to destroy
  */
@@ -1570,7 +2271,9 @@ void nvm_vblk_free(struct nvm_vblk *vblk);
  * Erase a virtual block
  *
  * @note
- * Erasing a vblk will reset internal position pointers
+ * Erasing a vblk will reset internal position pointers. With buffered writes
+ * enabled, staged data is dropped and the stripe in flight waited for, its
+ * errors fail the erase
  *
  * @param vblk The virtual block to erase
  *
@@ -1587,6 +2290,7 @@ ssize_t nvm_vblk_erase(struct nvm_vblk *vblk);
  * count must be a multiple of min-size, see struct nvm_geo
  * do not mix use of nvm_vblk_pwrite with nvm_vblk_write on the same virtual
  * block
+ * neither applies to buffered virtual blocks, see nvm_vblk_set_buffered
  *
  * @param vblk The virtual block to write to
  * @param buf Write content starting at buf
@@ -1634,11 +2338,46 @@ ssize_t nvm_vblk_pwrite(struct nvm_vblk *vblk, const void *buf, size_t count,
  */
 ssize_t nvm_vblk_pad(struct nvm_vblk *vblk);
 
+/**
+ * Write out what is staged on a buffered virtual block, padding the last
+ * write-unit with synthetic data, and wait for it
+ *
+ * @note
+ * The write position is advanced past the padding, does nothing when the
+ * virtual block is not buffered
+ *
+ * @param vblk The virtual block to flush
+ *
+ * @return On success, 0 is returned. On error, -1 is returned and `errno` set
+ * to indicate the error
+ */
+int nvm_vblk_flush(struct nvm_vblk *vblk);
+
 /**
  * Read from a virtual block
  */
 ssize_t nvm_vblk_read(struct nvm_vblk *vblk, void *buf, size_t count);
 
+/**
+ * Read up to 'count' bytes at the read position of a virtual block with
+ * read-ahead, without copying them
+ *
+ * @note
+ * At most the rest of the current read-ahead stripe is returned, 'buf' is
+ * valid until the next read from the virtual block
+ *
+ * @param vblk The virtual block to read from
+ * @param buf Set to the bytes read
+ * @param count The maximum number of bytes to read
+ *
+ * @return On success, the number of bytes read is returned and the read
+ * position is updated, 0 at the end of the virtual block. On error, -1 is
+ * returned and `errno` set to indicate the error, EINVAL when read-ahead is
+ * not enabled
+ */
+ssize_t nvm_vblk_read_zc(struct nvm_vblk *vblk, const void **buf,
+			 size_t count);
+
 /**
  * Read from a virtual block at given offset
  */
@@ -1724,6 +2463,456 @@ int nvm_vblk_set_pos_write(struct nvm_vblk *vblk, size_t pos);
  */
 void nvm_vblk_pr(struct nvm_vblk *vblk);
 
+/**
+ * Opaque handle for a group-commit append stream on top of a virtual block
+ *
+ * @see nvm_append_create
+ *
+ * @struct nvm_append
+ */
+struct nvm_append;
+
+/**
+ * Location of an appended record
+ *
+ * @struct nvm_append_loc
+ */
+struct nvm_append_loc {
+	struct nvm_addr addr;	///< Chunk and sector holding the first byte
+	uint32_t offset;	///< Byte offset of the record in the sector
+	uint64_t vofs;		///< Byte offset of the record in the vblk
+};
+
+/**
+ * Create an append stream writing records to 'vblk' from its write position
+ *
+ * Records of any size up to a write-unit of WS_OPT sectors are packed back to
+ * back into write-units, a unit is written when full or, zero-padded, when
+ * 'deadline_usec' has passed since its first record. The stream owns the
+ * write position of 'vblk' until `nvm_append_destroy`.
+ *
+ * @note
+ * This is only defined in OCSSD 2.0
+ *
+ * @param vblk Virtual block to append to, its write position must be aligned
+ * to a write-unit
+ * @param deadline_usec Longest time a record waits for others to fill its
+ * write-unit
+ *
+ * @return On success, a pointer to the stream. On error, NULL is returned and
+ * `errno` set to indicate the error
+ */
+struct nvm_append *nvm_append_create(struct nvm_vblk *vblk,
+				     uint64_t deadline_usec);
+
+/**
+ * Write out what is appended, padding the last write-unit, and free the stream
+ */
+void nvm_append_destroy(struct nvm_append *app);
+
+/**
+ * Append a record to the stream, may be called concurrently from multiple
+ * threads, returns once the record is written to the device
+ *
+ * @param app The stream to append to
+ * @param rec Record to append
+ * @param nbytes Size of the record, at most a write-unit of WS_OPT sectors
+ * @param loc Set to the location of the record, may be NULL
+ *
+ * @return On success, 0 is returned. On error, -1 is returned and `errno` set
+ * to indicate the error, ENOSPC when the vblk is full
+ */
+int nvm_append(struct nvm_append *app, const void *rec, size_t nbytes,
+	       struct nvm_append_loc *loc);
+
+/**
+ * Write out all records appended so far without waiting for their deadline
+ *
+ * @param app The stream to flush
+ *
+ * @return On success, 0 is returned. On error, -1 is returned and `errno` set
+ * to indicate the error
+ */
+int nvm_append_flush(struct nvm_append *app);
+
+/**
+ * Print the state of the stream in a humanly readable form
+ *
+ * @param app The entity to print information about
+ */
+void nvm_append_pr(struct nvm_append *app);
+
+/**
+ * Opaque handle for a pool of chunks which are erased in the background, such
+ * that writers get chunks ready for writing without waiting for an erase
+ *
+ * @see nvm_chunk_pool_create
+ *
+ * @struct nvm_chunk_pool
+ */
+struct nvm_chunk_pool;
+
+/**
+ * Create a pool of the free chunks of the given device and start its
+ * background thread
+ *
+ * The pool adopts all chunks reported as free. Chunks returned with
+ * `nvm_chunk_pool_put` are erased by the background thread, one at a time,
+ * whenever their PU has fewer than 'nready' erased chunks. While the PU has
+ * erased chunks left, the thread waits for the device to be idle, no command
+ * dispatched through 'dev' for the throttle, before each erase. A PU without
+ * any is refilled right away. The remaining ones stay in the pool until
+ * needed.
+ *
+ * On NVM_BE_SPDK, the thread erases on an ASYNC context of its own, as the
+ * queue pair of synchronous commands is not to be used from it. The pool is
+ * not created when that context cannot be initialized.
+ *
+ * @note
+ * This is only defined in OCSSD 2.0
+ *
+ * @param dev Associated device
+ * @param nready Number of erased chunks to keep ready per PU
+ *
+ * @return On success, a pointer to the pool. On error, NULL is returned and
+ * `errno` set to indicate the error
+ */
+struct nvm_chunk_pool *nvm_chunk_pool_create(struct nvm_dev *dev,
+					     uint32_t nready);
+
+/**
+ * Stop the background thread and free the pool, chunks still in the pool are
+ * left as they are on the device
+ */
+void nvm_chunk_pool_destroy(struct nvm_chunk_pool *pool);
+
+/**
+ * Set how long the device must be idle before the background thread erases a
+ * chunk ahead of need, leaving the device to foreground commands, the default
+ * is 1ms
+ *
+ * @param pool The pool to configure
+ * @param usec The idle time in microseconds, 0 to erase without waiting
+ *
+ * @return On success, 0 is returned. On error, -1 is returned and `errno` set
+ * to indicate the error
+ */
+int nvm_chunk_pool_set_throttle(struct nvm_chunk_pool *pool, uint64_t usec);
+
+/**
+ * Get an erased chunk on the PU given by 'addr->l.pugrp' and 'addr->l.punit'
+ *
+ * When no erased chunk is ready on the PU, one of its returned chunks is
+ * erased by the caller before returning, or when the background thread is
+ * erasing the last of them, the caller waits for it.
+ *
+ * @param pool The pool to get a chunk from
+ * @param addr PU to get a chunk on, set to the address of the chunk
+ *
+ * @return On success, 0 is returned. On error, -1 is returned and `errno` set
+ * to indicate the error, ENOSPC when the PU has no chunks in the pool
+ */
+int nvm_chunk_pool_get(struct nvm_chunk_pool *pool, struct nvm_addr *addr);
+
+/**
+ * Return a chunk obtained with `nvm_chunk_pool_get`, its data is no longer
+ * needed and it is erased before it is handed out again
+ *
+ * @param pool The pool the chunk was obtained from
+ * @param addr Address of the chunk
+ *
+ * @return On success, 0 is returned. On error, -1 is returned and `errno` set
+ * to indicate the error
+ */
+int nvm_chunk_pool_put(struct nvm_chunk_pool *pool, struct nvm_addr addr);
+
+/**
+ * Print the state of the pool in a humanly readable form
+ *
+ * @param pool The entity to print information about
+ */
+void nvm_chunk_pool_pr(struct nvm_chunk_pool *pool);
+
+/**
+ * Opaque handle for a page-mapped host FTL, exposing the chunks of a device as
+ * logical blocks of the sector size
+ *
+ * @see nvm_ftl_open
+ *
+ * @struct nvm_ftl
+ */
+struct nvm_ftl;
+
+/**
+ * Flags for `nvm_ftl_open`
+ */
+enum nvm_ftl_flags {
+	NVM_FTL_FORMAT = 0x1,	///< Format the device, dropping its contents
+	NVM_FTL_GC_GREEDY = 0x2,	///< Pick GC victims by NVM_GC_GREEDY
+};
+
+/**
+ * Open a host FTL on the given device, recovering its state or formatting it
+ *
+ * Logical blocks map to sectors through an in-memory table of 32-bit entries.
+ * Writes are staged and written in units of `nvm_dev_get_ws_opt` sectors,
+ * rotating over the parallel units. The table is persisted by checkpoints,
+ * written to free chunks and referenced by a root record in the superblock,
+ * the first two usable chunks at format. Checkpoints are taken periodically, on
+ * `nvm_ftl_checkpoint` and on `nvm_ftl_close`. When the device has at least
+ * 8 bytes of OOB per sector, each sector records the block it holds, and
+ * blocks written after the last checkpoint are recovered from it.
+ *
+ * Space is reclaimed from chunks without valid sectors, such chunks are reused
+ * after the next checkpoint. Chunks are emptied by relocating their valid
+ * sectors with a `nvm_gc` engine, by NVM_GC_COST_BENEFIT unless
+ * NVM_FTL_GC_GREEDY is given. Relocation runs ahead of need within a budget of
+ * 4 sectors per sector written, see `nvm_ftl_set_gc_budget`, and regardless of
+ * it when no chunk is left. Writes fail with ENOSPC when no victim is left.
+ *
+ * @note
+ * This is only defined in OCSSD 2.0
+ *
+ * @param dev Associated device
+ * @param flags NVM_FTL_FORMAT to format the device, otherwise it is recovered,
+ * and NVM_FTL_GC_GREEDY
+ *
+ * @return On success, a pointer to the FTL. On error, NULL is returned and
+ * `errno` set to indicate the error, ENOENT when the device is not formatted
+ */
+struct nvm_ftl *nvm_ftl_open(struct nvm_dev *dev, int flags);
+
+/**
+ * Write staged blocks, take a checkpoint and free the FTL
+ *
+ * @return On success, 0 is returned. On error, -1 is returned and `errno` set
+ * to indicate the error, the FTL is freed regardless
+ */
+int nvm_ftl_close(struct nvm_ftl *ftl);
+
+/**
+ * Returns the number of logical blocks exposed by the FTL, each of
+ * `nvm_geo.l.nbytes` bytes
+ */
+uint64_t nvm_ftl_get_nlbas(const struct nvm_ftl *ftl);
+
+/**
+ * Read 'nlbas' blocks from 'lba' into 'buf', blocks never written or trimmed
+ * read as zeros
+ *
+ * @return On success, 0 is returned. On error, -1 is returned and `errno` set
+ * to indicate the error
+ */
+int nvm_ftl_read(struct nvm_ftl *ftl, uint64_t lba, uint32_t nlbas,
+		 void *buf);
+
+/**
+ * Write 'nlbas' blocks from 'buf' to 'lba', the blocks are staged and written
+ * once a stripe of write units is full or on `nvm_ftl_flush`
+ *
+ * @return On success, 0 is returned. On error, -1 is returned and `errno` set
+ * to indicate the error
+ */
+int nvm_ftl_write(struct nvm_ftl *ftl, uint64_t lba, uint32_t nlbas,
+		  const void *buf);
+
+/**
+ * Drop the mapping of 'nlbas' blocks from 'lba'
+ *
+ * @note
+ * Trims are not logged, they are durable once the next checkpoint is taken by
+ * `nvm_ftl_checkpoint`, `nvm_ftl_close` or the checkpoint interval. When the
+ * FTL is recovered without it, trimmed blocks read back as of the last
+ * checkpoint, or as rolled forward from OOB
+ *
+ * @return On success, 0 is returned. On error, -1 is returned and `errno` set
+ * to indicate the error
+ */
+int nvm_ftl_trim(struct nvm_ftl *ftl, uint64_t lba, uint32_t nlbas);
+
+/**
+ * Write staged blocks, padding the last write unit
+ *
+ * @return On success, 0 is returned. On error, -1 is returned and `errno` set
+ * to indicate the error
+ */
+int nvm_ftl_flush(struct nvm_ftl *ftl);
+
+/**
+ * Write staged blocks and take a checkpoint
+ *
+ * @return On success, 0 is returned. On error, -1 is returned and `errno` set
+ * to indicate the error
+ */
+int nvm_ftl_checkpoint(struct nvm_ftl *ftl);
+
+/**
+ * Set the number of chunks filled between checkpoints, the default is 64
+ *
+ * @return On success, 0 is returned. On error, -1 is returned and `errno` set
+ * to indicate the error
+ */
+int nvm_ftl_set_ckpt_interval(struct nvm_ftl *ftl, uint32_t nchunks);
+
+/**
+ * Set the number of sectors relocated ahead of need per sector written, 0 for
+ * no limit, the default is 4
+ */
+void nvm_ftl_set_gc_budget(struct nvm_ftl *ftl, uint32_t ratio);
+
+/**
+ * Print the state of the FTL in a humanly readable form
+ *
+ * @param ftl The entity to print information about
+ */
+void nvm_ftl_pr(struct nvm_ftl *ftl);
+
+/**
+ * Opaque handle for a garbage-collection engine, tracking the valid sectors of
+ * chunks, picking victims among them and relocating their valid sectors
+ *
+ * @see nvm_gc_create
+ *
+ * @struct nvm_gc
+ */
+struct nvm_gc;
+
+/**
+ * Victim selection policies of `nvm_gc_pick`
+ */
+enum nvm_gc_policy {
+	NVM_GC_GREEDY = 0,		///< Fewest valid sectors
+	NVM_GC_COST_BENEFIT = 1,	///< Free space and age, weighed by wear
+};
+
+/**
+ * Flags for `nvm_gc_move`
+ */
+enum nvm_gc_flags {
+	NVM_GC_URGENT = 0x1,	///< Move regardless of the foreground budget
+};
+
+/**
+ * Create a garbage-collection engine for the given device
+ *
+ * Chunks become victim candidates with `nvm_gc_set_chunk`, their valid
+ * sectors are maintained with `nvm_gc_invalidate`. With NVM_GC_COST_BENEFIT,
+ * the victim maximizes '(1 - u) * age / (1 + u)' where 'u' is the fraction of
+ * valid sectors and 'age' counts the chunks set since, weighed down by the
+ * wear-level index from the chunk report. `nvm_gc_move` relocates by vector
+ * copy when the backend supports it, otherwise by reading into and writing
+ * from host memory, on an ASYNC context when the backend has one.
+ *
+ * The engine is unaware of what sectors hold, the caller updates its mappings
+ * after a move and returns the victim to `nvm_gc_set_chunk` once it is
+ * reclaimed.
+ *
+ * @note
+ * This is only defined in OCSSD 2.0
+ *
+ * @param dev Associated device
+ * @param policy Victim selection policy, see enum nvm_gc_policy
+ *
+ * @return On success, a pointer to the engine. On error, NULL is returned and
+ * `errno` set to indicate the error
+ */
+struct nvm_gc *nvm_gc_create(struct nvm_dev *dev, int policy);
+
+/**
+ * Free the given engine
+ */
+void nvm_gc_destroy(struct nvm_gc *gc);
+
+/**
+ * Set the valid sectors of a chunk, making it a victim candidate, or drop it
+ * from the candidates when 'bitmap' is NULL
+ *
+ * @param gc The engine
+ * @param chunk Address of the chunk
+ * @param bitmap One bit per sector, bit 'sectr % 64' of word 'sectr / 64' set
+ * when the sector is valid, or NULL
+ *
+ * @return On success, 0 is returned. On error, -1 is returned and `errno` set
+ * to indicate the error
+ */
+int nvm_gc_set_chunk(struct nvm_gc *gc, struct nvm_addr chunk,
+		     const uint64_t *bitmap);
+
+/**
+ * Mark the sector at 'addr' as no longer valid
+ *
+ * @return On success, 0 is returned. On error, -1 is returned and `errno` set
+ * to indicate the error
+ */
+int nvm_gc_invalidate(struct nvm_gc *gc, struct nvm_addr addr);
+
+/**
+ * Pick a victim among the candidates with at most 'nvalid_max' valid sectors
+ *
+ * @param gc The engine
+ * @param nvalid_max Valid sectors of the victim, at most
+ * @param chunk Set to the address of the victim
+ *
+ * @return On success, the number of valid sectors of the victim. On error, -1
+ * is returned and `errno` set to indicate the error, ENOENT when there is no
+ * candidate
+ */
+int nvm_gc_pick(struct nvm_gc *gc, uint32_t nvalid_max,
+		struct nvm_addr *chunk);
+
+/**
+ * Get the addresses of the valid sectors of a candidate
+ *
+ * @param gc The engine
+ * @param chunk Address of the chunk
+ * @param addrs Array of `nvm_geo.l.nsectr` entries, filled with the addresses
+ *
+ * @return On success, the number of addresses in 'addrs'. On error, -1 is
+ * returned and `errno` set to indicate the error, ENOENT when the chunk is not
+ * a candidate
+ */
+int nvm_gc_get_valid(struct nvm_gc *gc, struct nvm_addr chunk,
+		     struct nvm_addr addrs[]);
+
+/**
+ * Relocate the sectors of 'src' to the first 'nsrc' sectors of 'dst' and pad
+ * the remaining 'ndst - nsrc' sectors with zeros, OOB included
+ *
+ * 'dst' must follow the write rules of the device, 'ndst' being a multiple of
+ * `nvm_dev_get_ws_min`. Unless NVM_GC_URGENT is given, the move is refused when
+ * the budget set with `nvm_gc_set_budget` is exhausted.
+ *
+ * @param gc The engine
+ * @param src Sectors to relocate
+ * @param nsrc Number of entries in 'src'
+ * @param dst Sectors to write
+ * @param ndst Number of entries in 'dst'
+ * @param flags NVM_GC_URGENT or 0x0
+ *
+ * @return On success, 0 is returned. On error, -1 is returned and `errno` set
+ * to indicate the error, EAGAIN when the budget is exhausted
+ */
+int nvm_gc_move(struct nvm_gc *gc, struct nvm_addr src[], int nsrc,
+		struct nvm_addr dst[], int ndst, int flags);
+
+/**
+ * Limit moves to 'ratio' sectors written per foreground sector accounted with
+ * `nvm_gc_account`, 0 for no limit which is the default
+ */
+void nvm_gc_set_budget(struct nvm_gc *gc, uint32_t ratio);
+
+/**
+ * Account 'nsectr' sectors of foreground I/O, crediting the budget
+ */
+void nvm_gc_account(struct nvm_gc *gc, size_t nsectr);
+
+/**
+ * Print the state of the engine in a humanly readable form
+ *
+ * @param gc The entity to print information about
+ */
+void nvm_gc_pr(struct nvm_gc *gc);
+
 /**
  * Boilerplate for working with the API
  *
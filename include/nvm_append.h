@@ -0,0 +1,69 @@
+/*
+ * nvm_append - Internal header for group-commit append streams
+ *
+ * Copyright (C) Simon A. F. Lund <slund@cnexlabs.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __INTERNAL_NVM_APPEND_H
+#define __INTERNAL_NVM_APPEND_H
+
+#include <pthread.h>
+#include <liblightnvm.h>
+
+#define NVM_APPEND_NUNITS 8		///< Write-units in the staging ring
+
+/**
+ * Records are packed back to back into write-units of WS_OPT sectors, the
+ * unit numbered 'head' is open for records and those from 'tail' up to it are
+ * sealed and wait for the flusher. A unit is sealed when full or when its
+ * deadline expires, the latter is zero-padded. Units are written in order, so
+ * a record is committed once 'tail' has passed the last unit it touches.
+ */
+struct nvm_append {
+	struct nvm_vblk *vblk;
+	size_t unit_nbytes;		///< Bytes per write-unit, WS_OPT sectors
+	size_t base;			///< Byte offset in vblk of unit zero
+	uint64_t nunits_max;		///< Units that fit in the vblk
+	uint64_t deadline_usec;		///< Commit deadline of an open unit
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;		///< Signaled on append, seal and commit
+	pthread_t thread;		///< The flusher
+	int stop;			///< Tells the flusher to exit
+	int err;			///< Sticky errno of a failed unit write
+
+	uint64_t head;			///< Unit open for records
+	uint64_t tail;			///< Next unit to write, all before it are
+					///< committed
+	size_t head_nbytes;		///< Bytes of records in the open unit
+	struct timespec head_deadline;	///< When the open unit is sealed
+
+	size_t nrecs;			///< Records appended
+	size_t nrec_bytes;		///< Bytes of records appended
+	size_t nwrites;			///< Write commands of one or more units
+	size_t npadded;			///< Units sealed by their deadline
+
+	char *ring;			///< NVM_APPEND_NUNITS units, DMA buffer
+};
+
+#endif /* __INTERNAL_NVM_APPEND_H */
@@ -29,12 +29,175 @@
 #ifndef __INTERNAL_NVM_ASYNC_H
 #define __INTERNAL_NVM_ASYNC_H
 
+#include <liblightnvm.h>
+#include <nvm_rcache.h>
+
+/**
+ * Expected command latencies, used to pace waiting for completions
+ */
+#define NVM_ASYNC_LAT_READ_NSEC 100000ULL	///< 100us
+#define NVM_ASYNC_LAT_WRITE_NSEC 1000000ULL	///< 1ms
+#define NVM_ASYNC_LAT_ERASE_NSEC 3000000ULL	///< 3ms
+
+#define NVM_ASYNC_SPIN_NSEC 10000ULL		///< Hybrid spin before backoff
+#define NVM_ASYNC_NAP_MIN_NSEC 1000ULL		///< Shortest sleep
+#define NVM_ASYNC_NAP_MAX_NSEC 2000000ULL	///< Longest sleep
+
+/**
+ * Classes of commands by their expected latency
+ */
+enum nvm_async_cls {
+	NVM_ASYNC_CLS_READ = 0,
+	NVM_ASYNC_CLS_WRITE,
+	NVM_ASYNC_CLS_ERASE,
+	NVM_ASYNC_NCLS
+};
+
+/**
+ * A command with a deadline, as tracked on a context
+ */
+struct nvm_async_timed {
+	struct nvm_ret *ret;	///< The command
+	void *tag;		///< Backend handle of the command, e.g. an iocb
+};
+
 struct nvm_async_ctx {
 	uint32_t depth;		///< IO depth of the ASYNC CTX
 	uint32_t outstanding;	///< Outstanding IO on the ASYNC CTX
+	uint32_t nabandoned;	///< Outstanding IO completed as aborted
+	uint32_t nout[NVM_ASYNC_NCLS];	///< Outstanding IO per class
+	uint16_t flags;		///< Flags given to nvm_async_init
+	struct nvm_dev *dev;	///< Device given to nvm_async_init
+	enum nvm_async_wait_mode wait_mode;	///< How to wait for completions
+	int efd;		///< eventfd signaled on completion, -1: none
+
+	struct nvm_async_timed *timed;	///< Commands with deadlines, or NULL
+	uint32_t ntimed;		///< Number of entries in 'timed'
+	uint32_t plugged;	///< Backend may defer submission until flushed
+	uint32_t ndeferred;	///< Outstanding IO deferred while plugged
+	struct nvm_ret **failed;	///< Completed IO not handed out yet
+	uint32_t nfailed;		///< Number of entries in 'failed'
+
+	struct nvm_ret **reap;	///< Reap into this array instead of callbacks
+	uint32_t nreaped;	///< Number of entries in 'reap'
+
+	struct nvm_sched *sched;	///< See NVM_ASYNC_SCHED, or NULL
 
 	// Lower-layer context, e.g. for the implementation of nvm_be_*_async_*
 	void *be_ctx;
 };
 
+static inline enum nvm_async_cls nvm_async_opc_cls(int opcode)
+{
+	switch (opcode) {
+	case NVM_DOPC_SCALAR_ERASE:
+	case NVM_DOPC_VECTOR_ERASE:
+		return NVM_ASYNC_CLS_ERASE;
+
+	case NVM_DOPC_SCALAR_WRITE:
+	case NVM_DOPC_VECTOR_WRITE:
+	case NVM_DOPC_VECTOR_COPY:
+		return NVM_ASYNC_CLS_WRITE;
+
+	default:
+		return NVM_ASYNC_CLS_READ;
+	}
+}
+
+/**
+ * Account for a command with the given 'opcode' submitted on 'ctx'
+ */
+static inline void nvm_async_ctx_sub(struct nvm_async_ctx *ctx, int opcode)
+{
+	const enum nvm_async_cls cls = nvm_async_opc_cls(opcode);
+
+	ctx->outstanding += 1;
+	ctx->nout[cls] += 1;
+
+	if (cls != NVM_ASYNC_CLS_READ)
+		nvm_rcache_wr_sub(ctx->dev);
+}
+
+/**
+ * Account for a command with the given 'opcode' completed on 'ctx', or one
+ * which failed submission
+ */
+static inline void nvm_async_ctx_cpl(struct nvm_async_ctx *ctx, int opcode)
+{
+	const enum nvm_async_cls cls = nvm_async_opc_cls(opcode);
+
+	ctx->outstanding -= 1;
+	ctx->nout[cls] -= 1;
+
+	if (cls != NVM_ASYNC_CLS_READ)
+		nvm_rcache_wr_cpl(ctx->dev);
+}
+
+/**
+ * Track a command submitted on 'ctx', 'tag' is what the backend needs to
+ * abandon or cancel it, it is kept on 'ret' and, when the command has a
+ * deadline, on 'ctx'
+ */
+static inline void nvm_async_ctx_track(struct nvm_async_ctx *ctx,
+				       struct nvm_ret *ret, void *tag)
+{
+	ret->async.tag = tag;
+
+	if (!ctx->timed || !ret->async.deadline)
+		return;
+
+	ctx->timed[ctx->ntimed].ret = ret;
+	ctx->timed[ctx->ntimed].tag = tag;
+	ctx->ntimed += 1;
+}
+
+/**
+ * Stop tracking a command completed on 'ctx'
+ */
+static inline void nvm_async_ctx_untrack(struct nvm_async_ctx *ctx,
+					 struct nvm_ret *ret)
+{
+	if (ret)
+		ret->async.tag = NULL;
+
+	if (!ctx->ntimed || !ret || !ret->async.deadline)
+		return;
+
+	for (uint32_t i = 0; i < ctx->ntimed; ++i) {
+		if (ctx->timed[i].ret != ret)
+			continue;
+
+		ctx->timed[i] = ctx->timed[--ctx->ntimed];
+		return;
+	}
+}
+
+/**
+ * Complete a deferred command of 'ctx' which failed submission, it is handed
+ * to its callback, or reaped, with status NVM_RET_STATUS_ABORTED by the next
+ * poke, reap or wait looking at the context
+ */
+static inline void nvm_async_ctx_fail(struct nvm_async_ctx *ctx,
+				      struct nvm_ret *ret)
+{
+	ret->status = NVM_RET_STATUS_ABORTED;
+	ctx->failed[ctx->nfailed] = ret;
+	ctx->nfailed += 1;
+}
+
+/**
+ * State of a backoff while waiting for completions, zero-initialize it before
+ * the wait and on progress
+ */
+struct nvm_async_backoff {
+	uint64_t bgn;		///< Time when the wait started, nsec
+	uint64_t nap;		///< Next nap after the hybrid nap, nsec
+};
+
+/**
+ * Back off after a poke of 'ctx' found no completions, how is given by the
+ * wait-mode of 'ctx' and the latency of the outstanding commands
+ */
+void nvm_async_backoff(struct nvm_async_ctx *ctx, struct nvm_async_backoff *bo);
+
 #endif /* __INTERNAL_NVM_ASYNC_H */
@@ -159,6 +159,29 @@ struct nvm_be {
 	 * Wait for completion of all asynchronous events on a given context
 	 */
 	int (*async_wait)(struct nvm_dev *, struct nvm_async_ctx *);
+
+	/**
+	 * Submit the commands deferred on a plugged asynchronous context
+	 */
+	int (*async_flush)(struct nvm_dev *, struct nvm_async_ctx *);
+
+	/**
+	 * Read asynchronous events into an array instead of invoking callbacks
+	 */
+	int (*async_reap)(struct nvm_dev *, struct nvm_async_ctx *,
+			  struct nvm_ret **, uint32_t);
+
+	/**
+	 * Detach a command from its 'nvm_ret', its completion is then dropped,
+	 * and abort it on the device when the backend is able to
+	 */
+	void (*async_abandon)(struct nvm_dev *, struct nvm_async_ctx *, void *);
+
+	/**
+	 * Ask the device to abort the outstanding command of the given 'ret'
+	 */
+	int (*async_cancel)(struct nvm_dev *, struct nvm_async_ctx *,
+			    struct nvm_ret *);
 };
 
 /**
@@ -231,6 +254,17 @@ int nvm_be_nosys_async_poke(struct nvm_dev *dev, struct nvm_async_ctx *ctx,
 
 int nvm_be_nosys_async_wait(struct nvm_dev *dev, struct nvm_async_ctx *ctx);
 
+int nvm_be_nosys_async_flush(struct nvm_dev *dev, struct nvm_async_ctx *ctx);
+
+int nvm_be_nosys_async_reap(struct nvm_dev *dev, struct nvm_async_ctx *ctx,
+			    struct nvm_ret *rets[], uint32_t max);
+
+void nvm_be_nosys_async_abandon(struct nvm_dev *dev, struct nvm_async_ctx *ctx,
+				void *tag);
+
+int nvm_be_nosys_async_cancel(struct nvm_dev *dev, struct nvm_async_ctx *ctx,
+			      struct nvm_ret *ret);
+
 /**
  * Auxilary helpers
  */
@@ -242,6 +276,25 @@ int nvm_be_nosys_async_wait(struct nvm_dev *dev, struct nvm_async_ctx *ctx);
  */
 int nvm_be_split_dpath(const char *dev_path, char *nvme_name, int *nsid);
 
+/**
+ * Read the NUMA node from the sysfs attribute at the path formatted from 'fmt'
+ * and 'ident', returns -1 when the attribute is missing or the node unknown
+ */
+int nvm_be_sysfs_numa_node(const char *fmt, const char *ident);
+
+/**
+ * Address of a command in device-format, 'addr' is taken as is when 'flags'
+ * has `NVM_CMD_ADDR_DEV` set, otherwise it is converted from generic-format
+ */
+uint64_t nvm_be_addr_dev(struct nvm_dev *dev, struct nvm_addr addr,
+			 int flags);
+
+/**
+ * Addresses of a command in device-format, see `nvm_be_addr_dev`
+ */
+void nvm_be_addrs_dev(struct nvm_dev *dev, const struct nvm_addr addrs[],
+		      uint64_t dev_addrs[], int naddrs, int flags);
+
 /**
  * Fill out the geometry and other properties of the given device using the
  * idfy backend implementation
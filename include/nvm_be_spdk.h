@@ -33,6 +33,7 @@
 
 #define NVM_BE_SPDK_QPAIR_MAX 64
 #define NVM_BE_SPDK_ALIGN 0x1000
+#define NVM_BE_SPDK_NUMA_NODE_FMT "/sys/bus/pci/devices/%s/numa_node"
 
 /**
  * Internal representation of NVM_BE_SPDK state
@@ -74,6 +75,17 @@ int nvm_be_spdk_async_poke(struct nvm_dev *dev, struct nvm_async_ctx *ctx,
 
 int nvm_be_spdk_async_wait(struct nvm_dev *dev, struct nvm_async_ctx *ctx);
 
+int nvm_be_spdk_async_flush(struct nvm_dev *dev, struct nvm_async_ctx *ctx);
+
+int nvm_be_spdk_async_reap(struct nvm_dev *dev, struct nvm_async_ctx *ctx,
+			   struct nvm_ret *rets[], uint32_t max);
+
+void nvm_be_spdk_async_abandon(struct nvm_dev *dev, struct nvm_async_ctx *ctx,
+			       void *tag);
+
+int nvm_be_spdk_async_cancel(struct nvm_dev *dev, struct nvm_async_ctx *ctx,
+			     struct nvm_ret *ret);
+
 struct nvm_spec_idfy *nvm_be_spdk_idfy(struct nvm_dev *dev,
 				       struct nvm_ret *ret);
 
@@ -0,0 +1,79 @@
+/*
+ * nvm_buf - Internal header for buffer management
+ *
+ * Copyright (C) Simon A. F. Lund <slund@cnexlabs.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __INTERNAL_NVM_BUF_H
+#define __INTERNAL_NVM_BUF_H
+
+#include <stddef.h>
+
+/*
+ * The buffer pool hands out blocks in power-of-two size classes. Classes below
+ * 2MB are carved from a 2MB slab region shared by all of them, classes of 2MB
+ * and above take a region of their own per block. Regions are mapped with
+ * MAP_HUGETLB when hugepages are reserved, otherwise advised for THP, and are
+ * pre-faulted on creation. Requests above the largest class are mapped
+ * directly and unmapped on free.
+ */
+#define NVM_BUF_POOL_REGION_SH 21	///< Region size and alignment, 2MB
+#define NVM_BUF_POOL_CLS_MIN_SH 12	///< Smallest size-class, 4KB
+#define NVM_BUF_POOL_CLS_MAX_SH 26	///< Largest size-class, 64MB
+#define NVM_BUF_POOL_NCLS \
+	(NVM_BUF_POOL_CLS_MAX_SH - NVM_BUF_POOL_CLS_MIN_SH + 1)
+#define NVM_BUF_POOL_NNODES 8		///< NUMA nodes with their own depots
+#define NVM_BUF_POOL_NHOMES (NVM_BUF_POOL_NNODES + 1)
+
+#define NVM_BUF_POOL_TCACHE_NBYTES (1UL << 23)	///< Per-thread bytes per class
+#define NVM_BUF_POOL_TCACHE_NBLKS 32		///< Per-thread blocks per class
+#define NVM_BUF_POOL_DEPOT_NBYTES (1UL << 28)	///< Cached bytes per span-class
+#define NVM_BUF_POOL_HUGETLB_RETRY 64		///< Maps skipping MAP_HUGETLB
+#define NVM_BUF_POOL_SLAB_NBYTES (1UL << 16)	///< Bytes carved from a slab
+
+/**
+ * Allocate a buffer of at least 'nbytes' aligned to 'alignment' from the
+ * pool, falls back to `nvm_buf_virt_alloc` when the pool cannot serve it.
+ * Pages are placed on NUMA 'node' when it is non-negative.
+ *
+ * @return On success, a pointer to the buffer. On error, NULL is returned and
+ * `errno` set to indicate the error
+ */
+void *nvm_buf_pool_alloc(size_t alignment, size_t nbytes, int node);
+
+/**
+ * Reallocate a buffer allocated with `nvm_buf_pool_alloc`, the buffer is
+ * returned as is when its size-class already holds 'nbytes', otherwise it is
+ * moved to a buffer on the same NUMA node
+ *
+ * @return On success, a pointer to the buffer. On error, NULL is returned,
+ * `errno` set to indicate the error and 'buf' is left untouched
+ */
+void *nvm_buf_pool_realloc(void *buf, size_t alignment, size_t nbytes);
+
+/**
+ * Return a buffer allocated with `nvm_buf_pool_alloc`
+ */
+void nvm_buf_pool_free(void *buf);
+
+#endif /* __INTERNAL_NVM_BUF_H */
@@ -0,0 +1,67 @@
+/*
+ * nvm_chunk_pool - Internal header for the pool of pre-erased chunks
+ *
+ * Copyright (C) Simon A. F. Lund <slund@cnexlabs.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __INTERNAL_NVM_CHUNK_POOL_H
+#define __INTERNAL_NVM_CHUNK_POOL_H
+
+#include <pthread.h>
+#include <liblightnvm.h>
+
+#define NVM_CHUNK_POOL_THROTTLE_USEC 1000ULL	///< Idleness before an erase
+
+/**
+ * Chunks of a parallel unit, erased and waiting to be erased
+ */
+struct nvm_chunk_pool_pu {
+	struct nvm_addr *ready;		///< Erased chunks, handed out first
+	uint32_t nready;		///< Number of entries in 'ready'
+	struct nvm_addr *dirty;		///< Chunks to erase before reuse
+	uint32_t ndirty;		///< Number of entries in 'dirty'
+	uint32_t nerasing;		///< Chunks erased in the background now
+};
+
+struct nvm_chunk_pool {
+	struct nvm_dev *dev;
+	uint32_t npus;			///< Number of PUs in 'pus'
+	uint32_t nready_min;		///< Erased chunks to keep ready per PU
+	uint64_t throttle_usec;		///< Idleness before a background erase
+	uint32_t cursor;		///< PU where the next refill starts
+
+	size_t nerased;			///< Chunks erased in the background
+	size_t nfailed;			///< Chunks dropped as their erase failed
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;		///< Signaled on put, get and destroy
+	pthread_cond_t erased;		///< Signaled as background erases end
+	pthread_t thread;
+	int stop;			///< Tells the thread to exit
+	struct nvm_async_ctx *ctx;	///< Erases of the thread, SPDK only
+
+	struct nvm_addr *addrs;		///< Storage of 'ready' and 'dirty'
+	struct nvm_chunk_pool_pu pus[];
+};
+
+#endif /* __INTERNAL_NVM_CHUNK_POOL_H */
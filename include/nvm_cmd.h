@@ -33,6 +33,7 @@
 struct nvm_cmd_wrap {
 	struct nvm_dev *dev;
 	struct nvm_ret *ret;
+	struct nvm_async_ctx *async_ctx;	// ASYNC CTX, NULL: SYNC
 
 	struct nvm_nvme_cmd cmd;
 
@@ -74,4 +75,20 @@ void nvm_cmd_wrap_term(struct nvm_cmd_wrap *wrap);
 void nvm_cmd_wrap_cpl(struct nvm_cmd_wrap *wrap,
 		      const struct nvm_nvme_cpl *cpl);
 
+/**
+ * Returns the control word of a command submitted with the given 'flags',
+ * that is, the flags without those in NVM_CMD_MASK_LIB
+ */
+static inline uint16_t nvm_cmd_control(int flags)
+{
+	return flags & ~NVM_CMD_MASK_LIB;
+}
+
+/**
+ * Submit 'cmd' to the backend, bypassing the scheduler of its ASYNC context,
+ * counting it in 'ncmds' of the device
+ */
+int nvm_cmd_dispatch(struct nvm_dev *dev, const struct nvm_cmd_desc *cmd,
+		     uint16_t flags);
+
 #endif /* __INTERNAL_NVM_CMD_H */
@@ -29,8 +29,23 @@
 #ifndef __INTERNAL_NVM_DEV_H
 #define __INTERNAL_NVM_DEV_H
 
+#include <stdatomic.h>
 #include <liblightnvm.h>
 
+/**
+ * Geometry-dependent address math, selected once per device by
+ * `nvm_addr_fns_setup`, power-of-two geometries get shift/mask variants
+ */
+struct nvm_addr_fns {
+	int (*check)(struct nvm_addr addr, const struct nvm_dev *dev);
+	uint64_t (*gen2lpo)(struct nvm_dev *dev, struct nvm_addr addr);
+	struct nvm_addr (*lpo2gen)(struct nvm_dev *dev, uint64_t lpo);
+	uint64_t oob_mask;	///< Address bits beyond power-of-two geometry
+	uint8_t nchunk_sh;	///< log2 of geo.l.nchunk
+	uint8_t npunit_sh;	///< log2 of geo.l.npunit
+	int ws_opt_sh;		///< log2 of ws_opt, -1 when not a power of two
+};
+
 struct nvm_dev {
 	int fd;				///< Device IOCTL handle
 	char name[NVM_DEV_NAME_LEN];	///< Device name e.g. "nvme0n1"
@@ -61,6 +76,31 @@ struct nvm_dev {
 	struct nvm_be *be;		///< Backend interface
 	void *be_state;			///< Backend state
 	int cmd_opts;			///< Default options for CMD execution
+	int numa_node;			///< NUMA node of the device, -1: none
+	int numa_bind;			///< Bind vblk IO threads to 'numa_node'
+	struct nvm_addr_fns addr_fns;	///< Address math for the geometry
+	struct nvm_rcache *rcache;	///< See nvm_dev_set_rcache, or NULL
+	atomic_uint nwr_inflight;	///< Writes, copies and erases in flight
+	atomic_uint ncmds;		///< Commands dispatched, for idleness
 };
 
+/**
+ * Binds the calling thread to the CPUs of the NUMA node of the device when
+ * binding is enabled with `nvm_dev_set_numa_bind`, saving the affinity of the
+ * thread. Must be paired with `nvm_dev_numa_unbind` on the same thread, nested
+ * pairs leave the affinity to the outermost one.
+ */
+void nvm_dev_numa_bind(const struct nvm_dev *dev);
+
+/**
+ * Restores the affinity of the calling thread saved by `nvm_dev_numa_bind`
+ */
+void nvm_dev_numa_unbind(void);
+
+/**
+ * Selects the address math of the device from its geometry, must be called
+ * whenever the geometry or the write-unit of the device changes
+ */
+void nvm_addr_fns_setup(struct nvm_dev *dev);
+
 #endif /* __INTERNAL_NVM_DEV_H */
@@ -0,0 +1,170 @@
+/*
+ * nvm_ftl - Internal header for the page-mapped host FTL
+ *
+ * Copyright (C) Simon A. F. Lund <slund@cnexlabs.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __INTERNAL_NVM_FTL_H
+#define __INTERNAL_NVM_FTL_H
+
+#include <pthread.h>
+#include <liblightnvm.h>
+
+#define NVM_FTL_MAGIC 0x32305f4c54464d4eULL	///< Root record magic
+#define NVM_FTL_UNMAPPED UINT32_MAX	///< L2P / P2L entry without a mapping
+#define NVM_FTL_STAGED 0x80000000U	///< L2P flag, the rest is a stage slot
+#define NVM_FTL_NIL UINT32_MAX		///< No chunk
+#define NVM_FTL_OP_PCT 10		///< Overprovisioning in percent
+#define NVM_FTL_CKPT_INTERVAL 64	///< Chunks closed between checkpoints
+#define NVM_FTL_STAGE_NUNITS_MAX 32	///< Write units staged, at most
+#define NVM_FTL_GC_NCHUNKS 2		///< Chunks held back for relocation
+#define NVM_FTL_GC_RATIO 4		///< GC sectors per user sector
+
+/*
+ * Physical sectors are addressed by a 32-bit 'ppa' of
+ * '(pu * nchunk + chunk) * nsectr + sectr', and chunks by a 'cid' of
+ * 'pu * nchunk + chunk'. The top bit of a ppa is reserved for NVM_FTL_STAGED.
+ */
+
+enum nvm_ftl_chunk_state {
+	NVM_FTL_CHUNK_FREE = 0,		///< Unused, erased before use
+	NVM_FTL_CHUNK_OPEN,		///< Being written by its PU
+	NVM_FTL_CHUNK_CLOSED,		///< Full, or abandoned on error
+	NVM_FTL_CHUNK_DEAD,		///< No valid data, free on checkpoint
+	NVM_FTL_CHUNK_META,		///< Superblock or checkpoint data
+	NVM_FTL_CHUNK_OFFLINE,		///< Unusable
+};
+
+struct nvm_ftl_chunk {
+	uint32_t nvalid;		///< Sectors holding mapped blocks
+	uint32_t wp;			///< Sectors written or allocated
+	uint8_t state;			///< See enum nvm_ftl_chunk_state
+	uint8_t erased;			///< Whether a free chunk is erased
+	uint8_t tracked;		///< Whether the GC engine tracks it
+};
+
+/**
+ * Per-sector OOB metadata, allows rolling forward from a checkpoint
+ */
+struct nvm_ftl_oob {
+	uint32_t lba;			///< Block stored in the sector
+	uint32_t useq;			///< Sequence number of the write unit
+};
+
+/**
+ * Root record, written to the superblock chunks by every checkpoint
+ */
+struct nvm_ftl_root {
+	uint64_t magic;
+	uint64_t seq;			///< Checkpoint number
+	uint64_t nlbas;			///< Number of logical blocks
+	uint32_t useq;			///< Last write unit it covers
+	uint32_t csum;			///< Checksum of the L2P table
+	uint32_t nchunks;		///< Number of entries in 'cids'
+	uint32_t rcsum;			///< Checksum of the record
+	uint32_t sb_cids[2];		///< Superblock chunks
+	uint32_t cids[];		///< Chunks of the L2P table
+};
+
+/**
+ * Block found in OOB while rolling forward
+ */
+struct nvm_ftl_rfwd {
+	uint32_t useq;			///< Sequence number of the write unit
+	uint32_t ppa;			///< Sector holding the block
+	uint32_t lba;			///< The block
+};
+
+struct nvm_ftl_pu {
+	uint32_t open;			///< Chunk being written, or NVM_FTL_NIL
+	uint32_t tail_cid;		///< Chunk of 'tail', or NVM_FTL_NIL
+	char *tail;			///< Last sectors of 'tail_cid'
+};
+
+/**
+ * Tail of a chunk abandoned on a write error, kept until the chunk is dead as
+ * the device may not serve it
+ */
+struct nvm_ftl_orphan {
+	uint32_t cid;			///< The abandoned chunk
+	uint32_t wp;			///< Sectors written to it
+	char *tail;			///< Last 'tail_nsectr' sectors of it
+};
+
+struct nvm_ftl {
+	struct nvm_dev *dev;
+	pthread_mutex_t lock;
+
+	uint32_t npus;			///< Number of PUs in 'pus'
+	uint32_t nchunk;		///< Chunks per PU
+	uint32_t nsectr;		///< Sectors per chunk
+	size_t sectr_nbytes;		///< Bytes per sector and logical block
+	size_t oob_nbytes;		///< OOB bytes per sector, 0: unused
+	uint32_t ws_opt;		///< Sectors per write unit
+	uint32_t cmd_nsectr;		///< Sectors per command
+	uint32_t tail_nsectr;		///< Sectors kept in 'tail' of each PU
+
+	uint64_t nlbas;			///< Number of logical blocks
+	uint32_t *l2p;			///< Logical block to ppa
+	uint32_t *p2l;			///< Ppa to logical block
+	struct nvm_ftl_chunk *chunks;	///< Indexed by cid
+	struct nvm_ftl_pu *pus;
+	struct nvm_ftl_orphan *orphans;	///< Tails of abandoned chunks
+	uint32_t norphans;		///< Number of entries in 'orphans'
+	uint32_t nfree;			///< Chunks in NVM_FTL_CHUNK_FREE
+	uint32_t ndead;			///< Chunks in NVM_FTL_CHUNK_DEAD
+	uint32_t cursor;		///< PU of the next write unit
+	uint32_t useq;			///< Number of the last write unit
+
+	char *stage;			///< DMA buffer of 'stage_nunits' units
+	uint32_t *stage_lbas;		///< Block of each staged sector
+	uint32_t stage_nunits;		///< Write units in 'stage'
+	uint32_t nstaged;		///< Sectors staged
+	char *meta;			///< DMA buffer for OOB
+	char *bounce;			///< DMA buffer of a command
+
+	uint64_t ckpt_seq;		///< Number of the last checkpoint
+	uint32_t ckpt_interval;		///< Chunks closed between checkpoints
+	uint32_t nclosed;		///< Chunks closed since it
+	uint32_t ckpt_nchunks;		///< Chunks taken by a checkpoint
+	uint32_t *ckpt_cids;		///< Chunks of the last checkpoint
+	uint32_t sb_cids[2];		///< Superblock chunks
+	uint32_t sb_active;		///< Superblock chunk in use
+	uint32_t rec_nsectr;		///< Sectors written per root record
+
+	struct nvm_gc *gc;
+	uint32_t gc_cid;		///< Chunk relocated to, or NVM_FTL_NIL
+	uint32_t *gc_shadow;		///< Sources of the last sectors of it
+	int gc_unpadded;		///< Whether 'gc_shadow' is in use
+	struct nvm_addr *gc_src;	///< Sectors of a victim to relocate
+	struct nvm_addr *gc_dst;	///< Sectors relocated to
+	uint64_t *gc_bitmap;		///< Valid sectors of a chunk
+
+	size_t nwrites;			///< Blocks written by the user
+	size_t nprogs;			///< Sectors written by the FTL
+	size_t nckpts;			///< Checkpoints taken
+	size_t gc_nvictims;		///< Chunks reclaimed by relocation
+	size_t gc_nmoved;		///< Sectors relocated
+};
+
+#endif /* __INTERNAL_NVM_FTL_H */
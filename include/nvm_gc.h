@@ -0,0 +1,81 @@
+/*
+ * nvm_gc - Internal header for the garbage-collection engine
+ *
+ * Copyright (C) Simon A. F. Lund <slund@cnexlabs.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __INTERNAL_NVM_GC_H
+#define __INTERNAL_NVM_GC_H
+
+#include <pthread.h>
+#include <liblightnvm.h>
+
+#define NVM_GC_CREDIT_NCHUNKS 4		///< Credit kept, at most, in chunks
+
+/**
+ * Valid sectors of a chunk tracked by the engine
+ */
+struct nvm_gc_chunk {
+	uint64_t *bitmap;		///< One bit per sector, set when valid
+	uint32_t nvalid;		///< Bits set in 'bitmap'
+	uint8_t tracked;		///< Whether it is a victim candidate
+	uint8_t wli;			///< Wear-level index from the report
+	uint64_t stamp;			///< Value of 'clock' when it was set
+};
+
+struct nvm_gc {
+	struct nvm_dev *dev;
+	pthread_mutex_t lock;
+	int policy;			///< See enum nvm_gc_policy
+
+	uint32_t npus;			///< Number of PUs
+	uint32_t nchunk;		///< Chunks per PU
+	uint32_t nsectr;		///< Sectors per chunk
+	uint32_t nwords;		///< Bitmap words per chunk
+	size_t sectr_nbytes;		///< Bytes per sector
+	size_t oob_nbytes;		///< OOB bytes per sector
+	uint32_t ws_min;		///< Sectors per minimal write
+	uint32_t cmd_nsectr;		///< Sectors per command
+
+	int copy;			///< Vector copy, -1: untried
+	struct nvm_async_ctx *ctx;	///< Pipeline, NULL: synchronous
+	char *bufs[2];			///< DMA buffers of a command each
+	char *metas[2];			///< DMA buffers for OOB of each
+
+	uint8_t *stale;			///< PUs with outdated wear
+	uint64_t clock;			///< Number of chunks set
+	uint32_t ratio;			///< GC sectors per foreground sector
+	int64_t credit;			///< Sectors GC may write
+
+	size_t ntracked;		///< Chunks tracked
+	size_t npicks;			///< Victims picked
+	size_t ncopied;			///< Sectors relocated by vector copy
+	size_t nrewritten;		///< Sectors relocated by read and write
+	size_t npadded;			///< Sectors of padding written
+	size_t nthrottled;		///< Moves refused by the budget
+
+	uint64_t *bitmaps;		///< Storage of the bitmaps of 'chunks'
+	struct nvm_gc_chunk chunks[];	///< Indexed by 'pu * nchunk + chunk'
+};
+
+#endif /* __INTERNAL_NVM_GC_H */
@@ -0,0 +1,132 @@
+/*
+ * nvm_rcache - Internal header for the host sector read cache
+ *
+ * Copyright (C) Simon A. F. Lund <slund@cnexlabs.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __INTERNAL_NVM_RCACHE_H
+#define __INTERNAL_NVM_RCACHE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <liblightnvm.h>
+
+#define NVM_RCACHE_NSHARDS 16		///< Shards, each with its own lock
+#define NVM_RCACHE_NIL UINT32_MAX	///< No entry
+#define NVM_RCACHE_SMALL_PCT 10		///< S3-FIFO small queue, %
+
+enum nvm_rcache_queue {
+	NVM_RCACHE_Q_FREE = 0,
+	NVM_RCACHE_Q_SMALL,		///< S3-FIFO probation
+	NVM_RCACHE_Q_MAIN,		///< The CLOCK, or S3-FIFO main
+	NVM_RCACHE_Q_GHOST,		///< S3-FIFO keys evicted from small
+	NVM_RCACHE_NQUEUES
+};
+
+/**
+ * A cached sector, or a ghost with only its key, indices below 'nslots' of
+ * the shard hold the sector at the same index in 'data'
+ */
+struct nvm_rcache_ent {
+	uint64_t key;			///< Device-format sector address
+	uint32_t hnext;			///< Next in chain or free list
+	uint32_t prev;			///< Previous in queue
+	uint32_t next;			///< Next in queue
+	uint8_t queue;			///< See enum nvm_rcache_queue
+	uint8_t freq;			///< Hits, saturating
+};
+
+struct nvm_rcache_list {
+	uint32_t head;
+	uint32_t tail;
+	uint32_t len;
+};
+
+struct nvm_rcache_shard {
+	pthread_mutex_t lock;
+	struct nvm_rcache_ent *ents;	///< 'nslots' sectors then 'nghosts'
+	uint32_t nslots;
+	uint32_t nghosts;
+	uint32_t free_slots;		///< Free list of sector entries
+	uint32_t free_ghosts;		///< Free list of ghost entries
+	uint32_t small_max;		///< Small is evicted first past
+	uint32_t *buckets;		///< Heads of hash chains
+	uint32_t bucket_mask;
+	char *data;			///< 'nslots' sectors
+	struct nvm_rcache_list queues[NVM_RCACHE_NQUEUES];
+};
+
+struct nvm_rcache {
+	enum nvm_rcache_policy policy;
+	size_t sectr_nbytes;
+	uint8_t freq_max;		///< 1 for CLOCK, 3 for S3-FIFO
+	atomic_uint_fast64_t seq;	///< Bumped by invalidations, completions
+	atomic_uint_fast64_t nhits;
+	atomic_uint_fast64_t nmisses;
+	atomic_uint_fast64_t ninserts;
+	atomic_uint_fast64_t nevicts;
+	atomic_uint_fast64_t ninvals;
+	struct nvm_rcache_shard shards[NVM_RCACHE_NSHARDS];
+};
+
+/**
+ * Serve the read 'cmd' from the cache when all of its sectors are cached,
+ * otherwise set 'ticket' for `nvm_rcache_fill`
+ *
+ * @return 1 when served, 0 when it must go to the device
+ */
+int nvm_rcache_read(struct nvm_dev *dev, const struct nvm_cmd_desc *cmd,
+		    uint16_t flags, uint64_t *ticket);
+
+/**
+ * Insert the sectors read by 'cmd', unless an invalidation or the completion
+ * of a write, copy or erase happened since 'ticket' was taken, or one is in
+ * flight, the device might then have returned sectors it was changing
+ */
+void nvm_rcache_fill(struct nvm_dev *dev, const struct nvm_cmd_desc *cmd,
+		     uint16_t flags, uint64_t ticket);
+
+/**
+ * Drop the sectors which the write, erase or copy 'cmd' changes
+ */
+void nvm_rcache_inval(struct nvm_dev *dev, const struct nvm_cmd_desc *cmd,
+		      uint16_t flags);
+
+/**
+ * Account for a write, copy or erase handed to the device, fills of the cache
+ * are held off until it completes
+ */
+void nvm_rcache_wr_sub(struct nvm_dev *dev);
+
+/**
+ * Account for the completion of a write, copy or erase, or of one which failed
+ * submission
+ */
+void nvm_rcache_wr_cpl(struct nvm_dev *dev);
+
+/**
+ * Free the cache of the device
+ */
+void nvm_rcache_free(struct nvm_rcache *rcache);
+
+#endif /* __INTERNAL_NVM_RCACHE_H */
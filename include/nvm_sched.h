@@ -0,0 +1,167 @@
+/*
+ * nvm_sched - Internal header for the parallel-unit-aware ASYNC scheduler
+ *
+ * Copyright (C) Simon A. F. Lund <slund@cnexlabs.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __INTERNAL_NVM_SCHED_H
+#define __INTERNAL_NVM_SCHED_H
+
+#include <liblightnvm.h>
+#include <nvm_async.h>
+
+#define NVM_SCHED_PU_DEPTH 2	///< Default bound on in-flight commands per PU
+#define NVM_SCHED_PU_DEPTH_WR 1	///< Default bound on in-flight writes per PU
+#define NVM_SCHED_HIGH_BURST 8	///< High-priority dispatches before a normal
+
+enum nvm_sched_prio {
+	NVM_SCHED_PRIO_HIGH = 0,
+	NVM_SCHED_PRIO_NORMAL,
+	NVM_SCHED_NPRIO
+};
+
+/**
+ * A command accepted by the scheduler, queued on its PU or in flight
+ */
+struct nvm_sched_cmd {
+	struct nvm_cmd_desc desc;		///< Refers to 'addrs' and 'dst'
+	struct nvm_addr addrs[NVM_NADDR_MAX];
+	struct nvm_addr dst[NVM_NADDR_MAX];
+	uint16_t flags;			///< Flags of the submission
+	uint32_t pu;			///< Index of the PU of 'addrs[0]'
+	enum nvm_async_cls cls;		///< Latency class of 'desc.opc'
+	enum nvm_sched_prio prio;	///< Queue of the command on its PU
+
+	nvm_async_cb cb;		///< Callback of the submitter
+	void *cb_arg;			///< Callback argument of the submitter
+
+	struct nvm_sched *sched;
+	struct nvm_sched_cmd *next;	///< Next in queue, free-list or failed
+};
+
+struct nvm_sched_queue {
+	struct nvm_sched_cmd *head;	///< Oldest queued command
+	struct nvm_sched_cmd *tail;	///< Newest queued command
+};
+
+/**
+ * Software queues and in-flight accounting of a parallel unit
+ */
+struct nvm_sched_pu {
+	struct nvm_sched_queue queue[NVM_SCHED_NPRIO];
+	uint32_t nhigh;			///< High-priority dispatches in a row
+	uint32_t ninflight;		///< Commands dispatched to the backend
+	uint32_t nout[NVM_ASYNC_NCLS];	///< In-flight commands per class
+};
+
+struct nvm_sched {
+	uint32_t npus;			///< Number of PUs in 'pus'
+	uint32_t pu_depth;		///< Bound on in-flight commands per PU
+	uint32_t pu_depth_wr;		///< Bound on in-flight writes per PU
+	uint32_t nqueued;		///< Commands queued on all PUs
+	uint32_t cursor;		///< PU where the next dispatch round starts
+
+	struct nvm_sched_cmd *cmds;	///< One per slot of the ASYNC context
+	struct nvm_sched_cmd *free;	///< Unused entries of 'cmds'
+	struct nvm_sched_cmd *failed;	///< Dispatch failed, to be completed
+	uint32_t nfailed;		///< Number of entries in 'failed'
+
+	struct nvm_sched_pu pus[];
+};
+
+/**
+ * Allocate a scheduler for an ASYNC context of the given 'depth' on 'dev'
+ *
+ * @return On success, a pointer to the scheduler. On error, NULL is returned
+ * and `errno` set to indicate the error
+ */
+struct nvm_sched *nvm_sched_init(struct nvm_dev *dev, uint32_t depth);
+
+void nvm_sched_term(struct nvm_sched *sched);
+
+/**
+ * Whether the command submitted with the given 'flags' and 'ret' goes through
+ * the scheduler of its ASYNC context. Addresses on device format are decoded
+ * to find their PU
+ */
+static inline int nvm_sched_active(uint16_t flags, const struct nvm_ret *ret)
+{
+	return (flags & NVM_CMD_ASYNC) && ret && ret->async.ctx &&
+	       ret->async.ctx->sched;
+}
+
+/**
+ * Accept 'cmd' on the ASYNC context of 'cmd->ret', it is dispatched right
+ * away when its PU admits it, otherwise it is queued on its PU by priority
+ *
+ * @return On success, 0 is returned. On error, -1 is returned and `errno` set
+ * to indicate the error, EAGAIN when the context is full
+ */
+int nvm_sched_submit(struct nvm_dev *dev, const struct nvm_cmd_desc *cmd,
+		     uint16_t flags);
+
+/**
+ * Dispatch queued commands of 'ctx', high priority and idle PUs first
+ *
+ * @return The number of commands dispatched
+ */
+int nvm_sched_kick(struct nvm_dev *dev, struct nvm_async_ctx *ctx);
+
+/**
+ * Complete commands which failed dispatch, storing them in 'rets' when given,
+ * no more than 'max' of them, otherwise invoking their callbacks
+ *
+ * @return The number of commands completed
+ */
+int nvm_sched_drain(struct nvm_async_ctx *ctx, struct nvm_ret *rets[],
+		    uint32_t max);
+
+/**
+ * Complete 'ret' with status NVM_RET_STATUS_ABORTED when it is queued on
+ * 'ctx', or failed dispatch, invoking its callback
+ *
+ * @return On success, 0 is returned. On error, -1 is returned and `errno` set
+ * to ENOENT, 'ret' is then not held by the scheduler, e.g. it is in flight
+ */
+int nvm_sched_cancel(struct nvm_async_ctx *ctx, struct nvm_ret *ret);
+
+/**
+ * Account for the completion of 'nrets' commands reaped from 'ctx'
+ */
+void nvm_sched_reaped(struct nvm_async_ctx *ctx, struct nvm_ret *rets[],
+		      int nrets);
+
+/**
+ * Number of commands accepted but not completed on 'ctx'
+ */
+static inline uint32_t nvm_sched_npending(const struct nvm_async_ctx *ctx)
+{
+	uint32_t npending = ctx->outstanding - ctx->nabandoned + ctx->nfailed;
+
+	if (ctx->sched)
+		npending += ctx->sched->nqueued + ctx->sched->nfailed;
+
+	return npending;
+}
+
+#endif /* __INTERNAL_NVM_SCHED_H */
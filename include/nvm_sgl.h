@@ -29,22 +29,72 @@
 #ifndef __INTERNAL_NVM_SGL_H
 #define __INTERNAL_NVM_SGL_H
 
+#include <stdint.h>
+#include <stdatomic.h>
 #include <nvm_dev.h>
 
-#include <bsd/sys/queue.h>
+#define NVM_SGL_POOL_NSGLS 64	///< Number of SGLs pre-allocated by a pool
+#define NVM_SGL_ARENA_NDESCR 64	///< Descriptors per SGL in the pool arena
+
+/*
+ * Descriptors are laid out in segments of one 4K page, the last slot of each
+ * segment is reserved for the Segment or Last Segment descriptor chaining it
+ * to the next
+ */
+#define NVM_SGL_SEG_NDESCR 256	///< Descriptor slots per segment
+
+#define NVM_SGL_ARENA_SGL 0x1	///< The SGL itself lives in a pool arena
+#define NVM_SGL_ARENA_DESCR 0x2	///< The descriptors live in a pool arena
 
 struct nvm_sgl {
 	struct nvm_nvme_sgl_descriptor *indirect, *descriptors;
-	int ndescr, nalloc;
+	int ndescr, nalloc;	///< Data descriptors and allocated slots
 	size_t len;
+	int flags;
+};
+
+/*
+ * Free SGLs are kept in magazines, each thread owns a magazine per pool and
+ * exchanges it with the depot when it runs empty or full. The depot is a
+ * pair of lock-free stacks of magazines, referenced by index and tagged
+ * against ABA. Magazines are carved in chunks as needed and live as long as
+ * the pool.
+ */
+#define NVM_SGL_MAG_NSGLS 16		///< SGLs per magazine
+#define NVM_SGL_POOL_CHUNK_NMAGS 64	///< Magazines carved per chunk
+#define NVM_SGL_POOL_NCHUNKS 1024	///< Maximum number of chunks
+#define NVM_SGL_POOL_NTHREADS 256	///< Threads with their own magazines
 
-	SLIST_ENTRY(nvm_sgl) free_list;
+struct nvm_sgl_mag {
+	struct nvm_sgl *sgls[NVM_SGL_MAG_NSGLS];
+	int nsgls;
+	uint32_t idx;			///< Index of the magazine in its pool
+	_Atomic uint32_t next;		///< Depot link, index + 1, 0 terminates
 };
 
 struct nvm_sgl_pool {
 	struct nvm_dev *dev;
 
-	SLIST_HEAD(, nvm_sgl) free_list;
+	struct nvm_sgl *sgls;				///< SGL arena
+	struct nvm_nvme_sgl_descriptor *descr;		///< Descriptor arena
+
+	_Atomic(struct nvm_sgl_mag *) chunks[NVM_SGL_POOL_NCHUNKS];
+	atomic_uint nmags;				///< Magazines carved
+
+	_Atomic uint64_t full;		///< Depot of non-empty magazines
+	_Atomic uint64_t empty;		///< Depot of empty magazines
+
+	struct nvm_sgl_mag *tmags[NVM_SGL_POOL_NTHREADS];	///< Per-thread
 };
 
+/**
+ * Chain the segments of 'sgl' and setup 'head' as the descriptor pointing to
+ * the first segment
+ *
+ * @return On success, 0 is returned. On error, -1 is returned and `errno` set
+ * to indicate the error.
+ */
+int nvm_sgl_chain(struct nvm_dev *dev, struct nvm_sgl *sgl,
+		  struct nvm_nvme_sgl_descriptor *head);
+
 #endif /* __INTERNAL_NVM_SGL_H */
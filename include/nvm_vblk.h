@@ -31,9 +31,71 @@
 
 #include <liblightnvm.h>
 
+/**
+ * Host copies of the last written sectors of the chunks of a vblk, those the
+ * device cannot yet read back, see nvm_dev_get_mw_cunits
+ */
+struct nvm_vblk_wcache {
+	size_t nsectr;		///< Sectors per ring, MW_CUNITS rounded to WS_OPT
+	size_t wp[128];		///< Sectors written per chunk
+	char *ring[128];	///< Last 'nsectr' sectors per chunk, NULL: none
+};
+
+/**
+ * Staging of buffered writes, see nvm_vblk_set_buffered. Writes are copied
+ * into the open stripe, a write-unit for each chunk, which is written
+ * asynchronously when full while the next one fills. At most one stripe is in
+ * flight, thus at most one write per chunk.
+ */
+struct nvm_vblk_wbuf {
+	struct nvm_async_ctx *ctx;	///< For stripes, NULL: write them sync
+	struct nvm_ret rets[128];	///< One per write-unit of a stripe
+	size_t unit_nbytes;		///< WS_OPT sectors in bytes
+	size_t stripe_nbytes;		///< Bytes per stripe
+	char *ring;			///< Two stripes, DMA buffer
+	char *meta;			///< Meta of a write-unit, or NULL
+	int open;			///< Index in 'ring' of the open stripe
+	size_t ofz;			///< vblk offset of open stripe
+	size_t nstaged;			///< Bytes staged in open stripe
+	int inflight;			///< Other stripe is in flight
+	size_t inflight_ofz;		///< vblk offset of it
+	size_t inflight_nbytes;		///< Bytes of it
+	size_t nerr;			///< Failed writes of it
+};
+
+/**
+ * A stripe read ahead into the ring of nvm_vblk_rahead
+ */
+struct nvm_vblk_rahead_buf {
+	size_t ofz;			///< vblk offset of the stripe
+	size_t nbytes;			///< Bytes of it, short at the end
+	uint32_t npending;		///< Reads not yet completed
+	uint32_t nerr;			///< Failed reads
+};
+
+/**
+ * Read-ahead of sequential reads, see nvm_vblk_set_readahead. Buffers from
+ * 'head' up to 'tail' are in flight or read, 'head' is the one the stream
+ * position 'pos' is in.
+ */
+struct nvm_vblk_rahead {
+	struct nvm_async_ctx *ctx;	///< For reads, NULL: read them sync
+	struct nvm_ret *rets;		///< 'nblks' per buffer
+	size_t unit_nbytes;		///< WS_OPT sectors in bytes
+	size_t stripe_nbytes;		///< Bytes per stripe
+	uint32_t nbufs;			///< Stripes in the window
+	char *ring;			///< 'nbufs' stripes, DMA buffer
+	struct nvm_vblk_rahead_buf *bufs;
+	uint64_t head;			///< Buffer being consumed
+	uint64_t tail;			///< Next buffer to read into
+	size_t next_ofz;		///< vblk offset to read ahead next
+	size_t pos;			///< Stream position, SIZE_MAX: none
+};
+
 struct nvm_vblk {
 	struct nvm_dev *dev;
 	struct nvm_addr blks[128];
+	uint64_t blks_dev[128];		///< Chunk addresses in device-format
 	int32_t nblks;
 	size_t nbytes;
 	size_t pos_write;
@@ -43,6 +105,9 @@ struct nvm_vblk {
 	struct nvm_async_ctx *async_ctx;
 	struct nvm_ret **rets;
 	uint32_t retsp;
+	struct nvm_vblk_wcache *wcache;	///< See nvm_vblk_set_wcache, or NULL
+	struct nvm_vblk_wbuf *wbuf;	///< See nvm_vblk_set_buffered
+	struct nvm_vblk_rahead *rahead;	///< See nvm_vblk_set_readahead
 };
 
 struct nvm_vblk_async_cb_state {
@@ -83,7 +83,7 @@ void nvm_addr_prn(const struct nvm_addr *addr, unsigned int naddrs,
 	}
 }
 
-int nvm_addr_check(struct nvm_addr addr, const struct nvm_dev *dev)
+static int addr_check_gen(struct nvm_addr addr, const struct nvm_dev *dev)
 {
 	const struct nvm_geo *geo = nvm_dev_get_geo(dev);
 	int exceeded = 0;
@@ -121,6 +121,30 @@ int nvm_addr_check(struct nvm_addr addr, const struct nvm_dev *dev)
 	return -1;
 }
 
+/**
+ * With power-of-two geometry every in-bounds address has all of the bits
+ * above each field-width cleared, the general check only runs to report
+ * which bounds are exceeded
+ */
+static int addr_check_pow2(struct nvm_addr addr, const struct nvm_dev *dev)
+{
+	if (!(addr.val & dev->addr_fns.oob_mask))
+		return 0;
+
+	return addr_check_gen(addr, dev);
+}
+
+int nvm_addr_check(struct nvm_addr addr, const struct nvm_dev *dev)
+{
+	if (!dev->addr_fns.check) {
+		NVM_DEBUG("FAILED: address math is not setup");
+		errno = EINVAL;
+		return -1;
+	}
+
+	return dev->addr_fns.check(addr, dev);
+}
+
 inline uint64_t nvm_addr_gen2dev(struct nvm_dev *dev, struct nvm_addr addr)
 {
 	if (dev->verid == NVM_SPEC_VERID_20) {
@@ -172,6 +196,189 @@ inline struct nvm_addr nvm_addr_dev2gen(struct nvm_dev *dev, uint64_t addr)
 	}
 }
 
+#define ADDR_FMT_NFIELDS 6
+
+/**
+ * Address fields as (offset, width-mask) pairs in generic- and device-format,
+ * derived once per bulk conversion such that the loops are branch-free
+ */
+struct addr_fmt {
+	int nfields;
+	int ordered;				///< Same field order in both
+	uint64_t gen_off[ADDR_FMT_NFIELDS];
+	uint64_t gen_wid[ADDR_FMT_NFIELDS];
+	uint64_t dev_off[ADDR_FMT_NFIELDS];
+	uint64_t dev_msk[ADDR_FMT_NFIELDS];
+};
+
+static void addr_fmt_field(struct addr_fmt *fmt, uint64_t gen_off,
+			   uint64_t gen_nbits, uint64_t dev_off,
+			   uint64_t dev_msk)
+{
+	const int i = fmt->nfields++;
+
+	fmt->gen_off[i] = gen_off;
+	fmt->gen_wid[i] = (1ULL << gen_nbits) - 1;
+	fmt->dev_off[i] = dev_off;
+	fmt->dev_msk[i] = dev_msk;
+}
+
+static void addr_fmt_setup(struct nvm_dev *dev, struct addr_fmt *fmt)
+{
+	fmt->nfields = 0;
+
+	if (dev->verid == NVM_SPEC_VERID_20) {
+		addr_fmt_field(fmt, 0, 32, dev->lbaz.sectr, dev->lbam.sectr);
+		addr_fmt_field(fmt, 32, 16, dev->lbaz.chunk, dev->lbam.chunk);
+		addr_fmt_field(fmt, 48, 8, dev->lbaz.punit, dev->lbam.punit);
+		addr_fmt_field(fmt, 56, 8, dev->lbaz.pugrp, dev->lbam.pugrp);
+	} else {
+		addr_fmt_field(fmt, 0, 8, dev->ppaf.n.sec_off, dev->mask.n.sec);
+		addr_fmt_field(fmt, 8, 16, dev->ppaf.n.pg_off, dev->mask.n.pg);
+		addr_fmt_field(fmt, 24, 8, dev->ppaf.n.pl_off, dev->mask.n.pl);
+		addr_fmt_field(fmt, 32, 16, dev->ppaf.n.blk_off,
+			       dev->mask.n.blk);
+		addr_fmt_field(fmt, 48, 8, dev->ppaf.n.lun_off,
+			       dev->mask.n.lun);
+		addr_fmt_field(fmt, 56, 8, dev->ppaf.n.ch_off, dev->mask.n.ch);
+	}
+
+	fmt->ordered = 1;
+	for (int i = 0; i < fmt->nfields; ++i) {
+		if (i && (fmt->dev_off[i] <= fmt->dev_off[i - 1]))
+			fmt->ordered = 0;
+		if (fmt->dev_msk[i] >> fmt->dev_off[i] > fmt->gen_wid[i])
+			fmt->ordered = 0;
+	}
+}
+
+static inline uint64_t addr_fmt_gen2dev(const struct addr_fmt *fmt,
+					uint64_t gen)
+{
+	uint64_t d_addr = 0;
+
+	for (int i = 0; i < ADDR_FMT_NFIELDS; ++i) {
+		if (i < fmt->nfields) {
+			d_addr |= ((gen >> fmt->gen_off[i]) & fmt->gen_wid[i])
+				  << fmt->dev_off[i];
+		}
+	}
+
+	return d_addr;
+}
+
+static inline uint64_t addr_fmt_dev2gen(const struct addr_fmt *fmt,
+					uint64_t d_addr)
+{
+	uint64_t gen = 0;
+
+	for (int i = 0; i < ADDR_FMT_NFIELDS; ++i) {
+		if (i < fmt->nfields) {
+			gen |= (((d_addr & fmt->dev_msk[i]) >> fmt->dev_off[i])
+				& fmt->gen_wid[i]) << fmt->gen_off[i];
+		}
+	}
+
+	return gen;
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define NVM_ADDR_CONV_X86
+
+/**
+ * Converts four addresses per iteration using per-field shift/mask/or
+ */
+__attribute__((target("avx2")))
+static int addr_gen2dev_avx2(const struct addr_fmt *fmt,
+			     const struct nvm_addr addrs[],
+			     uint64_t dev_addrs[], int naddrs)
+{
+	__m128i gen_off[ADDR_FMT_NFIELDS], dev_off[ADDR_FMT_NFIELDS];
+	__m256i gen_wid[ADDR_FMT_NFIELDS];
+	int i = 0;
+
+	for (int f = 0; f < fmt->nfields; ++f) {
+		gen_off[f] = _mm_cvtsi64_si128((long long)fmt->gen_off[f]);
+		dev_off[f] = _mm_cvtsi64_si128((long long)fmt->dev_off[f]);
+		gen_wid[f] = _mm256_set1_epi64x((long long)fmt->gen_wid[f]);
+	}
+
+	for (; i + 4 <= naddrs; i += 4) {
+		const __m256i gen = _mm256_loadu_si256((const void *)&addrs[i]);
+		__m256i d_addr = _mm256_setzero_si256();
+
+		for (int f = 0; f < fmt->nfields; ++f) {
+			__m256i field = _mm256_srl_epi64(gen, gen_off[f]);
+
+			field = _mm256_and_si256(field, gen_wid[f]);
+			d_addr = _mm256_or_si256(d_addr,
+					_mm256_sll_epi64(field, dev_off[f]));
+		}
+
+		_mm256_storeu_si256((void *)&dev_addrs[i], d_addr);
+	}
+
+	return i;
+}
+
+/**
+ * Gathers the device fields and deposits them in generic-format, valid when
+ * the fields are ordered the same in both formats
+ */
+__attribute__((target("bmi2")))
+static int addr_dev2gen_bmi2(const struct addr_fmt *fmt,
+			     const uint64_t dev_addrs[],
+			     struct nvm_addr addrs[], int naddrs)
+{
+	uint64_t dev_msk = 0, gen_msk = 0;
+
+	for (int f = 0; f < fmt->nfields; ++f) {
+		dev_msk |= fmt->dev_msk[f];
+		gen_msk |= (fmt->dev_msk[f] >> fmt->dev_off[f])
+			   << fmt->gen_off[f];
+	}
+
+	for (int i = 0; i < naddrs; ++i)
+		addrs[i].val = _pdep_u64(_pext_u64(dev_addrs[i], dev_msk),
+					 gen_msk);
+
+	return naddrs;
+}
+#endif
+
+void nvm_addr_gen2dev_n(struct nvm_dev *dev, const struct nvm_addr addrs[],
+			uint64_t dev_addrs[], int naddrs)
+{
+	struct addr_fmt fmt;
+	int i = 0;
+
+	addr_fmt_setup(dev, &fmt);
+
+#if defined(NVM_ADDR_CONV_X86)
+	if (__builtin_cpu_supports("avx2"))
+		i = addr_gen2dev_avx2(&fmt, addrs, dev_addrs, naddrs);
+#endif
+	for (; i < naddrs; ++i)
+		dev_addrs[i] = addr_fmt_gen2dev(&fmt, addrs[i].val);
+}
+
+void nvm_addr_dev2gen_n(struct nvm_dev *dev, const uint64_t dev_addrs[],
+			struct nvm_addr addrs[], int naddrs)
+{
+	struct addr_fmt fmt;
+	int i = 0;
+
+	addr_fmt_setup(dev, &fmt);
+
+#if defined(NVM_ADDR_CONV_X86)
+	if (fmt.ordered && __builtin_cpu_supports("bmi2"))
+		i = addr_dev2gen_bmi2(&fmt, dev_addrs, addrs, naddrs);
+#endif
+	for (; i < naddrs; ++i)
+		addrs[i].val = addr_fmt_dev2gen(&fmt, dev_addrs[i]);
+}
+
 uint64_t nvm_addr_gen2off(struct nvm_dev *dev, struct nvm_addr addr)
 {
 	return nvm_addr_gen2dev(dev, addr) << dev->ssw;
@@ -192,7 +399,7 @@ uint64_t nvm_addr_off2dev(struct nvm_dev *dev, uint64_t off)
 	return off >> dev->ssw;
 }
 
-uint64_t nvm_addr_gen2lpo(struct nvm_dev *dev, struct nvm_addr addr)
+static uint64_t addr_gen2lpo_gen(struct nvm_dev *dev, struct nvm_addr addr)
 {
 	const struct nvm_geo *geo = nvm_dev_get_geo(dev);
 
@@ -205,12 +412,44 @@ uint64_t nvm_addr_gen2lpo(struct nvm_dev *dev, struct nvm_addr addr)
 	return idx * sizeof(struct nvm_spec_rprt_descr);
 }
 
-struct nvm_addr nvm_addr_lpo2gen(struct nvm_dev *dev, uint64_t lpo)
+static uint64_t addr_gen2lpo_pow2(struct nvm_dev *dev, struct nvm_addr addr)
+{
+	const struct nvm_addr_fns *fns = &dev->addr_fns;
+
+	uint64_t idx = 0;
+
+	idx |= (uint64_t)addr.l.pugrp << (fns->npunit_sh + fns->nchunk_sh);
+	idx |= (uint64_t)addr.l.punit << fns->nchunk_sh;
+	idx |= addr.l.chunk;
+
+	return idx * sizeof(struct nvm_spec_rprt_descr);
+}
+
+uint64_t nvm_addr_gen2lpo(struct nvm_dev *dev, struct nvm_addr addr)
+{
+	if (!dev->addr_fns.gen2lpo) {
+		NVM_DEBUG("FAILED: address math is not setup");
+		errno = EINVAL;
+		return 0;
+	}
+
+	return dev->addr_fns.gen2lpo(dev, addr);
+}
+
+static struct nvm_addr addr_lpo2gen_gen(struct nvm_dev *dev, uint64_t lpo)
 {
 	const struct nvm_geo *geo = nvm_dev_get_geo(dev);
 
 	const size_t i = lpo / sizeof(struct nvm_spec_rprt_descr);
 
+	if (!(geo->l.nchunk && geo->l.npunit && geo->l.npugrp)) {
+		const struct nvm_addr none = { .val = 0 };
+
+		NVM_DEBUG("FAILED: geometry is not populated");
+		errno = EINVAL;
+		return none;
+	}
+
 	const struct nvm_addr addr = {
 	.l.sectr = 0,
 	.l.chunk = i % geo->l.nchunk,
@@ -221,6 +460,109 @@ struct nvm_addr nvm_addr_lpo2gen(struct nvm_dev *dev, uint64_t lpo)
 	return addr;
 }
 
+static struct nvm_addr addr_lpo2gen_pow2(struct nvm_dev *dev, uint64_t lpo)
+{
+	const struct nvm_geo *geo = nvm_dev_get_geo(dev);
+	const struct nvm_addr_fns *fns = &dev->addr_fns;
+
+	const size_t i = lpo / sizeof(struct nvm_spec_rprt_descr);
+
+	const struct nvm_addr addr = {
+	.l.sectr = 0,
+	.l.chunk = i & (geo->l.nchunk - 1),
+	.l.punit = (i >> fns->nchunk_sh) & (geo->l.npunit - 1),
+	.l.pugrp = (i >> (fns->nchunk_sh + fns->npunit_sh)) &
+		   (geo->l.npugrp - 1)
+	};
+
+	return addr;
+}
+
+struct nvm_addr nvm_addr_lpo2gen(struct nvm_dev *dev, uint64_t lpo)
+{
+	if (!dev->addr_fns.lpo2gen) {
+		const struct nvm_addr none = { .val = 0 };
+
+		NVM_DEBUG("FAILED: address math is not setup");
+		errno = EINVAL;
+		return none;
+	}
+
+	return dev->addr_fns.lpo2gen(dev, lpo);
+}
+
+static inline int addr_pow2(uint64_t x)
+{
+	return x && !(x & (x - 1));
+}
+
+static inline uint8_t addr_log2(uint64_t x)
+{
+	return x ? 63 - __builtin_clzll(x) : 0;
+}
+
+void nvm_addr_fns_setup(struct nvm_dev *dev)
+{
+	const struct nvm_geo *geo = nvm_dev_get_geo(dev);
+	struct nvm_addr_fns *fns = &dev->addr_fns;
+	const int ws_opt = nvm_dev_get_ws_opt(dev);
+	struct nvm_addr oob = { .val = 0 };
+	int pow2 = 0;
+
+	fns->check = addr_check_gen;
+	fns->gen2lpo = addr_gen2lpo_gen;
+	fns->lpo2gen = addr_lpo2gen_gen;
+	fns->oob_mask = 0;
+	fns->ws_opt_sh = (ws_opt > 0 && addr_pow2(ws_opt)) ?
+			 addr_log2(ws_opt) : -1;
+
+	// Bitfield assignment truncates ~(n - 1) to the bits at or above n
+	switch (dev->verid) {
+	case NVM_SPEC_VERID_12:
+		pow2 = addr_pow2(geo->g.nchannels) &&
+		       addr_pow2(geo->g.nluns) &&
+		       addr_pow2(geo->g.nplanes) &&
+		       addr_pow2(geo->g.nblocks) &&
+		       addr_pow2(geo->g.npages) &&
+		       addr_pow2(geo->g.nsectors);
+		if (!pow2)
+			break;
+
+		oob.g.ch = ~(geo->g.nchannels - 1);
+		oob.g.lun = ~(geo->g.nluns - 1);
+		oob.g.pl = ~(geo->g.nplanes - 1);
+		oob.g.blk = ~(geo->g.nblocks - 1);
+		oob.g.pg = ~(geo->g.npages - 1);
+		oob.g.sec = ~(geo->g.nsectors - 1);
+
+		fns->check = addr_check_pow2;
+		break;
+
+	case NVM_SPEC_VERID_20:
+		pow2 = addr_pow2(geo->l.npugrp) &&
+		       addr_pow2(geo->l.npunit) &&
+		       addr_pow2(geo->l.nchunk) &&
+		       addr_pow2(geo->l.nsectr);
+		if (!pow2)
+			break;
+
+		oob.l.pugrp = ~(geo->l.npugrp - 1);
+		oob.l.punit = ~(geo->l.npunit - 1);
+		oob.l.chunk = ~(geo->l.nchunk - 1);
+		oob.l.sectr = ~(geo->l.nsectr - 1);
+
+		fns->nchunk_sh = addr_log2(geo->l.nchunk);
+		fns->npunit_sh = addr_log2(geo->l.npunit);
+
+		fns->check = addr_check_pow2;
+		fns->gen2lpo = addr_gen2lpo_pow2;
+		fns->lpo2gen = addr_lpo2gen_pow2;
+		break;
+	}
+
+	fns->oob_mask = oob.val;
+}
+
 void nvm_addr_fill_crange(struct nvm_addr *addrs, struct nvm_addr addr,
 			  uint32_t naddrs)
 {
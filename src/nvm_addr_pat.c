@@ -0,0 +1,304 @@
+/*
+ * addr_pat - Address-pattern iterators for vector commands
+ *
+ * Copyright (C) Simon A. F. Lund <slund@cnexlabs.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <liblightnvm.h>
+#include <nvm_dev.h>
+
+/**
+ * Element 'idx' of the random sequence for 'seed', using the splitmix64 mixer
+ */
+static inline uint64_t pat_rand(uint64_t seed, uint64_t idx)
+{
+	uint64_t z = seed + (idx + 1) * 0x9E3779B97F4A7C15ULL;
+
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+
+	return z ^ (z >> 31);
+}
+
+static int pat_setup(struct nvm_addr_pat *pat, const struct nvm_dev *dev,
+		     enum nvm_addr_pat_type type, const struct nvm_addr chunks[],
+		     size_t nchunks, int verid)
+{
+	const struct nvm_geo *geo = nvm_dev_get_geo(dev);
+
+	if (!(pat && geo && chunks && nchunks)) {
+		NVM_DEBUG("FAILED: invalid argument");
+		errno = EINVAL;
+		return -1;
+	}
+	if (nvm_dev_get_verid(dev) != verid) {
+		NVM_DEBUG("FAILED: unsupported verid: %d",
+			  nvm_dev_get_verid(dev));
+		errno = ENOSYS;
+		return -1;
+	}
+
+	*pat = (struct nvm_addr_pat){ 0 };
+
+	pat->type = type;
+	pat->chunks = chunks;
+	pat->nchunks = nchunks;
+	pat->chunk_nsectr = geo->l.nsectr;
+	pat->unit_nsectr = 1;
+	pat->stride = 1;
+	pat->naddrs = nchunks * geo->l.nsectr;
+
+	return 0;
+}
+
+int nvm_addr_pat_horz(struct nvm_addr_pat *pat, const struct nvm_dev *dev,
+		      const struct nvm_addr chunks[], size_t nchunks)
+{
+	if (pat_setup(pat, dev, NVM_ADDR_PAT_HORZ, chunks, nchunks,
+		      NVM_SPEC_VERID_20))
+		return -1;		// Propagate errno
+
+	pat->unit_nsectr = nvm_dev_get_ws_opt(dev);
+	if (!pat->unit_nsectr || (pat->chunk_nsectr % pat->unit_nsectr)) {
+		NVM_DEBUG("FAILED: unit_nsectr: %zu", pat->unit_nsectr);
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+int nvm_addr_pat_vert(struct nvm_addr_pat *pat, const struct nvm_dev *dev,
+		      const struct nvm_addr chunks[], size_t nchunks)
+{
+	return pat_setup(pat, dev, NVM_ADDR_PAT_VERT, chunks, nchunks,
+			 NVM_SPEC_VERID_20);
+}
+
+int nvm_addr_pat_plane(struct nvm_addr_pat *pat, const struct nvm_dev *dev,
+		       const struct nvm_addr blks[], size_t nblks)
+{
+	const struct nvm_geo *geo = nvm_dev_get_geo(dev);
+
+	if (pat_setup(pat, dev, NVM_ADDR_PAT_PLANE, blks, nblks,
+		      NVM_SPEC_VERID_12))
+		return -1;		// Propagate errno
+
+	pat->nplanes = geo->g.nplanes;
+	pat->nsectors = geo->g.nsectors;
+	pat->unit_nsectr = geo->g.nplanes * geo->g.nsectors;
+	pat->chunk_nsectr = pat->unit_nsectr * geo->g.npages;
+	pat->naddrs = nblks * pat->chunk_nsectr;
+
+	return 0;
+}
+
+int nvm_addr_pat_stride(struct nvm_addr_pat *pat, const struct nvm_dev *dev,
+			const struct nvm_addr chunks[], size_t nchunks,
+			size_t stride)
+{
+	if (!stride) {
+		NVM_DEBUG("FAILED: !stride");
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (pat_setup(pat, dev, NVM_ADDR_PAT_STRIDE, chunks, nchunks,
+		      NVM_SPEC_VERID_20))
+		return -1;		// Propagate errno
+
+	pat->stride = stride;
+	pat->naddrs = (pat->naddrs + stride - 1) / stride;
+
+	return 0;
+}
+
+int nvm_addr_pat_rand(struct nvm_addr_pat *pat, const struct nvm_dev *dev,
+		      const struct nvm_addr chunks[], size_t nchunks,
+		      size_t naddrs, uint64_t seed)
+{
+	if (pat_setup(pat, dev, NVM_ADDR_PAT_RAND, chunks, nchunks,
+		      NVM_SPEC_VERID_20))
+		return -1;		// Propagate errno
+
+	pat->naddrs = naddrs;
+	pat->seed = seed;
+
+	return 0;
+}
+
+void nvm_addr_pat_rewind(struct nvm_addr_pat *pat)
+{
+	pat->pos = 0;
+}
+
+/**
+ * Emits 'naddrs' addresses of a pattern made of runs of consecutive sectors,
+ * the position is resolved once per run
+ */
+static void pat_next_runs(const struct nvm_addr_pat *pat, size_t pos,
+			  struct nvm_addr addrs[], size_t naddrs)
+{
+	const size_t unit = pat->unit_nsectr;
+	size_t idx = 0;
+
+	while (idx < naddrs) {
+		struct nvm_addr base;
+		size_t sectr, run;
+
+		switch (pat->type) {
+		case NVM_ADDR_PAT_HORZ: {
+			const size_t wunit = pos / unit;
+
+			base = pat->chunks[wunit % pat->nchunks];
+			sectr = (wunit / pat->nchunks) * unit + pos % unit;
+			run = unit - pos % unit;
+			break;
+		}
+
+		default:	// NVM_ADDR_PAT_VERT
+			base = pat->chunks[pos / pat->chunk_nsectr];
+			sectr = pos % pat->chunk_nsectr;
+			run = pat->chunk_nsectr - sectr;
+			break;
+		}
+
+		if (run > naddrs - idx)
+			run = naddrs - idx;
+
+		for (size_t i = 0; i < run; ++i) {
+			addrs[idx + i] = base;
+			addrs[idx + i].l.sectr = sectr + i;
+		}
+
+		idx += run;
+		pos += run;
+	}
+}
+
+/**
+ * Emits 'naddrs' addresses of OCSSD 1.2 plane-pages, interleaving planes
+ * within a page and pages over the blocks
+ */
+static void pat_next_plane(const struct nvm_addr_pat *pat, size_t pos,
+			   struct nvm_addr addrs[], size_t naddrs)
+{
+	const size_t spage_naddrs = pat->unit_nsectr;
+
+	size_t spg = pos / spage_naddrs;
+	size_t pl = (pos % spage_naddrs) / pat->nsectors;
+	size_t sec = pos % pat->nsectors;
+
+	for (size_t idx = 0; idx < naddrs; ++idx) {
+		addrs[idx] = pat->chunks[spg % pat->nchunks];
+		addrs[idx].g.pg = spg / pat->nchunks;
+		addrs[idx].g.pl = pl;
+		addrs[idx].g.sec = sec;
+
+		if (++sec < pat->nsectors)
+			continue;
+		sec = 0;
+		if (++pl < pat->nplanes)
+			continue;
+		pl = 0;
+		++spg;
+	}
+}
+
+static void pat_next_stride(const struct nvm_addr_pat *pat, size_t pos,
+			    struct nvm_addr addrs[], size_t naddrs)
+{
+	const size_t lin = pos * pat->stride;
+
+	size_t chunk = lin / pat->chunk_nsectr;
+	size_t sectr = lin % pat->chunk_nsectr;
+
+	for (size_t idx = 0; idx < naddrs; ++idx) {
+		addrs[idx] = pat->chunks[chunk];
+		addrs[idx].l.sectr = sectr;
+
+		sectr += pat->stride;
+		while (sectr >= pat->chunk_nsectr) {
+			sectr -= pat->chunk_nsectr;
+			++chunk;
+		}
+	}
+}
+
+static void pat_next_rand(const struct nvm_addr_pat *pat, size_t pos,
+			  struct nvm_addr addrs[], size_t naddrs)
+{
+	const uint64_t tsectr = pat->nchunks * pat->chunk_nsectr;
+
+	for (size_t idx = 0; idx < naddrs; ++idx) {
+		const uint64_t sectr = pat_rand(pat->seed, pos + idx) % tsectr;
+
+		addrs[idx] = pat->chunks[sectr / pat->chunk_nsectr];
+		addrs[idx].l.sectr = sectr % pat->chunk_nsectr;
+	}
+}
+
+int nvm_addr_pat_next(struct nvm_addr_pat *pat, struct nvm_addr addrs[],
+		      int naddrs)
+{
+	size_t nemit;
+
+	if (!(pat && addrs) || naddrs < 0) {
+		NVM_DEBUG("FAILED: invalid argument");
+		errno = EINVAL;
+		return -1;
+	}
+
+	nemit = pat->naddrs - pat->pos;
+	if (nemit > (size_t)naddrs)
+		nemit = naddrs;
+
+	switch (pat->type) {
+	case NVM_ADDR_PAT_HORZ:
+	case NVM_ADDR_PAT_VERT:
+		pat_next_runs(pat, pat->pos, addrs, nemit);
+		break;
+
+	case NVM_ADDR_PAT_PLANE:
+		pat_next_plane(pat, pat->pos, addrs, nemit);
+		break;
+
+	case NVM_ADDR_PAT_STRIDE:
+		pat_next_stride(pat, pat->pos, addrs, nemit);
+		break;
+
+	case NVM_ADDR_PAT_RAND:
+		pat_next_rand(pat, pat->pos, addrs, nemit);
+		break;
+
+	default:
+		NVM_DEBUG("FAILED: invalid type: %d", pat->type);
+		errno = EINVAL;
+		return -1;
+	}
+
+	pat->pos += nemit;
+
+	return nemit;
+}
@@ -0,0 +1,352 @@
+/*
+ * nvm_append - Group-commit append streams on top of virtual blocks
+ *
+ * Copyright (C) Simon A. F. Lund <slund@cnexlabs.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <liblightnvm.h>
+#include <liblightnvm_spec.h>
+#include <nvm_dev.h>
+#include <nvm_vblk.h>
+#include <nvm_append.h>
+
+static inline int append_expired(const struct timespec *deadline)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	return now.tv_sec > deadline->tv_sec ||
+	       (now.tv_sec == deadline->tv_sec &&
+		now.tv_nsec >= deadline->tv_nsec);
+}
+
+/**
+ * Seal the open unit, zero-padding what is left of it, and open the next
+ */
+static void append_seal(struct nvm_append *app)
+{
+	char *unit = app->ring + (app->head % NVM_APPEND_NUNITS) *
+				 app->unit_nbytes;
+
+	if (app->head_nbytes < app->unit_nbytes) {
+		memset(unit + app->head_nbytes, 0,
+		       app->unit_nbytes - app->head_nbytes);
+		app->npadded += 1;
+	}
+
+	app->head += 1;
+	app->head_nbytes = 0;
+
+	pthread_cond_broadcast(&app->cond);
+}
+
+/**
+ * The flusher, writes sealed units in order, as many as are consecutive in
+ * the ring with a single write, and seals the open unit on its deadline
+ */
+static void *append_flush(void *arg)
+{
+	struct nvm_append *app = arg;
+
+	pthread_mutex_lock(&app->lock);
+	for (;;) {
+		size_t first, nunits;
+		ssize_t nbytes;
+		int err = 0;
+
+		if (app->tail == app->head) {		// Nothing sealed
+			if (app->head_nbytes && (app->stop ||
+			    append_expired(&app->head_deadline))) {
+				append_seal(app);
+			} else if (app->stop) {
+				break;
+			} else if (app->head_nbytes) {
+				pthread_cond_timedwait(&app->cond, &app->lock,
+						       &app->head_deadline);
+				continue;
+			} else {
+				pthread_cond_wait(&app->cond, &app->lock);
+				continue;
+			}
+		}
+
+		first = app->tail % NVM_APPEND_NUNITS;
+		nunits = app->head - app->tail;
+		if (nunits > NVM_APPEND_NUNITS - first)
+			nunits = NVM_APPEND_NUNITS - first;
+		pthread_mutex_unlock(&app->lock);
+
+		nbytes = nvm_vblk_pwrite(app->vblk,
+					 app->ring + first * app->unit_nbytes,
+					 nunits * app->unit_nbytes,
+					 app->base + app->tail * app->unit_nbytes);
+		if (nbytes < 0)
+			err = errno;
+
+		pthread_mutex_lock(&app->lock);
+		if (err) {
+			NVM_DEBUG("FAILED: nvm_vblk_pwrite, err: %d", err);
+			app->err = err;
+		}
+		app->tail += nunits;
+		app->vblk->pos_write = app->base +
+				       app->tail * app->unit_nbytes;
+		app->nwrites += 1;
+
+		pthread_cond_broadcast(&app->cond);
+	}
+	pthread_mutex_unlock(&app->lock);
+
+	return NULL;
+}
+
+struct nvm_append *nvm_append_create(struct nvm_vblk *vblk,
+				     uint64_t deadline_usec)
+{
+	const struct nvm_geo *geo = nvm_dev_get_geo(vblk->dev);
+	struct nvm_append *app;
+	int err;
+
+	if (nvm_dev_get_verid(vblk->dev) != NVM_SPEC_VERID_20) {
+		NVM_DEBUG("FAILED: unsupported verid");
+		errno = ENOSYS;
+		return NULL;
+	}
+
+	app = calloc(1, sizeof(*app));
+	if (!app) {
+		NVM_DEBUG("FAILED: calloc app");
+		return NULL;
+	}
+	app->vblk = vblk;
+	app->unit_nbytes = nvm_dev_get_ws_opt(vblk->dev) * geo->l.nbytes;
+	app->base = vblk->pos_write;
+	app->deadline_usec = deadline_usec;
+
+	if (app->base % app->unit_nbytes) {
+		NVM_DEBUG("FAILED: unaligned pos_write: %zu", app->base);
+		free(app);
+		errno = EINVAL;
+		return NULL;
+	}
+	app->nunits_max = (vblk->nbytes - app->base) / app->unit_nbytes;
+
+	app->ring = nvm_buf_alloc(vblk->dev,
+				  NVM_APPEND_NUNITS * app->unit_nbytes, NULL);
+	if (!app->ring) {
+		NVM_DEBUG("FAILED: nvm_buf_alloc(ring)");
+		free(app);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	pthread_mutex_init(&app->lock, NULL);
+	pthread_cond_init(&app->cond, NULL);
+
+	err = pthread_create(&app->thread, NULL, append_flush, app);
+	if (err) {
+		NVM_DEBUG("FAILED: pthread_create, err: %d", err);
+		pthread_cond_destroy(&app->cond);
+		pthread_mutex_destroy(&app->lock);
+		nvm_buf_free(vblk->dev, app->ring);
+		free(app);
+		errno = err;
+		return NULL;
+	}
+
+	return app;
+}
+
+void nvm_append_destroy(struct nvm_append *app)
+{
+	if (!app)
+		return;
+
+	pthread_mutex_lock(&app->lock);
+	app->stop = 1;
+	pthread_cond_broadcast(&app->cond);
+	pthread_mutex_unlock(&app->lock);
+
+	pthread_join(app->thread, NULL);
+
+	pthread_cond_destroy(&app->cond);
+	pthread_mutex_destroy(&app->lock);
+	nvm_buf_free(app->vblk->dev, app->ring);
+	free(app);
+}
+
+/**
+ * Locate the byte at 'vofs' in the vblk as chunk, sector and byte within the
+ * sector, following the striping of vblk_stripe_addrs
+ */
+static void append_loc(const struct nvm_append *app, size_t vofs,
+		       struct nvm_append_loc *loc)
+{
+	const struct nvm_vblk *vblk = app->vblk;
+	const size_t WS_OPT = nvm_dev_get_ws_opt(vblk->dev);
+	const size_t sectr_nbytes = nvm_dev_get_geo(vblk->dev)->l.nbytes;
+	const size_t sectr = vofs / sectr_nbytes;
+	const size_t wunit = sectr / WS_OPT;
+
+	loc->addr = vblk->blks[wunit % vblk->nblks];
+	loc->addr.l.sectr = (wunit / vblk->nblks) * WS_OPT + sectr % WS_OPT;
+	loc->offset = vofs % sectr_nbytes;
+	loc->vofs = vofs;
+}
+
+int nvm_append(struct nvm_append *app, const void *rec, size_t nbytes,
+	       struct nvm_append_loc *loc)
+{
+	const char *src = rec;
+	uint64_t last;
+	size_t start, left;
+
+	if (!nbytes || nbytes > app->unit_nbytes) {
+		NVM_DEBUG("FAILED: invalid nbytes: %zu", nbytes);
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&app->lock);
+
+	// Wait for ring space for all of the units the record touches
+	for (;;) {
+		const uint64_t span = app->head_nbytes + nbytes >
+				      app->unit_nbytes ? 2 : 1;
+
+		if (app->err || app->head + span - app->tail <=
+				NVM_APPEND_NUNITS)
+			break;
+
+		pthread_cond_wait(&app->cond, &app->lock);
+	}
+	if (app->err) {
+		errno = app->err;
+		pthread_mutex_unlock(&app->lock);
+		NVM_DEBUG("FAILED: stream failed, err: %d", errno);
+		return -1;
+	}
+
+	start = app->head * app->unit_nbytes + app->head_nbytes;
+	if (start + nbytes > app->nunits_max * app->unit_nbytes) {
+		pthread_mutex_unlock(&app->lock);
+		NVM_DEBUG("FAILED: vblk is full");
+		errno = ENOSPC;
+		return -1;
+	}
+
+	for (left = nbytes; left;) {
+		const size_t room = app->unit_nbytes - app->head_nbytes;
+		const size_t n = left < room ? left : room;
+		char *unit = app->ring + (app->head % NVM_APPEND_NUNITS) *
+					 app->unit_nbytes;
+
+		if (!app->head_nbytes) {	// First record, start the clock
+			struct timespec *dl = &app->head_deadline;
+
+			clock_gettime(CLOCK_REALTIME, dl);
+			dl->tv_sec += app->deadline_usec / 1000000;
+			dl->tv_nsec += (app->deadline_usec % 1000000) * 1000;
+			if (dl->tv_nsec >= 1000000000) {
+				dl->tv_sec += 1;
+				dl->tv_nsec -= 1000000000;
+			}
+			pthread_cond_broadcast(&app->cond);
+		}
+
+		memcpy(unit + app->head_nbytes, src, n);
+		app->head_nbytes += n;
+		src += n;
+		left -= n;
+
+		if (app->head_nbytes == app->unit_nbytes)
+			append_seal(app);
+	}
+	app->nrecs += 1;
+	app->nrec_bytes += nbytes;
+
+	// Group commit, wait for the units holding the record to be written
+	last = (start + nbytes - 1) / app->unit_nbytes;
+	while (app->tail <= last && !app->err)
+		pthread_cond_wait(&app->cond, &app->lock);
+
+	if (app->tail <= last) {
+		errno = app->err;
+		pthread_mutex_unlock(&app->lock);
+		NVM_DEBUG("FAILED: stream failed, err: %d", errno);
+		return -1;
+	}
+	pthread_mutex_unlock(&app->lock);
+
+	if (loc)
+		append_loc(app, app->base + start, loc);
+
+	return 0;
+}
+
+int nvm_append_flush(struct nvm_append *app)
+{
+	uint64_t last;
+
+	pthread_mutex_lock(&app->lock);
+	if (app->head_nbytes)
+		append_seal(app);
+
+	last = app->head;
+	while (app->tail < last && !app->err)
+		pthread_cond_wait(&app->cond, &app->lock);
+
+	if (app->tail < last) {
+		errno = app->err;
+		pthread_mutex_unlock(&app->lock);
+		NVM_DEBUG("FAILED: stream failed, err: %d", errno);
+		return -1;
+	}
+	pthread_mutex_unlock(&app->lock);
+
+	return 0;
+}
+
+void nvm_append_pr(struct nvm_append *app)
+{
+	pthread_mutex_lock(&app->lock);
+	printf("append:\n");
+	printf("  unit_nbytes: %zu\n", app->unit_nbytes);
+	printf("  deadline_usec: %"PRIu64"\n", app->deadline_usec);
+	printf("  head: %"PRIu64"\n", app->head);
+	printf("  tail: %"PRIu64"\n", app->tail);
+	printf("  nrecs: %zu\n", app->nrecs);
+	printf("  nrec_bytes: %zu\n", app->nrec_bytes);
+	printf("  nwrites: %zu\n", app->nwrites);
+	printf("  npadded: %zu\n", app->npadded);
+	printf("  err: %d\n", app->err);
+	pthread_mutex_unlock(&app->lock);
+}
@@ -26,32 +26,388 @@
  * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
+#include <time.h>
 #include <liblightnvm.h>
 #include <nvm_be.h>
 #include <nvm_dev.h>
 #include <nvm_async.h>
+#include <nvm_sched.h>
 
 struct nvm_async_ctx *nvm_async_init(struct nvm_dev *dev, uint32_t depth,
 				     uint16_t flags)
 {
-	return dev->be->async_init(dev, depth, flags);
+	struct nvm_async_ctx *ctx = dev->be->async_init(dev, depth, flags);
+
+	if (!ctx)
+		return NULL;	// Propagate errno
+
+	ctx->flags = flags;
+	ctx->dev = dev;
+
+	ctx->failed = calloc(ctx->depth, sizeof(*ctx->failed));
+	if (!ctx->failed) {
+		NVM_DEBUG("FAILED: calloc failed");
+		nvm_async_term(dev, ctx);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	if (flags & NVM_ASYNC_DEADLINE) {
+		ctx->timed = calloc(ctx->depth, sizeof(*ctx->timed));
+		if (!ctx->timed) {
+			NVM_DEBUG("FAILED: calloc timed");
+			nvm_async_term(dev, ctx);
+			errno = ENOMEM;
+			return NULL;
+		}
+	}
+
+	if (flags & NVM_ASYNC_SCHED) {
+		ctx->sched = nvm_sched_init(dev, ctx->depth);
+		if (!ctx->sched) {
+			int err = errno;
+
+			NVM_DEBUG("FAILED: nvm_sched_init");
+			nvm_async_term(dev, ctx);
+			errno = err;
+			return NULL;
+		}
+	}
+
+	return ctx;
 }
 
 int nvm_async_term(struct nvm_dev *dev, struct nvm_async_ctx *ctx)
 {
+	free(ctx->timed);
+	ctx->timed = NULL;
+	ctx->ntimed = 0;
+
+	free(ctx->failed);
+	ctx->failed = NULL;
+	ctx->nfailed = 0;
+
+	nvm_sched_term(ctx->sched);
+	ctx->sched = NULL;
+
 	return dev->be->async_term(dev, ctx);
 }
 
+int nvm_async_set_pu_depth(struct nvm_async_ctx *ctx, uint32_t depth)
+{
+	if (!ctx->sched) {
+		NVM_DEBUG("FAILED: ctx was not created with NVM_ASYNC_SCHED");
+		errno = ENOSYS;
+		return -1;
+	}
+	if (!depth) {
+		NVM_DEBUG("FAILED: depth: %u", depth);
+		errno = EINVAL;
+		return -1;
+	}
+
+	ctx->sched->pu_depth = depth;
+
+	return 0;
+}
+
+int nvm_async_set_pu_depth_wr(struct nvm_async_ctx *ctx, uint32_t depth)
+{
+	if (!ctx->sched) {
+		NVM_DEBUG("FAILED: ctx was not created with NVM_ASYNC_SCHED");
+		errno = ENOSYS;
+		return -1;
+	}
+	if (!depth) {
+		NVM_DEBUG("FAILED: depth: %u", depth);
+		errno = EINVAL;
+		return -1;
+	}
+
+	ctx->sched->pu_depth_wr = depth;
+
+	return 0;
+}
+
+int nvm_async_set_wait_mode(struct nvm_async_ctx *ctx,
+			    enum nvm_async_wait_mode mode)
+{
+	switch (mode) {
+	case NVM_ASYNC_WAIT_POLL:
+	case NVM_ASYNC_WAIT_HYBRID:
+	case NVM_ASYNC_WAIT_SLEEP:
+		ctx->wait_mode = mode;
+		return 0;
+	}
+
+	NVM_DEBUG("FAILED: invalid mode: %d", mode);
+	errno = EINVAL;
+	return -1;
+}
+
+static inline uint64_t async_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline void async_nap(uint64_t nsec)
+{
+	struct timespec nap;
+
+	if (nsec < NVM_ASYNC_NAP_MIN_NSEC)
+		nsec = NVM_ASYNC_NAP_MIN_NSEC;
+	if (nsec > NVM_ASYNC_NAP_MAX_NSEC)
+		nsec = NVM_ASYNC_NAP_MAX_NSEC;
+
+	nap.tv_sec = 0;
+	nap.tv_nsec = nsec;
+
+	nanosleep(&nap, NULL);
+}
+
+static inline void async_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+/**
+ * Expected latency of the shortest outstanding command
+ */
+static inline uint64_t async_lat_nsec(const struct nvm_async_ctx *ctx)
+{
+	if (ctx->nout[NVM_ASYNC_CLS_READ])
+		return NVM_ASYNC_LAT_READ_NSEC;
+	if (ctx->nout[NVM_ASYNC_CLS_WRITE])
+		return NVM_ASYNC_LAT_WRITE_NSEC;
+	if (ctx->nout[NVM_ASYNC_CLS_ERASE])
+		return NVM_ASYNC_LAT_ERASE_NSEC;
+
+	return NVM_ASYNC_LAT_READ_NSEC;
+}
+
+void nvm_async_backoff(struct nvm_async_ctx *ctx, struct nvm_async_backoff *bo)
+{
+	switch (ctx->wait_mode) {
+	case NVM_ASYNC_WAIT_POLL:
+		async_relax();
+		return;
+
+	case NVM_ASYNC_WAIT_HYBRID:
+		if (!bo->bgn)
+			bo->bgn = async_clock();
+
+		if (async_clock() - bo->bgn < NVM_ASYNC_SPIN_NSEC) {
+			async_relax();
+		} else if (!bo->nap) {
+			// Sleep through most of the expected latency
+			async_nap(async_lat_nsec(ctx) / 2);
+			bo->nap = NVM_ASYNC_NAP_MIN_NSEC;
+		} else {
+			// Then poll with exponentially growing naps
+			async_nap(bo->nap);
+			if (bo->nap < async_lat_nsec(ctx) / 8)
+				bo->nap *= 2;
+		}
+		return;
+
+	case NVM_ASYNC_WAIT_SLEEP:
+		async_nap(async_lat_nsec(ctx) / 8);
+		return;
+	}
+}
+
+uint64_t nvm_async_deadline(uint64_t usec)
+{
+	return async_clock() + usec * 1000ULL;
+}
+
+/**
+ * Complete the command of 'ret' with NVM_RET_STATUS_ABORTED, the backend
+ * drops the completion from the device when it arrives and, when it can, asks
+ * the device to stop working on the command. When 'slot' is given
+ * the 'ret' is stored in it instead of invoking its callback
+ */
+static void async_abandon(struct nvm_dev *dev, struct nvm_async_ctx *ctx,
+			  uint32_t idx, struct nvm_ret **slot)
+{
+	struct nvm_ret *ret = ctx->timed[idx].ret;
+	void *tag = ctx->timed[idx].tag;
+
+	// The backend may complete, and thus untrack, other commands meanwhile
+	ctx->timed[idx] = ctx->timed[--ctx->ntimed];
+	ctx->nabandoned += 1;
+	dev->be->async_abandon(dev, ctx, tag);
+
+	ret->async.tag = NULL;
+	ret->status = NVM_RET_STATUS_ABORTED;
+	if (slot)
+		*slot = ret;
+	else if (ret->async.cb)
+		ret->async.cb(ret, ret->async.cb_arg);
+}
+
+/**
+ * Abandon commands whose deadline has passed, no more than 'max' of them when
+ * storing them in 'rets'
+ */
+static int async_expire(struct nvm_dev *dev, struct nvm_async_ctx *ctx,
+			struct nvm_ret *rets[], uint32_t max)
+{
+	uint64_t now;
+	uint32_t nexpired = 0;
+
+	if (!ctx->ntimed)
+		return 0;
+
+	now = async_clock();
+	for (uint32_t i = 0; i < ctx->ntimed;) {
+		if (rets && nexpired == max)
+			break;
+		if (ctx->timed[i].ret->async.deadline > now) {
+			++i;
+			continue;
+		}
+
+		async_abandon(dev, ctx, i, rets ? &rets[nexpired] : NULL);
+		++nexpired;
+	}
+
+	return nexpired;
+}
+
+/**
+ * Complete the commands held on the context, deferred commands which failed
+ * submission and completions found while ringing a doorbell, no more than
+ * 'max' of them when storing them in 'rets'
+ */
+static int async_drain(struct nvm_async_ctx *ctx, struct nvm_ret *rets[],
+		       uint32_t max)
+{
+	int ndrained = 0;
+
+	while (ctx->nfailed && (!rets || (uint32_t)ndrained < max)) {
+		struct nvm_ret *ret = ctx->failed[--ctx->nfailed];
+
+		if (rets)
+			rets[ndrained] = ret;
+		else if (ret->async.cb)
+			ret->async.cb(ret, ret->async.cb_arg);
+		++ndrained;
+	}
+
+	return ndrained;
+}
+
+int nvm_async_cancel(struct nvm_dev *dev, struct nvm_async_ctx *ctx,
+		     struct nvm_ret *ret)
+{
+	if (!nvm_sched_cancel(ctx, ret))
+		return 0;
+
+	for (uint32_t i = 0; i < ctx->ntimed; ++i) {
+		if (ctx->timed[i].ret != ret)
+			continue;
+
+		async_abandon(dev, ctx, i, NULL);
+		return 0;
+	}
+
+	if (!dev->be->async_cancel(dev, ctx, ret))
+		return 0;
+
+	if (errno == ENOSYS)
+		errno = ENOENT;
+	NVM_DEBUG("FAILED: ret: %p cannot be cancelled", (void*)ret);
+	return -1;
+}
+
 int nvm_async_wait(struct nvm_dev *dev, struct nvm_async_ctx *ctx)
 {
-	return dev->be->async_wait(dev, ctx);
+	struct nvm_async_backoff bo = { 0 };
+	int acc = 0;
+
+	// Without deadlines or queues to watch the backend may wait its own way
+	if (ctx->wait_mode == NVM_ASYNC_WAIT_POLL && !ctx->ntimed &&
+	    !ctx->nabandoned && !ctx->nfailed && !ctx->sched)
+		return dev->be->async_wait(dev, ctx);
+
+	while (nvm_sched_npending(ctx)) {
+		int res = nvm_async_poke(dev, ctx, 0);
+
+		if (res < 0) {
+			NVM_DEBUG("FAILED: async_poke");
+			return -1;
+		}
+		if (res) {
+			acc += res;
+			bo = (struct nvm_async_backoff){ 0 };
+			continue;
+		}
+
+		nvm_async_backoff(ctx, &bo);
+	}
+
+	return acc;
 }
 
 int nvm_async_poke(struct nvm_dev *dev, struct nvm_async_ctx *ctx, uint32_t max)
 {
-	return dev->be->async_poke(dev, ctx, max);
+	const int nexpired = async_expire(dev, ctx, NULL, 0);
+	int res;
+
+	res = dev->be->async_poke(dev, ctx, max);
+	if (res < 0)
+		return -1;	// Propagate errno
+
+	res += async_drain(ctx, NULL, 0);
+
+	if (ctx->sched) {
+		nvm_sched_kick(dev, ctx);
+		res += nvm_sched_drain(ctx, NULL, 0);
+	}
+
+	return nexpired + res;
+}
+
+int nvm_async_reap(struct nvm_dev *dev, struct nvm_async_ctx *ctx,
+		   struct nvm_ret *rets[], uint32_t max)
+{
+	if (!rets || !max) {
+		NVM_DEBUG("FAILED: rets: %p, max: %u", (void*)rets, max);
+		errno = EINVAL;
+		return -1;
+	}
+
+	int nreaped = async_expire(dev, ctx, rets, max);
+
+	nreaped += nvm_sched_drain(ctx, rets + nreaped, max - nreaped);
+	nreaped += async_drain(ctx, rets + nreaped, max - nreaped);
+
+	if ((uint32_t)nreaped < max) {
+		int res = dev->be->async_reap(dev, ctx, rets + nreaped,
+					      max - nreaped);
+		if (res < 0 && !nreaped)
+			return -1;	// Propagate errno
+		if (res > 0)
+			nreaped += res;
+	}
+
+	if (ctx->sched) {
+		nvm_sched_reaped(ctx, rets, nreaped);
+		nvm_sched_kick(dev, ctx);
+	}
+
+	return nreaped;
 }
 
 uint32_t nvm_async_get_depth(struct nvm_async_ctx *ctx) {
@@ -59,5 +415,16 @@ uint32_t nvm_async_get_depth(struct nvm_async_ctx *ctx) {
 }
 
 uint32_t nvm_async_get_outstanding(struct nvm_async_ctx *ctx) {
-	return ctx->outstanding;
+	return nvm_sched_npending(ctx);
+}
+
+int nvm_async_get_fd(struct nvm_async_ctx *ctx)
+{
+	if (ctx->efd < 0) {
+		NVM_DEBUG("FAILED: no eventfd on ctx");
+		errno = ENOSYS;
+		return -1;
+	}
+
+	return ctx->efd;
 }
@@ -28,6 +28,7 @@
  */
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <dirent.h>
 #include <liblightnvm.h>
 #include <nvm_be.h>
@@ -298,6 +299,40 @@ int nvm_be_nosys_async_wait(struct nvm_dev *NVM_UNUSED(dev),
 	return -1;
 }
 
+int nvm_be_nosys_async_flush(struct nvm_dev *NVM_UNUSED(dev),
+			     struct nvm_async_ctx *NVM_UNUSED(ctx))
+{
+	NVM_DEBUG("FAILED: not implemented(possibly intentionally)");
+	errno = ENOSYS;
+	return -1;
+}
+
+int nvm_be_nosys_async_reap(struct nvm_dev *NVM_UNUSED(dev),
+			    struct nvm_async_ctx *NVM_UNUSED(ctx),
+			    struct nvm_ret **NVM_UNUSED(rets),
+			    uint32_t NVM_UNUSED(max))
+{
+	NVM_DEBUG("FAILED: not implemented(possibly intentionally)");
+	errno = ENOSYS;
+	return -1;
+}
+
+void nvm_be_nosys_async_abandon(struct nvm_dev *NVM_UNUSED(dev),
+				struct nvm_async_ctx *NVM_UNUSED(ctx),
+				void *NVM_UNUSED(tag))
+{
+	NVM_DEBUG("FAILED: not implemented(possibly intentionally)");
+}
+
+int nvm_be_nosys_async_cancel(struct nvm_dev *NVM_UNUSED(dev),
+			      struct nvm_async_ctx *NVM_UNUSED(ctx),
+			      struct nvm_ret *NVM_UNUSED(ret))
+{
+	NVM_DEBUG("FAILED: not implemented(possibly intentionally)");
+	errno = ENOSYS;
+	return -1;
+}
+
 int nvm_be_split_dpath(const char *dev_path, char *nvme_name, int *nsid)
 {
 	const char prefix[] = "/dev/nvme";
@@ -326,6 +361,46 @@ int nvm_be_split_dpath(const char *dev_path, char *nvme_name, int *nsid)
 	return 0;
 }
 
+int nvm_be_sysfs_numa_node(const char *fmt, const char *ident)
+{
+	char path[NVM_DEV_PATH_LEN * 2];
+	FILE *fp;
+	int node;
+
+	snprintf(path, sizeof(path), fmt, ident);
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		NVM_DEBUG("INFO: no numa_node attr: %s", path);
+		return -1;
+	}
+	if (fscanf(fp, "%d", &node) != 1)
+		node = -1;
+	fclose(fp);
+
+	return node < 0 ? -1 : node;
+}
+
+uint64_t nvm_be_addr_dev(struct nvm_dev *dev, struct nvm_addr addr,
+			 int flags)
+{
+	if (flags & NVM_CMD_ADDR_DEV)
+		return addr.val;
+
+	return nvm_addr_gen2dev(dev, addr);
+}
+
+void nvm_be_addrs_dev(struct nvm_dev *dev, const struct nvm_addr addrs[],
+		      uint64_t dev_addrs[], int naddrs, int flags)
+{
+	if (flags & NVM_CMD_ADDR_DEV) {
+		memcpy(dev_addrs, addrs, naddrs * sizeof(*dev_addrs));
+		return;
+	}
+
+	nvm_addr_gen2dev_n(dev, addrs, dev_addrs, naddrs);
+}
+
 int nvm_be_populate_quirks(struct nvm_dev *dev, const char serial[])
 {
 	const int serial_len = strlen(serial);
@@ -405,6 +480,8 @@ int nvm_be_populate_derived(struct nvm_dev *dev)
 		break;
 	}
 
+	nvm_addr_fns_setup(dev);
+
 	nvm_dev_set_erase_naddrs_max(dev, NVM_NADDR_MAX);
 	nvm_dev_set_write_naddrs_max(dev, NVM_NADDR_MAX);
 	nvm_dev_set_read_naddrs_max(dev, NVM_NADDR_MAX);
@@ -420,6 +497,7 @@ int nvm_be_populate(struct nvm_dev *dev, struct nvm_be *be)
 	int err;
 
 	dev->be = be;			// TODO: Clean the init. process
+	nvm_addr_fns_setup(dev);	// Generic until the geometry is known
 
 	idfy = be->idfy(dev, NULL);
 	if (!idfy) {
@@ -58,6 +58,10 @@ struct nvm_be nvm_be_ioctl = {
 	.async_term = nvm_be_nosys_async_term,
 	.async_poke = nvm_be_nosys_async_poke,
 	.async_wait = nvm_be_nosys_async_wait,
+	.async_flush = nvm_be_nosys_async_flush,
+	.async_reap = nvm_be_nosys_async_reap,
+	.async_abandon = nvm_be_nosys_async_abandon,
+	.async_cancel = nvm_be_nosys_async_cancel,
 };
 #else
 #define _GNU_SOURCE
@@ -74,6 +78,7 @@ struct nvm_be nvm_be_ioctl = {
 #include <nvm_be.h>
 #include <nvm_be_ioctl.h>
 #include <nvm_dev.h>
+#include <nvm_cmd.h>
 
 #ifdef NVM_DEBUG_ENABLED
 static const char *ioctl_request_to_str(unsigned long req)
@@ -413,7 +418,7 @@ int nvm_be_ioctl_sbbt(struct nvm_dev *dev, struct nvm_addr *addrs, int naddrs,
 	}
 
 	cmd.vadmin.opcode = NVM_AOPC_SBBT; // Construct command
-	cmd.vadmin.control = flags;
+	cmd.vadmin.control = nvm_cmd_control(flags);
 	cmd.vadmin.nppas = naddrs - 1; // Unnatural numbers: counting from zero
 	cmd.vadmin.ppa_list = naddrs == 1 ? dev_addrs[0] : (uint64_t)dev_addrs;
 
@@ -457,7 +462,7 @@ int nvm_be_ioctl_scalar_erase(struct nvm_dev *dev, struct nvm_addr *addrs,
 	for(int idx = 0; idx < naddrs; ++idx) {
 		dsmr[idx].cattr = 0;
 		dsmr[idx].nlb = geo->l.nsectr;
-		dsmr[idx].slba = nvm_addr_gen2dev(dev, addrs[idx]);
+		dsmr[idx].slba = nvm_be_addr_dev(dev, addrs[idx], flags);
 	}
 
 	cmd.passthru.opcode = NVM_DOPC_SCALAR_ERASE;
@@ -490,7 +495,7 @@ int nvm_be_ioctl_scalar_erase(struct nvm_dev *dev, struct nvm_addr *addrs,
 static inline int cmd_scalar_wr_dep_ioc(struct nvm_dev *dev,
 					struct nvm_addr addr, int naddrs,
 					void *data, void *meta,
-					uint16_t NVM_UNUSED(flags),
+					uint16_t flags,
 					uint16_t opcode,
 					struct nvm_ret *ret)
 {
@@ -500,7 +505,7 @@ static inline int cmd_scalar_wr_dep_ioc(struct nvm_dev *dev,
 	cmd.user.nblocks = naddrs - 1;
 	cmd.user.metadata = (__u64)(uintptr_t) meta;
 	cmd.user.addr = (__u64)(uintptr_t) data;
-	cmd.user.slba = nvm_addr_gen2dev(dev, addr);
+	cmd.user.slba = nvm_be_addr_dev(dev, addr, flags);
 
 	int err = ioctl_wrap(dev, NVME_IOCTL_SUBMIT_IO, &cmd, ret);
 	if (err) {
@@ -538,7 +543,7 @@ static inline int cmd_scalar_wr(struct nvm_dev *dev, struct nvm_addr addr,
 	cmd.passthru.metadata_len = meta ? dev->geo.meta_nbytes * naddrs : 0;
 	cmd.passthru.data_len = dev->geo.sector_nbytes * naddrs;
 
-	uint64_t slba = nvm_addr_gen2dev(dev, addr);
+	uint64_t slba = nvm_be_addr_dev(dev, addr, flags);
 
 	cmd.passthru.cdw10 = slba;
 	cmd.passthru.cdw11 = slba >> 32;
@@ -589,7 +594,7 @@ static inline int cmd_vector_ewr(struct nvm_dev *dev, struct nvm_addr addrs[],
 
 	struct nvm_cmd cmd = {.cdw={0}};
 	uint64_t dev_addrs[naddrs];
-	int i, err;
+	int err;
 
 	if (naddrs > NVM_NADDR_MAX) {
 		errno = EINVAL;
@@ -597,12 +602,10 @@ static inline int cmd_vector_ewr(struct nvm_dev *dev, struct nvm_addr addrs[],
 	}
 
 	cmd.vuser.opcode = opcode;
-	cmd.vuser.control = flags | NVM_FLAG_DEFAULT;
+	cmd.vuser.control = nvm_cmd_control(flags) | NVM_FLAG_DEFAULT;
 
 	// Setup PPAs: Convert address format from generic to device specific
-	for (i = 0; i < naddrs; ++i) {
-		dev_addrs[i] = nvm_addr_gen2dev(dev, addrs[i]);
-	}
+	nvm_be_addrs_dev(dev, addrs, dev_addrs, naddrs, flags);
 
 	// Unnatural numbers: counting from zero
 	cmd.vuser.nppas = naddrs - 1;
@@ -735,6 +738,14 @@ struct nvm_dev *nvm_be_ioctl_open(const char *dev_path, int flags)
 		return NULL;
 	}
 
+	// The namespace device is the controller, its device the PCI function
+	dev->numa_node = nvm_be_sysfs_numa_node("/sys/block/%s/device/numa_node",
+						dev->name);
+	if (dev->numa_node < 0) {
+		dev->numa_node = nvm_be_sysfs_numa_node(
+			"/sys/block/%s/device/device/numa_node", dev->name);
+	}
+
 	err = nvm_be_populate(dev, &nvm_be_ioctl);
 	if (err) {
 		NVM_DEBUG("FAILED: nvm_be_populate");
@@ -789,5 +800,9 @@ struct nvm_be nvm_be_ioctl = {
 	.async_term = nvm_be_nosys_async_term,
 	.async_poke = nvm_be_nosys_async_poke,
 	.async_wait = nvm_be_nosys_async_wait,
+	.async_flush = nvm_be_nosys_async_flush,
+	.async_reap = nvm_be_nosys_async_reap,
+	.async_abandon = nvm_be_nosys_async_abandon,
+	.async_cancel = nvm_be_nosys_async_cancel,
 };
 #endif
@@ -60,6 +60,10 @@ struct nvm_be nvm_be_lbd = {
 	.async_term = nvm_be_nosys_async_term,
 	.async_poke = nvm_be_nosys_async_poke,
 	.async_wait = nvm_be_nosys_async_wait,
+	.async_flush = nvm_be_nosys_async_flush,
+	.async_reap = nvm_be_nosys_async_reap,
+	.async_abandon = nvm_be_nosys_async_abandon,
+	.async_cancel = nvm_be_nosys_async_cancel,
 };
 #else
 #include <stdlib.h>
@@ -71,6 +75,7 @@ struct nvm_be nvm_be_lbd = {
 #include <linux/fs.h>
 #include <time.h>
 #include <sys/ioctl.h>
+#include <sys/eventfd.h>
 #include <nvm_be_ioctl.h>
 #include <nvm_dev.h>
 #include <nvm_async.h>
@@ -79,6 +84,11 @@ struct nvm_be nvm_be_lbd = {
 #include <libaio.h>
 #define NVM_BE_LBD_ASYNC_DEFAULT_IODEPTH 256
 
+#ifndef IOCB_FLAG_IOPRIO
+#define IOCB_FLAG_IOPRIO (1 << 1)
+#endif
+#define NVM_BE_LBD_IOPRIO_HIGH (2 << 13)	///< IOPRIO_CLASS_BE, level 0
+
 struct nvm_be_lbd_async_state {
 	io_context_t aio_ctx;
 	struct io_event *aio_events;
@@ -113,6 +123,12 @@ struct nvm_async_ctx *nvm_be_lbd_async_init(struct nvm_dev *NVM_UNUSED(dev),
 		return NULL;
 	}
 
+	// Signaled by the kernel for every completion, see nvm_async_get_fd
+	ctx->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (ctx->efd < 0) {
+		NVM_DEBUG("FAILED: eventfd, errno: %s", strerror(errno));
+	}
+
 	return ctx;
 }
 
@@ -129,6 +145,10 @@ int nvm_be_lbd_async_term(struct nvm_dev *NVM_UNUSED(dev),
 	free(state->aio_events);
 	free(state->iocbs);
 
+	if (ctx->efd >= 0) {
+		close(ctx->efd);
+	}
+
 	if (0 != (err = io_queue_release(state->aio_ctx))) {
 		errno = -err;
 		return -1;
@@ -140,29 +160,69 @@ int nvm_be_lbd_async_term(struct nvm_dev *NVM_UNUSED(dev),
 	return 0;
 }
 
-int cmd_async_getevents(struct nvm_async_ctx *ctx, unsigned int min,
-			unsigned int max, struct timespec *timeout)
+static inline int lbd_iocb_opc(const struct iocb *iocb)
+{
+	return iocb->aio_lio_opcode == IO_CMD_PREAD ? NVM_DOPC_SCALAR_READ :
+						      NVM_DOPC_SCALAR_WRITE;
+}
+
+/**
+ * Reads events and invokes their callbacks, or when 'rets' is given, stores
+ * the completed 'nvm_ret' in 'rets' and reads no more than 'max' events. With
+ * 'wait' it blocks until all commands, except abandoned ones, are completed
+ */
+int cmd_async_getevents(struct nvm_async_ctx *ctx, int wait,
+			unsigned int max, struct timespec *timeout,
+			struct nvm_ret *rets[])
 {
 	struct nvm_be_lbd_async_state *state = ctx->be_ctx;
 
 	int r, nevents = 0;
-	while (ctx->outstanding) {
-		if (0 == (r = io_getevents(state->aio_ctx, min, max, state->aio_events, timeout))) {
+
+	// Drain before reaping, completions after the drain signal it again
+	if (ctx->efd >= 0) {
+		uint64_t ncpl;
+
+		if (read(ctx->efd, &ncpl, sizeof(ncpl)) < 0 && errno != EAGAIN) {
+			NVM_DEBUG("FAILED: read(efd), errno: %s",
+				  strerror(errno));
+		}
+	}
+
+	while (ctx->outstanding - ctx->nabandoned) {
+		const unsigned int min = wait ?
+					 ctx->outstanding - ctx->nabandoned : 0;
+		const unsigned int nr = rets ? max - nevents : max;
+
+		if (!nr)
+			break;
+
+		if (0 == (r = io_getevents(state->aio_ctx, min, nr, state->aio_events, timeout))) {
 			break;
 		}
 
 		if (r < 0) return -r;
 
-		nevents += r;
-
 		for (int i = 0; i < r; i++) {
 			struct io_event *event = &state->aio_events[i];
 			struct nvm_ret *ret = event->data;
 
-			ret->status = event->res2;
-			ret->async.cb(ret, ret->async.cb_arg);
+			// Return the slot first, the callback may submit
+			nvm_async_ctx_cpl(ctx, lbd_iocb_opc(event->obj));
+			state->iocbs[ctx->outstanding] = event->obj;
 
-			state->iocbs[--(ctx->outstanding)] = event->obj;
+			if (!ret) {		// Abandoned, see async_abandon
+				ctx->nabandoned -= 1;
+				continue;
+			}
+			nvm_async_ctx_untrack(ctx, ret);
+
+			ret->status = event->res2;
+			if (rets)
+				rets[nevents] = ret;
+			else
+				ret->async.cb(ret, ret->async.cb_arg);
+			++nevents;
 		}
 	}
 
@@ -177,17 +237,31 @@ int nvm_be_lbd_async_poke(struct nvm_dev *NVM_UNUSED(dev),
 		max = ctx->depth;
 	}
 
-	return cmd_async_getevents(ctx, 0, max, &timeout);
+	return cmd_async_getevents(ctx, 0, max, &timeout, NULL);
+}
+
+int nvm_be_lbd_async_reap(struct nvm_dev *NVM_UNUSED(dev),
+			  struct nvm_async_ctx *ctx, struct nvm_ret *rets[],
+			  uint32_t max)
+{
+	struct timespec timeout = { 0, 0 };
+
+	if (max > ctx->depth) {
+		max = ctx->depth;
+	}
+
+	return cmd_async_getevents(ctx, 0, max, &timeout, rets);
 }
 
 int nvm_be_lbd_async_wait(struct nvm_dev *NVM_UNUSED(dev),
 			  struct nvm_async_ctx *ctx)
 {
-	return cmd_async_getevents(ctx, ctx->outstanding, ctx->depth, NULL);
+	return cmd_async_getevents(ctx, 1, ctx->depth, NULL, NULL);
 }
 
 int cmd_async_scalar_wr(struct nvm_dev *dev, int naddrs, void *data,
-			const off_t offset, struct nvm_ret *ret, int opcode)
+			const off_t offset, uint16_t flags,
+			struct nvm_ret *ret, int opcode)
 {
 	struct nvm_async_ctx *ctx = ret->async.ctx;
 	struct nvm_be_lbd_async_state *state = ctx->be_ctx;
@@ -197,7 +271,7 @@ int cmd_async_scalar_wr(struct nvm_dev *dev, int naddrs, void *data,
 		return -1;
 	}
 
-	struct iocb *iocb = state->iocbs[ctx->outstanding++];
+	struct iocb *iocb = state->iocbs[ctx->outstanding];
 
 	switch(opcode) {
 	case NVM_DOPC_SCALAR_WRITE:
@@ -217,18 +291,78 @@ int cmd_async_scalar_wr(struct nvm_dev *dev, int naddrs, void *data,
 	}
 
 	iocb->data = ret;
+	if (ctx->efd >= 0) {
+		io_set_eventfd(iocb, ctx->efd);
+	}
+	if ((flags & NVM_CMD_PRIO_HIGH) || (ctx->flags & NVM_ASYNC_PRIO_HIGH)) {
+		iocb->aio_reqprio = NVM_BE_LBD_IOPRIO_HIGH;
+		iocb->u.c.flags |= IOCB_FLAG_IOPRIO;
+	}
+	nvm_async_ctx_sub(ctx, opcode);
+
+	// Deferred iocbs stay on top of the stack until nvm_be_lbd_async_flush
+	if (ctx->plugged) {
+		ctx->ndeferred += 1;
+		nvm_async_ctx_track(ctx, ret, iocb);
+		return 0;
+	}
 
 	int r = io_submit(state->aio_ctx, 1, &iocb);
 	if (r < 0) {
+		nvm_async_ctx_cpl(ctx, opcode);
 		errno = -r;
 		return -1;
 	}
+	nvm_async_ctx_track(ctx, ret, iocb);
 
 	return 0;
 }
+
+void nvm_be_lbd_async_abandon(struct nvm_dev *NVM_UNUSED(dev),
+			      struct nvm_async_ctx *NVM_UNUSED(ctx), void *tag)
+{
+	struct iocb *iocb = tag;
+
+	iocb->data = NULL;	// Dropped by cmd_async_getevents
+}
+
+int nvm_be_lbd_async_flush(struct nvm_dev *NVM_UNUSED(dev),
+			   struct nvm_async_ctx *ctx)
+{
+	struct nvm_be_lbd_async_state *state = ctx->be_ctx;
+	struct iocb **iocbs = &state->iocbs[ctx->outstanding - ctx->ndeferred];
+	const uint32_t ndeferred = ctx->ndeferred;
+	uint32_t nsubmitted = 0;
+
+	ctx->ndeferred = 0;
+
+	while (nsubmitted < ndeferred) {
+		int r = io_submit(state->aio_ctx, ndeferred - nsubmitted,
+				  iocbs + nsubmitted);
+		if (r <= 0) {
+			// Give the slots of the iocbs not submitted back
+			for (uint32_t i = nsubmitted; i < ndeferred; ++i) {
+				nvm_async_ctx_cpl(ctx, lbd_iocb_opc(iocbs[i]));
+				nvm_async_ctx_untrack(ctx, iocbs[i]->data);
+				nvm_async_ctx_fail(ctx, iocbs[i]->data);
+			}
+			if (nsubmitted)
+				break;
+
+			NVM_DEBUG("FAILED: io_submit, r: %d", r);
+			errno = r ? -r : EAGAIN;
+			return -1;
+		}
+
+		nsubmitted += r;
+	}
+
+	return nsubmitted;
+}
 #else
 int cmd_async_scalar_wr(struct nvm_dev *NVM_UNUSED(dev), int NVM_UNUSED(naddrs),
 			void *NVM_UNUSED(data), const off_t NVM_UNUSED(offset),
+			uint16_t NVM_UNUSED(flags),
 			struct nvm_ret *NVM_UNUSED(ret), int NVM_UNUSED(opcode))
 {
 	NVM_DEBUG("FAILED: missing libaio for ASYNC write/read support");
@@ -251,7 +385,8 @@ static int nvm_be_lbd_scalar_erase(struct nvm_dev *dev, struct nvm_addr addrs[],
 		uint64_t range[2];
 		int err;
 
-		range[0] = nvm_addr_gen2off(dev, addrs[i]);
+		range[0] = nvm_addr_dev2off(dev, nvm_be_addr_dev(dev, addrs[i],
+								 flags));
 		range[1] = dev->geo.l.nsectr << dev->ssw;
 
 		err = ioctl(dev->fd, BLKDISCARD, &range);
@@ -270,7 +405,8 @@ int nvm_be_lbd_scalar_read(struct nvm_dev *dev, struct nvm_addr addr,
 			   int naddrs, void *data, void *meta, uint16_t flags,
 			   struct nvm_ret *ret)
 {
-	const off_t offset = nvm_addr_gen2off(dev, addr);
+	const off_t offset = nvm_addr_dev2off(dev, nvm_be_addr_dev(dev, addr,
+								   flags));
 	ssize_t res;
 
 	if (meta) {
@@ -280,7 +416,7 @@ int nvm_be_lbd_scalar_read(struct nvm_dev *dev, struct nvm_addr addr,
 	}
 
 	if (flags & NVM_CMD_ASYNC) {
-		return cmd_async_scalar_wr(dev, naddrs, data, offset,
+		return cmd_async_scalar_wr(dev, naddrs, data, offset, flags,
 					   ret, NVM_DOPC_SCALAR_READ);
 	}
 
@@ -298,7 +434,8 @@ int nvm_be_lbd_scalar_write(struct nvm_dev *dev, struct nvm_addr addr,
 			    int naddrs, const void *data, const void *meta,
 			    uint16_t flags, struct nvm_ret *ret)
 {
-	const off_t offset = nvm_addr_gen2off(dev, addr);
+	const off_t offset = nvm_addr_dev2off(dev, nvm_be_addr_dev(dev, addr,
+								   flags));
 	ssize_t res;
 
 	if (meta) {
@@ -309,7 +446,7 @@ int nvm_be_lbd_scalar_write(struct nvm_dev *dev, struct nvm_addr addr,
 
 	if (flags & NVM_CMD_ASYNC) {
 		return cmd_async_scalar_wr(dev, naddrs, (void*) data, offset,
-					   ret, NVM_DOPC_SCALAR_WRITE);
+					   flags, ret, NVM_DOPC_SCALAR_WRITE);
 	}
 
 	res = pwrite(dev->fd, data, dev->geo.l.nbytes * naddrs, offset);
@@ -366,11 +503,19 @@ struct nvm_be nvm_be_lbd = {
 	.async_term = nvm_be_lbd_async_term,
 	.async_poke = nvm_be_lbd_async_poke,
 	.async_wait = nvm_be_lbd_async_wait,
+	.async_flush = nvm_be_lbd_async_flush,
+	.async_reap = nvm_be_lbd_async_reap,
+	.async_abandon = nvm_be_lbd_async_abandon,
+	.async_cancel = nvm_be_nosys_async_cancel,
 #else
 	.async_init = nvm_be_nosys_async_init,
 	.async_term = nvm_be_nosys_async_term,
 	.async_poke = nvm_be_nosys_async_poke,
 	.async_wait = nvm_be_nosys_async_wait,
+	.async_flush = nvm_be_nosys_async_flush,
+	.async_reap = nvm_be_nosys_async_reap,
+	.async_abandon = nvm_be_nosys_async_abandon,
+	.async_cancel = nvm_be_nosys_async_cancel,
 #endif
 };
 #endif
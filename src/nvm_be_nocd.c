@@ -39,6 +39,10 @@ struct nvm_be nvm_be_nocd = {
 	.async_term = nvm_be_nosys_async_term,
 	.async_poke = nvm_be_nosys_async_poke,
 	.async_wait = nvm_be_nosys_async_wait,
+	.async_flush = nvm_be_nosys_async_flush,
+	.async_reap = nvm_be_nosys_async_reap,
+	.async_abandon = nvm_be_nosys_async_abandon,
+	.async_cancel = nvm_be_nosys_async_cancel,
 
 	.idfy = nvm_be_nosys_idfy,
 	.rprt = nvm_be_nosys_rprt,
@@ -135,6 +139,8 @@ struct nvm_dev *nvm_be_nocd_open(const char *dev_path, int flags)
 	dev->be_state = spdk;
 	dev->nsid = spdk->nsid;
 	memcpy(&dev->ns, &spdk->nsdata, sizeof(dev->ns));
+	dev->numa_node = nvm_be_sysfs_numa_node(NVM_BE_SPDK_NUMA_NODE_FMT,
+						spdk->trid.traddr);
 
 	err = nvm_be_populate(dev, &nvm_be_nocd);
 	if (err) {
@@ -385,6 +391,10 @@ struct nvm_be nvm_be_nocd = {
 	.async_term = nvm_be_spdk_async_term,
 	.async_poke = nvm_be_spdk_async_poke,
 	.async_wait = nvm_be_spdk_async_wait,
+	.async_flush = nvm_be_spdk_async_flush,
+	.async_reap = nvm_be_spdk_async_reap,
+	.async_abandon = nvm_be_spdk_async_abandon,
+	.async_cancel = nvm_be_spdk_async_cancel,
 
 	.idfy = nvm_be_nocd_idfy,
 	.rprt = nvm_be_nocd_rprt,
@@ -56,10 +56,16 @@ struct nvm_be nvm_be_spdk = {
 	.async_term = nvm_be_nosys_async_term,
 	.async_poke = nvm_be_nosys_async_poke,
 	.async_wait = nvm_be_nosys_async_wait,
+	.async_flush = nvm_be_nosys_async_flush,
+	.async_reap = nvm_be_nosys_async_reap,
+	.async_abandon = nvm_be_nosys_async_abandon,
+	.async_cancel = nvm_be_nosys_async_cancel,
 };
 #else
 #include <assert.h>
+#include <stdatomic.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <sys/types.h>
 #include <nvm_async.h>
 #include <nvm_dev.h>
@@ -67,12 +73,14 @@ struct nvm_be nvm_be_spdk = {
 #include <nvm_sgl.h>
 #include <nvm_be.h>
 #include <nvm_be_spdk.h>
+#include <spdk/version.h>
 #ifdef NVM_BE_SPDK_CHOKE_PRINTING
 #include <dpdk/rte_log.h>
 #include <spdk/log.h>
 #endif
 
 #define NVM_BE_SPDK_MAX_PROBE_ATTEMPTS 2
+#define NVM_BE_SPDK_ABORT_USEC 1000000	///< Time for the device to abort
 
 static int _do_spdk_env_init = 1;
 
@@ -133,6 +141,10 @@ static bool probe_cb(void *cb_ctx, const struct spdk_nvme_transport_id *trid,
 	/* Disable CMB sqs / cqs for now due to shared PMR / CMB */
 	opts->use_cmb_sqs = false;
 
+	/* Opt-in, controllers without support for WRR fail to initialize */
+	if (getenv("NVM_BE_SPDK_WRR"))
+		opts->arb_mechanism = SPDK_NVME_CC_AMS_WRR;
+
 	return !state->attached;
 }
 
@@ -348,6 +360,8 @@ struct nvm_dev *nvm_be_spdk_open(const char *dev_path, int flags)
 	dev->be_state = state;
 	dev->nsid = state->nsid;
 	memcpy(&dev->ns, &state->nsdata, sizeof(dev->ns));
+	dev->numa_node = nvm_be_sysfs_numa_node(NVM_BE_SPDK_NUMA_NODE_FMT,
+						state->trid.traddr);
 
 	err = nvm_be_populate(dev, &nvm_be_spdk);
 	if (err) {
@@ -380,7 +394,7 @@ failed:
  */
 struct nvm_async_ctx *nvm_be_spdk_async_init(struct nvm_dev *dev,
 					     uint32_t depth,
-					     uint16_t NVM_UNUSED(flags))
+					     uint16_t flags)
 {
 	struct nvm_be_spdk_state *state = dev->be_state;
 	struct spdk_nvme_io_qpair_opts qpair_opts = { 0 };
@@ -394,6 +408,18 @@ struct nvm_async_ctx *nvm_be_spdk_async_init(struct nvm_dev *dev,
 		qpair_opts.io_queue_requests = depth * 2;
 	}
 
+#if SPDK_VERSION_MAJOR >= 20
+	// Doorbells are rung by spdk_async_ring, once per batch
+	qpair_opts.delay_cmd_submit = true;
+#endif
+
+	// Priorities only take effect with weighted round robin arbitration
+	if (spdk_nvme_ctrlr_get_regs_cc(state->ctrlr).bits.ams ==
+	    SPDK_NVME_CC_AMS_WRR) {
+		qpair_opts.qprio = (flags & NVM_ASYNC_PRIO_HIGH) ?
+				   SPDK_NVME_QPRIO_HIGH : SPDK_NVME_QPRIO_MEDIUM;
+	}
+
 	ctx = calloc(1, sizeof(*ctx));
 	if (!ctx) {
 		NVM_DEBUG("FAILED: calloc, ctx: %p, errno: %s",
@@ -403,6 +429,7 @@ struct nvm_async_ctx *nvm_be_spdk_async_init(struct nvm_dev *dev,
 	}
 
 	ctx->depth = qpair_opts.io_queue_size;
+	ctx->efd = -1;		// Completions are only found by polling
 
 	ctx->be_ctx = spdk_nvme_ctrlr_alloc_io_qpair(state->ctrlr, &qpair_opts,
 						     sizeof(qpair_opts));
@@ -447,10 +474,42 @@ int nvm_be_spdk_async_term(struct nvm_dev *NVM_UNUSED(dev),
 	return 0;
 }
 
+/**
+ * Ring the doorbell of the qpair of 'ctx' for the commands submitted since it
+ * was last rung. With delay_cmd_submit, SPDK rings it when processing
+ * completions, the completions found meanwhile are held on 'ctx->failed' and
+ * handed out by the next poke, reap or wait, as on any other backend.
+ */
+static int spdk_async_ring(struct nvm_async_ctx *ctx)
+{
+	struct spdk_nvme_qpair *qpair = ctx->be_ctx;
+	struct nvm_ret **reap = ctx->reap;
+	const uint32_t nreaped = ctx->nreaped;
+	int32_t res;
+
+	ctx->reap = ctx->failed + ctx->nfailed;
+	ctx->nreaped = 0;
+
+	res = spdk_nvme_qpair_process_completions(qpair, 0);
+
+	ctx->nfailed += ctx->nreaped;
+	ctx->reap = reap;
+	ctx->nreaped = nreaped;
+
+	if (res < 0) {
+		NVM_DEBUG("FAILED: processing completions: res: %d", res);
+		errno = EIO;
+		return -1;
+	}
+
+	return 0;
+}
+
 int nvm_be_spdk_async_poke(struct nvm_dev *NVM_UNUSED(dev),
 			   struct nvm_async_ctx *ctx, uint32_t max)
 {
 	struct spdk_nvme_qpair *qpair = ctx->be_ctx;
+	const uint32_t nabandoned = ctx->nabandoned;
 	int32_t res;
 
 	res = spdk_nvme_qpair_process_completions(qpair, max);
@@ -459,14 +518,38 @@ int nvm_be_spdk_async_poke(struct nvm_dev *NVM_UNUSED(dev),
 		return -1;
 	}
 
-	return res;
+	// Completions of abandoned commands are dropped, do not count them
+	return res - (nabandoned - ctx->nabandoned);
+}
+
+int nvm_be_spdk_async_reap(struct nvm_dev *NVM_UNUSED(dev),
+			   struct nvm_async_ctx *ctx, struct nvm_ret *rets[],
+			   uint32_t max)
+{
+	struct spdk_nvme_qpair *qpair = ctx->be_ctx;
+	int32_t res;
+
+	// cmd_async_cb stores the completions in 'rets'
+	ctx->reap = rets;
+	ctx->nreaped = 0;
+
+	res = spdk_nvme_qpair_process_completions(qpair, max);
+
+	ctx->reap = NULL;
+
+	if (res < 0) {
+		NVM_DEBUG("FAILED: processing completions: res: %d", res);
+		return -1;
+	}
+
+	return ctx->nreaped;
 }
 
 int nvm_be_spdk_async_wait(struct nvm_dev *dev, struct nvm_async_ctx *ctx)
 {
 	int acc = 0;
 
-	while(ctx->outstanding) {
+	while(ctx->outstanding - ctx->nabandoned) {
 		int res;
 
 		res = nvm_be_spdk_async_poke(dev, ctx, 0);
@@ -481,6 +564,14 @@ int nvm_be_spdk_async_wait(struct nvm_dev *dev, struct nvm_async_ctx *ctx)
 	return acc;
 }
 
+int nvm_be_spdk_async_flush(struct nvm_dev *NVM_UNUSED(dev),
+			    struct nvm_async_ctx *ctx)
+{
+	ctx->ndeferred = 0;
+
+	return spdk_async_ring(ctx);
+}
+
 struct cpl_ctx {
 	struct spdk_nvme_cpl cpl;
 	bool completed;
@@ -498,6 +589,178 @@ static void cmd_sync_admin_cb(void *cb_arg, const struct spdk_nvme_cpl *cpl)
 	ctx->completed = 1;
 }
 
+#if SPDK_VERSION_MAJOR >= 21
+struct abort_ctx {
+	struct spdk_nvme_cpl cpl;
+	atomic_bool completed;
+	atomic_int refs;		///< Waiter and callback, last one frees
+};
+
+static void abort_put(struct abort_ctx *actx)
+{
+	if (atomic_fetch_sub(&actx->refs, 1) == 1)
+		free(actx);
+}
+
+static void spdk_async_abort_cb(void *cb_arg, const struct spdk_nvme_cpl *cpl)
+{
+	struct abort_ctx *actx = cb_arg;
+
+	memcpy(&actx->cpl, cpl, sizeof(*cpl));
+	atomic_store(&actx->completed, true);
+	abort_put(actx);
+}
+
+/**
+ * Ask the device to abort the command of 'wrap' with the NVMe Abort command,
+ * waiting no longer than NVM_BE_SPDK_ABORT_USEC for it to do so
+ *
+ * @return 0 when the device reports the command aborted. Otherwise, -1 is
+ * returned and `errno` set to indicate the error
+ */
+static int spdk_async_abort(struct nvm_be_spdk_state *state,
+			    struct nvm_async_ctx *ctx,
+			    struct nvm_cmd_wrap *wrap)
+{
+	const uint64_t timeout = spdk_get_ticks() + NVM_BE_SPDK_ABORT_USEC *
+				 spdk_get_ticks_hz() / 1000000ULL;
+	struct abort_ctx *actx;
+	int err = 0;
+
+	actx = calloc(1, sizeof(*actx));
+	if (!actx) {
+		NVM_DEBUG("FAILED: calloc");
+		errno = ENOMEM;
+		return -1;
+	}
+	atomic_init(&actx->completed, false);
+	atomic_init(&actx->refs, 2);
+
+	// The command is identified by its callback argument, SPDK holds the CID
+	err = spdk_nvme_ctrlr_cmd_abort_ext(state->ctrlr, ctx->be_ctx, wrap,
+					    spdk_async_abort_cb, actx);
+	if (err) {
+		NVM_DEBUG("FAILED: spdk_nvme_ctrlr_cmd_abort_ext err: %d", err);
+		free(actx);
+		errno = -err;
+		return -1;
+	}
+
+	while (!atomic_load(&actx->completed)) {
+		if (spdk_nvme_ctrlr_process_admin_completions(state->ctrlr) < 0) {
+			NVM_DEBUG("FAILED: processing admin completions");
+			err = EIO;
+			break;
+		}
+		if (spdk_get_ticks() > timeout) {
+			NVM_DEBUG("FAILED: abort timed out");
+			err = ETIMEDOUT;
+			break;
+		}
+	}
+
+	if (!err && spdk_nvme_cpl_is_error(&actx->cpl)) {
+		NVM_DEBUG("FAILED: abort sc: 0x%x", actx->cpl.status.sc);
+		err = EIO;
+	}
+	if (!err && (actx->cpl.cdw0 & 0x1)) {	// Command not aborted
+		NVM_DEBUG("FAILED: device did not abort the command");
+		err = EBUSY;
+	}
+
+	abort_put(actx);	// A late completion frees it when timed out
+
+	if (err) {
+		errno = err;
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Reset the qpair of 'ctx' by disconnecting and reconnecting it, for when the
+ * device will not abort a command. Every command outstanding on the qpair
+ * completes as aborted, the completions are held on 'ctx->failed' as with
+ * spdk_async_ring and those of abandoned commands dropped.
+ */
+static int spdk_async_reset(struct nvm_async_ctx *ctx)
+{
+	struct spdk_nvme_qpair *qpair = ctx->be_ctx;
+	struct nvm_ret **reap = ctx->reap;
+	const uint32_t nreaped = ctx->nreaped;
+	int err;
+
+	ctx->reap = ctx->failed + ctx->nfailed;
+	ctx->nreaped = 0;
+
+	spdk_nvme_ctrlr_disconnect_io_qpair(qpair);
+	// Fails with -ENXIO, after completing what is still outstanding
+	spdk_nvme_qpair_process_completions(qpair, 0);
+
+	ctx->nfailed += ctx->nreaped;
+	ctx->reap = reap;
+	ctx->nreaped = nreaped;
+
+	err = spdk_nvme_ctrlr_reconnect_io_qpair(qpair);
+	if (err) {
+		NVM_DEBUG("FAILED: spdk_nvme_ctrlr_reconnect_io_qpair err: %d",
+			  err);
+		errno = -err;
+		return -1;
+	}
+
+	return 0;
+}
+#endif
+
+void nvm_be_spdk_async_abandon(struct nvm_dev *dev, struct nvm_async_ctx *ctx,
+			       void *tag)
+{
+	struct nvm_cmd_wrap *wrap = tag;
+
+	wrap->ret = NULL;	// Dropped by cmd_async_cb
+
+#if SPDK_VERSION_MAJOR >= 21
+	if (!spdk_async_abort(dev->be_state, ctx, wrap))
+		return;
+
+	if (spdk_async_reset(ctx)) {
+		NVM_DEBUG("FAILED: spdk_async_reset");
+	}
+#else
+	(void)dev;
+	(void)ctx;
+#endif
+}
+
+int nvm_be_spdk_async_cancel(struct nvm_dev *dev, struct nvm_async_ctx *ctx,
+			     struct nvm_ret *ret)
+{
+#if SPDK_VERSION_MAJOR >= 21
+	struct nvm_cmd_wrap *wrap = ret->async.tag;
+
+	if (!wrap || wrap->ret != ret || wrap->async_ctx != ctx) {
+		NVM_DEBUG("FAILED: ret: %p is not outstanding", (void*)ret);
+		errno = ENOENT;
+		return -1;
+	}
+
+	if (!spdk_async_abort(dev->be_state, ctx, wrap))
+		return 0;
+
+	// The command completes as aborted, along with the rest of the qpair
+	if (spdk_async_reset(ctx)) {
+		NVM_DEBUG("FAILED: spdk_async_reset");
+		return -1;
+	}
+
+	return 0;
+#else
+	return nvm_be_nosys_async_cancel(dev, ctx, ret);
+#endif
+}
+
 static inline int cmd_sync_admin(struct nvm_dev *dev, struct nvm_nvme_cmd *cmd,
 				 void *data, size_t data_len,
 				 void *meta, size_t meta_len,
@@ -710,7 +973,7 @@ int nvm_be_spdk_sbbt(struct nvm_dev *dev, struct nvm_addr *addrs,
 	struct nvm_nvme_cmd cmd = { 0 };
 
 	cmd.opcode = NVM_AOPC_SBBT; // Construct command
-	cmd.s12.control = flags;
+	cmd.s12.control = nvm_cmd_control(flags);
 	cmd.s12.naddrs = naddrs - 1;
 
 	if (cmd.s12.naddrs) {
@@ -721,8 +984,7 @@ int nvm_be_spdk_sbbt(struct nvm_dev *dev, struct nvm_addr *addrs,
 			return -1;
 		}
 
-		for (int i = 0; i < naddrs; ++i)
-			addrs_dma[i] = nvm_addr_gen2dev(dev, addrs[i]);
+		nvm_addr_gen2dev_n(dev, addrs, addrs_dma, naddrs);
 
 		cmd.addrs = addrs_phys;
 	} else {
@@ -745,14 +1007,41 @@ static void cmd_sync_cb(void *cb_arg, const struct spdk_nvme_cpl *cpl)
 	nvm_cmd_wrap_cpl(cb_arg, (const struct nvm_nvme_cpl*)cpl);
 }
 
+/**
+ * Ring the doorbell for a command submitted on 'ctx', or leave it to
+ * nvm_be_spdk_async_flush when the command is part of a batch
+ */
+static inline void spdk_async_submitted(struct nvm_async_ctx *ctx)
+{
+	if (ctx->plugged) {
+		ctx->ndeferred += 1;
+		return;
+	}
+
+	if (spdk_async_ring(ctx)) {
+		NVM_DEBUG("FAILED: spdk_async_ring");
+	}
+}
+
 static void cmd_async_cb(void *cb_arg, const struct spdk_nvme_cpl *cpl)
 {
 	struct nvm_cmd_wrap *wrap = cb_arg;
+	struct nvm_async_ctx *ctx = wrap->async_ctx;
+
+	nvm_async_ctx_cpl(ctx, wrap->cmd.opcode);
 
-	wrap->ret->async.ctx->outstanding -= 1;
+	if (!wrap->ret) {		// Abandoned, see async_abandon
+		ctx->nabandoned -= 1;
+		nvm_cmd_wrap_term(wrap);
+		return;
+	}
+	nvm_async_ctx_untrack(ctx, wrap->ret);
 
 	nvm_cmd_wrap_cpl(wrap, (const struct nvm_nvme_cpl*)cpl);
-	wrap->ret->async.cb(wrap->ret, wrap->ret->async.cb_arg);
+	if (ctx->reap)
+		ctx->reap[ctx->nreaped++] = wrap->ret;
+	else
+		wrap->ret->async.cb(wrap->ret, wrap->ret->async.cb_arg);
 	nvm_cmd_wrap_term(wrap);
 }
 
@@ -766,8 +1055,9 @@ static inline int cmd_async_ewrc(struct nvm_dev *dev, struct nvm_addr addrs[],
 	struct nvm_cmd_wrap *wrap = NULL;
 	int err = 0;
 
-	// Early exit when queue is full
-	if ((ret->async.ctx->outstanding + 1) > ret->async.ctx->depth) {
+	// Early exit when queue is full, held completions take entries as well
+	if ((ret->async.ctx->outstanding + ret->async.ctx->nfailed + 1) >
+	    ret->async.ctx->depth) {
 		errno = EAGAIN;
 		return -1;
 	}
@@ -781,16 +1071,19 @@ static inline int cmd_async_ewrc(struct nvm_dev *dev, struct nvm_addr addrs[],
 	}
 
 	// Submit command
-	ret->async.ctx->outstanding += 1;
+	wrap->async_ctx = ret->async.ctx;
+	nvm_async_ctx_sub(ret->async.ctx, opcode);
 
 	err = submit_ioc(state->ctrlr, qpair, &wrap->cmd,
 			 wrap->data, wrap->data_len, wrap->meta,
 			 cmd_async_cb, wrap);
 	if (err) {
-		ret->async.ctx->outstanding -= 1;
+		nvm_async_ctx_cpl(ret->async.ctx, opcode);
 		NVM_DEBUG("FAILED: submission failed");
 		goto failed;
 	}
+	nvm_async_ctx_track(ret->async.ctx, ret, wrap);
+	spdk_async_submitted(ret->async.ctx);
 
 	return 0;
 
@@ -1029,8 +1322,9 @@ static inline int cmd_async_pass(struct nvm_dev *dev, struct nvm_nvme_cmd *cmd,
 	struct nvm_cmd_wrap *wrap = NULL;
 	int err = 0;
 
-	// Early exit when queue is full
-	if ((ret->async.ctx->outstanding + 1) > ret->async.ctx->depth) {
+	// Early exit when queue is full, held completions take entries as well
+	if ((ret->async.ctx->outstanding + ret->async.ctx->nfailed + 1) >
+	    ret->async.ctx->depth) {
 		errno = EAGAIN;
 		return -1;
 	}
@@ -1044,17 +1338,21 @@ static inline int cmd_async_pass(struct nvm_dev *dev, struct nvm_nvme_cmd *cmd,
 	}
 
 	// NVM_CMD_ASYNC: submission of pass-through command
-	ret->async.ctx->outstanding += 1;
+	wrap->cmd.opcode = cmd->opcode;		// Accounted on completion
+	wrap->async_ctx = ret->async.ctx;
+	nvm_async_ctx_sub(ret->async.ctx, cmd->opcode);
 	err = submit_ioc(state->ctrlr, qpair, cmd,
 			 wrap->data, wrap->data_len,
 			 wrap->meta,
 			 cmd_async_cb,
 			 wrap);
 	if (err) {
-		ret->async.ctx->outstanding -= 1;
+		nvm_async_ctx_cpl(ret->async.ctx, cmd->opcode);
 		NVM_DEBUG("FAILED: submission failed");
 		goto failed;
 	}
+	nvm_async_ctx_track(ret->async.ctx, ret, wrap);
+	spdk_async_submitted(ret->async.ctx);
 
 	return 0;
 
@@ -1161,6 +1459,10 @@ struct nvm_be nvm_be_spdk = {
 	.async_term = nvm_be_spdk_async_term,
 	.async_poke = nvm_be_spdk_async_poke,
 	.async_wait = nvm_be_spdk_async_wait,
+	.async_flush = nvm_be_spdk_async_flush,
+	.async_reap = nvm_be_spdk_async_reap,
+	.async_abandon = nvm_be_spdk_async_abandon,
+	.async_cancel = nvm_be_spdk_async_cancel,
 
 	.idfy = nvm_be_spdk_idfy,
 	.rprt = nvm_be_spdk_rprt,
@@ -25,21 +25,28 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#ifndef WIN32
+#include <malloc.h>
+#endif
 #include <liblightnvm.h>
 #include <nvm_dev.h>
 #include <nvm_be.h>
+#include <nvm_buf.h>
 
 #ifdef NVM_BE_SPDK_ENABLED
 #include <spdk/stdinc.h>
 #include <spdk/env.h>
 #include <spdk/nvme.h>
 #else
-static inline void* spdk_dma_malloc(size_t NVM_UNUSED(size),
-				    size_t NVM_UNUSED(align),
-				    uint64_t *NVM_UNUSED(phys_addr))
+#define SPDK_ENV_SOCKET_ID_ANY	(-1)
+static inline void* spdk_dma_malloc_socket(size_t NVM_UNUSED(size),
+					   size_t NVM_UNUSED(align),
+					   uint64_t *NVM_UNUSED(phys_addr),
+					   int NVM_UNUSED(socket_id))
 {
 	errno = ENOSYS;
 	return NULL;
@@ -56,30 +63,97 @@ void *spdk_dma_realloc(void *NVM_UNUSED(buf), size_t NVM_UNUSED(size),
 }
 #endif
 
+#ifdef WIN32
+/**
+ * Header in front of a buffer from `_aligned_malloc`, as `_aligned_msize` must
+ * be given the alignment the buffer was allocated with
+ */
+struct nvm_buf_virt_hdr {
+	size_t alignment;	///< Alignment given to _aligned_malloc
+	size_t hdr_nbytes;	///< Bytes in front of the buffer
+};
+
+static inline struct nvm_buf_virt_hdr *virt_hdr(void *buf)
+{
+	return (struct nvm_buf_virt_hdr *)buf - 1;
+}
+#endif
+
 void *nvm_buf_virt_alloc(size_t alignment, size_t nbytes)
 {
+#ifdef WIN32
+	struct nvm_buf_virt_hdr *hdr;
+	size_t hdr_nbytes;
+	char *raw;
+#endif
+
 	if (!nbytes) {
 		errno = EINVAL;
 		return NULL;
 	}
 #ifdef WIN32
-	return _aligned_malloc(nbytes, alignment);
+	if (!alignment)
+		alignment = sizeof(void *);
+	hdr_nbytes = ((sizeof(*hdr) + alignment - 1) / alignment) * alignment;
+
+	raw = _aligned_malloc(hdr_nbytes + nbytes, alignment);
+	if (!raw)
+		return NULL;
+
+	hdr = virt_hdr(raw + hdr_nbytes);
+	hdr->alignment = alignment;
+	hdr->hdr_nbytes = hdr_nbytes;
+
+	return raw + hdr_nbytes;
 #else
 	return aligned_alloc(alignment, nbytes);
 #endif
 }
 
-void *nvm_buf_virt_realloc(void *NVM_UNUSED(buf), size_t NVM_UNUSED(alignment),
-	size_t NVM_UNUSED(nbytes))
+void *nvm_buf_virt_realloc(void *buf, size_t alignment, size_t nbytes)
 {
-	errno = ENOSYS;
-	return NULL;
+	size_t buf_nbytes, cls_nbytes = 1;
+	void *grown;
+
+	if (!buf)
+		return nvm_buf_virt_alloc(alignment, nbytes);
+
+	if (!nbytes) {
+		errno = EINVAL;
+		return NULL;
+	}
+#ifdef WIN32
+	buf_nbytes = _aligned_msize((char *)buf - virt_hdr(buf)->hdr_nbytes,
+				    virt_hdr(buf)->alignment, 0) -
+		     virt_hdr(buf)->hdr_nbytes;
+#else
+	buf_nbytes = malloc_usable_size(buf);
+#endif
+	if ((nbytes <= buf_nbytes) &&
+	    !(alignment && ((uintptr_t)buf % alignment)))
+		return buf;
+
+	while ((cls_nbytes < nbytes) || (cls_nbytes < alignment))
+		cls_nbytes <<= 1;
+
+	grown = nvm_buf_virt_alloc(alignment, cls_nbytes);
+	if (!grown) {
+		NVM_DEBUG("FAILED: nvm_buf_virt_alloc cls_nbytes: %zu",
+			  cls_nbytes);
+		return NULL;
+	}
+
+	memcpy(grown, buf, buf_nbytes < cls_nbytes ? buf_nbytes : cls_nbytes);
+	nvm_buf_virt_free(buf);
+
+	return grown;
 }
 
 void nvm_buf_virt_free(void *buf)
 {
 #ifdef WIN32
-	_aligned_free(buf);
+	if (buf)
+		_aligned_free((char *)buf - virt_hdr(buf)->hdr_nbytes);
 #else
 	free(buf);
 #endif
@@ -107,11 +181,14 @@ void *nvm_buf_alloc(const struct nvm_dev *dev, size_t nbytes, uint64_t *phys)
 	switch(dev->be->id) {
 	case NVM_BE_IOCTL:
 	case NVM_BE_LBD:
-		return nvm_buf_virt_alloc(alignment, nbytes);
+		return nvm_buf_pool_alloc(alignment, nbytes, dev->numa_node);
 
 	case NVM_BE_SPDK:
 	case NVM_BE_NOCD:
-		return spdk_dma_malloc(nbytes, alignment, phys);
+		return spdk_dma_malloc_socket(nbytes, alignment, phys,
+					      dev->numa_node < 0 ?
+					      SPDK_ENV_SOCKET_ID_ANY :
+					      dev->numa_node);
 
 	case NVM_BE_ANY:
 		errno = EINVAL;
@@ -145,7 +222,7 @@ void *nvm_buf_realloc(const struct nvm_dev *dev, void *buf, size_t nbytes,
 	switch (dev->be->id) {
 	case NVM_BE_IOCTL:
 	case NVM_BE_LBD:
-		return nvm_buf_virt_realloc(buf, alignment, nbytes);
+		return nvm_buf_pool_realloc(buf, alignment, nbytes);
 
 	case NVM_BE_SPDK:
 	case NVM_BE_NOCD:
@@ -165,7 +242,7 @@ void nvm_buf_free(const struct nvm_dev *dev, void *buf)
 	switch(dev->be->id) {
 		case NVM_BE_IOCTL:
 		case NVM_BE_LBD:
-			nvm_buf_virt_free(buf);
+			nvm_buf_pool_free(buf);
 			break;
 
 		case NVM_BE_SPDK:
@@ -212,11 +289,228 @@ int nvm_buf_vtophys(const struct nvm_dev *dev, void *buf, uint64_t *phys)
 	return 0;
 }
 
+#define NVM_BUF_BLK_NBYTES (1UL << 16)	// Unit of work for fill/diff kernels
+#define NVM_BUF_PAR_NBYTES (1UL << 22)	// Parallelize fill/diff above this
+#define NVM_BUF_FILL_PERIOD 26		// Period of the A-Z fill pattern
+
+static inline size_t buf_nblks(size_t nbytes)
+{
+	return (nbytes + NVM_BUF_BLK_NBYTES - 1) / NVM_BUF_BLK_NBYTES;
+}
+
+static inline size_t buf_blk_nbytes(size_t blk, size_t nbytes)
+{
+	const size_t bgn = blk * NVM_BUF_BLK_NBYTES;
+
+	return nbytes - bgn < NVM_BUF_BLK_NBYTES ? nbytes - bgn :
+						   NVM_BUF_BLK_NBYTES;
+}
+
 void nvm_buf_fill(char *buf, size_t nbytes)
 {
-	#pragma omp parallel for schedule(static, 1)
-	for (size_t i = 0; i < nbytes; ++i)
-		buf[i] = (i % 26) + 65;
+	const size_t span = NVM_BUF_FILL_PERIOD * 64;
+	char pattern[NVM_BUF_FILL_PERIOD * 65];
+
+	// Copies of a whole number of periods keep the phase across copies
+	for (size_t i = 0; i < sizeof(pattern); ++i)
+		pattern[i] = (i % NVM_BUF_FILL_PERIOD) + 65;
+
+	#pragma omp parallel for schedule(static) if (nbytes > NVM_BUF_PAR_NBYTES)
+	for (size_t blk = 0; blk < buf_nblks(nbytes); ++blk) {
+		const size_t bgn = blk * NVM_BUF_BLK_NBYTES;
+		const size_t end = bgn + buf_blk_nbytes(blk, nbytes);
+
+		for (size_t i = bgn; i < end; i += span) {
+			memcpy(buf + i, pattern + (i % NVM_BUF_FILL_PERIOD),
+			       end - i < span ? end - i : span);
+		}
+	}
+}
+
+/**
+ * Counts the non-zero bytes of 'word'
+ */
+static inline size_t buf_word_nz(uint64_t word)
+{
+	word |= word >> 4;
+	word |= word >> 2;
+	word |= word >> 1;
+
+	return __builtin_popcountll(word & 0x0101010101010101ULL);
+}
+
+static inline uint64_t buf_word_ld(const char *buf)
+{
+	uint64_t word;
+
+	memcpy(&word, buf, sizeof(word));
+
+	return word;
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define NVM_BUF_DIFF_AVX2
+
+__attribute__((target("avx2")))
+static size_t buf_diff_avx2(const char *expected, const char *actual,
+			    size_t nbytes)
+{
+	size_t diff = 0, i = 0;
+
+	for (; i + 32 <= nbytes; i += 32) {
+		__m256i exp = _mm256_loadu_si256((const __m256i *)(expected + i));
+		__m256i act = _mm256_loadu_si256((const __m256i *)(actual + i));
+		unsigned int eq;
+
+		eq = _mm256_movemask_epi8(_mm256_cmpeq_epi8(exp, act));
+		diff += 32 - __builtin_popcount(eq);
+	}
+	for (; i < nbytes; ++i)
+		diff += expected[i] != actual[i];
+
+	return diff;
+}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define NVM_BUF_DIFF_NEON
+
+static size_t buf_diff_neon(const char *expected, const char *actual,
+			    size_t nbytes)
+{
+	size_t diff = 0, i = 0;
+
+	for (; i + 16 <= nbytes; i += 16) {
+		uint8x16_t exp = vld1q_u8((const uint8_t *)(expected + i));
+		uint8x16_t act = vld1q_u8((const uint8_t *)(actual + i));
+
+		diff += vaddvq_u8(vshrq_n_u8(vmvnq_u8(vceqq_u8(exp, act)), 7));
+	}
+	for (; i < nbytes; ++i)
+		diff += expected[i] != actual[i];
+
+	return diff;
+}
+#endif
+
+static size_t buf_diff_blk(const char *expected, const char *actual,
+			   size_t nbytes)
+{
+	size_t diff = 0, i = 0;
+
+	// Equal blocks are the common case, and libc memcmp is vectorized
+	if (!memcmp(expected, actual, nbytes))
+		return 0;
+
+#if defined(NVM_BUF_DIFF_AVX2)
+	if (__builtin_cpu_supports("avx2"))
+		return buf_diff_avx2(expected, actual, nbytes);
+#elif defined(NVM_BUF_DIFF_NEON)
+	return buf_diff_neon(expected, actual, nbytes);
+#endif
+
+	for (; i + 8 <= nbytes; i += 8)
+		diff += buf_word_nz(buf_word_ld(expected + i) ^
+				    buf_word_ld(actual + i));
+	for (; i < nbytes; ++i)
+		diff += expected[i] != actual[i];
+
+	return diff;
+}
+
+/**
+ * Word 'widx' of the pattern stream for 'seed', using the splitmix64 mixer
+ */
+static inline uint64_t buf_pattern_word(uint64_t seed, uint64_t widx)
+{
+	uint64_t z = seed + (widx + 1) * 0x9E3779B97F4A7C15ULL;
+
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+
+	return z ^ (z >> 31);
+}
+
+static inline char buf_pattern_byte(uint64_t seed, uint64_t offset)
+{
+	return (char)(buf_pattern_word(seed, offset >> 3) >> ((offset & 7) * 8));
+}
+
+/**
+ * Word at byte 'offset' of the pattern stream, 'offset' must be word-aligned,
+ * byte-order matches `buf_pattern_byte` on any host
+ */
+static inline uint64_t buf_pattern_ld(uint64_t seed, uint64_t offset)
+{
+	uint64_t word = buf_pattern_word(seed, offset >> 3);
+	char bytes[8];
+
+	for (int k = 0; k < 8; ++k)
+		bytes[k] = (char)(word >> (k * 8));
+
+	return buf_word_ld(bytes);
+}
+
+static void buf_pattern_fill_blk(char *buf, size_t nbytes, uint64_t seed,
+				 uint64_t offset)
+{
+	size_t i = 0;
+
+	for (; (i < nbytes) && ((offset + i) & 7); ++i)
+		buf[i] = buf_pattern_byte(seed, offset + i);
+	for (; i + 8 <= nbytes; i += 8) {
+		const uint64_t word = buf_pattern_ld(seed, offset + i);
+
+		memcpy(buf + i, &word, sizeof(word));
+	}
+	for (; i < nbytes; ++i)
+		buf[i] = buf_pattern_byte(seed, offset + i);
+}
+
+static size_t buf_pattern_diff_blk(const char *actual, size_t nbytes,
+				   uint64_t seed, uint64_t offset)
+{
+	size_t diff = 0, i = 0;
+
+	for (; (i < nbytes) && ((offset + i) & 7); ++i)
+		diff += actual[i] != buf_pattern_byte(seed, offset + i);
+	for (; i + 8 <= nbytes; i += 8)
+		diff += buf_word_nz(buf_word_ld(actual + i) ^
+				    buf_pattern_ld(seed, offset + i));
+	for (; i < nbytes; ++i)
+		diff += actual[i] != buf_pattern_byte(seed, offset + i);
+
+	return diff;
+}
+
+void nvm_buf_pattern_fill(char *buf, size_t nbytes, uint64_t seed,
+			  uint64_t offset)
+{
+	#pragma omp parallel for schedule(static) if (nbytes > NVM_BUF_PAR_NBYTES)
+	for (size_t blk = 0; blk < buf_nblks(nbytes); ++blk) {
+		const size_t bgn = blk * NVM_BUF_BLK_NBYTES;
+
+		buf_pattern_fill_blk(buf + bgn, buf_blk_nbytes(blk, nbytes),
+				     seed, offset + bgn);
+	}
+}
+
+size_t nvm_buf_pattern_diff(const char *actual, size_t nbytes, uint64_t seed,
+			    uint64_t offset)
+{
+	size_t diff = 0;
+
+	#pragma omp parallel for schedule(static) reduction(+:diff) \
+		if (nbytes > NVM_BUF_PAR_NBYTES)
+	for (size_t blk = 0; blk < buf_nblks(nbytes); ++blk) {
+		const size_t bgn = blk * NVM_BUF_BLK_NBYTES;
+
+		diff += buf_pattern_diff_blk(actual + bgn,
+					     buf_blk_nbytes(blk, nbytes),
+					     seed, offset + bgn);
+	}
+
+	return diff;
 }
 
 void nvm_buf_pr(const char *buf, size_t nbytes)
@@ -238,9 +532,14 @@ size_t nvm_buf_diff(const char *expected, const char *actual, size_t nbytes)
 {
 	size_t diff = 0;
 
-	for (size_t i = 0; i < nbytes; ++i)
-		if (expected[i] != actual[i])
-			++diff;
+	#pragma omp parallel for schedule(static) reduction(+:diff) \
+		if (nbytes > NVM_BUF_PAR_NBYTES)
+	for (size_t blk = 0; blk < buf_nblks(nbytes); ++blk) {
+		const size_t bgn = blk * NVM_BUF_BLK_NBYTES;
+
+		diff += buf_diff_blk(expected + bgn, actual + bgn,
+				     buf_blk_nbytes(blk, nbytes));
+	}
 
 	return diff;
 }
@@ -307,6 +606,7 @@ void nvm_buf_set_pr(struct nvm_buf_set *bufs)
 	printf("  bufs: %p\n", (void*)bufs);
 	printf("  nbytes: %zu\n", bufs->nbytes);
 	printf("  nbytes_meta: %zu\n", bufs->nbytes_meta);
+	printf("  pattern: %d\n", bufs->pattern);
 	printf("  write: %p\n", (void*)bufs->write);
 	printf("  write_meta: %p\n", (void*)bufs->write_meta);
 	printf("  read: %p\n",(void*) bufs->read);
@@ -325,15 +625,27 @@ void nvm_buf_set_free(struct nvm_buf_set *bufs)
 		return;
 	}
 
+	if (!bufs->pattern) {
+		nvm_buf_free(bufs->dev, bufs->read);
+		nvm_buf_free(bufs->dev, bufs->read_meta);
+	}
 	nvm_buf_free(bufs->dev, bufs->write);
 	nvm_buf_free(bufs->dev, bufs->write_meta);
-	nvm_buf_free(bufs->dev, bufs->read);
-	nvm_buf_free(bufs->dev, bufs->read_meta);
 	nvm_buf_free(bufs->dev, bufs);
 }
 
 void nvm_buf_set_fill(struct nvm_buf_set *bufs)
 {
+	if (bufs->pattern) {
+		if (bufs->nbytes)
+			nvm_buf_pattern_fill(bufs->write, bufs->nbytes,
+					     bufs->seed, 0);
+		if (bufs->nbytes_meta)
+			nvm_buf_pattern_fill(bufs->write_meta,
+					     bufs->nbytes_meta, ~bufs->seed, 0);
+		return;
+	}
+
 	if (bufs->nbytes) {
 		nvm_buf_fill(bufs->write, bufs->nbytes);
 		memset(bufs->read, 0, bufs->nbytes);
@@ -397,3 +709,73 @@ struct nvm_buf_set *nvm_buf_set_alloc(struct nvm_dev *dev, size_t nbytes,
 
 	return bufs;
 }
+
+struct nvm_buf_set *nvm_buf_set_alloc_pattern(struct nvm_dev *dev,
+					      size_t nbytes,
+					      size_t nbytes_meta,
+					      uint64_t seed)
+{
+	struct nvm_buf_set *bufs = NULL;
+
+	bufs = nvm_buf_alloc(dev, sizeof(*bufs), NULL);
+	if (!bufs) {
+		NVM_DEBUG("FAILED: allocating bufs");
+		return NULL;
+	}
+	memset(bufs, 0, sizeof(*bufs));
+
+	bufs->dev = dev;
+	bufs->pattern = 1;
+	bufs->seed = seed;
+
+	if (nbytes) {
+		bufs->nbytes = nbytes;
+
+		bufs->write = nvm_buf_alloc(dev, bufs->nbytes, NULL);
+		if (!bufs->write) {
+			NVM_DEBUG("FAILED: alloc nbytes: %zu", bufs->nbytes);
+			nvm_buf_set_free(bufs);
+			return NULL;
+		}
+		bufs->read = bufs->write;
+	}
+
+	if (nbytes_meta) {
+		bufs->nbytes_meta = nbytes_meta;
+
+		bufs->write_meta = nvm_buf_alloc(dev, bufs->nbytes_meta, NULL);
+		if (!bufs->write_meta) {
+			NVM_DEBUG("FAILED: alloc m nbytes_meta: %zu",
+				  bufs->nbytes_meta);
+			nvm_buf_set_free(bufs);
+			return NULL;
+		}
+		bufs->read_meta = bufs->write_meta;
+	}
+
+	return bufs;
+}
+
+size_t nvm_buf_set_diff(const struct nvm_buf_set *bufs)
+{
+	size_t ndiff = 0;
+
+	if (bufs->pattern) {
+		if (bufs->nbytes)
+			ndiff += nvm_buf_pattern_diff(bufs->read, bufs->nbytes,
+						      bufs->seed, 0);
+		if (bufs->nbytes_meta)
+			ndiff += nvm_buf_pattern_diff(bufs->read_meta,
+						      bufs->nbytes_meta,
+						      ~bufs->seed, 0);
+		return ndiff;
+	}
+
+	if (bufs->nbytes)
+		ndiff += nvm_buf_diff(bufs->write, bufs->read, bufs->nbytes);
+	if (bufs->nbytes_meta)
+		ndiff += nvm_buf_diff(bufs->write_meta, bufs->read_meta,
+				      bufs->nbytes_meta);
+
+	return ndiff;
+}
@@ -0,0 +1,720 @@
+/*
+ * buf_pool - Size-classed hugepage buffer pool for the kernel backends
+ *
+ * Copyright (C) Simon A. F. Lund <slund@cnexlabs.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <liblightnvm.h>
+#include <nvm_buf.h>
+
+#ifndef NVM_BUF_POOL_ENABLED
+void *nvm_buf_pool_alloc(size_t alignment, size_t nbytes,
+			 int NVM_UNUSED(node))
+{
+	return nvm_buf_virt_alloc(alignment, nbytes);
+}
+
+void *nvm_buf_pool_realloc(void *buf, size_t alignment, size_t nbytes)
+{
+	return nvm_buf_virt_realloc(buf, alignment, nbytes);
+}
+
+void nvm_buf_pool_free(void *buf)
+{
+	nvm_buf_virt_free(buf);
+}
+
+size_t nvm_buf_pool_trim(void)
+{
+	return 0;
+}
+#else
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+#define REGION_NBYTES (1UL << NVM_BUF_POOL_REGION_SH)
+#define REGION_SLAB -2		///< Region cls of a slab, see 'nvm_buf_slab'
+#define SLAB_NPAGES (REGION_NBYTES >> NVM_BUF_POOL_CLS_MIN_SH)
+
+/*
+ * Regions are looked up by the 2MB window containing the start of a block,
+ * using a two-level radix over the 47-bit user address space. Only the first
+ * window of a region is registered, since blocks in a slab never cross a
+ * window and spans are only ever handed out by their base address.
+ */
+#define RADIX_LEAF_SH 14
+#define RADIX_TOP_SH (47 - NVM_BUF_POOL_REGION_SH - RADIX_LEAF_SH)
+
+struct nvm_buf_region {
+	char *base;
+	size_t nbytes;		///< Number of bytes mapped
+	size_t nused;		///< Bytes handed out as blocks
+	int cls;		///< Size-class index, -1 for direct mappings
+	int home;		///< Depot home, see 'node_home'
+	size_t nidle;		///< Bytes found in the depots, see 'depot_trim'
+	int trim;		///< Whether 'depot_trim' unmaps it
+	int8_t slab_cls[SLAB_NPAGES];	///< Class of the block at each page
+};
+
+typedef _Atomic(struct nvm_buf_region *) nvm_buf_region_ref;
+
+struct nvm_buf_depot {
+	pthread_mutex_t lock;
+	void *head;		///< Intrusive list of free blocks
+	size_t nblks;
+};
+
+/**
+ * Slab region shared by the size-classes below REGION_NBYTES of a home, blocks
+ * are carved from it in batches of NVM_BUF_POOL_SLAB_NBYTES
+ */
+struct nvm_buf_slab {
+	pthread_mutex_t lock;
+	struct nvm_buf_region *region;	///< Region carved from, or NULL
+	size_t off;			///< Bytes of it carved
+};
+
+struct nvm_buf_tcache {
+	int nblks[NVM_BUF_POOL_NHOMES][NVM_BUF_POOL_NCLS];
+	void *blks[NVM_BUF_POOL_NHOMES][NVM_BUF_POOL_NCLS]
+		  [NVM_BUF_POOL_TCACHE_NBLKS];
+};
+
+static _Atomic(nvm_buf_region_ref *) radix[1UL << RADIX_TOP_SH];
+static struct nvm_buf_depot depots[NVM_BUF_POOL_NHOMES][NVM_BUF_POOL_NCLS];
+static struct nvm_buf_slab slabs[NVM_BUF_POOL_NHOMES];
+
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tcache_key;
+static int tcache_key_valid;
+static atomic_int hugetlb_skip;
+static size_t page_nbytes;
+
+static _Thread_local struct nvm_buf_tcache *tcache;
+
+static inline size_t cls_nbytes(int cls)
+{
+	return 1UL << (cls + NVM_BUF_POOL_CLS_MIN_SH);
+}
+
+/**
+ * Blocks are kept apart by the NUMA node backing them, home 0 holds blocks
+ * without a node preference and home n + 1 blocks preferring node n
+ */
+static inline int node_home(int node)
+{
+	return (node < 0 || node >= NVM_BUF_POOL_NNODES) ? 0 : node + 1;
+}
+
+static inline int cls_tcache_nblks(int cls)
+{
+	size_t nblks = NVM_BUF_POOL_TCACHE_NBYTES / cls_nbytes(cls);
+
+	return nblks > NVM_BUF_POOL_TCACHE_NBLKS ? NVM_BUF_POOL_TCACHE_NBLKS :
+						   (int)nblks;
+}
+
+/**
+ * Returns the size-class index serving 'nbytes' at 'alignment', or -1 when it
+ * is larger than the largest class
+ */
+static inline int cls_find(size_t alignment, size_t nbytes)
+{
+	size_t want = nbytes > alignment ? nbytes : alignment;
+	int sh = NVM_BUF_POOL_CLS_MIN_SH;
+
+	while ((1UL << sh) < want) {
+		if (++sh > NVM_BUF_POOL_CLS_MAX_SH)
+			return -1;
+	}
+
+	return sh - NVM_BUF_POOL_CLS_MIN_SH;
+}
+
+static inline nvm_buf_region_ref *radix_slot(const void *buf, int create)
+{
+	const uintptr_t key = (uintptr_t)buf >> NVM_BUF_POOL_REGION_SH;
+	const uintptr_t top = key >> RADIX_LEAF_SH;
+	nvm_buf_region_ref *leaf;
+
+	if (top >= (1UL << RADIX_TOP_SH))
+		return NULL;
+
+	leaf = atomic_load_explicit(&radix[top], memory_order_acquire);
+	if (!leaf && create) {
+		nvm_buf_region_ref *expected = NULL;
+
+		leaf = calloc(1UL << RADIX_LEAF_SH, sizeof(*leaf));
+		if (!leaf)
+			return NULL;
+
+		if (!atomic_compare_exchange_strong(&radix[top], &expected,
+						    leaf)) {
+			free(leaf);
+			leaf = expected;
+		}
+	}
+	if (!leaf)
+		return NULL;
+
+	return &leaf[key & ((1UL << RADIX_LEAF_SH) - 1)];
+}
+
+static inline struct nvm_buf_region *region_lookup(const void *buf)
+{
+	nvm_buf_region_ref *slot = radix_slot(buf, 0);
+
+	return slot ? atomic_load_explicit(slot, memory_order_acquire) : NULL;
+}
+
+/**
+ * Returns the size-class index of the block 'buf' in 'region'
+ */
+static inline int region_cls(const struct nvm_buf_region *region,
+			     const void *buf)
+{
+	if (region->cls != REGION_SLAB)
+		return region->cls;
+
+	return region->slab_cls[((const char *)buf - region->base) >>
+				NVM_BUF_POOL_CLS_MIN_SH];
+}
+
+/**
+ * Prefer 'node' for the pages of the given range, done before pre-faulting
+ * such that pages are placed on first touch
+ */
+static void region_bind(void *base, size_t nbytes, int node)
+{
+#ifdef SYS_mbind
+	unsigned long nodemask[NVM_BUF_POOL_NNODES / (8 * sizeof(long)) + 1];
+
+	if (node < 0 || node >= NVM_BUF_POOL_NNODES)
+		return;
+
+	memset(nodemask, 0, sizeof(nodemask));
+	nodemask[node / (8 * sizeof(long))] = 1UL <<
+					       (node % (8 * sizeof(long)));
+
+	if (syscall(SYS_mbind, base, nbytes, MPOL_PREFERRED, nodemask,
+		    NVM_BUF_POOL_NNODES + 1, 0)) {
+		NVM_DEBUG("INFO: mbind failed node: %d, errno: %d", node, errno);
+	}
+#else
+	(void)base; (void)nbytes; (void)node;
+#endif
+}
+
+static void region_prefault(char *base, size_t nbytes)
+{
+	for (size_t off = 0; off < nbytes; off += page_nbytes)
+		((volatile char *)base)[off] = 0;
+}
+
+/**
+ * Maps 'nbytes', a multiple of REGION_NBYTES, aligned to REGION_NBYTES and
+ * preferring 'node'. Tries MAP_HUGETLB first, then an over-sized anonymous
+ * mapping trimmed to alignment and advised for THP. The mapping is pre-faulted
+ * either way. After MAP_HUGETLB fails, the next NVM_BUF_POOL_HUGETLB_RETRY
+ * mappings go straight to THP, and it is tried again thereafter.
+ */
+static void *region_map(size_t nbytes, int node)
+{
+	char *raw, *base;
+	size_t head;
+
+#ifdef MAP_HUGETLB
+	int skip = atomic_load_explicit(&hugetlb_skip, memory_order_relaxed);
+
+	while (skip && !atomic_compare_exchange_weak(&hugetlb_skip, &skip,
+						     skip - 1))
+		;
+
+	if (!skip) {
+		base = mmap(NULL, nbytes, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (base != MAP_FAILED) {
+			region_bind(base, nbytes, node);
+			region_prefault(base, nbytes);
+			return base;
+		}
+
+		NVM_DEBUG("INFO: MAP_HUGETLB failed, using THP, errno: %d",
+			  errno);
+		atomic_store_explicit(&hugetlb_skip,
+				      NVM_BUF_POOL_HUGETLB_RETRY,
+				      memory_order_relaxed);
+	}
+#endif
+
+	raw = mmap(NULL, nbytes + REGION_NBYTES, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (raw == MAP_FAILED) {
+		NVM_DEBUG("FAILED: mmap nbytes: %zu", nbytes);
+		return NULL;
+	}
+
+	head = (REGION_NBYTES - ((uintptr_t)raw & (REGION_NBYTES - 1))) &
+	       (REGION_NBYTES - 1);
+	base = raw + head;
+	if (head)
+		munmap(raw, head);
+	munmap(base + nbytes, REGION_NBYTES - head);
+
+#ifdef MADV_HUGEPAGE
+	madvise(base, nbytes, MADV_HUGEPAGE);
+#endif
+	region_bind(base, nbytes, node);
+	region_prefault(base, nbytes);
+
+	return base;
+}
+
+static struct nvm_buf_region *region_alloc(size_t nbytes, int cls, int node)
+{
+	struct nvm_buf_region *region;
+	nvm_buf_region_ref *slot;
+
+	region = malloc(sizeof(*region));
+	if (!region) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	region->nbytes = nbytes;
+	region->nused = cls == REGION_SLAB ? 0 : nbytes;
+	region->cls = cls;
+	region->home = node_home(node);
+	region->nidle = 0;
+	region->trim = 0;
+	region->base = region_map(nbytes, node);
+	if (!region->base) {
+		free(region);
+		return NULL;
+	}
+
+	slot = radix_slot(region->base, 1);
+	if (!slot) {
+		NVM_DEBUG("FAILED: radix_slot base: %p", (void *)region->base);
+		munmap(region->base, region->nbytes);
+		free(region);
+		errno = ENOMEM;
+		return NULL;
+	}
+	atomic_store_explicit(slot, region, memory_order_release);
+
+	return region;
+}
+
+static void region_free(struct nvm_buf_region *region)
+{
+	atomic_store_explicit(radix_slot(region->base, 0), NULL,
+			      memory_order_release);
+	munmap(region->base, region->nbytes);
+	free(region);
+}
+
+static void depot_push(int home, int cls, void *blks[], int nblks)
+{
+	struct nvm_buf_depot *depot = &depots[home][cls];
+
+	pthread_mutex_lock(&depot->lock);
+	for (int i = 0; i < nblks; ++i) {
+		if ((cls_nbytes(cls) > REGION_NBYTES) &&
+		    ((depot->nblks + 1) * cls_nbytes(cls) >
+		     NVM_BUF_POOL_DEPOT_NBYTES)) {
+			region_free(region_lookup(blks[i]));
+			continue;
+		}
+
+		*(void **)blks[i] = depot->head;
+		depot->head = blks[i];
+		++depot->nblks;
+	}
+	pthread_mutex_unlock(&depot->lock);
+}
+
+static int depot_pop(int home, int cls, void *blks[], int nblks)
+{
+	struct nvm_buf_depot *depot = &depots[home][cls];
+	int npopped = 0;
+
+	pthread_mutex_lock(&depot->lock);
+	for (; (npopped < nblks) && depot->head; ++npopped) {
+		blks[npopped] = depot->head;
+		depot->head = *(void **)depot->head;
+		--depot->nblks;
+	}
+	pthread_mutex_unlock(&depot->lock);
+
+	return npopped;
+}
+
+/**
+ * Unmaps the regions of 'home' of which every block is in the depots, returns
+ * the number of bytes released. Blocks are counted against their region in a
+ * first pass, the second marks the regions left idle, and the third unlinks
+ * their blocks and unmaps a region with its last block, after having read the
+ * link it holds. No blocks are carved meanwhile, as the slab lock is held.
+ */
+static size_t depot_trim(int home)
+{
+	struct nvm_buf_slab *slab = &slabs[home];
+	size_t nbytes = 0;
+
+	pthread_mutex_lock(&slab->lock);
+	for (int cls = 0; cls < NVM_BUF_POOL_NCLS; ++cls)
+		pthread_mutex_lock(&depots[home][cls].lock);
+
+	for (int cls = 0; cls < NVM_BUF_POOL_NCLS; ++cls) {
+		for (void *blk = depots[home][cls].head; blk;
+		     blk = *(void **)blk)
+			region_lookup(blk)->nidle += cls_nbytes(cls);
+	}
+	for (int cls = 0; cls < NVM_BUF_POOL_NCLS; ++cls) {
+		for (void *blk = depots[home][cls].head; blk;
+		     blk = *(void **)blk) {
+			struct nvm_buf_region *region = region_lookup(blk);
+
+			region->trim = region->nidle == region->nused;
+		}
+	}
+
+	for (int cls = 0; cls < NVM_BUF_POOL_NCLS; ++cls) {
+		struct nvm_buf_depot *depot = &depots[home][cls];
+		void **link = &depot->head;
+
+		while (*link) {
+			void *blk = *link;
+			void *next = *(void **)blk;
+			struct nvm_buf_region *region = region_lookup(blk);
+
+			if (!region->trim) {
+				region->nidle = 0;
+				link = (void **)blk;
+				continue;
+			}
+
+			*link = next;
+			--depot->nblks;
+			region->nidle -= cls_nbytes(cls);
+			if (region->nidle)
+				continue;
+
+			if (region == slab->region) {
+				slab->region = NULL;
+				slab->off = 0;
+			}
+			nbytes += region->nbytes;
+			region_free(region);
+		}
+	}
+
+	for (int cls = NVM_BUF_POOL_NCLS - 1; cls >= 0; --cls)
+		pthread_mutex_unlock(&depots[home][cls].lock);
+	pthread_mutex_unlock(&slab->lock);
+
+	return nbytes;
+}
+
+/**
+ * Carves a batch of blocks of 'cls' from the slab of the home of 'node',
+ * mapping a new slab when the current one is full. Returns the first block
+ * and sets 'nblks' to the number of blocks carved.
+ */
+static char *slab_carve(int node, int cls, size_t *nblks)
+{
+	const size_t blk_nbytes = cls_nbytes(cls);
+	struct nvm_buf_slab *slab = &slabs[node_home(node)];
+	struct nvm_buf_region *region;
+	size_t off;
+
+	pthread_mutex_lock(&slab->lock);
+	off = (slab->off + blk_nbytes - 1) & ~(blk_nbytes - 1);
+	if (!slab->region || off + blk_nbytes > REGION_NBYTES) {
+		// The rest of a full slab is left unused
+		region = region_alloc(REGION_NBYTES, REGION_SLAB, node);
+		if (!region) {
+			pthread_mutex_unlock(&slab->lock);
+			return NULL;
+		}
+		slab->region = region;
+		off = 0;
+	}
+	region = slab->region;
+
+	*nblks = NVM_BUF_POOL_SLAB_NBYTES / blk_nbytes;
+	if (*nblks > (REGION_NBYTES - off) / blk_nbytes)
+		*nblks = (REGION_NBYTES - off) / blk_nbytes;
+	if (!*nblks)
+		*nblks = 1;
+
+	for (size_t i = 0; i < *nblks; ++i) {
+		region->slab_cls[(off + i * blk_nbytes) >>
+				 NVM_BUF_POOL_CLS_MIN_SH] = cls;
+	}
+	region->nused += *nblks * blk_nbytes;
+	slab->off = off + *nblks * blk_nbytes;
+	pthread_mutex_unlock(&slab->lock);
+
+	return region->base + off;
+}
+
+/**
+ * Returns one block of 'cls' on 'node' and hands the rest of those carved or
+ * mapped along with it to the depot, a block of REGION_NBYTES or more gets a
+ * region of its own
+ */
+static void *depot_grow(int node, int cls)
+{
+	const size_t blk_nbytes = cls_nbytes(cls);
+	struct nvm_buf_region *region;
+	size_t nblks;
+	char *base;
+
+	if (blk_nbytes >= REGION_NBYTES) {
+		region = region_alloc(blk_nbytes, cls, node);
+
+		return region ? region->base : NULL;
+	}
+
+	base = slab_carve(node, cls, &nblks);
+	if (!base)
+		return NULL;
+
+	if (nblks > 1) {
+		struct nvm_buf_depot *depot = &depots[node_home(node)][cls];
+
+		pthread_mutex_lock(&depot->lock);
+		for (size_t i = 1; i < nblks; ++i) {
+			void *blk = base + i * blk_nbytes;
+
+			*(void **)blk = depot->head;
+			depot->head = blk;
+		}
+		depot->nblks += nblks - 1;
+		pthread_mutex_unlock(&depot->lock);
+	}
+
+	return base;
+}
+
+static void tcache_flush(void *arg)
+{
+	struct nvm_buf_tcache *cache = arg;
+
+	for (int home = 0; home < NVM_BUF_POOL_NHOMES; ++home) {
+		for (int cls = 0; cls < NVM_BUF_POOL_NCLS; ++cls)
+			depot_push(home, cls, cache->blks[home][cls],
+				   cache->nblks[home][cls]);
+	}
+
+	free(cache);
+	tcache = NULL;
+}
+
+static struct nvm_buf_tcache *tcache_get(void)
+{
+	if (tcache)
+		return tcache;
+	if (!tcache_key_valid)
+		return NULL;
+
+	tcache = calloc(1, sizeof(*tcache));
+	if (tcache)
+		pthread_setspecific(tcache_key, tcache);
+
+	return tcache;
+}
+
+static void pool_init(void)
+{
+	long sz = sysconf(_SC_PAGESIZE);
+
+	page_nbytes = sz > 0 ? (size_t)sz : 4096;
+
+	for (int home = 0; home < NVM_BUF_POOL_NHOMES; ++home) {
+		for (int cls = 0; cls < NVM_BUF_POOL_NCLS; ++cls)
+			pthread_mutex_init(&depots[home][cls].lock, NULL);
+		pthread_mutex_init(&slabs[home].lock, NULL);
+	}
+
+	tcache_key_valid = !pthread_key_create(&tcache_key, tcache_flush);
+}
+
+void *nvm_buf_pool_alloc(size_t alignment, size_t nbytes, int node)
+{
+	const int home = node_home(node);
+	struct nvm_buf_tcache *cache;
+	struct nvm_buf_region *region;
+	void *buf;
+	int cls, *nblks;
+
+	if (!nbytes) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if ((alignment & (alignment - 1)) || (alignment > REGION_NBYTES))
+		return nvm_buf_virt_alloc(alignment, nbytes);
+
+	pthread_once(&pool_once, pool_init);
+
+	cls = cls_find(alignment, nbytes);
+	if (cls < 0) {
+		region = region_alloc((nbytes + REGION_NBYTES - 1) &
+				      ~(REGION_NBYTES - 1), -1, node);
+
+		return region ? region->base :
+				nvm_buf_virt_alloc(alignment, nbytes);
+	}
+
+	cache = tcache_get();
+	nblks = cache ? &cache->nblks[home][cls] : NULL;
+	if (nblks && *nblks)
+		return cache->blks[home][cls][--*nblks];
+
+	if (nblks && cls_tcache_nblks(cls)) {
+		*nblks = depot_pop(home, cls, cache->blks[home][cls],
+				   (cls_tcache_nblks(cls) + 1) / 2);
+		if (*nblks)
+			return cache->blks[home][cls][--*nblks];
+	} else if (depot_pop(home, cls, &buf, 1)) {
+		return buf;
+	}
+
+	buf = depot_grow(node, cls);
+
+	return buf ? buf : nvm_buf_virt_alloc(alignment, nbytes);
+}
+
+void *nvm_buf_pool_realloc(void *buf, size_t alignment, size_t nbytes)
+{
+	struct nvm_buf_region *region;
+	size_t buf_nbytes;
+	void *grown;
+	int cls;
+
+	if (!buf)
+		return nvm_buf_pool_alloc(alignment, nbytes, -1);
+
+	if (!nbytes) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	region = region_lookup(buf);
+	if (!region)
+		return nvm_buf_virt_realloc(buf, alignment, nbytes);
+
+	cls = region_cls(region, buf);
+	buf_nbytes = cls < 0 ? region->nbytes : cls_nbytes(cls);
+	if ((nbytes <= buf_nbytes) &&
+	    !(alignment && ((uintptr_t)buf % alignment)))
+		return buf;
+
+	grown = nvm_buf_pool_alloc(alignment, nbytes, region->home - 1);
+	if (!grown) {
+		NVM_DEBUG("FAILED: nvm_buf_pool_alloc nbytes: %zu", nbytes);
+		return NULL;
+	}
+
+	memcpy(grown, buf, buf_nbytes < nbytes ? buf_nbytes : nbytes);
+	nvm_buf_pool_free(buf);
+
+	return grown;
+}
+
+void nvm_buf_pool_free(void *buf)
+{
+	struct nvm_buf_region *region;
+	struct nvm_buf_tcache *cache;
+	int home, cls, cap, *nblks;
+
+	if (!buf)
+		return;
+
+	region = region_lookup(buf);
+	if (!region) {
+		nvm_buf_virt_free(buf);
+		return;
+	}
+	if (region->cls == -1) {
+		region_free(region);
+		return;
+	}
+
+	home = region->home;
+	cls = region_cls(region, buf);
+	cap = cls_tcache_nblks(cls);
+	cache = tcache_get();
+	if (!(cache && cap)) {
+		depot_push(home, cls, &buf, 1);
+		return;
+	}
+
+	nblks = &cache->nblks[home][cls];
+	if (*nblks == cap) {
+		const int nflush = (cap + 1) / 2;
+
+		*nblks -= nflush;
+		depot_push(home, cls, &cache->blks[home][cls][*nblks], nflush);
+	}
+	cache->blks[home][cls][(*nblks)++] = buf;
+}
+
+size_t nvm_buf_pool_trim(void)
+{
+	size_t nbytes = 0;
+
+	pthread_once(&pool_once, pool_init);
+
+	if (tcache) {
+		for (int home = 0; home < NVM_BUF_POOL_NHOMES; ++home) {
+			for (int cls = 0; cls < NVM_BUF_POOL_NCLS; ++cls) {
+				depot_push(home, cls, tcache->blks[home][cls],
+					   tcache->nblks[home][cls]);
+				tcache->nblks[home][cls] = 0;
+			}
+		}
+	}
+
+	for (int home = 0; home < NVM_BUF_POOL_NHOMES; ++home)
+		nbytes += depot_trim(home);
+
+	atomic_store_explicit(&hugetlb_skip, 0, memory_order_relaxed);
+
+	return nbytes;
+}
+#endif
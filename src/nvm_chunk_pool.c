@@ -0,0 +1,416 @@
+/*
+ * chunk_pool - Pool of chunks erased in the background ahead of writes
+ *
+ * Copyright (C) Simon A. F. Lund <slund@cnexlabs.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <liblightnvm.h>
+#include <liblightnvm_spec.h>
+#include <nvm_dev.h>
+#include <nvm_chunk_pool.h>
+
+static inline struct nvm_chunk_pool_pu *pool_pu(struct nvm_chunk_pool *pool,
+						struct nvm_addr addr)
+{
+	const struct nvm_geo *geo = nvm_dev_get_geo(pool->dev);
+
+	if (addr.l.pugrp >= geo->l.npugrp || addr.l.punit >= geo->l.npunit)
+		return NULL;
+
+	return &pool->pus[addr.l.pugrp * geo->l.npunit + addr.l.punit];
+}
+
+/**
+ * Erase 'addr' on the ASYNC context 'ctx', or synchronously when it is NULL
+ */
+static int pool_erase(struct nvm_chunk_pool *pool, struct nvm_async_ctx *ctx,
+		      struct nvm_addr addr)
+{
+	struct nvm_ret ret = { 0 };
+
+	if (!ctx)
+		return nvm_cmd_erase(pool->dev, &addr, 1, NULL, 0x0, &ret);
+
+	ret.async.ctx = ctx;
+	if (nvm_cmd_erase(pool->dev, &addr, 1, NULL, NVM_CMD_ASYNC, &ret))
+		return -1;	// Propagate errno
+	if (nvm_async_wait(pool->dev, ctx) < 0)
+		return -1;	// Propagate errno
+	if (ret.status) {
+		errno = EIO;
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Get the PU to refill next, one below its target with chunks to erase
+ *
+ * @return Index of the PU, or -1 when none needs a refill
+ */
+static int pool_pick(struct nvm_chunk_pool *pool)
+{
+	for (uint32_t i = 0; i < pool->npus; ++i) {
+		const uint32_t idx = (pool->cursor + i) % pool->npus;
+		const struct nvm_chunk_pool_pu *pu = &pool->pus[idx];
+
+		if (pu->ndirty && pu->nready < pool->nready_min) {
+			pool->cursor = (idx + 1) % pool->npus;
+			return idx;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * Wait for 'throttle_usec' with the lock held and tell whether the device was
+ * idle meanwhile, that is, whether no command was dispatched to it
+ *
+ * @return 1 when the device was idle, 0 when it was not or the pool stops
+ */
+static int pool_idle(struct nvm_chunk_pool *pool)
+{
+	const unsigned int ncmds = atomic_load(&pool->dev->ncmds);
+	struct timespec until;
+
+	if (!pool->throttle_usec)
+		return 1;
+
+	clock_gettime(CLOCK_REALTIME, &until);
+	until.tv_sec += pool->throttle_usec / 1000000;
+	until.tv_nsec += (pool->throttle_usec % 1000000) * 1000;
+	if (until.tv_nsec >= 1000000000) {
+		until.tv_sec += 1;
+		until.tv_nsec -= 1000000000;
+	}
+	while (!pool->stop && pthread_cond_timedwait(&pool->cond, &pool->lock,
+						     &until) == 0)
+		;
+
+	return !pool->stop && atomic_load(&pool->dev->ncmds) == ncmds;
+}
+
+/**
+ * Background refill, one erase at a time such that at most one PU at a time
+ * is busy erasing on behalf of the pool. A PU with erased chunks left is only
+ * refilled once the device has been idle for the throttle, one without any is
+ * refilled right away as its next get would erase inline.
+ */
+static void *pool_refill(void *arg)
+{
+	struct nvm_chunk_pool *pool = arg;
+	int idle = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	while (!pool->stop) {
+		struct nvm_chunk_pool_pu *pu;
+		struct nvm_addr addr;
+		int idx, err;
+
+		idx = pool_pick(pool);
+		if (idx < 0) {
+			idle = 0;
+			pthread_cond_wait(&pool->cond, &pool->lock);
+			continue;
+		}
+		pu = &pool->pus[idx];
+		if (pu->nready && !idle) {
+			idle = pool_idle(pool);
+			continue;	// Pick again, the pool may have changed
+		}
+		idle = 0;
+
+		addr = pu->dirty[--pu->ndirty];
+		pu->nerasing += 1;
+		pthread_mutex_unlock(&pool->lock);
+
+		err = pool_erase(pool, pool->ctx, addr);
+
+		pthread_mutex_lock(&pool->lock);
+		pu->nerasing -= 1;
+		if (err) {
+			NVM_DEBUG("FAILED: pool_erase, dropping chunk");
+			pool->nfailed += 1;
+		} else {
+			pu->ready[pu->nready++] = addr;
+			pool->nerased += 1;
+		}
+		pthread_cond_broadcast(&pool->erased);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+/**
+ * Adopt the free chunks of all PUs as erased, taking the report of each PU
+ */
+static int pool_adopt(struct nvm_chunk_pool *pool)
+{
+	const struct nvm_geo *geo = nvm_dev_get_geo(pool->dev);
+
+	for (uint32_t idx = 0; idx < pool->npus; ++idx) {
+		struct nvm_chunk_pool_pu *pu = &pool->pus[idx];
+		struct nvm_addr addr = { .val = 0 };
+		struct nvm_spec_rprt *rprt;
+
+		addr.l.pugrp = idx / geo->l.npunit;
+		addr.l.punit = idx % geo->l.npunit;
+
+		rprt = nvm_cmd_rprt(pool->dev, &addr, 0x0, NULL);
+		if (!rprt) {
+			NVM_DEBUG("FAILED: nvm_cmd_rprt");
+			return -1;	// Propagate errno
+		}
+
+		for (uint32_t i = 0; i < rprt->ndescr && i < geo->l.nchunk;
+		     ++i) {
+			if (rprt->descr[i].cs != NVM_CHUNK_STATE_FREE)
+				continue;
+
+			addr.l.chunk = i;
+			pu->ready[pu->nready++] = addr;
+		}
+
+		nvm_buf_free(pool->dev, rprt);
+	}
+
+	return 0;
+}
+
+struct nvm_chunk_pool *nvm_chunk_pool_create(struct nvm_dev *dev,
+					     uint32_t nready)
+{
+	const struct nvm_geo *geo = nvm_dev_get_geo(dev);
+	const uint32_t npus = geo->l.npugrp * geo->l.npunit;
+	struct nvm_chunk_pool *pool;
+	int err;
+
+	if (nvm_dev_get_verid(dev) != NVM_SPEC_VERID_20) {
+		NVM_DEBUG("FAILED: unsupported verid");
+		errno = ENOSYS;
+		return NULL;
+	}
+
+	pool = calloc(1, sizeof(*pool) + npus * sizeof(*pool->pus));
+	if (!pool) {
+		NVM_DEBUG("FAILED: calloc pool");
+		return NULL;
+	}
+	pool->dev = dev;
+	pool->npus = npus;
+	pool->nready_min = nready;
+	pool->throttle_usec = NVM_CHUNK_POOL_THROTTLE_USEC;
+
+	pool->addrs = calloc(2 * npus * geo->l.nchunk, sizeof(*pool->addrs));
+	if (!pool->addrs) {
+		NVM_DEBUG("FAILED: calloc addrs");
+		free(pool);
+		return NULL;
+	}
+	for (uint32_t idx = 0; idx < npus; ++idx) {
+		pool->pus[idx].ready = &pool->addrs[2 * idx * geo->l.nchunk];
+		pool->pus[idx].dirty = pool->pus[idx].ready + geo->l.nchunk;
+	}
+
+	// SPDK qpairs are not thread-safe, the thread needs one of its own
+	if (nvm_dev_get_be_id(dev) == NVM_BE_SPDK) {
+		pool->ctx = nvm_async_init(dev, 1, 0);
+		if (!pool->ctx) {
+			NVM_DEBUG("FAILED: nvm_async_init");
+			err = errno;
+			goto failed;
+		}
+	}
+
+	if (pool_adopt(pool)) {
+		err = errno;
+		goto failed;
+	}
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+	pthread_cond_init(&pool->erased, NULL);
+
+	err = pthread_create(&pool->thread, NULL, pool_refill, pool);
+	if (err) {
+		NVM_DEBUG("FAILED: pthread_create, err: %d", err);
+		pthread_cond_destroy(&pool->erased);
+		pthread_cond_destroy(&pool->cond);
+		pthread_mutex_destroy(&pool->lock);
+		goto failed;
+	}
+
+	return pool;
+
+failed:
+	if (pool->ctx)
+		nvm_async_term(dev, pool->ctx);
+	free(pool->addrs);
+	free(pool);
+	errno = err;
+	return NULL;
+}
+
+void nvm_chunk_pool_destroy(struct nvm_chunk_pool *pool)
+{
+	if (!pool)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = 1;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	pthread_join(pool->thread, NULL);
+
+	if (pool->ctx)
+		nvm_async_term(pool->dev, pool->ctx);
+	pthread_cond_destroy(&pool->erased);
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->addrs);
+	free(pool);
+}
+
+int nvm_chunk_pool_set_throttle(struct nvm_chunk_pool *pool, uint64_t usec)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->throttle_usec = usec;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	return 0;
+}
+
+int nvm_chunk_pool_get(struct nvm_chunk_pool *pool, struct nvm_addr *addr)
+{
+	struct nvm_chunk_pool_pu *pu = pool_pu(pool, *addr);
+
+	if (!pu) {
+		NVM_DEBUG("FAILED: invalid PU");
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		struct nvm_addr dirty;
+		int err;
+
+		if (pu->nready) {
+			*addr = pu->ready[--pu->nready];
+			pthread_cond_signal(&pool->cond);	// Refill
+			pthread_mutex_unlock(&pool->lock);
+			return 0;
+		}
+
+		// Nothing ready, wait for a background erase of the PU
+		if (!pu->ndirty) {
+			if (!pu->nerasing)
+				break;
+
+			pthread_cond_wait(&pool->erased, &pool->lock);
+			continue;
+		}
+
+		// Otherwise erase inline, dropping chunks which fail it
+		dirty = pu->dirty[--pu->ndirty];
+		pthread_mutex_unlock(&pool->lock);
+		err = pool_erase(pool, NULL, dirty);
+		pthread_mutex_lock(&pool->lock);
+
+		if (!err) {
+			pthread_mutex_unlock(&pool->lock);
+			*addr = dirty;
+			return 0;
+		}
+
+		NVM_DEBUG("FAILED: pool_erase, dropping chunk");
+		pool->nfailed += 1;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	NVM_DEBUG("FAILED: no chunks left on PU");
+	errno = ENOSPC;
+	return -1;
+}
+
+int nvm_chunk_pool_put(struct nvm_chunk_pool *pool, struct nvm_addr addr)
+{
+	const struct nvm_geo *geo = nvm_dev_get_geo(pool->dev);
+	struct nvm_chunk_pool_pu *pu = pool_pu(pool, addr);
+
+	if (!pu || addr.l.chunk >= geo->l.nchunk) {
+		NVM_DEBUG("FAILED: invalid chunk");
+		errno = EINVAL;
+		return -1;
+	}
+
+	addr.l.sectr = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	if (pu->nready + pu->ndirty + pu->nerasing >= geo->l.nchunk) {
+		pthread_mutex_unlock(&pool->lock);
+		NVM_DEBUG("FAILED: PU holds all its chunks already");
+		errno = EINVAL;
+		return -1;
+	}
+	pu->dirty[pu->ndirty++] = addr;
+	pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	return 0;
+}
+
+void nvm_chunk_pool_pr(struct nvm_chunk_pool *pool)
+{
+	size_t nready = 0, ndirty = 0, nerasing = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	for (uint32_t idx = 0; idx < pool->npus; ++idx) {
+		nready += pool->pus[idx].nready;
+		ndirty += pool->pus[idx].ndirty;
+		nerasing += pool->pus[idx].nerasing;
+	}
+
+	printf("chunk_pool:\n");
+	printf("  npus: %u\n", pool->npus);
+	printf("  nready_min: %u\n", pool->nready_min);
+	printf("  throttle_usec: %"PRIu64"\n", pool->throttle_usec);
+	printf("  nready: %zu\n", nready);
+	printf("  ndirty: %zu\n", ndirty);
+	printf("  nerasing: %zu\n", nerasing);
+	printf("  nerased: %zu\n", pool->nerased);
+	printf("  nfailed: %zu\n", pool->nfailed);
+	pthread_mutex_unlock(&pool->lock);
+}
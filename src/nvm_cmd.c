@@ -29,6 +29,9 @@
 #include <nvm_be.h>
 #include <nvm_dev.h>
 #include <nvm_cmd.h>
+#include <nvm_rcache.h>
+#include <nvm_async.h>
+#include <nvm_sched.h>
 #include <nvm_sgl.h>
 
 int nvm_cmd_is_scalar(uint16_t opcode)
@@ -65,26 +68,24 @@ void nvm_cmd_wrap_cpl(struct nvm_cmd_wrap *wrap,
 	wrap->completed = (cpl->status.sc != 0 || cpl->status.sct != 0) ? -1 : 1;
 }
 
-static inline void cmd_wrap_setup_sgl(struct nvm_cmd_wrap *wrap, void *data,
-				      void *meta, int flags)
+static inline int cmd_wrap_setup_sgl(struct nvm_cmd_wrap *wrap, void *data,
+				     void *meta, int flags)
 {
 	struct nvm_sgl *sgl = data;
 	uint64_t phys;
 
 	if (!(flags & NVM_CMD_SGL)) {
-		return;
+		return 0;
 	}
 
 	wrap->cmd.psdt = NVM_NVME_PSDT_SGL_MPTR_CONTIGUOUS;
 
+	// A single descriptor, e.g. physically contiguous data, needs no segment
 	if (sgl->ndescr == 1) {
 		wrap->cmd.dptr.sgl = sgl->descriptors[0];
-	} else {
-		nvm_buf_vtophys(wrap->dev, sgl->descriptors, &phys);
-
-		wrap->cmd.dptr.sgl.unkeyed.type = NVM_NVME_SGL_DESCR_TYPE_LAST_SEGMENT;
-		wrap->cmd.dptr.sgl.unkeyed.len = sgl->ndescr * sizeof(struct nvm_nvme_sgl_descriptor);
-		wrap->cmd.dptr.sgl.addr = phys;
+	} else if (nvm_sgl_chain(wrap->dev, sgl, &wrap->cmd.dptr.sgl)) {
+		NVM_DEBUG("FAILED: nvm_sgl_chain");
+		return -1;
 	}
 
 	wrap->data = NULL;
@@ -95,13 +96,14 @@ static inline void cmd_wrap_setup_sgl(struct nvm_cmd_wrap *wrap, void *data,
 
 		sgl = meta;
 
-		nvm_buf_vtophys(wrap->dev, sgl->descriptors, &phys);
 		if (sgl->ndescr == 1) {
+			nvm_buf_vtophys(wrap->dev, sgl->descriptors, &phys);
 			wrap->cmd.mptr = phys;
 		} else {
-			sgl->indirect->unkeyed.type = NVM_NVME_SGL_DESCR_TYPE_LAST_SEGMENT;
-			sgl->indirect->unkeyed.len = sgl->ndescr * sizeof(struct nvm_nvme_sgl_descriptor);
-			sgl->indirect->addr = phys;
+			if (nvm_sgl_chain(wrap->dev, sgl, sgl->indirect)) {
+				NVM_DEBUG("FAILED: nvm_sgl_chain");
+				return -1;
+			}
 
 			nvm_buf_vtophys(wrap->dev, sgl->indirect, &phys);
 			wrap->cmd.mptr = phys;
@@ -110,6 +112,8 @@ static inline void cmd_wrap_setup_sgl(struct nvm_cmd_wrap *wrap, void *data,
 		wrap->meta = NULL;
 		wrap->meta_len = 0;
 	}
+
+	return 0;
 }
 
 /**
@@ -157,7 +161,8 @@ struct nvm_cmd_wrap *nvm_cmd_wrap_setup(struct nvm_dev *dev, int opcode,
 		wrap->data_len = wrap->dsmr_len;
 
 		for(int idx = 0; idx < naddrs; ++idx) {
-			const uint64_t slba = nvm_addr_gen2dev(dev, addrs[idx]);
+			const uint64_t slba = nvm_be_addr_dev(dev, addrs[idx],
+							      flags);
 
 			wrap->dsmr_dma[idx].cattr = 0;
 			wrap->dsmr_dma[idx].nlb = geo->l.nsectr;
@@ -173,7 +178,7 @@ struct nvm_cmd_wrap *nvm_cmd_wrap_setup(struct nvm_dev *dev, int opcode,
 	switch (dev->verid) {
 	case NVM_SPEC_VERID_12:
 		wrap->cmd.s12.naddrs = naddrs - 1;
-		wrap->cmd.s12.control = flags;
+		wrap->cmd.s12.control = nvm_cmd_control(flags);
 
 		wrap->data_len = data ? geo->g.sector_nbytes * naddrs : 0;
 		wrap->meta_len = geo->g.meta_nbytes * naddrs;
@@ -208,12 +213,15 @@ struct nvm_cmd_wrap *nvm_cmd_wrap_setup(struct nvm_dev *dev, int opcode,
 		}
 	}
 
-	cmd_wrap_setup_sgl(wrap, data, meta, flags);
+	if (cmd_wrap_setup_sgl(wrap, data, meta, flags)) {
+		NVM_DEBUG("FAILED: cmd_wrap_setup_sgl");
+		goto failed;
+	}
 	
 	switch (opcode) {
 	case NVM_DOPC_SCALAR_WRITE:
 	case NVM_DOPC_SCALAR_READ:
-		wrap->cmd.addrs = nvm_addr_gen2dev(dev, addrs[0]);
+		wrap->cmd.addrs = nvm_be_addr_dev(dev, addrs[0], flags);
 		/* FALLTHRU */
 
 	case NVM_DOPC_SCALAR_ERASE:
@@ -234,13 +242,11 @@ struct nvm_cmd_wrap *nvm_cmd_wrap_setup(struct nvm_dev *dev, int opcode,
 			goto failed;
 		}
 
-		for (int i = 0; i < naddrs; ++i) {
-			wrap->addrs_dma[i] = nvm_addr_gen2dev(dev, addrs[i]);
-		}
+		nvm_be_addrs_dev(dev, addrs, wrap->addrs_dma, naddrs, flags);
 
 		wrap->cmd.addrs = addrs_phys;
 	} else {
-		wrap->cmd.addrs = nvm_addr_gen2dev(dev, addrs[0]);
+		wrap->cmd.addrs = nvm_be_addr_dev(dev, addrs[0], flags);
 	}
 
 	if (dst) {		// Addrs. for COPY(DST)
@@ -254,12 +260,12 @@ struct nvm_cmd_wrap *nvm_cmd_wrap_setup(struct nvm_dev *dev, int opcode,
 				goto failed;
 			}
 
-			for (int i = 0; i < naddrs; ++i) {
-				wrap->dst_dma[i] = nvm_addr_gen2dev(dev, dst[i]);
-			}
+			nvm_be_addrs_dev(dev, dst, wrap->dst_dma, naddrs,
+					 flags);
 			wrap->cmd.addrs_dst = dst_phys;
 		} else {
-			wrap->cmd.addrs_dst = nvm_addr_gen2dev(dev, dst[0]);
+			wrap->cmd.addrs_dst = nvm_be_addr_dev(dev, dst[0],
+							      flags);
 		}
 	}
 
@@ -443,8 +449,8 @@ int nvm_cmd_sfeat(struct nvm_dev *dev, enum nvm_nvme_feat_id id,
 	return dev->be->sfeat(dev, id, feat, ret);
 }
 
-int nvm_cmd_erase(struct nvm_dev *dev, struct nvm_addr addrs[], int naddrs,
-		  void *meta, uint16_t flags, struct nvm_ret *ret)
+static int cmd_erase(struct nvm_dev *dev, struct nvm_addr addrs[], int naddrs,
+		     void *meta, uint16_t flags, struct nvm_ret *ret)
 {
 	int opt = flags & NVM_CMD_MASK_ADDR;
 
@@ -467,9 +473,9 @@ int nvm_cmd_erase(struct nvm_dev *dev, struct nvm_addr addrs[], int naddrs,
 	}
 }
 
-int nvm_cmd_write(struct nvm_dev *dev, struct nvm_addr addrs[], int naddrs,
-		  const void *data, const void *meta, uint16_t flags,
-		  struct nvm_ret *ret)
+static int cmd_write(struct nvm_dev *dev, struct nvm_addr addrs[], int naddrs,
+		     const void *data, const void *meta, uint16_t flags,
+		     struct nvm_ret *ret)
 {
 	int opt = flags & NVM_CMD_MASK_ADDR;
 
@@ -488,9 +494,9 @@ int nvm_cmd_write(struct nvm_dev *dev, struct nvm_addr addrs[], int naddrs,
 	}
 }
 
-int nvm_cmd_read(struct nvm_dev *dev, struct nvm_addr addrs[], int naddrs,
-		 void *data, void *meta, uint16_t flags,
-		 struct nvm_ret *ret)
+static int cmd_read(struct nvm_dev *dev, struct nvm_addr addrs[], int naddrs,
+		    void *data, void *meta, uint16_t flags,
+		    struct nvm_ret *ret)
 {
 	int opt = flags & NVM_CMD_MASK_ADDR;
 
@@ -509,9 +515,186 @@ int nvm_cmd_read(struct nvm_dev *dev, struct nvm_addr addrs[], int naddrs,
 	}
 }
 
+static int cmd_copy(struct nvm_dev *dev, struct nvm_addr src[],
+		    struct nvm_addr dst[], int naddrs, uint16_t flags,
+		    struct nvm_ret *ret)
+{
+	return dev->be->vector_copy(dev, src, dst, naddrs, flags, ret);
+}
+
+static int cmd_dispatch(struct nvm_dev *dev, const struct nvm_cmd_desc *cmd,
+			uint16_t flags)
+{
+	switch (cmd->opc) {
+	case NVM_CMD_DESC_ERASE:
+		return cmd_erase(dev, cmd->addrs, cmd->naddrs, cmd->meta,
+				 flags, cmd->ret);
+	case NVM_CMD_DESC_WRITE:
+		return cmd_write(dev, cmd->addrs, cmd->naddrs, cmd->data,
+				 cmd->meta, flags, cmd->ret);
+	case NVM_CMD_DESC_READ:
+		return cmd_read(dev, cmd->addrs, cmd->naddrs, cmd->data,
+				cmd->meta, flags, cmd->ret);
+	case NVM_CMD_DESC_COPY:
+		return cmd_copy(dev, cmd->addrs, cmd->dst, cmd->naddrs, flags,
+				cmd->ret);
+	}
+
+	NVM_DEBUG("FAILED: cmd->opc: %d", cmd->opc);
+	errno = EINVAL;
+	return -1;
+}
+
+/**
+ * Dispatch through the read cache, reads are served from it or fill it, and
+ * everything else invalidates what it changes before it is submitted and
+ * holds off fills until it completes, ASYNC commands are accounted for by
+ * their backend
+ */
+static int cmd_dispatch_cached(struct nvm_dev *dev,
+			       const struct nvm_cmd_desc *cmd, uint16_t flags)
+{
+	const int iomd = (flags & NVM_CMD_MASK_IOMD) ?
+			 (flags & NVM_CMD_MASK_IOMD) :
+			 (dev->cmd_opts & NVM_CMD_MASK_IOMD);
+	uint64_t ticket;
+	int err;
+
+	if (cmd->opc != NVM_CMD_DESC_READ) {
+		nvm_rcache_inval(dev, cmd, flags);
+		if (iomd & NVM_CMD_ASYNC)
+			return cmd_dispatch(dev, cmd, flags);
+
+		nvm_rcache_wr_sub(dev);
+		err = cmd_dispatch(dev, cmd, flags);
+		nvm_rcache_wr_cpl(dev);
+
+		return err;
+	}
+
+	if (nvm_rcache_read(dev, cmd, flags, &ticket))
+		return 0;
+
+	err = cmd_read(dev, cmd->addrs, cmd->naddrs, cmd->data, cmd->meta,
+		       flags, cmd->ret);
+	if (!err)
+		nvm_rcache_fill(dev, cmd, flags, ticket);
+
+	return err;
+}
+
+int nvm_cmd_dispatch(struct nvm_dev *dev, const struct nvm_cmd_desc *cmd,
+		     uint16_t flags)
+{
+	atomic_fetch_add_explicit(&dev->ncmds, 1, memory_order_relaxed);
+
+	if (dev->rcache)
+		return cmd_dispatch_cached(dev, cmd, flags);
+
+	return cmd_dispatch(dev, cmd, flags);
+}
+
+/**
+ * Submit 'cmd' through the scheduler of its ASYNC context when it has one,
+ * otherwise directly to the backend
+ */
+static inline int cmd_submit(struct nvm_dev *dev,
+			     const struct nvm_cmd_desc *cmd, uint16_t flags)
+{
+	if (nvm_sched_active(flags, cmd->ret))
+		return nvm_sched_submit(dev, cmd, flags);
+
+	return nvm_cmd_dispatch(dev, cmd, flags);
+}
+
+int nvm_cmd_erase(struct nvm_dev *dev, struct nvm_addr addrs[], int naddrs,
+		  void *meta, uint16_t flags, struct nvm_ret *ret)
+{
+	const struct nvm_cmd_desc cmd = {
+		.opc = NVM_CMD_DESC_ERASE, .addrs = addrs, .naddrs = naddrs,
+		.meta = meta, .ret = ret,
+	};
+
+	return cmd_submit(dev, &cmd, flags);
+}
+
+int nvm_cmd_write(struct nvm_dev *dev, struct nvm_addr addrs[], int naddrs,
+		  const void *data, const void *meta, uint16_t flags,
+		  struct nvm_ret *ret)
+{
+	const struct nvm_cmd_desc cmd = {
+		.opc = NVM_CMD_DESC_WRITE, .addrs = addrs, .naddrs = naddrs,
+		.data = (void *)data, .meta = (void *)meta, .ret = ret,
+	};
+
+	return cmd_submit(dev, &cmd, flags);
+}
+
+int nvm_cmd_read(struct nvm_dev *dev, struct nvm_addr addrs[], int naddrs,
+		 void *data, void *meta, uint16_t flags,
+		 struct nvm_ret *ret)
+{
+	const struct nvm_cmd_desc cmd = {
+		.opc = NVM_CMD_DESC_READ, .addrs = addrs, .naddrs = naddrs,
+		.data = data, .meta = meta, .ret = ret,
+	};
+
+	return cmd_submit(dev, &cmd, flags);
+}
+
 int nvm_cmd_copy(struct nvm_dev *dev, struct nvm_addr src[],
 		 struct nvm_addr dst[], int naddrs, uint16_t flags,
 		 struct nvm_ret *ret)
 {
-	return dev->be->vector_copy(dev, src, dst, naddrs, flags, ret);
+	const struct nvm_cmd_desc cmd = {
+		.opc = NVM_CMD_DESC_COPY, .addrs = src, .dst = dst,
+		.naddrs = naddrs, .ret = ret,
+	};
+
+	return cmd_submit(dev, &cmd, flags);
+}
+
+int nvm_cmd_submit_batch(struct nvm_dev *dev, struct nvm_async_ctx *ctx,
+			 struct nvm_cmd_desc cmds[], int ncmds, uint16_t flags)
+{
+	int nqueued = 0;
+
+	if (!ctx || !cmds || ncmds < 0) {
+		NVM_DEBUG("FAILED: ctx: %p, cmds: %p, ncmds: %d", (void*)ctx,
+			  (void*)cmds, ncmds);
+		errno = EINVAL;
+		return -1;
+	}
+
+	flags = (flags & ~NVM_CMD_SYNC) | NVM_CMD_ASYNC;
+
+	ctx->plugged = 1;
+	for (; nqueued < ncmds; ++nqueued) {
+		struct nvm_cmd_desc *cmd = &cmds[nqueued];
+		int err;
+
+		if (!cmd->ret) {
+			NVM_DEBUG("FAILED: cmds[%d].ret: NULL", nqueued);
+			errno = EINVAL;
+			break;
+		}
+		cmd->ret->async.ctx = ctx;
+
+		err = cmd_submit(dev, cmd, flags);
+		if (err)
+			break;		// Propagate errno
+	}
+	ctx->plugged = 0;
+
+	// Deferred commands failing submission are completed as aborted
+	if (ctx->ndeferred && dev->be->async_flush(dev, ctx) < 0) {
+		NVM_DEBUG("FAILED: async_flush");
+	}
+
+	if (!nqueued && ncmds) {
+		NVM_DEBUG("FAILED: no commands accepted");
+		return -1;	// Propagate errno
+	}
+
+	return nqueued;
 }
@@ -26,13 +26,18 @@
  * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
 #include <liblightnvm.h>
 #include <nvm_be.h>
 #include <nvm_dev.h>
+#include <nvm_rcache.h>
 
 const char *nvm_pmode_str(int pmode) {
 	switch (pmode) {
@@ -79,6 +84,156 @@ static inline void nvm_dev_cmd_opts_pr(const struct nvm_dev *dev)
 	       (dev->cmd_opts & NVM_CMD_PRP) ? "PRP" : "SGL");
 }
 
+/**
+ * Reads the list of CPUs of the given NUMA node e.g. "0-7,16-23"
+ */
+static int nvm_dev_numa_cpulist(int node, char *cpulist, size_t len)
+{
+	char path[64];
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+		 node);
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return -1;
+
+	if (!fgets(cpulist, len, fp)) {
+		fclose(fp);
+		errno = EIO;
+		return -1;
+	}
+	fclose(fp);
+
+	cpulist[strcspn(cpulist, "\n")] = '\0';
+
+	return 0;
+}
+
+#ifdef __linux__
+static _Thread_local int nvm_dev_numa_depth;
+static _Thread_local int nvm_dev_numa_restore;
+static _Thread_local cpu_set_t nvm_dev_numa_saved;
+static _Thread_local int nvm_dev_numa_node = -1;
+static _Thread_local cpu_set_t nvm_dev_numa_cpus;
+
+/**
+ * Parses the CPUs of 'node' into the thread-local cache, returns the number
+ * of CPUs. The cache is kept for the node last parsed by the thread.
+ */
+static int nvm_dev_numa_cpus_get(int node)
+{
+	char cpulist[1024], *tok, *save = NULL;
+
+	if (node == nvm_dev_numa_node)
+		return CPU_COUNT(&nvm_dev_numa_cpus);
+
+	nvm_dev_numa_node = node;		// Attempt once per node
+	CPU_ZERO(&nvm_dev_numa_cpus);
+
+	if (nvm_dev_numa_cpulist(node, cpulist, sizeof(cpulist))) {
+		NVM_DEBUG("FAILED: nvm_dev_numa_cpulist node: %d", node);
+		return 0;
+	}
+
+	for (tok = strtok_r(cpulist, ",", &save); tok;
+	     tok = strtok_r(NULL, ",", &save)) {
+		int bgn, end;
+
+		switch (sscanf(tok, "%d-%d", &bgn, &end)) {
+		case 1:
+			end = bgn;
+			/* FALLTHRU */
+		case 2:
+			for (int cpu = bgn; cpu <= end && cpu < CPU_SETSIZE; ++cpu)
+				CPU_SET(cpu, &nvm_dev_numa_cpus);
+			break;
+
+		default:
+			NVM_DEBUG("FAILED: parsing cpulist: %s", tok);
+			CPU_ZERO(&nvm_dev_numa_cpus);
+			return 0;
+		}
+	}
+
+	return CPU_COUNT(&nvm_dev_numa_cpus);
+}
+
+void nvm_dev_numa_bind(const struct nvm_dev *dev)
+{
+	if (nvm_dev_numa_depth++)
+		return;
+
+	nvm_dev_numa_restore = 0;
+
+	if (!dev->numa_bind || (dev->numa_node < 0) ||
+	    !nvm_dev_numa_cpus_get(dev->numa_node))
+		return;
+
+	if (sched_getaffinity(0, sizeof(nvm_dev_numa_saved),
+			      &nvm_dev_numa_saved)) {
+		NVM_DEBUG("FAILED: sched_getaffinity errno: %d", errno);
+		return;
+	}
+
+	if (sched_setaffinity(0, sizeof(nvm_dev_numa_cpus),
+			      &nvm_dev_numa_cpus)) {
+		NVM_DEBUG("FAILED: sched_setaffinity node: %d, errno: %d",
+			  dev->numa_node, errno);
+		return;
+	}
+
+	nvm_dev_numa_restore = 1;
+}
+
+void nvm_dev_numa_unbind(void)
+{
+	if (!nvm_dev_numa_depth || --nvm_dev_numa_depth)
+		return;
+
+	if (!nvm_dev_numa_restore)
+		return;
+
+	nvm_dev_numa_restore = 0;
+
+	if (sched_setaffinity(0, sizeof(nvm_dev_numa_saved),
+			      &nvm_dev_numa_saved)) {
+		NVM_DEBUG("FAILED: sched_setaffinity restore, errno: %d",
+			  errno);
+	}
+}
+#else
+void nvm_dev_numa_bind(const struct nvm_dev *NVM_UNUSED(dev))
+{
+	return;
+}
+
+void nvm_dev_numa_unbind(void)
+{
+	return;
+}
+#endif
+
+static inline void nvm_dev_numa_pr(const struct nvm_dev *dev)
+{
+	char cpulist[1024];
+
+	if (!dev) {
+		printf("numa: ~\n");
+		return;
+	}
+
+	printf("numa:\n");
+	printf("  node: %d\n", nvm_dev_get_numa_node(dev));
+	printf("  bind: %d\n", nvm_dev_get_numa_bind(dev));
+	if ((dev->numa_node < 0) ||
+	    nvm_dev_numa_cpulist(dev->numa_node, cpulist, sizeof(cpulist)))
+		printf("  cpus: ~\n");
+	else
+		printf("  cpus: '%s'\n", cpulist);
+}
+
 void nvm_dev_attr_pr(const struct nvm_dev *dev)
 {
 	if (!dev) {
@@ -112,6 +267,7 @@ void nvm_dev_pr(const struct nvm_dev *dev)
 	printf("dev_"); nvm_geo_pr(&dev->geo);
 	printf("dev_"); nvm_dev_cmd_opts_pr(dev);
 	printf("dev_"); nvm_dev_vblk_opts_pr(dev);
+	printf("dev_"); nvm_dev_numa_pr(dev);
 
 	switch(nvm_dev_get_verid(dev)) {
 	case NVM_SPEC_VERID_12:
@@ -222,6 +378,40 @@ int nvm_dev_set_quirks(struct nvm_dev *dev, int quirks)
 	return 0;
 }
 
+int nvm_dev_get_numa_node(const struct nvm_dev *dev)
+{
+	return dev->numa_node;
+}
+
+int nvm_dev_set_numa_node(struct nvm_dev *dev, int node)
+{
+	if (node < -1) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	dev->numa_node = node;
+
+	return 0;
+}
+
+int nvm_dev_get_numa_bind(const struct nvm_dev *dev)
+{
+	return dev->numa_bind;
+}
+
+int nvm_dev_set_numa_bind(struct nvm_dev *dev, int bind)
+{
+	if ((bind != 0) && (bind != 1)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	dev->numa_bind = bind;
+
+	return 0;
+}
+
 int nvm_dev_get_pmode(const struct nvm_dev *dev)
 {
 	return dev->vblk_opts.pmode;
@@ -407,6 +597,7 @@ struct nvm_dev * nvm_dev_openf(const char *dev_path, int flags) {
 	}
 
 	dev->bbts_cached = 0;
+	dev->rcache = NULL;
 	dev->nbbts = dev->geo.nchannels * dev->geo.nluns;
 	dev->bbts = malloc(sizeof(*dev->bbts) * dev->nbbts);
 	if (!dev->bbts) {
@@ -463,6 +654,9 @@ void nvm_dev_close(struct nvm_dev *dev)
 
 	dev->be->close(dev);
 
+	nvm_rcache_free(dev->rcache);
 	free(dev->bbts);
 	free(dev);
+
+	nvm_buf_pool_trim();
 }
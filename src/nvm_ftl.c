@@ -0,0 +1,1866 @@
+/*
+ * nvm_ftl - Page-mapped host FTL exposing a logical block interface
+ *
+ * Copyright (C) Simon A. F. Lund <slund@cnexlabs.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <liblightnvm.h>
+#include <liblightnvm_spec.h>
+#include <nvm_dev.h>
+#include <nvm_omp.h>
+#include <nvm_ftl.h>
+#include <nvm_gc.h>
+
+#define NVM_FTL_CSUM_SEED 2166136261U
+
+static inline uint32_t ftl_round_up(uint32_t val, uint32_t unit)
+{
+	return ((val + unit - 1) / unit) * unit;
+}
+
+static inline int ftl_is_staged(uint32_t ppa)
+{
+	return ppa != NVM_FTL_UNMAPPED && (ppa & NVM_FTL_STAGED);
+}
+
+static inline uint32_t ftl_nchunks(const struct nvm_ftl *ftl)
+{
+	return ftl->npus * ftl->nchunk;
+}
+
+static inline struct nvm_addr ftl_addr(const struct nvm_ftl *ftl,
+				       uint32_t cid, uint32_t sectr)
+{
+	const struct nvm_geo *geo = nvm_dev_get_geo(ftl->dev);
+	const uint32_t pu = cid / ftl->nchunk;
+	struct nvm_addr addr = { .val = 0 };
+
+	addr.l.pugrp = pu / geo->l.npunit;
+	addr.l.punit = pu % geo->l.npunit;
+	addr.l.chunk = cid % ftl->nchunk;
+	addr.l.sectr = sectr;
+
+	return addr;
+}
+
+/**
+ * FNV-1a of 'buf', continued from 'csum'
+ */
+static uint32_t ftl_csum(uint32_t csum, const void *buf, size_t nbytes)
+{
+	const uint8_t *bytes = buf;
+
+	for (size_t i = 0; i < nbytes; ++i) {
+		csum ^= bytes[i];
+		csum *= 16777619U;
+	}
+
+	return csum;
+}
+
+/**
+ * Sectors written by a checkpoint of 'nlbas' blocks, the L2P table rounded up
+ * to write units, followed by padding making all of it readable
+ */
+static uint64_t ftl_ckpt_nsectr(const struct nvm_ftl *ftl, uint64_t nlbas)
+{
+	const uint64_t nbytes = nlbas * sizeof(*ftl->l2p);
+	const uint64_t nsectr = (nbytes + ftl->sectr_nbytes - 1) /
+				ftl->sectr_nbytes;
+
+	return ((nsectr + ftl->ws_opt - 1) / ftl->ws_opt) * ftl->ws_opt +
+	       ftl->tail_nsectr;
+}
+
+static uint32_t ftl_ckpt_nchunks(const struct nvm_ftl *ftl, uint64_t nlbas)
+{
+	return (ftl_ckpt_nsectr(ftl, nlbas) + ftl->nsectr - 1) / ftl->nsectr;
+}
+
+/**
+ * Write or read 'nsectr' consecutive sectors of chunk 'cid' from 'sectr', one
+ * command per 'cmd_nsectr' sectors
+ */
+static int ftl_dev_io(struct nvm_ftl *ftl, int write, uint32_t cid,
+		      uint32_t sectr, uint32_t nsectr, void *data, void *meta)
+{
+	for (uint32_t ofz = 0; ofz < nsectr; ofz += ftl->cmd_nsectr) {
+		const uint32_t n = nsectr - ofz < ftl->cmd_nsectr ?
+				   nsectr - ofz : ftl->cmd_nsectr;
+		char *data_ofz = (char *)data + ofz * ftl->sectr_nbytes;
+		char *meta_ofz = meta ? (char *)meta + ofz * ftl->oob_nbytes :
+				 NULL;
+		struct nvm_addr addrs[NVM_NADDR_MAX];
+		int err;
+
+		for (uint32_t i = 0; i < n; ++i)
+			addrs[i] = ftl_addr(ftl, cid, sectr + ofz + i);
+
+		if (write)
+			err = nvm_cmd_write(ftl->dev, addrs, n, data_ofz,
+					    meta_ofz, 0x0, NULL);
+		else
+			err = nvm_cmd_read(ftl->dev, addrs, n, data_ofz,
+					   meta_ofz, 0x0, NULL);
+		if (err) {
+			NVM_DEBUG("FAILED: nvm_cmd_%s",
+				  write ? "write" : "read");
+			errno = EIO;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int ftl_chunk_erase(struct nvm_ftl *ftl, uint32_t cid)
+{
+	struct nvm_addr addr = ftl_addr(ftl, cid, 0);
+
+	if (nvm_cmd_erase(ftl->dev, &addr, 1, NULL, 0x0, NULL)) {
+		NVM_DEBUG("FAILED: nvm_cmd_erase");
+		return -1;	// Propagate errno
+	}
+	ftl->chunks[cid].wp = 0;
+
+	return 0;
+}
+
+/**
+ * Take a free chunk on PU 'pu', or on any PU when it is NVM_FTL_NIL, erasing
+ * it when needed and taking chunks which fail the erase offline
+ *
+ * @return On success, the chunk is returned. On error, NVM_FTL_NIL is returned
+ * and `errno` set to ENOSPC when no chunk is free beyond 'nreserve'
+ */
+static uint32_t ftl_chunk_get(struct nvm_ftl *ftl, uint32_t pu,
+			      uint32_t nreserve)
+{
+	const uint32_t bgn = pu == NVM_FTL_NIL ? 0 : pu * ftl->nchunk;
+	const uint32_t end = pu == NVM_FTL_NIL ? ftl_nchunks(ftl) :
+			     bgn + ftl->nchunk;
+
+	while (ftl->nfree > nreserve) {
+		uint32_t cid = NVM_FTL_NIL;
+
+		for (uint32_t idx = bgn; idx < end; ++idx) {
+			if (ftl->chunks[idx].state != NVM_FTL_CHUNK_FREE)
+				continue;
+			if (ftl->chunks[idx].erased) {
+				cid = idx;
+				break;
+			}
+			if (cid == NVM_FTL_NIL)
+				cid = idx;
+		}
+		if (cid == NVM_FTL_NIL)
+			break;
+
+		ftl->nfree -= 1;
+		if (!ftl->chunks[cid].erased && ftl_chunk_erase(ftl, cid)) {
+			NVM_DEBUG("FAILED: ftl_chunk_erase, taking it offline");
+			ftl->chunks[cid].state = NVM_FTL_CHUNK_OFFLINE;
+			continue;
+		}
+		ftl->chunks[cid].erased = 0;
+		ftl->chunks[cid].nvalid = 0;
+		ftl->chunks[cid].wp = 0;
+
+		return cid;
+	}
+
+	errno = ENOSPC;
+	return NVM_FTL_NIL;
+}
+
+/**
+ * Return a chunk to the free chunks, it is erased when taken again
+ */
+static void ftl_chunk_free(struct nvm_ftl *ftl, uint32_t cid)
+{
+	struct nvm_ftl_chunk *chunk = &ftl->chunks[cid];
+
+	chunk->state = NVM_FTL_CHUNK_FREE;
+	chunk->erased = 0;
+	chunk->nvalid = 0;
+	ftl->nfree += 1;
+}
+
+static void ftl_chunk_close(struct nvm_ftl *ftl, uint32_t cid)
+{
+	struct nvm_ftl_pu *pu = &ftl->pus[cid / ftl->nchunk];
+
+	if (pu->open == cid)
+		pu->open = NVM_FTL_NIL;
+	ftl->chunks[cid].state = NVM_FTL_CHUNK_CLOSED;
+	ftl->nclosed += 1;
+}
+
+static struct nvm_ftl_orphan *ftl_orphan(const struct nvm_ftl *ftl,
+					 uint32_t cid)
+{
+	for (uint32_t i = 0; i < ftl->norphans; ++i) {
+		if (ftl->orphans[i].cid == cid)
+			return &ftl->orphans[i];
+	}
+
+	return NULL;
+}
+
+/**
+ * Keep the tail of the PU of 'cid' with the chunk, abandoned after failing a
+ * write at 'wp', and give the PU a new one
+ */
+static void ftl_orphan_add(struct nvm_ftl *ftl, uint32_t cid, uint32_t wp)
+{
+	struct nvm_ftl_pu *pu = &ftl->pus[cid / ftl->nchunk];
+	struct nvm_ftl_orphan *orphans;
+	char *tail;
+
+	if (!ftl->tail_nsectr || pu->tail_cid != cid ||
+	    !ftl->chunks[cid].nvalid)
+		return;
+
+	tail = malloc(ftl->tail_nsectr * ftl->sectr_nbytes);
+	orphans = realloc(ftl->orphans, (ftl->norphans + 1) *
+			  sizeof(*ftl->orphans));
+	if (!tail || !orphans) {
+		NVM_DEBUG("FAILED: allocating orphan, tail left to the device");
+		free(tail);
+		if (orphans)
+			ftl->orphans = orphans;
+		return;
+	}
+	ftl->orphans = orphans;
+	ftl->orphans[ftl->norphans].cid = cid;
+	ftl->orphans[ftl->norphans].wp = wp;
+	ftl->orphans[ftl->norphans].tail = pu->tail;
+	ftl->norphans += 1;
+
+	pu->tail = tail;
+	pu->tail_cid = NVM_FTL_NIL;
+}
+
+static void ftl_gc_untrack(struct nvm_ftl *ftl, uint32_t cid)
+{
+	struct nvm_ftl_chunk *chunk = &ftl->chunks[cid];
+
+	if (!chunk->tracked)
+		return;
+
+	nvm_gc_set_chunk(ftl->gc, ftl_addr(ftl, cid, 0), NULL);
+	chunk->tracked = 0;
+}
+
+/**
+ * Hand a closed chunk to the GC engine with its valid sectors, or refresh them.
+ * Chunks with a tail held by the host are left to overwrites, the device may
+ * not serve the tail.
+ */
+static void ftl_gc_track(struct nvm_ftl *ftl, uint32_t cid)
+{
+	struct nvm_ftl_chunk *chunk = &ftl->chunks[cid];
+	const uint32_t *p2l = &ftl->p2l[(size_t)cid * ftl->nsectr];
+
+	if (chunk->state != NVM_FTL_CHUNK_CLOSED)
+		return;
+	if (ftl_orphan(ftl, cid) || (chunk->wp < ftl->nsectr &&
+	    ftl->pus[cid / ftl->nchunk].tail_cid == cid)) {
+		ftl_gc_untrack(ftl, cid);
+		return;
+	}
+
+	memset(ftl->gc_bitmap, 0, ((ftl->nsectr + 63) / 64) *
+	       sizeof(*ftl->gc_bitmap));
+	for (uint32_t sectr = 0; sectr < ftl->nsectr; ++sectr) {
+		if (p2l[sectr] != NVM_FTL_UNMAPPED)
+			ftl->gc_bitmap[sectr / 64] |= 1ULL << (sectr % 64);
+	}
+
+	if (nvm_gc_set_chunk(ftl->gc, ftl_addr(ftl, cid, 0), ftl->gc_bitmap)) {
+		NVM_DEBUG("FAILED: nvm_gc_set_chunk");
+		return;
+	}
+	chunk->tracked = 1;
+}
+
+/**
+ * Mark a closed chunk without valid sectors dead, it cannot be reused before
+ * the next checkpoint as the last one may still map blocks to it
+ */
+static void ftl_chunk_settle(struct nvm_ftl *ftl, uint32_t cid)
+{
+	struct nvm_ftl_chunk *chunk = &ftl->chunks[cid];
+	struct nvm_ftl_orphan *orphan;
+
+	if (chunk->state != NVM_FTL_CHUNK_CLOSED || chunk->nvalid)
+		return;
+
+	chunk->state = NVM_FTL_CHUNK_DEAD;
+	ftl->ndead += 1;
+	ftl_gc_untrack(ftl, cid);
+
+	orphan = ftl_orphan(ftl, cid);
+	if (orphan) {
+		free(orphan->tail);
+		*orphan = ftl->orphans[--ftl->norphans];
+	}
+}
+
+/**
+ * Drop the mapping of 'lba', invalidating the sector or stage slot holding it
+ */
+static void ftl_unmap(struct nvm_ftl *ftl, uint64_t lba)
+{
+	const uint32_t ppa = ftl->l2p[lba];
+	uint32_t cid;
+
+	if (ppa == NVM_FTL_UNMAPPED)
+		return;
+
+	ftl->l2p[lba] = NVM_FTL_UNMAPPED;
+	if (ppa & NVM_FTL_STAGED) {
+		ftl->stage_lbas[ppa & ~NVM_FTL_STAGED] = NVM_FTL_UNMAPPED;
+		return;
+	}
+
+	cid = ppa / ftl->nsectr;
+	ftl->p2l[ppa] = NVM_FTL_UNMAPPED;
+	ftl->chunks[cid].nvalid -= 1;
+	if (ftl->chunks[cid].tracked)
+		nvm_gc_invalidate(ftl->gc, ftl_addr(ftl, cid,
+						    ppa % ftl->nsectr));
+	ftl_chunk_settle(ftl, cid);
+}
+
+/**
+ * Fill 'buf' with 'nbytes' of the checkpoint stream from byte 'ofz', that is,
+ * the L2P table with staged blocks unmapped, followed by zeros
+ */
+static void ftl_ckpt_fill(const struct nvm_ftl *ftl, char *buf, uint64_t ofz,
+			  size_t nbytes)
+{
+	const uint64_t bgn = ofz / sizeof(*ftl->l2p);
+	uint32_t *ents = (uint32_t *)buf;
+
+	for (size_t i = 0; i < nbytes / sizeof(*ents); ++i) {
+		uint32_t ent = 0;
+
+		if (bgn + i < ftl->nlbas) {
+			ent = ftl->l2p[bgn + i];
+			if (ftl_is_staged(ent))
+				ent = NVM_FTL_UNMAPPED;
+		}
+		ents[i] = ent;
+	}
+}
+
+static void ftl_oob_fill(const struct nvm_ftl *ftl, char *meta,
+			 const uint32_t *lbas, uint32_t nsectr, uint32_t useq)
+{
+	for (uint32_t i = 0; i < nsectr; ++i) {
+		const struct nvm_ftl_oob oob = {
+			.lba = lbas ? lbas[i] : NVM_FTL_UNMAPPED,
+			.useq = useq
+		};
+		char *dst = meta + i * ftl->oob_nbytes;
+
+		memset(dst, 0, ftl->oob_nbytes);
+		memcpy(dst, &oob, sizeof(oob));
+	}
+}
+
+static void ftl_gc_close(struct nvm_ftl *ftl)
+{
+	const uint32_t cid = ftl->gc_cid;
+
+	ftl->gc_cid = NVM_FTL_NIL;
+	ftl->gc_unpadded = 0;
+	ftl_chunk_close(ftl, cid);
+	ftl_chunk_settle(ftl, cid);
+	ftl_gc_track(ftl, cid);
+}
+
+/**
+ * Give up the GC chunk after a failed write, blocks relocated to its last
+ * sectors are mapped back to their sources, which are not freed before the
+ * chunk is padded
+ */
+static void ftl_gc_abandon(struct nvm_ftl *ftl)
+{
+	const uint32_t cid = ftl->gc_cid;
+	struct nvm_ftl_chunk *chunk = &ftl->chunks[cid];
+	const uint32_t bgn = chunk->wp > ftl->tail_nsectr ?
+			     chunk->wp - ftl->tail_nsectr : 0;
+
+	for (uint32_t sectr = bgn; ftl->gc_unpadded && sectr < chunk->wp;
+	     ++sectr) {
+		const uint32_t ppa = cid * ftl->nsectr + sectr;
+		const uint32_t src = ftl->gc_shadow[sectr % ftl->tail_nsectr];
+		const uint32_t lba = ftl->p2l[ppa];
+		struct nvm_ftl_chunk *victim = &ftl->chunks[src / ftl->nsectr];
+
+		if (lba == NVM_FTL_UNMAPPED)
+			continue;
+
+		ftl->l2p[lba] = src;
+		ftl->p2l[src] = lba;
+		ftl->p2l[ppa] = NVM_FTL_UNMAPPED;
+		chunk->nvalid -= 1;
+		if (victim->state == NVM_FTL_CHUNK_DEAD) {
+			victim->state = NVM_FTL_CHUNK_CLOSED;
+			ftl->ndead -= 1;
+		}
+		victim->nvalid += 1;
+		ftl_gc_track(ftl, src / ftl->nsectr);
+	}
+
+	ftl_gc_close(ftl);
+}
+
+/**
+ * Pad the GC chunk past the blocks relocated to its last sectors, such that
+ * the device serves them and their sources can be freed
+ */
+static void ftl_gc_pad(struct nvm_ftl *ftl)
+{
+	char *meta = ftl->oob_nbytes ? ftl->meta : NULL;
+	struct nvm_ftl_chunk *chunk;
+	uint32_t nsectr;
+
+	if (!ftl->gc_unpadded)
+		return;
+
+	chunk = &ftl->chunks[ftl->gc_cid];
+	nsectr = NVM_MIN(ftl->tail_nsectr, ftl->nsectr - chunk->wp);
+
+	memset(ftl->bounce, 0, nsectr * ftl->sectr_nbytes);
+	if (meta)
+		ftl_oob_fill(ftl, meta, NULL, nsectr, 0);
+
+	if (ftl_dev_io(ftl, 1, ftl->gc_cid, chunk->wp, nsectr, ftl->bounce,
+		       meta)) {
+		NVM_DEBUG("FAILED: ftl_dev_io, abandoning chunk");
+		ftl_gc_abandon(ftl);
+		return;
+	}
+	chunk->wp += nsectr;
+	ftl->nprogs += nsectr;
+	ftl->gc_unpadded = 0;
+
+	if (chunk->wp == ftl->nsectr)
+		ftl_gc_close(ftl);
+}
+
+/**
+ * Relocate the valid sectors of a victim picked by the GC engine to the GC
+ * chunk, the victim is dead once all of them are moved. The GC chunk is taken
+ * from the chunks held back from user writes.
+ *
+ * @return On success, 0 is returned. On error, -1 is returned and `errno` set
+ * to indicate the error, ENOENT when no victim frees a write unit and EAGAIN
+ * when the GC budget is exhausted
+ */
+static int ftl_gc_step(struct nvm_ftl *ftl, int flags)
+{
+	const struct nvm_geo *geo = nvm_dev_get_geo(ftl->dev);
+	struct nvm_addr addr;
+	uint32_t vcid;
+	int nvalid;
+
+	if (nvm_gc_pick(ftl->gc, ftl->nsectr - ftl->ws_opt, &addr) < 0) {
+		NVM_DEBUG("FAILED: nvm_gc_pick");
+		return -1;	// Propagate errno
+	}
+	vcid = (addr.l.pugrp * geo->l.npunit + addr.l.punit) * ftl->nchunk +
+	       addr.l.chunk;
+
+	nvalid = nvm_gc_get_valid(ftl->gc, addr, ftl->gc_src);
+	if (nvalid < 0) {
+		NVM_DEBUG("FAILED: nvm_gc_get_valid");
+		return -1;	// Propagate errno
+	}
+
+	for (int ofz = 0; ofz < nvalid;) {
+		struct nvm_ftl_chunk *chunk;
+		uint32_t n, ndst;
+
+		if (ftl->gc_cid == NVM_FTL_NIL) {
+			const uint32_t cid = ftl_chunk_get(ftl, NVM_FTL_NIL,
+							   ftl->ckpt_nchunks);
+			struct nvm_ftl_pu *pu;
+
+			if (cid == NVM_FTL_NIL) {
+				NVM_DEBUG("FAILED: ftl_chunk_get");
+				return -1;	// Propagate errno
+			}
+			// The tail of the PU may be left from its last use
+			pu = &ftl->pus[cid / ftl->nchunk];
+			if (pu->tail_cid == cid)
+				pu->tail_cid = NVM_FTL_NIL;
+			ftl->chunks[cid].state = NVM_FTL_CHUNK_OPEN;
+			ftl->gc_cid = cid;
+		}
+		chunk = &ftl->chunks[ftl->gc_cid];
+
+		n = NVM_MIN(nvalid - ofz, (int)(ftl->nsectr - chunk->wp));
+		ndst = ftl_round_up(n, ftl->ws_opt);
+		for (uint32_t i = 0; i < ndst; ++i)
+			ftl->gc_dst[i] = ftl_addr(ftl, ftl->gc_cid,
+						  chunk->wp + i);
+
+		if (nvm_gc_move(ftl->gc, ftl->gc_src + ofz, n, ftl->gc_dst,
+				ndst, flags)) {
+			const int err = errno;
+
+			NVM_DEBUG("FAILED: nvm_gc_move");
+			if (err != EAGAIN)
+				ftl_gc_abandon(ftl);
+			errno = err;
+			return -1;
+		}
+
+		for (uint32_t i = 0; i < n; ++i) {
+			const uint32_t src = vcid * ftl->nsectr +
+					     ftl->gc_src[ofz + i].l.sectr;
+			const uint32_t dst = ftl->gc_cid * ftl->nsectr +
+					     chunk->wp + i;
+			const uint32_t lba = ftl->p2l[src];
+
+			if (lba == NVM_FTL_UNMAPPED)
+				continue;
+
+			ftl->l2p[lba] = dst;
+			ftl->p2l[dst] = lba;
+			ftl->p2l[src] = NVM_FTL_UNMAPPED;
+			ftl->chunks[vcid].nvalid -= 1;
+			chunk->nvalid += 1;
+			nvm_gc_invalidate(ftl->gc, ftl->gc_src[ofz + i]);
+			if (ftl->tail_nsectr)
+				ftl->gc_shadow[(chunk->wp + i) %
+					       ftl->tail_nsectr] = src;
+		}
+		chunk->wp += ndst;
+		ftl->nprogs += ndst;
+		ftl->gc_nmoved += n;
+		ftl->gc_unpadded = ftl->tail_nsectr > 0;
+		if (chunk->wp == ftl->nsectr)
+			ftl_gc_close(ftl);
+
+		ofz += n;
+	}
+
+	ftl_chunk_settle(ftl, vcid);
+	ftl->gc_nvictims += 1;
+
+	return 0;
+}
+
+/**
+ * Get the sector to read for a mapped 'ppa', its source when it is relocated
+ * among the last sectors of the GC chunk, which the device may not serve yet
+ */
+static uint32_t ftl_gc_shadow(const struct nvm_ftl *ftl, uint32_t ppa)
+{
+	uint32_t sectr;
+
+	if (!ftl->gc_unpadded || ppa / ftl->nsectr != ftl->gc_cid)
+		return ppa;
+
+	sectr = ppa % ftl->nsectr;
+	if (sectr + ftl->tail_nsectr < ftl->chunks[ftl->gc_cid].wp)
+		return ppa;
+
+	return ftl->gc_shadow[sectr % ftl->tail_nsectr];
+}
+
+/**
+ * Write the L2P table to newly taken chunks and a root record referencing them
+ * to the superblock, then free the chunks of the previous checkpoint and the
+ * dead chunks, none of which the new checkpoint maps blocks to
+ *
+ * Staged blocks are written as unmapped, the roll-forward picks them up once
+ * they reach the device. The GC chunk is padded first, the sources of blocks
+ * relocated to it may be among the dead chunks.
+ */
+static int ftl_ckpt(struct nvm_ftl *ftl)
+{
+	const uint64_t payload_nbytes = ftl->nlbas * sizeof(*ftl->l2p);
+	const uint64_t nsectr = ftl_ckpt_nsectr(ftl, ftl->nlbas);
+	struct nvm_ftl_root *root = (void *)ftl->bounce;
+	char *meta = ftl->oob_nbytes ? ftl->meta : NULL;
+	uint32_t csum = NVM_FTL_CSUM_SEED;
+	uint32_t cids[ftl->ckpt_nchunks];
+	uint32_t sb, sb_cid;
+
+	ftl_gc_pad(ftl);
+
+	for (uint32_t i = 0; i < ftl->ckpt_nchunks; ++i) {
+		cids[i] = ftl_chunk_get(ftl, NVM_FTL_NIL, 0);
+		if (cids[i] == NVM_FTL_NIL) {
+			NVM_DEBUG("FAILED: ftl_chunk_get");
+			while (i--) {
+				ftl_chunk_free(ftl, cids[i]);
+				ftl->chunks[cids[i]].erased = 1;
+			}
+			return -1;	// Propagate errno
+		}
+		ftl->chunks[cids[i]].state = NVM_FTL_CHUNK_META;
+	}
+
+	if (meta)	// Checkpoint sectors carry no blocks
+		ftl_oob_fill(ftl, meta, NULL, NVM_MAX(ftl->cmd_nsectr,
+						      ftl->rec_nsectr), 0);
+
+	for (uint64_t sectr = 0; sectr < nsectr;) {
+		const uint32_t cid = cids[sectr / ftl->nsectr];
+		const uint32_t csectr = sectr % ftl->nsectr;
+		const uint64_t ofz = sectr * ftl->sectr_nbytes;
+		uint32_t n = ftl->cmd_nsectr;
+
+		if (n > nsectr - sectr)
+			n = nsectr - sectr;
+		if (n > ftl->nsectr - csectr)
+			n = ftl->nsectr - csectr;
+
+		ftl_ckpt_fill(ftl, ftl->bounce, ofz, n * ftl->sectr_nbytes);
+		if (ofz < payload_nbytes) {
+			const uint64_t left = payload_nbytes - ofz;
+
+			csum = ftl_csum(csum, ftl->bounce,
+					left < n * ftl->sectr_nbytes ?
+					left : n * ftl->sectr_nbytes);
+		}
+
+		if (ftl_dev_io(ftl, 1, cid, csectr, n, ftl->bounce, meta)) {
+			NVM_DEBUG("FAILED: ftl_dev_io");
+			goto failed;
+		}
+		ftl->chunks[cid].wp = csectr + n;
+		ftl->nprogs += n;
+		sectr += n;
+	}
+
+	sb = ftl->sb_active;
+	sb_cid = ftl->sb_cids[sb];
+	if (ftl->chunks[sb_cid].wp + ftl->rec_nsectr > ftl->nsectr) {
+		// The other holds older records only
+		sb = !sb;
+		sb_cid = ftl->sb_cids[sb];
+		if (ftl_chunk_erase(ftl, sb_cid)) {
+			NVM_DEBUG("FAILED: ftl_chunk_erase");
+			goto failed;
+		}
+	}
+
+	memset(ftl->bounce, 0, ftl->rec_nsectr * ftl->sectr_nbytes);
+	root->magic = NVM_FTL_MAGIC;
+	root->seq = ftl->ckpt_seq + 1;
+	root->nlbas = ftl->nlbas;
+	root->useq = ftl->useq;
+	root->csum = csum;
+	root->nchunks = ftl->ckpt_nchunks;
+	root->sb_cids[0] = ftl->sb_cids[0];
+	root->sb_cids[1] = ftl->sb_cids[1];
+	memcpy(root->cids, cids, sizeof(cids));
+	root->rcsum = ftl_csum(NVM_FTL_CSUM_SEED, root,
+			       sizeof(*root) + sizeof(cids));
+
+	if (ftl_dev_io(ftl, 1, sb_cid, ftl->chunks[sb_cid].wp,
+		       ftl->rec_nsectr, ftl->bounce, meta)) {
+		NVM_DEBUG("FAILED: ftl_dev_io");
+		ftl->chunks[sb_cid].wp = ftl->nsectr;	// Move on next time
+		goto failed;
+	}
+	ftl->chunks[sb_cid].wp += ftl->rec_nsectr;
+	ftl->nprogs += ftl->rec_nsectr;
+	ftl->sb_active = sb;
+
+	for (uint32_t i = 0; i < ftl->ckpt_nchunks; ++i) {
+		if (ftl->ckpt_cids[i] != NVM_FTL_NIL)
+			ftl_chunk_free(ftl, ftl->ckpt_cids[i]);
+		ftl->ckpt_cids[i] = cids[i];
+	}
+	for (uint32_t cid = 0; ftl->ndead && cid < ftl_nchunks(ftl); ++cid) {
+		if (ftl->chunks[cid].state != NVM_FTL_CHUNK_DEAD)
+			continue;
+		ftl_chunk_free(ftl, cid);
+		ftl->ndead -= 1;
+	}
+	ftl->ckpt_seq += 1;
+	ftl->nclosed = 0;
+	ftl->nckpts += 1;
+
+	return 0;
+
+failed:
+	for (uint32_t i = 0; i < ftl->ckpt_nchunks; ++i)
+		ftl_chunk_free(ftl, cids[i]);
+	return -1;	// Propagate errno
+}
+
+/**
+ * Allocate the next write unit, rotating over the PUs. When no free chunk is
+ * left, a checkpoint reclaims the dead chunks, after relocating the valid
+ * sectors of a victim when there are none.
+ */
+static int ftl_unit_alloc(struct nvm_ftl *ftl, uint32_t *cid, uint32_t *sectr)
+{
+	const uint32_t nreserve = ftl->ckpt_nchunks + NVM_FTL_GC_NCHUNKS;
+
+	for (uint32_t reclaim = 0; reclaim <= ftl_nchunks(ftl); ++reclaim) {
+		for (uint32_t i = 0; i < ftl->npus; ++i) {
+			const uint32_t idx = (ftl->cursor + i) % ftl->npus;
+			struct nvm_ftl_pu *pu = &ftl->pus[idx];
+			struct nvm_ftl_chunk *chunk;
+
+			if (pu->open == NVM_FTL_NIL) {
+				// Leave room for the checkpoint and the GC
+				pu->open = ftl_chunk_get(ftl, idx, nreserve);
+				if (pu->open == NVM_FTL_NIL)
+					continue;
+				ftl->chunks[pu->open].state =
+							NVM_FTL_CHUNK_OPEN;
+			}
+
+			*cid = pu->open;
+			chunk = &ftl->chunks[*cid];
+			*sectr = chunk->wp;
+			chunk->wp += ftl->ws_opt;
+			if (chunk->wp == ftl->nsectr)
+				ftl_chunk_close(ftl, *cid);
+
+			ftl->cursor = (idx + 1) % ftl->npus;
+			return 0;
+		}
+
+		// A few victims per checkpoint, each pads the GC chunk
+		while (ftl->ndead < ftl->npus &&
+		       !ftl_gc_step(ftl, NVM_GC_URGENT))
+			;
+		if (!ftl->ndead) {
+			if (errno == ENOENT)
+				break;
+
+			NVM_DEBUG("FAILED: ftl_gc_step");
+			return -1;	// Propagate errno
+		}
+		if (ftl_ckpt(ftl)) {
+			NVM_DEBUG("FAILED: ftl_ckpt");
+			return -1;	// Propagate errno
+		}
+	}
+
+	NVM_DEBUG("FAILED: no free chunks");
+	errno = ENOSPC;
+	return -1;
+}
+
+/**
+ * Undo the last `ftl_unit_alloc` on chunk 'cid'
+ */
+static void ftl_unit_unalloc(struct nvm_ftl *ftl, uint32_t cid)
+{
+	struct nvm_ftl_chunk *chunk = &ftl->chunks[cid];
+	struct nvm_ftl_pu *pu = &ftl->pus[cid / ftl->nchunk];
+
+	chunk->wp -= ftl->ws_opt;
+	if (chunk->state == NVM_FTL_CHUNK_CLOSED) {
+		chunk->state = NVM_FTL_CHUNK_OPEN;
+		pu->open = cid;
+		if (ftl->nclosed)
+			ftl->nclosed -= 1;
+	} else if (!chunk->wp) {
+		pu->open = NVM_FTL_NIL;
+		ftl_chunk_free(ftl, cid);
+		chunk->erased = 1;
+	}
+}
+
+/**
+ * Write the staged units, in parallel when they land on distinct chunks, and
+ * map their blocks. When 'pad' is set, a partial unit is padded and written.
+ *
+ * Units failing the write stay staged and their chunks are abandoned.
+ */
+static int ftl_stage_flush(struct nvm_ftl *ftl, int pad)
+{
+	const size_t unit_nbytes = ftl->ws_opt * ftl->sectr_nbytes;
+	uint32_t nunits = ftl->nstaged / ftl->ws_opt;
+	uint32_t cids[NVM_FTL_STAGE_NUNITS_MAX];
+	uint32_t sectrs[NVM_FTL_STAGE_NUNITS_MAX];
+	int errs[NVM_FTL_STAGE_NUNITS_MAX] = { 0 };
+	int distinct = 1;
+	size_t nerr = 0;
+
+	if (pad && ftl->nstaged % ftl->ws_opt) {
+		const uint32_t end = (nunits + 1) * ftl->ws_opt;
+
+		memset(ftl->stage + ftl->nstaged * ftl->sectr_nbytes, 0,
+		       (end - ftl->nstaged) * ftl->sectr_nbytes);
+		for (uint32_t slot = ftl->nstaged; slot < end; ++slot)
+			ftl->stage_lbas[slot] = NVM_FTL_UNMAPPED;
+		ftl->nstaged = end;
+		nunits += 1;
+	}
+	if (!nunits)
+		return 0;
+
+	for (uint32_t u = 0; u < nunits; ++u) {
+		if (ftl_unit_alloc(ftl, &cids[u], &sectrs[u])) {
+			NVM_DEBUG("FAILED: ftl_unit_alloc");
+			while (u--)
+				ftl_unit_unalloc(ftl, cids[u]);
+			return -1;	// Propagate errno
+		}
+		for (uint32_t v = 0; v < u; ++v)
+			distinct &= cids[u] != cids[v];
+	}
+
+	// Sequence numbers after allocation, which may take a checkpoint
+	for (uint32_t u = 0; u < nunits; ++u) {
+		ftl->useq += 1;
+		if (ftl->oob_nbytes)
+			ftl_oob_fill(ftl, ftl->meta + u * ftl->ws_opt *
+				     ftl->oob_nbytes,
+				     &ftl->stage_lbas[u * ftl->ws_opt],
+				     ftl->ws_opt, ftl->useq);
+	}
+
+	#pragma omp parallel for num_threads(nunits) schedule(static,1) if(distinct && nunits > 1)
+	for (uint32_t u = 0; u < nunits; ++u) {
+		char *meta = ftl->oob_nbytes ? ftl->meta + u * ftl->ws_opt *
+					       ftl->oob_nbytes : NULL;
+
+		errs[u] = ftl_dev_io(ftl, 1, cids[u], sectrs[u], ftl->ws_opt,
+				     ftl->stage + u * unit_nbytes, meta);
+	}
+
+	for (uint32_t u = 0; u < nunits; ++u) {
+		const uint32_t cid = cids[u];
+		struct nvm_ftl_pu *pu = &ftl->pus[cid / ftl->nchunk];
+
+		if (errs[u]) {
+			NVM_DEBUG("FAILED: ftl_dev_io, abandoning chunk");
+			if (ftl->chunks[cid].state == NVM_FTL_CHUNK_OPEN)
+				ftl_chunk_close(ftl, cid);
+			ftl_orphan_add(ftl, cid, sectrs[u]);
+			ftl_chunk_settle(ftl, cid);
+			ftl_gc_track(ftl, cid);
+			++nerr;
+			continue;
+		}
+
+		for (uint32_t i = 0; i < ftl->ws_opt; ++i) {
+			const uint32_t slot = u * ftl->ws_opt + i;
+			const uint32_t lba = ftl->stage_lbas[slot];
+			const uint32_t ppa = cid * ftl->nsectr + sectrs[u] + i;
+
+			if (lba == NVM_FTL_UNMAPPED)
+				continue;
+
+			ftl->l2p[lba] = ppa;
+			ftl->p2l[ppa] = lba;
+			ftl->chunks[cid].nvalid += 1;
+			ftl->stage_lbas[slot] = NVM_FTL_UNMAPPED;
+		}
+		ftl->nprogs += ftl->ws_opt;
+
+		if (ftl->tail_nsectr) {
+			memcpy(pu->tail + (sectrs[u] % ftl->tail_nsectr) *
+			       ftl->sectr_nbytes, ftl->stage + u * unit_nbytes,
+			       unit_nbytes);
+			pu->tail_cid = cid;
+		}
+
+		ftl_chunk_settle(ftl, cid);
+		ftl_gc_track(ftl, cid);
+	}
+
+	if (nerr) {
+		NVM_DEBUG("FAILED: nerr(%zu)", nerr);
+		errno = EIO;
+		return -1;
+	}
+	ftl->nstaged = 0;
+
+	// Relocate ahead of need, within the budget earned by the user writes
+	nvm_gc_account(ftl->gc, (size_t)nunits * ftl->ws_opt);
+	while (ftl->nfree + ftl->ndead < ftl->ckpt_nchunks +
+	       NVM_FTL_GC_NCHUNKS + ftl->npus && !ftl_gc_step(ftl, 0))
+		;
+
+	if (ftl->nclosed >= ftl->ckpt_interval)
+		return ftl_ckpt(ftl);
+
+	return 0;
+}
+
+static int ftl_stage(struct nvm_ftl *ftl, uint64_t lba, const void *data)
+{
+	uint32_t slot;
+
+	if (ftl->nstaged == ftl->stage_nunits * ftl->ws_opt &&
+	    ftl_stage_flush(ftl, 0)) {
+		NVM_DEBUG("FAILED: ftl_stage_flush");
+		return -1;	// Propagate errno
+	}
+
+	slot = ftl->nstaged++;
+	memcpy(ftl->stage + slot * ftl->sectr_nbytes, data, ftl->sectr_nbytes);
+	ftl_unmap(ftl, lba);
+	ftl->stage_lbas[slot] = lba;
+	ftl->l2p[lba] = NVM_FTL_STAGED | slot;
+
+	return 0;
+}
+
+/**
+ * Get the host copy of a mapped 'ppa', when it is staged or among the last
+ * sectors written to a chunk which the device may not serve yet
+ *
+ * @return The copy, or NULL when the sector is read from the device
+ */
+static const char *ftl_host_copy(const struct nvm_ftl *ftl, uint32_t ppa)
+{
+	const struct nvm_ftl_orphan *orphan;
+	const struct nvm_ftl_pu *pu;
+	uint32_t cid, sectr, wp;
+	const char *tail;
+
+	if (ppa & NVM_FTL_STAGED)
+		return ftl->stage + (ppa & ~NVM_FTL_STAGED) * ftl->sectr_nbytes;
+	if (!ftl->tail_nsectr)
+		return NULL;
+
+	cid = ppa / ftl->nsectr;
+	sectr = ppa % ftl->nsectr;
+	pu = &ftl->pus[cid / ftl->nchunk];
+	if (pu->tail_cid == cid) {
+		wp = ftl->chunks[cid].wp;
+		tail = pu->tail;
+	} else {
+		orphan = ftl_orphan(ftl, cid);
+		if (!orphan)
+			return NULL;
+		wp = orphan->wp;
+		tail = orphan->tail;
+	}
+	if (sectr + ftl->tail_nsectr < wp)
+		return NULL;
+
+	return tail + (sectr % ftl->tail_nsectr) * ftl->sectr_nbytes;
+}
+
+static int ftl_read_batch(struct nvm_ftl *ftl, struct nvm_addr addrs[],
+			  char *dsts[], uint32_t naddrs)
+{
+	if (nvm_cmd_read(ftl->dev, addrs, naddrs, ftl->bounce, NULL, 0x0,
+			 NULL)) {
+		NVM_DEBUG("FAILED: nvm_cmd_read");
+		errno = EIO;
+		return -1;
+	}
+
+	for (uint32_t i = 0; i < naddrs; ++i)
+		memcpy(dsts[i], ftl->bounce + i * ftl->sectr_nbytes,
+		       ftl->sectr_nbytes);
+
+	return 0;
+}
+
+static int ftl_check_range(const struct nvm_ftl *ftl, uint64_t lba,
+			   uint32_t nlbas)
+{
+	if (lba > ftl->nlbas || nlbas > ftl->nlbas - lba) {
+		NVM_DEBUG("FAILED: lba: %"PRIu64", nlbas: %u out of bounds",
+			  lba, nlbas);
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Take the chunk report of every PU, storing chunk states in 'cs' and write
+ * pointers in the chunks
+ */
+static int ftl_rprt(struct nvm_ftl *ftl, uint8_t *cs)
+{
+	for (uint32_t pu = 0; pu < ftl->npus; ++pu) {
+		struct nvm_addr addr = ftl_addr(ftl, pu * ftl->nchunk, 0);
+		struct nvm_spec_rprt *rprt;
+
+		rprt = nvm_cmd_rprt(ftl->dev, &addr, 0x0, NULL);
+		if (!rprt) {
+			NVM_DEBUG("FAILED: nvm_cmd_rprt");
+			return -1;	// Propagate errno
+		}
+
+		for (uint32_t i = 0; i < rprt->ndescr && i < ftl->nchunk; ++i) {
+			const uint32_t cid = pu * ftl->nchunk + i;
+
+			cs[cid] = rprt->descr[i].cs;
+			ftl->chunks[cid].wp = rprt->descr[i].wp;
+		}
+
+		nvm_buf_free(ftl->dev, rprt);
+	}
+
+	return 0;
+}
+
+static int ftl_l2p_alloc(struct nvm_ftl *ftl)
+{
+	ftl->l2p = malloc(ftl->nlbas * sizeof(*ftl->l2p));
+	if (!ftl->l2p) {
+		NVM_DEBUG("FAILED: malloc l2p");
+		return -1;
+	}
+	memset(ftl->l2p, 0xFF, ftl->nlbas * sizeof(*ftl->l2p));
+
+	return 0;
+}
+
+/**
+ * Take all usable chunks, size the logical block space and write an empty
+ * checkpoint
+ */
+static int ftl_format(struct nvm_ftl *ftl, const uint8_t *cs)
+{
+	uint32_t nusable = 0, nspare;
+
+	for (uint32_t cid = 0; cid < ftl_nchunks(ftl); ++cid) {
+		struct nvm_ftl_chunk *chunk = &ftl->chunks[cid];
+
+		// Erase all, OOB of a previous format must not roll forward
+		if ((cs[cid] & NVM_CHUNK_STATE_OFFLINE) ||
+		    (cs[cid] != NVM_CHUNK_STATE_FREE &&
+		     ftl_chunk_erase(ftl, cid))) {
+			chunk->state = NVM_FTL_CHUNK_OFFLINE;
+			continue;
+		}
+		chunk->state = NVM_FTL_CHUNK_FREE;
+		chunk->erased = 1;
+		chunk->wp = 0;
+		nusable += 1;
+	}
+
+	// The superblock takes the first two usable chunks, the root records
+	// name them for ftl_sb_find
+	for (uint32_t cid = 0, sb = 0; sb < 2; ++cid) {
+		if (cid == ftl_nchunks(ftl)) {
+			NVM_DEBUG("FAILED: no usable superblock chunks");
+			errno = ENOSPC;
+			return -1;
+		}
+		if (ftl->chunks[cid].state == NVM_FTL_CHUNK_OFFLINE)
+			continue;
+
+		ftl->chunks[cid].state = NVM_FTL_CHUNK_META;
+		ftl->sb_cids[sb++] = cid;
+		nusable -= 1;
+	}
+
+	// Size checkpoints for the worst case, then for the blocks exposed
+	ftl->ckpt_nchunks = ftl_ckpt_nchunks(ftl, (uint64_t)ftl_nchunks(ftl) *
+						  ftl->nsectr);
+	// Two checkpoints, an open chunk per PU and the GC chunks are spare
+	nspare = 2 * ftl->ckpt_nchunks + ftl->npus + 2 * NVM_FTL_GC_NCHUNKS;
+	if (nusable <= nspare) {
+		NVM_DEBUG("FAILED: too few usable chunks: %u", nusable);
+		errno = ENOSPC;
+		return -1;
+	}
+	ftl->nfree = nusable;
+	ftl->nlbas = (uint64_t)(nusable - nspare) * ftl->nsectr *
+		     (100 - NVM_FTL_OP_PCT) / 100;
+	ftl->ckpt_nchunks = ftl_ckpt_nchunks(ftl, ftl->nlbas);
+
+	if (ftl_l2p_alloc(ftl))
+		return -1;	// Propagate errno
+
+	return ftl_ckpt(ftl);
+}
+
+static int ftl_root_valid(const struct nvm_ftl *ftl, struct nvm_ftl_root *root)
+{
+	const uint32_t rcsum = root->rcsum;
+	uint32_t csum;
+
+	if (root->magic != NVM_FTL_MAGIC)
+		return 0;
+	if (root->nchunks > (ftl->sectr_nbytes - sizeof(*root)) /
+			    sizeof(root->cids[0]))
+		return 0;
+
+	root->rcsum = 0;
+	csum = ftl_csum(NVM_FTL_CSUM_SEED, root, sizeof(*root) +
+			root->nchunks * sizeof(root->cids[0]));
+	root->rcsum = rcsum;
+
+	return csum == rcsum;
+}
+
+/**
+ * Find the superblock chunks, named by the valid root records written to
+ * them, scanning the written chunks from the first
+ */
+static int ftl_sb_find(struct nvm_ftl *ftl, const uint8_t *cs)
+{
+	struct nvm_ftl_root *rec = (void *)ftl->bounce;
+	const uint32_t nchunks = ftl_nchunks(ftl);
+
+	for (uint32_t cid = 0; cid < nchunks; ++cid) {
+		if ((cs[cid] & NVM_CHUNK_STATE_OFFLINE) ||
+		    ftl->chunks[cid].wp < ftl->rec_nsectr)
+			continue;
+
+		if (ftl_dev_io(ftl, 0, cid, 0, 1, ftl->bounce, NULL)) {
+			NVM_DEBUG("FAILED: ftl_dev_io, skipping");
+			continue;
+		}
+		if (!ftl_root_valid(ftl, rec) ||
+		    rec->sb_cids[0] >= nchunks || rec->sb_cids[1] >= nchunks ||
+		    rec->sb_cids[0] == rec->sb_cids[1] ||
+		    (rec->sb_cids[0] != cid && rec->sb_cids[1] != cid))
+			continue;
+
+		ftl->sb_cids[0] = rec->sb_cids[0];
+		ftl->sb_cids[1] = rec->sb_cids[1];
+		return 0;
+	}
+
+	NVM_DEBUG("FAILED: no superblock");
+	errno = ENOENT;
+	return -1;
+}
+
+/**
+ * Find the valid root record of the latest checkpoint in the superblock
+ *
+ * @return On success, a copy of the record which the caller frees. On error,
+ * NULL is returned and `errno` set to indicate the error, ENOENT when none is
+ * found
+ */
+static struct nvm_ftl_root *ftl_root_find(struct nvm_ftl *ftl)
+{
+	struct nvm_ftl_root *rec = (void *)ftl->bounce;
+	struct nvm_ftl_root *root;
+	int found = 0;
+
+	root = malloc(ftl->sectr_nbytes);
+	if (!root) {
+		NVM_DEBUG("FAILED: malloc root");
+		return NULL;
+	}
+
+	for (uint32_t sb = 0; sb < 2; ++sb) {
+		const uint32_t cid = ftl->sb_cids[sb];
+
+		for (uint32_t sectr = 0;
+		     sectr + ftl->rec_nsectr <= ftl->chunks[cid].wp;
+		     sectr += ftl->rec_nsectr) {
+			if (ftl_dev_io(ftl, 0, cid, sectr, 1, ftl->bounce,
+				       NULL)) {
+				NVM_DEBUG("FAILED: ftl_dev_io, skipping");
+				continue;
+			}
+			if (!ftl_root_valid(ftl, rec))
+				continue;
+			if (found && rec->seq <= root->seq)
+				continue;
+
+			memcpy(root, rec, ftl->sectr_nbytes);
+			ftl->sb_active = sb;
+			found = 1;
+		}
+	}
+
+	if (!found) {
+		NVM_DEBUG("FAILED: no root record");
+		free(root);
+		errno = ENOENT;
+		return NULL;
+	}
+
+	return root;
+}
+
+/**
+ * Read the L2P table of the checkpoint given by 'root'
+ */
+static int ftl_ckpt_load(struct nvm_ftl *ftl, const struct nvm_ftl_root *root)
+{
+	const uint64_t payload_nbytes = ftl->nlbas * sizeof(*ftl->l2p);
+	const uint64_t nsectr = (payload_nbytes + ftl->sectr_nbytes - 1) /
+				ftl->sectr_nbytes;
+	uint32_t csum = NVM_FTL_CSUM_SEED;
+
+	for (uint64_t sectr = 0; sectr < nsectr;) {
+		const uint32_t cid = root->cids[sectr / ftl->nsectr];
+		const uint32_t csectr = sectr % ftl->nsectr;
+		const uint64_t ofz = sectr * ftl->sectr_nbytes;
+		uint32_t n = ftl->cmd_nsectr;
+		size_t nbytes;
+
+		if (n > nsectr - sectr)
+			n = nsectr - sectr;
+		if (n > ftl->nsectr - csectr)
+			n = ftl->nsectr - csectr;
+
+		if (ftl_dev_io(ftl, 0, cid, csectr, n, ftl->bounce, NULL)) {
+			NVM_DEBUG("FAILED: ftl_dev_io");
+			return -1;	// Propagate errno
+		}
+
+		nbytes = n * ftl->sectr_nbytes;
+		if (nbytes > payload_nbytes - ofz)
+			nbytes = payload_nbytes - ofz;
+		memcpy((char *)ftl->l2p + ofz, ftl->bounce, nbytes);
+		csum = ftl_csum(csum, ftl->bounce, nbytes);
+		sectr += n;
+	}
+
+	if (csum != root->csum) {
+		NVM_DEBUG("FAILED: checkpoint checksum mismatch");
+		errno = EIO;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int ftl_rfwd_cmp(const void *a, const void *b)
+{
+	const struct nvm_ftl_rfwd *x = a, *y = b;
+
+	if (x->useq != y->useq)
+		return x->useq < y->useq ? -1 : 1;
+
+	return x->ppa < y->ppa ? -1 : x->ppa > y->ppa;
+}
+
+/**
+ * Apply the blocks written after the checkpoint, found in the OOB of the data
+ * chunks, in the order they were written
+ *
+ * Sectors which cannot be read are skipped, the blocks they hold keep the
+ * mapping of the checkpoint.
+ */
+static int ftl_rfwd(struct nvm_ftl *ftl)
+{
+	const uint32_t useq_ckpt = ftl->useq;
+	struct nvm_ftl_rfwd *ents = NULL;
+	size_t nents = 0, nents_max = 0;
+	struct nvm_ftl_oob oob;
+
+	for (uint32_t cid = 0; cid < ftl_nchunks(ftl); ++cid) {
+		const struct nvm_ftl_chunk *chunk = &ftl->chunks[cid];
+
+		if (chunk->state != NVM_FTL_CHUNK_FREE || !chunk->wp)
+			continue;
+
+		// Units are written in order, the last tells whether any is new
+		if (ftl_dev_io(ftl, 0, cid, chunk->wp - 1, 1, ftl->bounce,
+			       ftl->meta)) {
+			NVM_DEBUG("FAILED: ftl_dev_io, skipping chunk");
+			continue;
+		}
+		memcpy(&oob, ftl->meta, sizeof(oob));
+		if (oob.useq <= useq_ckpt)
+			continue;
+
+		for (uint32_t sectr = 0; sectr < chunk->wp;
+		     sectr += ftl->cmd_nsectr) {
+			const uint32_t n = chunk->wp - sectr < ftl->cmd_nsectr ?
+					   chunk->wp - sectr : ftl->cmd_nsectr;
+
+			if (ftl_dev_io(ftl, 0, cid, sectr, n, ftl->bounce,
+				       ftl->meta)) {
+				NVM_DEBUG("FAILED: ftl_dev_io, skipping");
+				continue;
+			}
+
+			for (uint32_t i = 0; i < n; ++i) {
+				memcpy(&oob, ftl->meta + i * ftl->oob_nbytes,
+				       sizeof(oob));
+				if (oob.useq <= useq_ckpt ||
+				    oob.lba >= ftl->nlbas)
+					continue;
+
+				if (nents == nents_max) {
+					const size_t nmax = nents_max ?
+							    2 * nents_max :
+							    ftl->nsectr;
+					void *tmp;
+
+					tmp = realloc(ents,
+						      nmax * sizeof(*ents));
+					if (!tmp) {
+						NVM_DEBUG("FAILED: realloc");
+						free(ents);
+						return -1;
+					}
+					ents = tmp;
+					nents_max = nmax;
+				}
+				ents[nents].useq = oob.useq;
+				ents[nents].ppa = cid * ftl->nsectr + sectr + i;
+				ents[nents].lba = oob.lba;
+				nents += 1;
+
+				if (oob.useq > ftl->useq)
+					ftl->useq = oob.useq;
+			}
+		}
+	}
+
+	if (nents)
+		qsort(ents, nents, sizeof(*ents), ftl_rfwd_cmp);
+	for (size_t i = 0; i < nents; ++i)
+		ftl->l2p[ents[i].lba] = ents[i].ppa;
+
+	free(ents);
+
+	return 0;
+}
+
+/**
+ * Pad the chunks left open by the last run, making the sectors held back by
+ * the device cache readable, write pointers are updated by `ftl_rebuild`
+ */
+static void ftl_pad(struct nvm_ftl *ftl, const uint8_t *cs)
+{
+	char *meta = ftl->oob_nbytes ? ftl->meta : NULL;
+
+	if (!ftl->tail_nsectr)
+		return;
+
+	memset(ftl->bounce, 0, ftl->tail_nsectr * ftl->sectr_nbytes);
+	if (meta)
+		ftl_oob_fill(ftl, meta, NULL, ftl->tail_nsectr, 0);
+
+	for (uint32_t cid = 0; cid < ftl_nchunks(ftl); ++cid) {
+		const struct nvm_ftl_chunk *chunk = &ftl->chunks[cid];
+		uint32_t nsectr = ftl->nsectr - chunk->wp;
+
+		if (cs[cid] != NVM_CHUNK_STATE_OPEN ||
+		    chunk->state != NVM_FTL_CHUNK_FREE)
+			continue;
+
+		if (nsectr > ftl->tail_nsectr)
+			nsectr = ftl->tail_nsectr;
+		if (ftl_dev_io(ftl, 1, cid, chunk->wp, nsectr, ftl->bounce,
+			       meta)) {
+			NVM_DEBUG("FAILED: ftl_dev_io, chunk left unpadded");
+			continue;
+		}
+		ftl->nprogs += nsectr;
+	}
+}
+
+/**
+ * Derive the P2L table, the valid sectors and the state of data chunks from
+ * the L2P table, dropping mappings to sectors which are not written
+ */
+static void ftl_rebuild(struct nvm_ftl *ftl, const uint8_t *cs)
+{
+	const uint64_t nppas = (uint64_t)ftl_nchunks(ftl) * ftl->nsectr;
+
+	memset(ftl->p2l, 0xFF, nppas * sizeof(*ftl->p2l));
+	for (uint32_t cid = 0; cid < ftl_nchunks(ftl); ++cid)
+		ftl->chunks[cid].nvalid = 0;
+
+	for (uint64_t lba = 0; lba < ftl->nlbas; ++lba) {
+		const uint32_t ppa = ftl->l2p[lba];
+		struct nvm_ftl_chunk *chunk;
+
+		if (ppa == NVM_FTL_UNMAPPED)
+			continue;
+
+		chunk = ppa < nppas ? &ftl->chunks[ppa / ftl->nsectr] : NULL;
+		if (!chunk || chunk->state != NVM_FTL_CHUNK_FREE ||
+		    ppa % ftl->nsectr >= chunk->wp ||
+		    ftl->p2l[ppa] != NVM_FTL_UNMAPPED) {
+			ftl->l2p[lba] = NVM_FTL_UNMAPPED;
+			continue;
+		}
+
+		ftl->p2l[ppa] = lba;
+		chunk->nvalid += 1;
+	}
+
+	ftl->nfree = 0;
+	for (uint32_t cid = 0; cid < ftl_nchunks(ftl); ++cid) {
+		struct nvm_ftl_chunk *chunk = &ftl->chunks[cid];
+
+		if (chunk->state != NVM_FTL_CHUNK_FREE)
+			continue;
+
+		if (chunk->nvalid) {
+			struct nvm_ftl_pu *pu = &ftl->pus[cid / ftl->nchunk];
+
+			chunk->state = NVM_FTL_CHUNK_CLOSED;
+			if (cs[cid] != NVM_CHUNK_STATE_OPEN)
+				continue;
+
+			// Resume one padded chunk per PU
+			chunk->wp += ftl->tail_nsectr;
+			if (chunk->wp > ftl->nsectr)
+				chunk->wp = ftl->nsectr;
+			if (chunk->wp < ftl->nsectr &&
+			    pu->open == NVM_FTL_NIL) {
+				chunk->state = NVM_FTL_CHUNK_OPEN;
+				pu->open = cid;
+			}
+			continue;
+		}
+		chunk->erased = cs[cid] == NVM_CHUNK_STATE_FREE;
+		ftl->nfree += 1;
+	}
+
+	for (uint32_t cid = 0; cid < ftl_nchunks(ftl); ++cid)
+		ftl_gc_track(ftl, cid);
+}
+
+/**
+ * Recover from the latest checkpoint and roll forward from OOB
+ */
+static int ftl_load(struct nvm_ftl *ftl, const uint8_t *cs)
+{
+	struct nvm_ftl_root *root;
+
+	for (uint32_t cid = 0; cid < ftl_nchunks(ftl); ++cid) {
+		ftl->chunks[cid].state = cs[cid] & NVM_CHUNK_STATE_OFFLINE ?
+					 NVM_FTL_CHUNK_OFFLINE :
+					 NVM_FTL_CHUNK_FREE;
+	}
+
+	if (ftl_sb_find(ftl, cs)) {
+		NVM_DEBUG("FAILED: ftl_sb_find");
+		return -1;	// Propagate errno
+	}
+	root = ftl_root_find(ftl);
+	if (!root) {
+		NVM_DEBUG("FAILED: ftl_root_find");
+		return -1;	// Propagate errno
+	}
+
+	ftl->nlbas = root->nlbas;
+	ftl->ckpt_nchunks = ftl_ckpt_nchunks(ftl, root->nlbas);
+	if (root->nlbas > (uint64_t)ftl_nchunks(ftl) * ftl->nsectr ||
+	    root->nchunks != ftl->ckpt_nchunks) {
+		NVM_DEBUG("FAILED: root record does not match the device");
+		free(root);
+		errno = EINVAL;
+		return -1;
+	}
+	for (uint32_t i = 0; i < root->nchunks; ++i) {
+		if (root->cids[i] >= ftl_nchunks(ftl)) {
+			NVM_DEBUG("FAILED: invalid checkpoint chunk");
+			free(root);
+			errno = EINVAL;
+			return -1;
+		}
+		ftl->ckpt_cids[i] = root->cids[i];
+		ftl->chunks[root->cids[i]].state = NVM_FTL_CHUNK_META;
+	}
+	ftl->chunks[ftl->sb_cids[0]].state = NVM_FTL_CHUNK_META;
+	ftl->chunks[ftl->sb_cids[1]].state = NVM_FTL_CHUNK_META;
+	ftl->ckpt_seq = root->seq;
+	ftl->useq = root->useq;
+
+	if (ftl_l2p_alloc(ftl) || ftl_ckpt_load(ftl, root)) {
+		NVM_DEBUG("FAILED: ftl_l2p_alloc or ftl_ckpt_load");
+		free(root);
+		return -1;	// Propagate errno
+	}
+	free(root);
+
+	ftl_pad(ftl, cs);
+
+	if (ftl->oob_nbytes && ftl_rfwd(ftl)) {
+		NVM_DEBUG("FAILED: ftl_rfwd");
+		return -1;	// Propagate errno
+	}
+
+	ftl_rebuild(ftl, cs);
+
+	return 0;
+}
+
+static void ftl_free(struct nvm_ftl *ftl)
+{
+	nvm_gc_destroy(ftl->gc);
+	free(ftl->gc_shadow);
+	free(ftl->gc_src);
+	free(ftl->gc_dst);
+	free(ftl->gc_bitmap);
+	if (ftl->pus) {
+		for (uint32_t idx = 0; idx < ftl->npus; ++idx)
+			free(ftl->pus[idx].tail);
+	}
+	for (uint32_t i = 0; i < ftl->norphans; ++i)
+		free(ftl->orphans[i].tail);
+	free(ftl->orphans);
+	if (ftl->stage)
+		nvm_buf_free(ftl->dev, ftl->stage);
+	if (ftl->meta)
+		nvm_buf_free(ftl->dev, ftl->meta);
+	if (ftl->bounce)
+		nvm_buf_free(ftl->dev, ftl->bounce);
+	free(ftl->stage_lbas);
+	free(ftl->ckpt_cids);
+	free(ftl->l2p);
+	free(ftl->p2l);
+	free(ftl->chunks);
+	free(ftl->pus);
+	pthread_mutex_destroy(&ftl->lock);
+	free(ftl);
+}
+
+struct nvm_ftl *nvm_ftl_open(struct nvm_dev *dev, int flags)
+{
+	const struct nvm_geo *geo = nvm_dev_get_geo(dev);
+	const int mw_cunits = nvm_dev_get_mw_cunits(dev);
+	struct nvm_ftl *ftl;
+	uint32_t nchunks, ckpt_nchunks_max;
+	size_t bounce_nsectr, meta_nsectr;
+	uint8_t *cs = NULL;
+	int err;
+
+	if (nvm_dev_get_verid(dev) != NVM_SPEC_VERID_20) {
+		NVM_DEBUG("FAILED: unsupported verid");
+		errno = ENOSYS;
+		return NULL;
+	}
+
+	ftl = calloc(1, sizeof(*ftl));
+	if (!ftl) {
+		NVM_DEBUG("FAILED: calloc ftl");
+		return NULL;
+	}
+	pthread_mutex_init(&ftl->lock, NULL);
+
+	ftl->dev = dev;
+	ftl->npus = geo->l.npugrp * geo->l.npunit;
+	ftl->nchunk = geo->l.nchunk;
+	ftl->nsectr = geo->l.nsectr;
+	ftl->sectr_nbytes = geo->l.nbytes;
+	if (geo->l.nbytes_oob >= sizeof(struct nvm_ftl_oob))
+		ftl->oob_nbytes = geo->l.nbytes_oob;
+	ftl->ws_opt = nvm_dev_get_ws_opt(dev);
+	ftl->cmd_nsectr = ftl->ws_opt ?
+			  (NVM_NADDR_MAX / ftl->ws_opt) * ftl->ws_opt : 0;
+	ftl->stage_nunits = NVM_MIN(ftl->npus, NVM_FTL_STAGE_NUNITS_MAX);
+	ftl->ckpt_interval = NVM_FTL_CKPT_INTERVAL;
+	ftl->sb_cids[0] = NVM_FTL_NIL;
+	ftl->sb_cids[1] = NVM_FTL_NIL;
+	ftl->gc_cid = NVM_FTL_NIL;
+	nchunks = ftl_nchunks(ftl);
+
+	if (!ftl->cmd_nsectr || ftl->nsectr % ftl->ws_opt ||
+	    ftl->nchunk < 2 || mw_cunits < 0 ||
+	    (uint64_t)nchunks * ftl->nsectr >= NVM_FTL_STAGED) {
+		NVM_DEBUG("FAILED: unsupported geometry");
+		err = EINVAL;
+		goto failed;
+	}
+	ftl->tail_nsectr = ftl_round_up(mw_cunits, ftl->ws_opt);
+	ftl->rec_nsectr = ftl_round_up(1 + mw_cunits, ftl->ws_opt);
+
+	ckpt_nchunks_max = ftl_ckpt_nchunks(ftl, (uint64_t)nchunks *
+						 ftl->nsectr);
+	if (ftl->rec_nsectr > ftl->nsectr || sizeof(struct nvm_ftl_root) +
+	    ckpt_nchunks_max * sizeof(uint32_t) > ftl->sectr_nbytes) {
+		NVM_DEBUG("FAILED: root record does not fit");
+		err = EINVAL;
+		goto failed;
+	}
+
+	bounce_nsectr = NVM_MAX(ftl->cmd_nsectr, ftl->rec_nsectr);
+	meta_nsectr = NVM_MAX(bounce_nsectr, ftl->stage_nunits * ftl->ws_opt);
+
+	ftl->chunks = calloc(nchunks, sizeof(*ftl->chunks));
+	ftl->pus = calloc(ftl->npus, sizeof(*ftl->pus));
+	ftl->p2l = malloc((size_t)nchunks * ftl->nsectr * sizeof(*ftl->p2l));
+	ftl->ckpt_cids = malloc(ckpt_nchunks_max * sizeof(*ftl->ckpt_cids));
+	ftl->stage_lbas = malloc(ftl->stage_nunits * ftl->ws_opt *
+				 sizeof(*ftl->stage_lbas));
+	ftl->stage = nvm_buf_alloc(dev, ftl->stage_nunits * ftl->ws_opt *
+				   ftl->sectr_nbytes, NULL);
+	ftl->bounce = nvm_buf_alloc(dev, bounce_nsectr * ftl->sectr_nbytes,
+				    NULL);
+	if (ftl->oob_nbytes)
+		ftl->meta = nvm_buf_alloc(dev, meta_nsectr * ftl->oob_nbytes,
+					  NULL);
+	ftl->gc_shadow = malloc(NVM_MAX(ftl->tail_nsectr, 1) *
+				sizeof(*ftl->gc_shadow));
+	ftl->gc_src = malloc(ftl->nsectr * sizeof(*ftl->gc_src));
+	ftl->gc_dst = malloc(ftl->nsectr * sizeof(*ftl->gc_dst));
+	ftl->gc_bitmap = malloc(((ftl->nsectr + 63) / 64) *
+				sizeof(*ftl->gc_bitmap));
+	cs = malloc(nchunks);
+	if (!ftl->chunks || !ftl->pus || !ftl->p2l || !ftl->ckpt_cids ||
+	    !ftl->stage_lbas || !ftl->stage || !ftl->bounce ||
+	    (ftl->oob_nbytes && !ftl->meta) || !ftl->gc_shadow ||
+	    !ftl->gc_src || !ftl->gc_dst || !ftl->gc_bitmap || !cs) {
+		NVM_DEBUG("FAILED: allocating ftl");
+		err = ENOMEM;
+		goto failed;
+	}
+
+	ftl->gc = nvm_gc_create(dev, flags & NVM_FTL_GC_GREEDY ?
+				NVM_GC_GREEDY : NVM_GC_COST_BENEFIT);
+	if (!ftl->gc) {
+		NVM_DEBUG("FAILED: nvm_gc_create");
+		err = errno;
+		goto failed;
+	}
+	nvm_gc_set_budget(ftl->gc, NVM_FTL_GC_RATIO);
+	for (uint32_t idx = 0; idx < ftl->npus; ++idx) {
+		ftl->pus[idx].open = NVM_FTL_NIL;
+		ftl->pus[idx].tail_cid = NVM_FTL_NIL;
+		if (!ftl->tail_nsectr)
+			continue;
+
+		ftl->pus[idx].tail = malloc(ftl->tail_nsectr *
+					    ftl->sectr_nbytes);
+		if (!ftl->pus[idx].tail) {
+			NVM_DEBUG("FAILED: malloc tail");
+			err = ENOMEM;
+			goto failed;
+		}
+	}
+	for (uint32_t i = 0; i < ckpt_nchunks_max; ++i)
+		ftl->ckpt_cids[i] = NVM_FTL_NIL;
+	memset(ftl->p2l, 0xFF, (size_t)nchunks * ftl->nsectr *
+	       sizeof(*ftl->p2l));
+	memset(cs, NVM_CHUNK_STATE_OFFLINE, nchunks);
+
+	if (ftl_rprt(ftl, cs) ||
+	    (flags & NVM_FTL_FORMAT ? ftl_format(ftl, cs) :
+				      ftl_load(ftl, cs))) {
+		NVM_DEBUG("FAILED: ftl_rprt, ftl_format or ftl_load");
+		err = errno;
+		goto failed;
+	}
+	free(cs);
+
+	return ftl;
+
+failed:
+	free(cs);
+	ftl_free(ftl);
+	errno = err;
+	return NULL;
+}
+
+int nvm_ftl_close(struct nvm_ftl *ftl)
+{
+	int err = 0, ret;
+
+	if (!ftl)
+		return 0;
+
+	pthread_mutex_lock(&ftl->lock);
+	ret = ftl_stage_flush(ftl, 1);
+	if (!ret)
+		ret = ftl_ckpt(ftl);
+	if (ret)
+		err = errno;
+	pthread_mutex_unlock(&ftl->lock);
+
+	ftl_free(ftl);
+
+	if (ret) {
+		NVM_DEBUG("FAILED: ftl_stage_flush or ftl_ckpt");
+		errno = err;
+	}
+	return ret;
+}
+
+uint64_t nvm_ftl_get_nlbas(const struct nvm_ftl *ftl)
+{
+	return ftl->nlbas;
+}
+
+int nvm_ftl_read(struct nvm_ftl *ftl, uint64_t lba, uint32_t nlbas,
+		 void *buf)
+{
+	struct nvm_addr addrs[NVM_NADDR_MAX];
+	char *dsts[NVM_NADDR_MAX];
+	uint32_t naddrs = 0;
+	int err = 0;
+
+	if (ftl_check_range(ftl, lba, nlbas))
+		return -1;	// Propagate errno
+
+	pthread_mutex_lock(&ftl->lock);
+	for (uint32_t i = 0; i < nlbas && !err; ++i) {
+		char *dst = (char *)buf + (size_t)i * ftl->sectr_nbytes;
+		uint32_t ppa = ftl->l2p[lba + i];
+		const char *src;
+
+		if (ppa == NVM_FTL_UNMAPPED) {
+			memset(dst, 0, ftl->sectr_nbytes);
+			continue;
+		}
+
+		ppa = ftl_gc_shadow(ftl, ppa);
+		src = ftl_host_copy(ftl, ppa);
+		if (src) {
+			memcpy(dst, src, ftl->sectr_nbytes);
+			continue;
+		}
+
+		addrs[naddrs] = ftl_addr(ftl, ppa / ftl->nsectr,
+					 ppa % ftl->nsectr);
+		dsts[naddrs++] = dst;
+		if (naddrs == ftl->cmd_nsectr) {
+			err = ftl_read_batch(ftl, addrs, dsts, naddrs);
+			naddrs = 0;
+		}
+	}
+	if (!err && naddrs)
+		err = ftl_read_batch(ftl, addrs, dsts, naddrs);
+	pthread_mutex_unlock(&ftl->lock);
+
+	return err;
+}
+
+int nvm_ftl_write(struct nvm_ftl *ftl, uint64_t lba, uint32_t nlbas,
+		  const void *buf)
+{
+	uint32_t i;
+	int err = 0;
+
+	if (ftl_check_range(ftl, lba, nlbas))
+		return -1;	// Propagate errno
+
+	pthread_mutex_lock(&ftl->lock);
+	for (i = 0; i < nlbas; ++i) {
+		if (ftl_stage(ftl, lba + i, (const char *)buf +
+			      (size_t)i * ftl->sectr_nbytes)) {
+			NVM_DEBUG("FAILED: ftl_stage");
+			err = -1;
+			break;
+		}
+	}
+	ftl->nwrites += i;
+	pthread_mutex_unlock(&ftl->lock);
+
+	return err;
+}
+
+int nvm_ftl_trim(struct nvm_ftl *ftl, uint64_t lba, uint32_t nlbas)
+{
+	if (ftl_check_range(ftl, lba, nlbas))
+		return -1;	// Propagate errno
+
+	pthread_mutex_lock(&ftl->lock);
+	for (uint32_t i = 0; i < nlbas; ++i)
+		ftl_unmap(ftl, lba + i);
+	pthread_mutex_unlock(&ftl->lock);
+
+	return 0;
+}
+
+int nvm_ftl_flush(struct nvm_ftl *ftl)
+{
+	int err;
+
+	pthread_mutex_lock(&ftl->lock);
+	err = ftl_stage_flush(ftl, 1);
+	pthread_mutex_unlock(&ftl->lock);
+
+	return err;
+}
+
+int nvm_ftl_checkpoint(struct nvm_ftl *ftl)
+{
+	int err;
+
+	pthread_mutex_lock(&ftl->lock);
+	err = ftl_stage_flush(ftl, 1);
+	if (!err)
+		err = ftl_ckpt(ftl);
+	pthread_mutex_unlock(&ftl->lock);
+
+	return err;
+}
+
+int nvm_ftl_set_ckpt_interval(struct nvm_ftl *ftl, uint32_t nchunks)
+{
+	if (!nchunks) {
+		NVM_DEBUG("FAILED: invalid nchunks");
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&ftl->lock);
+	ftl->ckpt_interval = nchunks;
+	pthread_mutex_unlock(&ftl->lock);
+
+	return 0;
+}
+
+void nvm_ftl_set_gc_budget(struct nvm_ftl *ftl, uint32_t ratio)
+{
+	pthread_mutex_lock(&ftl->lock);
+	nvm_gc_set_budget(ftl->gc, ratio);
+	pthread_mutex_unlock(&ftl->lock);
+}
+
+void nvm_ftl_pr(struct nvm_ftl *ftl)
+{
+	pthread_mutex_lock(&ftl->lock);
+	printf("ftl:\n");
+	printf("  npus: %u\n", ftl->npus);
+	printf("  nlbas: %"PRIu64"\n", ftl->nlbas);
+	printf("  lba_nbytes: %zu\n", ftl->sectr_nbytes);
+	printf("  ws_opt: %u\n", ftl->ws_opt);
+	printf("  oob: %s\n", ftl->oob_nbytes ? "yes" : "no");
+	printf("  nfree: %u\n", ftl->nfree);
+	printf("  ndead: %u\n", ftl->ndead);
+	printf("  nstaged: %u\n", ftl->nstaged);
+	printf("  useq: %u\n", ftl->useq);
+	printf("  ckpt_seq: %"PRIu64"\n", ftl->ckpt_seq);
+	printf("  ckpt_nchunks: %u\n", ftl->ckpt_nchunks);
+	printf("  ckpt_interval: %u\n", ftl->ckpt_interval);
+	printf("  nwrites: %zu\n", ftl->nwrites);
+	printf("  nprogs: %zu\n", ftl->nprogs);
+	printf("  nckpts: %zu\n", ftl->nckpts);
+	printf("  gc_nvictims: %zu\n", ftl->gc_nvictims);
+	printf("  gc_nmoved: %zu\n", ftl->gc_nmoved);
+	pthread_mutex_unlock(&ftl->lock);
+}
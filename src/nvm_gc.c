@@ -0,0 +1,561 @@
+/*
+ * nvm_gc - Garbage-collection engine relocating valid sectors of chunks
+ *
+ * Copyright (C) Simon A. F. Lund <slund@cnexlabs.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <liblightnvm.h>
+#include <liblightnvm_spec.h>
+#include <nvm_dev.h>
+#include <nvm_gc.h>
+
+static inline struct nvm_gc_chunk *gc_chunk(struct nvm_gc *gc,
+					    struct nvm_addr addr)
+{
+	const struct nvm_geo *geo = nvm_dev_get_geo(gc->dev);
+
+	if (addr.l.pugrp >= geo->l.npugrp || addr.l.punit >= geo->l.npunit ||
+	    addr.l.chunk >= gc->nchunk)
+		return NULL;
+
+	return &gc->chunks[(addr.l.pugrp * geo->l.npunit + addr.l.punit) *
+			   gc->nchunk + addr.l.chunk];
+}
+
+static inline struct nvm_addr gc_addr(const struct nvm_gc *gc, uint32_t idx)
+{
+	const struct nvm_geo *geo = nvm_dev_get_geo(gc->dev);
+	const uint32_t pu = idx / gc->nchunk;
+	struct nvm_addr addr = { .val = 0 };
+
+	addr.l.pugrp = pu / geo->l.npunit;
+	addr.l.punit = pu % geo->l.npunit;
+	addr.l.chunk = idx % gc->nchunk;
+
+	return addr;
+}
+
+/**
+ * Refresh the wear-level index of the chunks of 'pu' from its chunk report
+ */
+static int gc_wear(struct nvm_gc *gc, uint32_t pu)
+{
+	struct nvm_addr addr = gc_addr(gc, pu * gc->nchunk);
+	struct nvm_spec_rprt *rprt;
+
+	rprt = nvm_cmd_rprt(gc->dev, &addr, 0x0, NULL);
+	if (!rprt) {
+		NVM_DEBUG("FAILED: nvm_cmd_rprt");
+		return -1;	// Propagate errno
+	}
+
+	for (uint32_t i = 0; i < rprt->ndescr && i < gc->nchunk; ++i)
+		gc->chunks[pu * gc->nchunk + i].wli = rprt->descr[i].wli;
+	gc->stale[pu] = 0;
+
+	nvm_buf_free(gc->dev, rprt);
+
+	return 0;
+}
+
+/**
+ * Benefit of reclaiming 'chunk', the sectors it frees for greedy, otherwise
+ * the sectors it frees per sector moved times its age, weighed down by wear
+ */
+static double gc_score(const struct nvm_gc *gc,
+		       const struct nvm_gc_chunk *chunk)
+{
+	const double u = (double)chunk->nvalid / gc->nsectr;
+	const double age = gc->clock - chunk->stamp;
+
+	if (gc->policy == NVM_GC_GREEDY)
+		return gc->nsectr - chunk->nvalid;
+
+	return (1.0 - u) * age / (1.0 + u) * (256 - chunk->wli) / 256.0;
+}
+
+/**
+ * Relocate 'naddrs' sectors by vector copy, stopping at the first command when
+ * the backend does not support it
+ *
+ * @return On success, the number of sectors copied. On error, -1 is returned
+ * and `errno` set to indicate the error
+ */
+static int gc_copy(struct nvm_gc *gc, struct nvm_addr src[],
+		   struct nvm_addr dst[], int naddrs)
+{
+	for (int ofz = 0; ofz < naddrs; ofz += gc->cmd_nsectr) {
+		const int n = NVM_MIN(naddrs - ofz, (int)gc->cmd_nsectr);
+
+		if (!nvm_cmd_copy(gc->dev, src + ofz, dst + ofz, n, 0x0,
+				  NULL)) {
+			gc->copy = 1;
+			gc->ncopied += n;
+			continue;
+		}
+		if (errno == ENOSYS && gc->copy < 0) {
+			gc->copy = 0;
+			return ofz;
+		}
+
+		NVM_DEBUG("FAILED: nvm_cmd_copy");
+		errno = EIO;
+		return -1;
+	}
+
+	return naddrs;
+}
+
+/**
+ * Read or write 'naddrs' sectors with the buffers 'b', on the ASYNC context of
+ * the engine when it has one
+ */
+static int gc_submit(struct nvm_gc *gc, int write, struct nvm_addr addrs[],
+		     int naddrs, int b, struct nvm_ret *ret)
+{
+	const uint16_t flags = gc->ctx ? NVM_CMD_ASYNC : 0x0;
+	char *meta = gc->oob_nbytes ? gc->metas[b] : NULL;
+
+	memset(ret, 0, sizeof(*ret));
+	ret->async.ctx = gc->ctx;
+
+	if (write)
+		return nvm_cmd_write(gc->dev, addrs, naddrs, gc->bufs[b], meta,
+				     flags, ret);
+
+	return nvm_cmd_read(gc->dev, addrs, naddrs, gc->bufs[b], meta, flags,
+			    ret);
+}
+
+/**
+ * Wait for the commands issued by `gc_submit`, of which the first 'nrets' of
+ * 'rets' were submitted
+ */
+static int gc_wait(struct nvm_gc *gc, struct nvm_ret rets[], int nrets)
+{
+	if (!gc->ctx)
+		return 0;
+
+	if (nvm_async_wait(gc->dev, gc->ctx) < 0) {
+		NVM_DEBUG("FAILED: nvm_async_wait");
+		return -1;
+	}
+	for (int i = 0; i < nrets; ++i) {
+		if (rets[i].status) {
+			NVM_DEBUG("FAILED: status: %u", rets[i].status);
+			errno = EIO;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Relocate 'nsrc' sectors through host memory followed by 'ndst - nsrc'
+ * sectors of padding, one command at a time with the read of the next command
+ * in flight with the write of the current one
+ */
+static int gc_rewrite(struct nvm_gc *gc, struct nvm_addr src[], int nsrc,
+		      struct nvm_addr dst[], int ndst)
+{
+	const int cmd_nsectr = gc->cmd_nsectr;
+	struct nvm_ret rets[2];
+	int nrets = 0;
+
+	if (nsrc) {
+		nrets = !gc_submit(gc, 0, src, NVM_MIN(nsrc, cmd_nsectr), 0,
+				   &rets[0]);
+		if (!nrets || gc_wait(gc, rets, nrets)) {
+			NVM_DEBUG("FAILED: gc_submit or gc_wait");
+			errno = EIO;
+			return -1;
+		}
+	}
+
+	for (int ofz = 0; ofz < ndst; ofz += cmd_nsectr) {
+		const int b = (ofz / cmd_nsectr) % 2;
+		const int n = NVM_MIN(ndst - ofz, cmd_nsectr);
+		const int nread = NVM_MAX(NVM_MIN(nsrc - ofz, n), 0);
+		const int next = ofz + cmd_nsectr;
+		int err;
+
+		if (nread < n) {
+			memset(gc->bufs[b] + nread * gc->sectr_nbytes, 0,
+			       (n - nread) * gc->sectr_nbytes);
+			if (gc->oob_nbytes)
+				memset(gc->metas[b] + nread * gc->oob_nbytes,
+				       0, (n - nread) * gc->oob_nbytes);
+		}
+
+		err = gc_submit(gc, 1, dst + ofz, n, b, &rets[0]);
+		nrets = !err;
+		if (!err && next < nsrc) {
+			err = gc_submit(gc, 0, src + next,
+					NVM_MIN(nsrc - next, cmd_nsectr), !b,
+					&rets[1]);
+			nrets += !err;
+		}
+		if (gc_wait(gc, rets, nrets) || err) {
+			NVM_DEBUG("FAILED: gc_submit or gc_wait");
+			errno = EIO;
+			return -1;
+		}
+
+		gc->nrewritten += nread;
+		gc->npadded += n - nread;
+	}
+
+	return 0;
+}
+
+static void gc_free(struct nvm_gc *gc)
+{
+	if (gc->ctx)
+		nvm_async_term(gc->dev, gc->ctx);
+	for (int b = 0; b < 2; ++b) {
+		if (gc->bufs[b])
+			nvm_buf_free(gc->dev, gc->bufs[b]);
+		if (gc->metas[b])
+			nvm_buf_free(gc->dev, gc->metas[b]);
+	}
+	free(gc->stale);
+	free(gc->bitmaps);
+	pthread_mutex_destroy(&gc->lock);
+	free(gc);
+}
+
+struct nvm_gc *nvm_gc_create(struct nvm_dev *dev, int policy)
+{
+	const struct nvm_geo *geo = nvm_dev_get_geo(dev);
+	const uint32_t npus = geo->l.npugrp * geo->l.npunit;
+	const uint32_t nchunks = npus * geo->l.nchunk;
+	struct nvm_gc *gc;
+	int ws_min;
+
+	if (nvm_dev_get_verid(dev) != NVM_SPEC_VERID_20) {
+		NVM_DEBUG("FAILED: unsupported verid");
+		errno = ENOSYS;
+		return NULL;
+	}
+	if (policy != NVM_GC_GREEDY && policy != NVM_GC_COST_BENEFIT) {
+		NVM_DEBUG("FAILED: invalid policy: %d", policy);
+		errno = EINVAL;
+		return NULL;
+	}
+	ws_min = nvm_dev_get_ws_min(dev);
+	if (ws_min <= 0 || ws_min > NVM_NADDR_MAX) {
+		NVM_DEBUG("FAILED: unsupported ws_min: %d", ws_min);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	gc = calloc(1, sizeof(*gc) + nchunks * sizeof(*gc->chunks));
+	if (!gc) {
+		NVM_DEBUG("FAILED: calloc gc");
+		return NULL;
+	}
+	pthread_mutex_init(&gc->lock, NULL);
+
+	gc->dev = dev;
+	gc->policy = policy;
+	gc->npus = npus;
+	gc->nchunk = geo->l.nchunk;
+	gc->nsectr = geo->l.nsectr;
+	gc->nwords = (gc->nsectr + 63) / 64;
+	gc->sectr_nbytes = geo->l.nbytes;
+	gc->oob_nbytes = geo->l.nbytes_oob;
+	gc->ws_min = ws_min;
+	gc->cmd_nsectr = (NVM_NADDR_MAX / ws_min) * ws_min;
+	gc->copy = -1;
+
+	gc->bitmaps = calloc((size_t)nchunks * gc->nwords,
+			     sizeof(*gc->bitmaps));
+	gc->stale = malloc(npus);
+	for (int b = 0; b < 2; ++b) {
+		gc->bufs[b] = nvm_buf_alloc(dev, gc->cmd_nsectr *
+					    gc->sectr_nbytes, NULL);
+		if (gc->oob_nbytes)
+			gc->metas[b] = nvm_buf_alloc(dev, gc->cmd_nsectr *
+						     gc->oob_nbytes, NULL);
+	}
+	if (!gc->bitmaps || !gc->stale || !gc->bufs[0] || !gc->bufs[1] ||
+	    (gc->oob_nbytes && (!gc->metas[0] || !gc->metas[1]))) {
+		NVM_DEBUG("FAILED: allocating gc");
+		gc_free(gc);
+		errno = ENOMEM;
+		return NULL;
+	}
+	memset(gc->stale, 1, npus);
+	for (uint32_t idx = 0; idx < nchunks; ++idx)
+		gc->chunks[idx].bitmap = &gc->bitmaps[idx * gc->nwords];
+
+	// Depth of two, the read of the next command and the current write
+	gc->ctx = nvm_async_init(dev, 2, 0x0);
+	if (!gc->ctx) {
+		NVM_DEBUG("FAILED: nvm_async_init, rewriting synchronously");
+	}
+
+	return gc;
+}
+
+void nvm_gc_destroy(struct nvm_gc *gc)
+{
+	if (!gc)
+		return;
+
+	gc_free(gc);
+}
+
+int nvm_gc_set_chunk(struct nvm_gc *gc, struct nvm_addr addr,
+		     const uint64_t *bitmap)
+{
+	struct nvm_gc_chunk *chunk = gc_chunk(gc, addr);
+	uint32_t nvalid = 0;
+
+	if (!chunk) {
+		NVM_DEBUG("FAILED: invalid chunk address");
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&gc->lock);
+	if (!bitmap) {
+		gc->ntracked -= chunk->tracked;
+		chunk->tracked = 0;
+		chunk->nvalid = 0;
+		pthread_mutex_unlock(&gc->lock);
+		return 0;
+	}
+
+	memcpy(chunk->bitmap, bitmap, gc->nwords * sizeof(*bitmap));
+	if (gc->nsectr % 64) {	// Drop bits beyond the last sector
+		chunk->bitmap[gc->nwords - 1] &= ~0ULL >>
+						 (64 - gc->nsectr % 64);
+	}
+	for (uint32_t i = 0; i < gc->nwords; ++i)
+		nvalid += __builtin_popcountll(chunk->bitmap[i]);
+
+	gc->ntracked += !chunk->tracked;
+	chunk->tracked = 1;
+	chunk->nvalid = nvalid;
+	chunk->stamp = gc->clock++;
+	gc->stale[(chunk - gc->chunks) / gc->nchunk] = 1;
+	pthread_mutex_unlock(&gc->lock);
+
+	return 0;
+}
+
+int nvm_gc_invalidate(struct nvm_gc *gc, struct nvm_addr addr)
+{
+	struct nvm_gc_chunk *chunk = gc_chunk(gc, addr);
+	uint64_t bit;
+
+	if (!chunk || addr.l.sectr >= gc->nsectr) {
+		NVM_DEBUG("FAILED: invalid sector address");
+		errno = EINVAL;
+		return -1;
+	}
+	bit = 1ULL << (addr.l.sectr % 64);
+
+	pthread_mutex_lock(&gc->lock);
+	if (chunk->tracked && (chunk->bitmap[addr.l.sectr / 64] & bit)) {
+		chunk->bitmap[addr.l.sectr / 64] &= ~bit;
+		chunk->nvalid -= 1;
+	}
+	pthread_mutex_unlock(&gc->lock);
+
+	return 0;
+}
+
+int nvm_gc_pick(struct nvm_gc *gc, uint32_t nvalid_max,
+		struct nvm_addr *chunk)
+{
+	uint32_t victim = UINT32_MAX;
+	double best = -1.0;
+	int nvalid;
+
+	pthread_mutex_lock(&gc->lock);
+	for (uint32_t pu = 0; gc->policy == NVM_GC_COST_BENEFIT &&
+	     pu < gc->npus; ++pu) {
+		if (gc->stale[pu] && gc_wear(gc, pu)) {
+			NVM_DEBUG("FAILED: gc_wear, keeping the last known");
+		}
+	}
+
+	for (uint32_t idx = 0; idx < gc->npus * gc->nchunk; ++idx) {
+		const struct nvm_gc_chunk *cand = &gc->chunks[idx];
+		double score;
+
+		if (!cand->tracked || cand->nvalid > nvalid_max)
+			continue;
+
+		score = gc_score(gc, cand);
+		if (score > best) {
+			best = score;
+			victim = idx;
+		}
+	}
+
+	if (victim == UINT32_MAX) {
+		pthread_mutex_unlock(&gc->lock);
+		NVM_DEBUG("FAILED: no victim");
+		errno = ENOENT;
+		return -1;
+	}
+
+	*chunk = gc_addr(gc, victim);
+	nvalid = gc->chunks[victim].nvalid;
+	gc->npicks += 1;
+	pthread_mutex_unlock(&gc->lock);
+
+	return nvalid;
+}
+
+int nvm_gc_get_valid(struct nvm_gc *gc, struct nvm_addr addr,
+		     struct nvm_addr addrs[])
+{
+	struct nvm_gc_chunk *chunk = gc_chunk(gc, addr);
+	int naddrs = 0;
+
+	if (!chunk) {
+		NVM_DEBUG("FAILED: invalid chunk address");
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&gc->lock);
+	if (!chunk->tracked) {
+		pthread_mutex_unlock(&gc->lock);
+		NVM_DEBUG("FAILED: chunk is not tracked");
+		errno = ENOENT;
+		return -1;
+	}
+
+	for (uint32_t sectr = 0; sectr < gc->nsectr; ++sectr) {
+		if (!(chunk->bitmap[sectr / 64] & (1ULL << (sectr % 64))))
+			continue;
+
+		addrs[naddrs] = addr;
+		addrs[naddrs].l.sectr = sectr;
+		naddrs += 1;
+	}
+	pthread_mutex_unlock(&gc->lock);
+
+	return naddrs;
+}
+
+int nvm_gc_move(struct nvm_gc *gc, struct nvm_addr src[], int nsrc,
+		struct nvm_addr dst[], int ndst, int flags)
+{
+	int ncopied = 0;
+
+	if (nsrc < 0 || ndst < nsrc || ndst % gc->ws_min) {
+		NVM_DEBUG("FAILED: nsrc: %d, ndst: %d, ws_min: %u", nsrc, ndst,
+			  gc->ws_min);
+		errno = EINVAL;
+		return -1;
+	}
+	if (!ndst)
+		return 0;
+
+	pthread_mutex_lock(&gc->lock);
+	if (!(flags & NVM_GC_URGENT) && gc->ratio && gc->credit <= 0) {
+		gc->nthrottled += 1;
+		pthread_mutex_unlock(&gc->lock);
+		NVM_DEBUG("FAILED: budget exhausted");
+		errno = EAGAIN;
+		return -1;
+	}
+
+	if (gc->copy) {
+		ncopied = gc_copy(gc, src, dst, (nsrc / gc->ws_min) *
+				  gc->ws_min);
+		if (ncopied < 0) {
+			pthread_mutex_unlock(&gc->lock);
+			NVM_DEBUG("FAILED: gc_copy");
+			return -1;	// Propagate errno
+		}
+	}
+
+	if (ncopied < ndst && gc_rewrite(gc, src + ncopied, nsrc - ncopied,
+					 dst + ncopied, ndst - ncopied)) {
+		pthread_mutex_unlock(&gc->lock);
+		NVM_DEBUG("FAILED: gc_rewrite");
+		return -1;	// Propagate errno
+	}
+
+	if (gc->ratio)
+		gc->credit -= ndst;
+	pthread_mutex_unlock(&gc->lock);
+
+	return 0;
+}
+
+void nvm_gc_set_budget(struct nvm_gc *gc, uint32_t ratio)
+{
+	pthread_mutex_lock(&gc->lock);
+	gc->ratio = ratio;
+	gc->credit = 0;
+	pthread_mutex_unlock(&gc->lock);
+}
+
+void nvm_gc_account(struct nvm_gc *gc, size_t nsectr)
+{
+	const int64_t credit_max = (int64_t)NVM_GC_CREDIT_NCHUNKS * gc->nsectr;
+
+	pthread_mutex_lock(&gc->lock);
+	if (gc->ratio) {
+		gc->credit += (int64_t)nsectr * gc->ratio;
+		if (gc->credit > credit_max)
+			gc->credit = credit_max;
+	}
+	pthread_mutex_unlock(&gc->lock);
+}
+
+void nvm_gc_pr(struct nvm_gc *gc)
+{
+	pthread_mutex_lock(&gc->lock);
+	printf("gc:\n");
+	printf("  policy: %s\n", gc->policy == NVM_GC_GREEDY ?
+	       "greedy" : "cost-benefit");
+	printf("  copy: %s\n", gc->copy < 0 ? "untried" :
+	       gc->copy ? "yes" : "no");
+	printf("  async: %s\n", gc->ctx ? "yes" : "no");
+	printf("  ratio: %u\n", gc->ratio);
+	printf("  credit: %"PRId64"\n", gc->credit);
+	printf("  ntracked: %zu\n", gc->ntracked);
+	printf("  npicks: %zu\n", gc->npicks);
+	printf("  ncopied: %zu\n", gc->ncopied);
+	printf("  nrewritten: %zu\n", gc->nrewritten);
+	printf("  npadded: %zu\n", gc->npadded);
+	printf("  nthrottled: %zu\n", gc->nthrottled);
+	pthread_mutex_unlock(&gc->lock);
+}
@@ -0,0 +1,537 @@
+/*
+ * nvm_rcache - Host sector read cache with CLOCK or S3-FIFO eviction
+ *
+ * Copyright (C) Simon A. F. Lund <slund@cnexlabs.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <liblightnvm.h>
+#include <liblightnvm_spec.h>
+#include <nvm_dev.h>
+#include <nvm_rcache.h>
+
+static inline uint64_t rcache_hash(uint64_t key)
+{
+	return key * 0x9E3779B97F4A7C15ULL;
+}
+
+static inline struct nvm_rcache_shard *rcache_shard(struct nvm_rcache *rcache,
+						    uint64_t key)
+{
+	return &rcache->shards[(rcache_hash(key) >> 32) % NVM_RCACHE_NSHARDS];
+}
+
+static inline uint32_t *rcache_bucket(struct nvm_rcache_shard *shard,
+				      uint64_t key)
+{
+	return &shard->buckets[rcache_hash(key) & shard->bucket_mask];
+}
+
+static uint32_t rcache_find(struct nvm_rcache_shard *shard, uint64_t key)
+{
+	uint32_t idx = *rcache_bucket(shard, key);
+
+	while (idx != NVM_RCACHE_NIL && shard->ents[idx].key != key)
+		idx = shard->ents[idx].hnext;
+
+	return idx;
+}
+
+static void rcache_unhash(struct nvm_rcache_shard *shard, uint32_t idx)
+{
+	uint32_t *link = rcache_bucket(shard, shard->ents[idx].key);
+
+	while (*link != idx)
+		link = &shard->ents[*link].hnext;
+
+	*link = shard->ents[idx].hnext;
+}
+
+static void rcache_push(struct nvm_rcache_shard *shard, enum nvm_rcache_queue q,
+			uint32_t idx)
+{
+	struct nvm_rcache_list *list = &shard->queues[q];
+	struct nvm_rcache_ent *ent = &shard->ents[idx];
+
+	ent->queue = q;
+	ent->prev = list->tail;
+	ent->next = NVM_RCACHE_NIL;
+
+	if (list->tail != NVM_RCACHE_NIL)
+		shard->ents[list->tail].next = idx;
+	else
+		list->head = idx;
+
+	list->tail = idx;
+	list->len += 1;
+}
+
+static void rcache_unlink(struct nvm_rcache_shard *shard, uint32_t idx)
+{
+	struct nvm_rcache_ent *ent = &shard->ents[idx];
+	struct nvm_rcache_list *list = &shard->queues[ent->queue];
+
+	if (ent->prev != NVM_RCACHE_NIL)
+		shard->ents[ent->prev].next = ent->next;
+	else
+		list->head = ent->next;
+
+	if (ent->next != NVM_RCACHE_NIL)
+		shard->ents[ent->next].prev = ent->prev;
+	else
+		list->tail = ent->prev;
+
+	list->len -= 1;
+	ent->queue = NVM_RCACHE_Q_FREE;
+}
+
+/**
+ * Remove entry 'idx' from its queue and hash chain and put it on its free list
+ */
+static void rcache_release(struct nvm_rcache_shard *shard, uint32_t idx)
+{
+	uint32_t *free_list = idx < shard->nslots ? &shard->free_slots :
+						    &shard->free_ghosts;
+
+	rcache_unlink(shard, idx);
+	rcache_unhash(shard, idx);
+
+	shard->ents[idx].hnext = *free_list;
+	*free_list = idx;
+}
+
+static uint32_t rcache_take(struct nvm_rcache_shard *shard, uint32_t *free_list,
+			    uint64_t key)
+{
+	const uint32_t idx = *free_list;
+	uint32_t *bucket = rcache_bucket(shard, key);
+
+	*free_list = shard->ents[idx].hnext;
+
+	shard->ents[idx].key = key;
+	shard->ents[idx].freq = 0;
+	shard->ents[idx].hnext = *bucket;
+	*bucket = idx;
+
+	return idx;
+}
+
+/**
+ * Remember 'key' as a ghost, making room by forgetting the oldest one
+ */
+static void rcache_ghost(struct nvm_rcache_shard *shard, uint64_t key)
+{
+	if (shard->free_ghosts == NVM_RCACHE_NIL)
+		rcache_release(shard, shard->queues[NVM_RCACHE_Q_GHOST].head);
+
+	rcache_push(shard, NVM_RCACHE_Q_GHOST,
+		    rcache_take(shard, &shard->free_ghosts, key));
+}
+
+/**
+ * Evict sectors until one is free
+ *
+ * CLOCK: the main queue is the clock, the head is the hand, a referenced
+ * sector gets a second chance at the tail.
+ *
+ * S3-FIFO: sectors enter the small queue, those hit while in it move to main,
+ * the rest are evicted with their key kept as a ghost. Keys found among the
+ * ghosts go straight to main. Main is a CLOCK counting up to three hits.
+ */
+static void rcache_evict(struct nvm_rcache *rcache,
+			 struct nvm_rcache_shard *shard)
+{
+	struct nvm_rcache_list *small = &shard->queues[NVM_RCACHE_Q_SMALL];
+	struct nvm_rcache_list *main = &shard->queues[NVM_RCACHE_Q_MAIN];
+
+	while (shard->free_slots == NVM_RCACHE_NIL) {
+		uint32_t idx;
+
+		if (small->len && (small->len >= shard->small_max ||
+				   !main->len)) {
+			const uint64_t key = shard->ents[small->head].key;
+
+			idx = small->head;
+			if (shard->ents[idx].freq) {
+				shard->ents[idx].freq = 0;
+				rcache_unlink(shard, idx);
+				rcache_push(shard, NVM_RCACHE_Q_MAIN, idx);
+				continue;
+			}
+
+			rcache_release(shard, idx);
+			rcache_ghost(shard, key);
+			atomic_fetch_add(&rcache->nevicts, 1);
+			continue;
+		}
+
+		idx = main->head;
+		if (shard->ents[idx].freq) {
+			shard->ents[idx].freq -= 1;
+			rcache_unlink(shard, idx);
+			rcache_push(shard, NVM_RCACHE_Q_MAIN, idx);
+			continue;
+		}
+
+		rcache_release(shard, idx);
+		atomic_fetch_add(&rcache->nevicts, 1);
+	}
+}
+
+static void rcache_insert(struct nvm_rcache *rcache, uint64_t key,
+			  const char *sectr)
+{
+	struct nvm_rcache_shard *shard = rcache_shard(rcache, key);
+	enum nvm_rcache_queue q = NVM_RCACHE_Q_MAIN;
+	uint32_t idx = rcache_find(shard, key);
+
+	if (idx != NVM_RCACHE_NIL && idx < shard->nslots) {	// Refresh
+		memcpy(shard->data + idx * rcache->sectr_nbytes, sectr,
+		       rcache->sectr_nbytes);
+		return;
+	}
+
+	if (idx != NVM_RCACHE_NIL)		// A ghost, straight to main
+		rcache_release(shard, idx);
+	else if (rcache->policy == NVM_RCACHE_S3FIFO)
+		q = NVM_RCACHE_Q_SMALL;
+
+	rcache_evict(rcache, shard);
+
+	idx = rcache_take(shard, &shard->free_slots, key);
+	rcache_push(shard, q, idx);
+	memcpy(shard->data + idx * rcache->sectr_nbytes, sectr,
+	       rcache->sectr_nbytes);
+
+	atomic_fetch_add(&rcache->ninserts, 1);
+}
+
+/**
+ * Get the device-format address of sector 'i' of 'addrs', scalar commands
+ * address 'naddrs' consecutive sectors from the first
+ */
+static inline uint64_t rcache_key(struct nvm_dev *dev, struct nvm_addr addrs[],
+				  int i, uint16_t flags)
+{
+	const int opt = (flags & NVM_CMD_MASK_ADDR) ?
+			(flags & NVM_CMD_MASK_ADDR) :
+			(dev->cmd_opts & NVM_CMD_MASK_ADDR);
+	const int scalar = opt == NVM_CMD_SCALAR;
+	const struct nvm_addr addr = addrs[scalar ? 0 : i];
+	const uint64_t key = (flags & NVM_CMD_ADDR_DEV) ? addr.val :
+			     nvm_addr_gen2dev(dev, addr);
+
+	return scalar ? key + i : key;
+}
+
+/**
+ * Whether 'cmd' is a read the cache can serve and fill, synchronous and
+ * without meta
+ */
+static inline int rcache_cacheable(struct nvm_dev *dev,
+				   const struct nvm_cmd_desc *cmd,
+				   uint16_t flags)
+{
+	const int iomd = (flags & NVM_CMD_MASK_IOMD) ?
+			 (flags & NVM_CMD_MASK_IOMD) :
+			 (dev->cmd_opts & NVM_CMD_MASK_IOMD);
+
+	return !(iomd & NVM_CMD_ASYNC) && !cmd->meta && cmd->data;
+}
+
+int nvm_rcache_read(struct nvm_dev *dev, const struct nvm_cmd_desc *cmd,
+		    uint16_t flags, uint64_t *ticket)
+{
+	struct nvm_rcache *rcache = dev->rcache;
+
+	*ticket = atomic_load(&rcache->seq);
+
+	if (!rcache_cacheable(dev, cmd, flags))
+		return 0;
+
+	for (int i = 0; i < cmd->naddrs; ++i) {
+		const uint64_t key = rcache_key(dev, cmd->addrs, i, flags);
+		struct nvm_rcache_shard *shard = rcache_shard(rcache, key);
+		uint32_t idx;
+
+		pthread_mutex_lock(&shard->lock);
+		idx = rcache_find(shard, key);
+		if (idx == NVM_RCACHE_NIL || idx >= shard->nslots) {
+			pthread_mutex_unlock(&shard->lock);
+			atomic_fetch_add(&rcache->nmisses, 1);
+			return 0;
+		}
+
+		if (shard->ents[idx].freq < rcache->freq_max)
+			shard->ents[idx].freq += 1;
+
+		memcpy((char *)cmd->data + i * rcache->sectr_nbytes,
+		       shard->data + idx * rcache->sectr_nbytes,
+		       rcache->sectr_nbytes);
+		pthread_mutex_unlock(&shard->lock);
+	}
+
+	if (cmd->ret) {
+		cmd->ret->status = 0;
+		cmd->ret->result.cdw0 = 0;
+	}
+	atomic_fetch_add(&rcache->nhits, 1);
+
+	return 1;
+}
+
+void nvm_rcache_fill(struct nvm_dev *dev, const struct nvm_cmd_desc *cmd,
+		     uint16_t flags, uint64_t ticket)
+{
+	struct nvm_rcache *rcache = dev->rcache;
+
+	if (!rcache_cacheable(dev, cmd, flags))
+		return;
+
+	for (int i = 0; i < cmd->naddrs; ++i) {
+		const uint64_t key = rcache_key(dev, cmd->addrs, i, flags);
+		struct nvm_rcache_shard *shard = rcache_shard(rcache, key);
+
+		pthread_mutex_lock(&shard->lock);
+		if (atomic_load(&rcache->seq) != ticket ||
+		    atomic_load(&dev->nwr_inflight)) {
+			pthread_mutex_unlock(&shard->lock);
+			return;		// Might be stale
+		}
+		rcache_insert(rcache, key, (const char *)cmd->data +
+					   i * rcache->sectr_nbytes);
+		pthread_mutex_unlock(&shard->lock);
+	}
+}
+
+void nvm_rcache_wr_sub(struct nvm_dev *dev)
+{
+	atomic_fetch_add(&dev->nwr_inflight, 1);
+}
+
+void nvm_rcache_wr_cpl(struct nvm_dev *dev)
+{
+	atomic_fetch_sub(&dev->nwr_inflight, 1);
+
+	if (dev->rcache)
+		atomic_fetch_add(&dev->rcache->seq, 1);
+}
+
+static void rcache_drop(struct nvm_rcache *rcache, uint64_t key)
+{
+	struct nvm_rcache_shard *shard = rcache_shard(rcache, key);
+	uint32_t idx;
+
+	pthread_mutex_lock(&shard->lock);
+	idx = rcache_find(shard, key);
+	if (idx != NVM_RCACHE_NIL) {
+		rcache_release(shard, idx);
+		if (idx < shard->nslots)
+			atomic_fetch_add(&rcache->ninvals, 1);
+	}
+	pthread_mutex_unlock(&shard->lock);
+}
+
+void nvm_rcache_inval(struct nvm_dev *dev, const struct nvm_cmd_desc *cmd,
+		      uint16_t flags)
+{
+	struct nvm_rcache *rcache = dev->rcache;
+	const struct nvm_geo *geo = nvm_dev_get_geo(dev);
+
+	atomic_fetch_add(&rcache->seq, 1);
+
+	for (int i = 0; i < cmd->naddrs; ++i) {
+		uint64_t key;
+
+		switch (cmd->opc) {
+		case NVM_CMD_DESC_ERASE:	// All sectors of the chunk
+			key = (flags & NVM_CMD_ADDR_DEV) ? cmd->addrs[i].val :
+			      nvm_addr_gen2dev(dev, cmd->addrs[i]);
+			key &= ~dev->lbam.sectr;
+			for (uint64_t s = 0; s < geo->l.nsectr; ++s)
+				rcache_drop(rcache, key | s << dev->lbaz.sectr);
+			break;
+
+		case NVM_CMD_DESC_COPY:
+			rcache_drop(rcache, (flags & NVM_CMD_ADDR_DEV) ?
+				    cmd->dst[i].val :
+				    nvm_addr_gen2dev(dev, cmd->dst[i]));
+			break;
+
+		default:
+			rcache_drop(rcache, rcache_key(dev, cmd->addrs, i,
+						       flags));
+			break;
+		}
+	}
+}
+
+static void rcache_shard_term(struct nvm_rcache_shard *shard)
+{
+	pthread_mutex_destroy(&shard->lock);
+	free(shard->ents);
+	free(shard->buckets);
+	free(shard->data);
+}
+
+void nvm_rcache_free(struct nvm_rcache *rcache)
+{
+	if (!rcache)
+		return;
+
+	for (int i = 0; i < NVM_RCACHE_NSHARDS; ++i)
+		rcache_shard_term(&rcache->shards[i]);
+
+	free(rcache);
+}
+
+static int rcache_shard_init(struct nvm_rcache_shard *shard, uint32_t nslots,
+			     uint32_t nghosts, size_t sectr_nbytes)
+{
+	const uint32_t nents = nslots + nghosts;
+	uint32_t nbuckets = 1;
+
+	while (nbuckets < nents)
+		nbuckets <<= 1;
+
+	shard->ents = calloc(nents, sizeof(*shard->ents));
+	shard->buckets = malloc(nbuckets * sizeof(*shard->buckets));
+	shard->data = malloc(nslots * sectr_nbytes);
+	if (!shard->ents || !shard->buckets || !shard->data) {
+		free(shard->ents);
+		free(shard->buckets);
+		free(shard->data);
+		return -1;
+	}
+
+	pthread_mutex_init(&shard->lock, NULL);
+	shard->nslots = nslots;
+	shard->nghosts = nghosts;
+	shard->small_max = (nslots * NVM_RCACHE_SMALL_PCT + 99) / 100;
+	shard->bucket_mask = nbuckets - 1;
+
+	for (uint32_t b = 0; b < nbuckets; ++b)
+		shard->buckets[b] = NVM_RCACHE_NIL;
+
+	for (int q = 0; q < NVM_RCACHE_NQUEUES; ++q) {
+		shard->queues[q].head = NVM_RCACHE_NIL;
+		shard->queues[q].tail = NVM_RCACHE_NIL;
+	}
+
+	// Free lists in index order, sectors then ghosts
+	for (uint32_t idx = 0; idx < nents; ++idx) {
+		const uint32_t last = idx < nslots ? nslots : nents;
+
+		shard->ents[idx].hnext = idx + 1 < last ? idx + 1 :
+							  NVM_RCACHE_NIL;
+	}
+	shard->free_slots = nslots ? 0 : NVM_RCACHE_NIL;
+	shard->free_ghosts = nghosts ? nslots : NVM_RCACHE_NIL;
+
+	return 0;
+}
+
+int nvm_dev_set_rcache(struct nvm_dev *dev, size_t nbytes,
+		       enum nvm_rcache_policy policy)
+{
+	const struct nvm_geo *geo = nvm_dev_get_geo(dev);
+	const size_t ent_nbytes = geo->l.nbytes + 2 * sizeof(uint32_t) +
+				  2 * sizeof(struct nvm_rcache_ent);
+	struct nvm_rcache *rcache;
+	uint32_t nslots;
+
+	nvm_rcache_free(dev->rcache);
+	dev->rcache = NULL;
+
+	if (!nbytes)
+		return 0;
+
+	if (nvm_dev_get_verid(dev) != NVM_SPEC_VERID_20) {
+		NVM_DEBUG("FAILED: unsupported verid");
+		errno = ENOSYS;
+		return -1;
+	}
+	if (policy != NVM_RCACHE_CLOCK && policy != NVM_RCACHE_S3FIFO) {
+		NVM_DEBUG("FAILED: invalid policy: %d", policy);
+		errno = EINVAL;
+		return -1;
+	}
+
+	nslots = nbytes / ent_nbytes / NVM_RCACHE_NSHARDS;
+	if (!nslots) {
+		NVM_DEBUG("FAILED: nbytes: %zu holds no sectors", nbytes);
+		errno = EINVAL;
+		return -1;
+	}
+
+	rcache = calloc(1, sizeof(*rcache));
+	if (!rcache) {
+		NVM_DEBUG("FAILED: calloc rcache");
+		return -1;
+	}
+	rcache->policy = policy;
+	rcache->sectr_nbytes = geo->l.nbytes;
+	rcache->freq_max = policy == NVM_RCACHE_S3FIFO ? 3 : 1;
+
+	for (int i = 0; i < NVM_RCACHE_NSHARDS; ++i) {
+		if (rcache_shard_init(&rcache->shards[i], nslots,
+				      policy == NVM_RCACHE_S3FIFO ? nslots : 0,
+				      rcache->sectr_nbytes)) {
+			NVM_DEBUG("FAILED: rcache_shard_init");
+			while (i--)	// Only the shards initialized so far
+				rcache_shard_term(&rcache->shards[i]);
+			free(rcache);
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+
+	dev->rcache = rcache;
+
+	return 0;
+}
+
+int nvm_dev_get_rcache_stats(const struct nvm_dev *dev,
+			     struct nvm_rcache_stats *stats)
+{
+	const struct nvm_rcache *rcache = dev->rcache;
+
+	if (!rcache) {
+		NVM_DEBUG("FAILED: no rcache");
+		errno = EINVAL;
+		return -1;
+	}
+
+	stats->nhits = atomic_load(&rcache->nhits);
+	stats->nmisses = atomic_load(&rcache->nmisses);
+	stats->ninserts = atomic_load(&rcache->ninserts);
+	stats->nevicts = atomic_load(&rcache->nevicts);
+	stats->ninvals = atomic_load(&rcache->ninvals);
+	stats->nsectrs = (uint64_t)rcache->shards[0].nslots *
+			 NVM_RCACHE_NSHARDS;
+
+	return 0;
+}
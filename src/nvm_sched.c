@@ -0,0 +1,507 @@
+/*
+ * sched - Parallel-unit-aware scheduling of ASYNC commands
+ *
+ * Copyright (C) Simon A. F. Lund <slund@cnexlabs.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <liblightnvm.h>
+#include <nvm_dev.h>
+#include <nvm_cmd.h>
+#include <nvm_async.h>
+#include <nvm_sched.h>
+
+/**
+ * Rounds of a dispatch, a PU is only served in a round when it admits more,
+ * writes, copies and erases also only within their own bound
+ */
+enum sched_round {
+	SCHED_ROUND_IDLE = 0,	///< PUs with nothing in flight
+	SCHED_ROUND_READS,	///< PUs with only reads in flight
+	SCHED_ROUND_ANY,	///< PUs below the bound
+	SCHED_NROUNDS
+};
+
+struct nvm_sched *nvm_sched_init(struct nvm_dev *dev, uint32_t depth)
+{
+	const struct nvm_geo *geo = nvm_dev_get_geo(dev);
+	const uint32_t npus = geo->l.npugrp * geo->l.npunit;
+	struct nvm_sched *sched;
+
+	if (!npus || !depth) {
+		NVM_DEBUG("FAILED: npus: %u, depth: %u", npus, depth);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	sched = calloc(1, sizeof(*sched) + npus * sizeof(*sched->pus));
+	if (!sched) {
+		NVM_DEBUG("FAILED: calloc sched");
+		return NULL;
+	}
+	sched->npus = npus;
+	sched->pu_depth = NVM_SCHED_PU_DEPTH;
+	sched->pu_depth_wr = NVM_SCHED_PU_DEPTH_WR;
+
+	sched->cmds = calloc(depth, sizeof(*sched->cmds));
+	if (!sched->cmds) {
+		NVM_DEBUG("FAILED: calloc cmds");
+		free(sched);
+		return NULL;
+	}
+	for (uint32_t i = 0; i < depth; ++i) {
+		sched->cmds[i].sched = sched;
+		sched->cmds[i].next = sched->free;
+		sched->free = &sched->cmds[i];
+	}
+
+	return sched;
+}
+
+void nvm_sched_term(struct nvm_sched *sched)
+{
+	if (!sched)
+		return;
+
+	free(sched->cmds);
+	free(sched);
+}
+
+static inline enum nvm_async_cls sched_cls(enum nvm_cmd_desc_opc opc)
+{
+	switch (opc) {
+	case NVM_CMD_DESC_ERASE:
+		return NVM_ASYNC_CLS_ERASE;
+	case NVM_CMD_DESC_WRITE:
+	case NVM_CMD_DESC_COPY:
+		return NVM_ASYNC_CLS_WRITE;
+	default:
+		return NVM_ASYNC_CLS_READ;
+	}
+}
+
+/**
+ * PU index of 'addr', the 1.2 channel and LUN alias PUG and PU. Addresses on
+ * device format, as given with NVM_CMD_ADDR_DEV, are decoded first
+ */
+static inline uint32_t sched_pu(struct nvm_dev *dev,
+				const struct nvm_sched *sched,
+				struct nvm_addr addr, uint16_t flags)
+{
+	uint32_t pu;
+
+	if (flags & NVM_CMD_ADDR_DEV)
+		addr = nvm_addr_dev2gen(dev, addr.val);
+
+	pu = addr.l.pugrp * dev->geo.l.npunit + addr.l.punit;
+
+	return pu < sched->npus ? pu : pu % sched->npus;
+}
+
+static inline int sched_admits(const struct nvm_sched *sched,
+			       const struct nvm_sched_pu *pu,
+			       const struct nvm_sched_cmd *scmd,
+			       enum sched_round round)
+{
+	const uint32_t nwr = pu->nout[NVM_ASYNC_CLS_WRITE] +
+			     pu->nout[NVM_ASYNC_CLS_ERASE];
+
+	if (scmd->cls != NVM_ASYNC_CLS_READ && nwr >= sched->pu_depth_wr)
+		return 0;
+
+	switch (round) {
+	case SCHED_ROUND_IDLE:
+		return !pu->ninflight;
+
+	case SCHED_ROUND_READS:
+		if (nwr)
+			return 0;
+		/* FALLTHRU */
+
+	default:
+		return pu->ninflight < sched->pu_depth;
+	}
+}
+
+/**
+ * Whether a burst of high-priority dispatches on 'pu' has kept a normal one
+ * waiting long enough for it to go next
+ */
+static inline int sched_starved(const struct nvm_sched_pu *pu)
+{
+	return pu->nhigh >= NVM_SCHED_HIGH_BURST &&
+	       pu->queue[NVM_SCHED_PRIO_NORMAL].head;
+}
+
+/**
+ * Pick the queue of 'pu' to dispatch from in the given 'round', high priority
+ * unless a burst of those has kept a normal one waiting
+ *
+ * @return The priority of the queue, or -1 when 'pu' admits none of them
+ */
+static inline int sched_pick(const struct nvm_sched *sched,
+			     const struct nvm_sched_pu *pu,
+			     enum sched_round round, int only_high)
+{
+	const int starved = sched_starved(pu);
+
+	if (only_high && starved)
+		return -1;
+
+	for (int i = 0; i < NVM_SCHED_NPRIO; ++i) {
+		const int prio = starved ? NVM_SCHED_NPRIO - 1 - i : i;
+		const struct nvm_sched_cmd *head = pu->queue[prio].head;
+
+		if (only_high && prio != NVM_SCHED_PRIO_HIGH)
+			continue;
+		if (head && sched_admits(sched, pu, head, round))
+			return prio;
+	}
+
+	return -1;
+}
+
+static inline void sched_enqueue(struct nvm_sched_queue *queue,
+				 struct nvm_sched_cmd *scmd)
+{
+	scmd->next = NULL;
+	if (queue->tail)
+		queue->tail->next = scmd;
+	else
+		queue->head = scmd;
+	queue->tail = scmd;
+}
+
+static inline struct nvm_sched_cmd *sched_dequeue(struct nvm_sched_queue *queue)
+{
+	struct nvm_sched_cmd *scmd = queue->head;
+
+	queue->head = scmd->next;
+	if (!queue->head)
+		queue->tail = NULL;
+	scmd->next = NULL;
+
+	return scmd;
+}
+
+static inline void sched_requeue(struct nvm_sched_queue *queue,
+				 struct nvm_sched_cmd *scmd)
+{
+	scmd->next = queue->head;
+	queue->head = scmd;
+	if (!queue->tail)
+		queue->tail = scmd;
+}
+
+/**
+ * Give 'scmd' back to the submitter, restoring its callback
+ */
+static inline void sched_release(struct nvm_sched *sched,
+				 struct nvm_sched_cmd *scmd)
+{
+	struct nvm_ret *ret = scmd->desc.ret;
+
+	ret->async.cb = scmd->cb;
+	ret->async.cb_arg = scmd->cb_arg;
+
+	scmd->next = sched->free;
+	sched->free = scmd;
+}
+
+static inline void sched_pu_cpl(struct nvm_sched *sched,
+				struct nvm_sched_cmd *scmd)
+{
+	struct nvm_sched_pu *pu = &sched->pus[scmd->pu];
+
+	pu->ninflight -= 1;
+	pu->nout[scmd->cls] -= 1;
+}
+
+/**
+ * Completion callback of scheduled commands, see nvm_sched_submit
+ */
+static void sched_cpl(struct nvm_ret *ret, void *cb_arg)
+{
+	struct nvm_sched_cmd *scmd = cb_arg;
+
+	sched_pu_cpl(scmd->sched, scmd);
+	sched_release(scmd->sched, scmd);
+
+	if (ret->async.cb)
+		ret->async.cb(ret, ret->async.cb_arg);
+}
+
+/**
+ * Hand 'scmd' to the backend and account for it on its PU
+ */
+static int sched_dispatch(struct nvm_dev *dev, struct nvm_sched *sched,
+			  struct nvm_sched_cmd *scmd)
+{
+	struct nvm_sched_pu *pu = &sched->pus[scmd->pu];
+
+	pu->ninflight += 1;
+	pu->nout[scmd->cls] += 1;
+
+	if (nvm_cmd_dispatch(dev, &scmd->desc, scmd->flags)) {
+		sched_pu_cpl(sched, scmd);
+		return -1;	// Propagate errno
+	}
+
+	if (scmd->prio == NVM_SCHED_PRIO_HIGH &&
+	    pu->queue[NVM_SCHED_PRIO_NORMAL].head)
+		pu->nhigh += 1;
+	else
+		pu->nhigh = 0;
+
+	return 0;
+}
+
+int nvm_sched_submit(struct nvm_dev *dev, const struct nvm_cmd_desc *cmd,
+		     uint16_t flags)
+{
+	struct nvm_sched *sched = cmd->ret->async.ctx->sched;
+	struct nvm_sched_cmd *scmd = sched->free;
+	struct nvm_sched_pu *pu;
+
+	if (cmd->opc < NVM_CMD_DESC_ERASE || cmd->opc > NVM_CMD_DESC_COPY ||
+	    cmd->naddrs < 1 || cmd->naddrs > NVM_NADDR_MAX || !cmd->addrs) {
+		NVM_DEBUG("FAILED: opc: %d, naddrs: %d, addrs: %p", cmd->opc,
+			  cmd->naddrs, (void*)cmd->addrs);
+		errno = EINVAL;
+		return -1;
+	}
+	if (!scmd) {
+		errno = EAGAIN;
+		return -1;
+	}
+	sched->free = scmd->next;
+	scmd->next = NULL;
+
+	scmd->desc = *cmd;
+	memcpy(scmd->addrs, cmd->addrs, cmd->naddrs * sizeof(*cmd->addrs));
+	scmd->desc.addrs = scmd->addrs;
+	if (cmd->dst) {
+		memcpy(scmd->dst, cmd->dst, cmd->naddrs * sizeof(*cmd->dst));
+		scmd->desc.dst = scmd->dst;
+	}
+	scmd->flags = flags;
+	scmd->pu = sched_pu(dev, sched, cmd->addrs[0], flags);
+	scmd->cls = sched_cls(cmd->opc);
+	scmd->prio = ((flags & NVM_CMD_PRIO_HIGH) ||
+		      (cmd->ret->async.ctx->flags & NVM_ASYNC_PRIO_HIGH)) ?
+		     NVM_SCHED_PRIO_HIGH : NVM_SCHED_PRIO_NORMAL;
+
+	scmd->cb = cmd->ret->async.cb;
+	scmd->cb_arg = cmd->ret->async.cb_arg;
+	cmd->ret->async.cb = sched_cpl;
+	cmd->ret->async.cb_arg = scmd;
+
+	// Dispatch right away unless it would overtake a command of its own
+	// priority or higher, or a normal one starved by a high-priority burst
+	pu = &sched->pus[scmd->pu];
+	for (int prio = 0; prio <= (int)scmd->prio; ++prio) {
+		if (pu->queue[prio].head)
+			goto queue;
+	}
+	if (sched_starved(pu))
+		goto queue;
+	if (sched_admits(sched, pu, scmd, SCHED_ROUND_ANY)) {
+		if (sched_dispatch(dev, sched, scmd)) {
+			sched_release(sched, scmd);
+			return -1;	// Propagate errno
+		}
+
+		return 0;
+	}
+
+queue:
+	sched_enqueue(&pu->queue[scmd->prio], scmd);
+	sched->nqueued += 1;
+
+	return 0;
+}
+
+int nvm_sched_kick(struct nvm_dev *dev, struct nvm_async_ctx *ctx)
+{
+	struct nvm_sched *sched = ctx->sched;
+	int ndispatched = 0;
+
+	if (!sched || !sched->nqueued)
+		return 0;
+
+	// Per round, high-priority commands on all PUs go before the others
+	for (int pass = 0; pass < SCHED_NROUNDS * 2; ++pass) {
+		const enum sched_round round = pass / 2;
+		const int only_high = !(pass % 2);
+
+		for (uint32_t i = 0; i < sched->npus; ++i) {
+			const uint32_t idx = (sched->cursor + i) % sched->npus;
+			struct nvm_sched_pu *pu = &sched->pus[idx];
+			int prio;
+
+			while ((prio = sched_pick(sched, pu, round,
+						  only_high)) >= 0) {
+				struct nvm_sched_queue *queue = &pu->queue[prio];
+				struct nvm_sched_cmd *scmd;
+
+				scmd = sched_dequeue(queue);
+				sched->nqueued -= 1;
+
+				if (!sched_dispatch(dev, sched, scmd)) {
+					++ndispatched;
+					continue;
+				}
+
+				if (errno == EAGAIN) {	// Context is full
+					sched_requeue(queue, scmd);
+					sched->nqueued += 1;
+					goto out;
+				}
+
+				NVM_DEBUG("FAILED: sched_dispatch");
+				scmd->next = sched->failed;
+				sched->failed = scmd;
+				sched->nfailed += 1;
+			}
+
+			if (!sched->nqueued)
+				goto out;
+		}
+	}
+
+out:
+	sched->cursor = (sched->cursor + 1) % sched->npus;
+
+	return ndispatched;
+}
+
+int nvm_sched_drain(struct nvm_async_ctx *ctx, struct nvm_ret *rets[],
+		    uint32_t max)
+{
+	struct nvm_sched *sched = ctx->sched;
+	int ndrained = 0;
+
+	if (!sched)
+		return 0;
+
+	while (sched->failed && (!rets || (uint32_t)ndrained < max)) {
+		struct nvm_sched_cmd *scmd = sched->failed;
+		struct nvm_ret *ret = scmd->desc.ret;
+
+		sched->failed = scmd->next;
+		sched->nfailed -= 1;
+		sched_release(sched, scmd);
+
+		ret->status = NVM_RET_STATUS_ABORTED;
+		if (rets)
+			rets[ndrained] = ret;
+		else if (ret->async.cb)
+			ret->async.cb(ret, ret->async.cb_arg);
+		++ndrained;
+	}
+
+	return ndrained;
+}
+
+/**
+ * Unlink 'scmd' from the list at 'head', updating 'tail' when given
+ *
+ * @return 1 when 'scmd' was on the list, 0 otherwise
+ */
+static inline int sched_unlink(struct nvm_sched_cmd **head,
+			       struct nvm_sched_cmd **tail,
+			       struct nvm_sched_cmd *scmd)
+{
+	struct nvm_sched_cmd *prev = NULL;
+
+	for (struct nvm_sched_cmd *cur = *head; cur; prev = cur, cur = cur->next) {
+		if (cur != scmd)
+			continue;
+
+		if (prev)
+			prev->next = cur->next;
+		else
+			*head = cur->next;
+		if (tail && *tail == cur)
+			*tail = prev;
+		cur->next = NULL;
+
+		return 1;
+	}
+
+	return 0;
+}
+
+int nvm_sched_cancel(struct nvm_async_ctx *ctx, struct nvm_ret *ret)
+{
+	struct nvm_sched *sched = ctx->sched;
+	struct nvm_sched_cmd *scmd;
+	struct nvm_sched_queue *queue;
+
+	if (!sched || ret->async.cb != sched_cpl) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	scmd = ret->async.cb_arg;
+	queue = &sched->pus[scmd->pu].queue[scmd->prio];
+
+	if (sched_unlink(&queue->head, &queue->tail, scmd)) {
+		sched->nqueued -= 1;
+	} else if (sched_unlink(&sched->failed, NULL, scmd)) {
+		sched->nfailed -= 1;
+	} else {
+		errno = ENOENT;		// In flight
+		return -1;
+	}
+
+	sched_release(sched, scmd);
+
+	ret->status = NVM_RET_STATUS_ABORTED;
+	if (ret->async.cb)
+		ret->async.cb(ret, ret->async.cb_arg);
+
+	return 0;
+}
+
+void nvm_sched_reaped(struct nvm_async_ctx *ctx, struct nvm_ret *rets[],
+		      int nrets)
+{
+	struct nvm_sched *sched = ctx->sched;
+
+	if (!sched)
+		return;
+
+	for (int i = 0; i < nrets; ++i) {
+		struct nvm_sched_cmd *scmd;
+
+		if (rets[i]->async.cb != sched_cpl)
+			continue;
+
+		scmd = rets[i]->async.cb_arg;
+		sched_pu_cpl(sched, scmd);
+		sched_release(sched, scmd);
+	}
+}
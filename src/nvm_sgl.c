@@ -27,15 +27,166 @@
  */
 
 #include <stdlib.h>
-#include <bsd/sys/queue.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #include <liblightnvm_spec.h>
 #include <nvm_dev.h>
 #include <nvm_sgl.h>
 #include <nvm_cmd.h>
 
-struct nvm_sgl_pool *nvm_sgl_pool_create(struct nvm_dev *dev)
+#define SGL_TID_NWORDS (NVM_SGL_POOL_NTHREADS / 64)
+
+static pthread_once_t sgl_once = PTHREAD_ONCE_INIT;
+static pthread_key_t sgl_tid_key;
+static int sgl_tid_key_valid;
+static _Atomic uint64_t sgl_tids[SGL_TID_NWORDS];	///< Claimed thread slots
+
+static _Thread_local int sgl_tid = -1;
+
+static void sgl_tid_release(void *arg)
+{
+	const int tid = (int)((intptr_t)arg - 1);
+
+	atomic_fetch_and(&sgl_tids[tid / 64], ~(1ULL << (tid % 64)));
+}
+
+static void sgl_init(void)
+{
+	sgl_tid_key_valid = !pthread_key_create(&sgl_tid_key, sgl_tid_release);
+}
+
+/**
+ * Returns the magazine slot of the calling thread, slots are released when
+ * the thread exits such that a new thread inherits the magazines it left
+ *
+ * @returns The slot, or -1 when all slots are taken
+ */
+static int sgl_tid_get(void)
+{
+	if (sgl_tid >= 0) {
+		return sgl_tid;
+	}
+
+	pthread_once(&sgl_once, sgl_init);
+	if (!sgl_tid_key_valid) {
+		return -1;
+	}
+
+	for (int word = 0; word < SGL_TID_NWORDS; ++word) {
+		uint64_t claimed = atomic_load(&sgl_tids[word]);
+
+		while (~claimed) {
+			const int bit = __builtin_ctzll(~claimed);
+			const uint64_t mask = 1ULL << bit;
+
+			claimed = atomic_fetch_or(&sgl_tids[word], mask);
+			if (claimed & mask) {
+				continue;
+			}
+
+			sgl_tid = word * 64 + bit;
+			pthread_setspecific(sgl_tid_key,
+					    (void *)(intptr_t)(sgl_tid + 1));
+			return sgl_tid;
+		}
+	}
+
+	return -1;
+}
+
+static inline struct nvm_sgl_mag *mag_get(struct nvm_sgl_pool *pool,
+					  uint32_t idx)
 {
+	struct nvm_sgl_mag *chunk;
+
+	chunk = atomic_load(&pool->chunks[idx / NVM_SGL_POOL_CHUNK_NMAGS]);
+
+	return &chunk[idx % NVM_SGL_POOL_CHUNK_NMAGS];
+}
+
+/**
+ * Carve a new, empty, magazine
+ */
+static struct nvm_sgl_mag *mag_new(struct nvm_sgl_pool *pool)
+{
+	const uint32_t idx = atomic_fetch_add(&pool->nmags, 1);
+	const uint32_t cidx = idx / NVM_SGL_POOL_CHUNK_NMAGS;
+	struct nvm_sgl_mag *chunk, *expected = NULL;
+	struct nvm_sgl_mag *mag;
+
+	if (cidx >= NVM_SGL_POOL_NCHUNKS) {
+		NVM_DEBUG("FAILED: out of magazines");
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	if (!atomic_load(&pool->chunks[cidx])) {
+		chunk = calloc(NVM_SGL_POOL_CHUNK_NMAGS, sizeof(*chunk));
+		if (!chunk) {
+			NVM_DEBUG("FAILED: calloc chunk");
+			return NULL;
+		}
+		if (!atomic_compare_exchange_strong(&pool->chunks[cidx],
+						    &expected, chunk)) {
+			free(chunk);	// Another thread carved the chunk
+		}
+	}
+
+	mag = mag_get(pool, idx);
+	mag->idx = idx;
+
+	return mag;
+}
+
+static void mag_push(_Atomic uint64_t *depot, struct nvm_sgl_mag *mag)
+{
+	uint64_t head = atomic_load(depot);
+	uint64_t top;
+
+	do {
+		atomic_store_explicit(&mag->next, (uint32_t)head,
+				      memory_order_relaxed);
+		top = (((head >> 32) + 1) << 32) | (mag->idx + 1);
+	} while (!atomic_compare_exchange_weak(depot, &head, top));
+}
+
+static struct nvm_sgl_mag *mag_pop(struct nvm_sgl_pool *pool,
+				   _Atomic uint64_t *depot)
+{
+	uint64_t head = atomic_load(depot);
+	uint64_t top;
+	uint32_t idx;
+
+	do {
+		idx = (uint32_t)head;
+		if (!idx) {
+			return NULL;
+		}
+
+		// The tag fails the exchange if 'idx' was popped meanwhile
+		top = (((head >> 32) + 1) << 32) |
+		      atomic_load(&mag_get(pool, idx - 1)->next);
+	} while (!atomic_compare_exchange_weak(depot, &head, top));
+
+	return mag_get(pool, idx - 1);
+}
+
+struct nvm_sgl_pool *nvm_sgl_pool_create_nsgls(struct nvm_dev *dev,
+					       int nsgls)
+{
+	const size_t dsize = sizeof(struct nvm_nvme_sgl_descriptor);
+	const size_t stride = NVM_SGL_ARENA_NDESCR + 1;
+	struct nvm_sgl_mag *mag = NULL;
+
+	if (nsgls < 0) {
+		NVM_DEBUG("FAILED: nsgls: %d", nsgls);
+		errno = EINVAL;
+		return NULL;
+	}
+
 	struct nvm_sgl_pool *pool = calloc(1, sizeof(*pool));
 	if (!pool) {
 		return NULL;
@@ -43,22 +194,80 @@ struct nvm_sgl_pool *nvm_sgl_pool_create(struct nvm_dev *dev)
 
 	pool->dev = dev;
 
+	if (!nsgls) {
+		return pool;
+	}
+
+	// Carve the SGLs, their descriptors and indirect segment from arenas
+	pool->sgls = calloc(nsgls, sizeof(*pool->sgls));
+	pool->descr = nvm_buf_alloc(dev, nsgls * stride * dsize, NULL);
+	if (!(pool->sgls && pool->descr)) {
+		NVM_DEBUG("FAILED: allocating arenas");
+		nvm_buf_free(dev, pool->descr);
+		free(pool->sgls);
+		free(pool);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	// Populate the depot with full magazines
+	for (int i = 0; i < nsgls; ++i) {
+		struct nvm_sgl *sgl = &pool->sgls[i];
+
+		sgl->descriptors = &pool->descr[i * stride];
+		sgl->indirect = &pool->descr[i * stride + NVM_SGL_ARENA_NDESCR];
+		sgl->nalloc = NVM_SGL_ARENA_NDESCR;
+		sgl->flags = NVM_SGL_ARENA_SGL | NVM_SGL_ARENA_DESCR;
+
+		if (!mag && !(mag = mag_new(pool))) {
+			NVM_DEBUG("FAILED: mag_new");
+			nvm_sgl_pool_destroy(pool);
+			return NULL;
+		}
+
+		mag->sgls[mag->nsgls++] = sgl;
+		if (mag->nsgls == NVM_SGL_MAG_NSGLS || i == nsgls - 1) {
+			mag_push(&pool->full, mag);
+			mag = NULL;
+		}
+	}
+
 	return pool;
 }
 
+struct nvm_sgl_pool *nvm_sgl_pool_create(struct nvm_dev *dev)
+{
+	return nvm_sgl_pool_create_nsgls(dev, NVM_SGL_POOL_NSGLS);
+}
+
 void nvm_sgl_pool_destroy(struct nvm_sgl_pool *pool)
 {
 	struct nvm_dev *dev = pool->dev;
-	struct nvm_sgl *sgl;
+	const uint32_t nmags_max = NVM_SGL_POOL_NCHUNKS *
+				   NVM_SGL_POOL_CHUNK_NMAGS;
+	uint32_t nmags = atomic_load(&pool->nmags);
+
+	if (nmags > nmags_max)
+		nmags = nmags_max;
+
+	// Every free SGL is in a magazine, whether in the depot or a thread's
+	for (uint32_t idx = 0; idx < nmags; ++idx) {
+		struct nvm_sgl_mag *mag;
 
-	while (!SLIST_EMPTY(&pool->free_list)) {
-		sgl = SLIST_FIRST(&pool->free_list);
-		SLIST_REMOVE_HEAD(&pool->free_list, free_list);
-		nvm_sgl_destroy(dev, sgl);
+		if (!atomic_load(&pool->chunks[idx / NVM_SGL_POOL_CHUNK_NMAGS]))
+			continue;
+
+		mag = mag_get(pool, idx);
+		for (int i = 0; i < mag->nsgls; ++i)
+			nvm_sgl_destroy(dev, mag->sgls[i]);
 	}
 
-	free(pool);
+	for (int cidx = 0; cidx < NVM_SGL_POOL_NCHUNKS; ++cidx)
+		free(atomic_load(&pool->chunks[cidx]));
 
+	nvm_buf_free(dev, pool->descr);
+	free(pool->sgls);
+	free(pool);
 }
 
 struct nvm_sgl *nvm_sgl_create(struct nvm_dev *dev, int hint)
@@ -86,19 +295,45 @@ struct nvm_sgl *nvm_sgl_create(struct nvm_dev *dev, int hint)
 
 struct nvm_sgl *nvm_sgl_alloc(struct nvm_sgl_pool *pool)
 {
+	const int tid = sgl_tid_get();
+	struct nvm_sgl_mag *mag = tid < 0 ? NULL : pool->tmags[tid];
+	struct nvm_sgl_mag *full;
 	struct nvm_sgl *sgl;
 
-	if (NULL != (sgl = SLIST_FIRST(&pool->free_list))) {
-		SLIST_REMOVE_HEAD(&pool->free_list, free_list);
+	if (mag && mag->nsgls) {
+		return mag->sgls[--mag->nsgls];
+	}
+
+	// Exchange the empty magazine for a full one
+	full = mag_pop(pool, &pool->full);
+	if (!full) {
+		return nvm_sgl_create(pool->dev, NVM_SGL_ARENA_NDESCR);
+	}
+
+	sgl = full->sgls[--full->nsgls];
+
+	if (tid < 0) {
+		mag_push(full->nsgls ? &pool->full : &pool->empty, full);
 		return sgl;
 	}
 
-	return nvm_sgl_create(pool->dev, 1);
+	if (mag) {
+		mag_push(&pool->empty, mag);
+	}
+	pool->tmags[tid] = full;
+
+	return sgl;
 }
 
 void nvm_sgl_destroy(struct nvm_dev *dev, struct nvm_sgl *sgl)
 {
-	nvm_buf_free(dev, sgl->descriptors);
+	if (!(sgl->flags & NVM_SGL_ARENA_DESCR))
+		nvm_buf_free(dev, sgl->descriptors);
+
+	// Arena SGLs are released along with their pool
+	if (sgl->flags & NVM_SGL_ARENA_SGL)
+		return;
+
 	nvm_buf_free(dev, sgl->indirect);
 	free(sgl);
 }
@@ -111,47 +346,157 @@ void nvm_sgl_reset(struct nvm_sgl *sgl)
 
 void nvm_sgl_free(struct nvm_sgl_pool *pool, struct nvm_sgl *sgl)
 {
+	const int tid = sgl_tid_get();
+	struct nvm_sgl_mag *mag = tid < 0 ? NULL : pool->tmags[tid];
+	struct nvm_sgl_mag *empty;
+
 	sgl->ndescr = 0;
 	sgl->len = 0;
-	SLIST_INSERT_HEAD(&pool->free_list, sgl, free_list);
+
+	if (mag && mag->nsgls < NVM_SGL_MAG_NSGLS) {
+		mag->sgls[mag->nsgls++] = sgl;
+		return;
+	}
+
+	// Exchange the full magazine for an empty one
+	empty = mag_pop(pool, &pool->empty);
+	if (!empty && !(empty = mag_new(pool))) {
+		NVM_DEBUG("FAILED: no magazine, destroying sgl");
+		nvm_sgl_destroy(pool->dev, sgl);
+		return;
+	}
+
+	empty->sgls[empty->nsgls++] = sgl;
+
+	if (tid < 0) {
+		mag_push(&pool->full, empty);
+		return;
+	}
+
+	if (mag) {
+		mag_push(&pool->full, mag);
+	}
+	pool->tmags[tid] = empty;
 }
 
+/**
+ * Slot of the data descriptor at index 'idx', skipping the chaining slot at
+ * the end of each segment
+ */
+static inline int sgl_slot(int idx)
+{
+	return idx + idx / (NVM_SGL_SEG_NDESCR - 1);
+}
 
-int nvm_sgl_add(struct nvm_dev *dev, struct nvm_sgl *sgl, void *addr,
-	size_t len)
+static int sgl_grow(struct nvm_dev *dev, struct nvm_sgl *sgl)
 {
-	struct nvm_nvme_sgl_descriptor *d;
+	const size_t dsize = sizeof(struct nvm_nvme_sgl_descriptor);
+	const int nalloc = sgl->nalloc ? 2 * sgl->nalloc : 1;
+	struct nvm_nvme_sgl_descriptor *descriptors;
 
-	/**
-	 * FIXME(klaus.jensen): currently we only support one Last Segment
-	 *  descriptor (one 4K page).
-	 */
-	if (sgl->ndescr == 256) {
-		NVM_DEBUG("max 256 SGL descriptors supported");
+	if (sgl->flags & NVM_SGL_ARENA_DESCR) {
+		// Move out of the arena, the arena slot cannot grow in-place
+		descriptors = nvm_buf_alloc(dev, nalloc * dsize, NULL);
+		if (descriptors) {
+			memcpy(descriptors, sgl->descriptors,
+			       sgl_slot(sgl->ndescr) * dsize);
+			sgl->flags &= ~NVM_SGL_ARENA_DESCR;
+		}
+	} else {
+		descriptors = nvm_buf_realloc(dev, sgl->descriptors,
+					      nalloc * dsize, NULL);
+	}
+	if (!descriptors) {
+		NVM_DEBUG("FAILED: growing to nalloc: %d", nalloc);
+		return -1;
+	}
+
+	sgl->descriptors = descriptors;
+	sgl->nalloc = nalloc;
+
+	return 0;
+}
+
+int nvm_sgl_chain(struct nvm_dev *dev, struct nvm_sgl *sgl,
+		  struct nvm_nvme_sgl_descriptor *head)
+{
+	const size_t dsize = sizeof(struct nvm_nvme_sgl_descriptor);
+	const int nseg = (sgl->ndescr + NVM_SGL_SEG_NDESCR - 2) /
+			 (NVM_SGL_SEG_NDESCR - 1);
+	struct nvm_nvme_sgl_descriptor *link = head;
+
+	if (!sgl->ndescr) {
+		NVM_DEBUG("FAILED: empty sgl");
 		errno = EINVAL;
 		return -1;
 	}
 
-	if (sgl->ndescr == sgl->nalloc) {
-		size_t nbytes;
-		sgl->nalloc = sgl->nalloc ? 2 * sgl->nalloc : 1;
-		nbytes = sgl->nalloc * sizeof(struct nvm_nvme_sgl_descriptor);
-		sgl->descriptors = nvm_buf_realloc(dev, sgl->descriptors, nbytes, NULL);
-		if (!sgl->descriptors) {
+	// Link each segment from the chaining slot of its predecessor
+	for (int seg = 0; seg < nseg; ++seg) {
+		struct nvm_nvme_sgl_descriptor *descr;
+		int nslots = NVM_SGL_SEG_NDESCR;
+		uint64_t phys;
+
+		descr = &sgl->descriptors[seg * NVM_SGL_SEG_NDESCR];
+		if (seg == nseg - 1) {
+			nslots = sgl->ndescr - seg * (NVM_SGL_SEG_NDESCR - 1);
+		}
+
+		if (nvm_buf_vtophys(dev, descr, &phys)) {
+			NVM_DEBUG("FAILED: nvm_buf_vtophys");
 			return -1;
 		}
+
+		memset(link, 0, sizeof(*link));
+		link->unkeyed.type = seg == nseg - 1 ?
+			NVM_NVME_SGL_DESCR_TYPE_LAST_SEGMENT :
+			NVM_NVME_SGL_DESCR_TYPE_SEGMENT;
+		link->unkeyed.len = nslots * dsize;
+		link->addr = phys;
+
+		link = &descr[NVM_SGL_SEG_NDESCR - 1];
 	}
 
-	d = &sgl->descriptors[sgl->ndescr];
-	d->unkeyed.type = NVM_NVME_SGL_DESCR_TYPE_DATA_BLOCK;
-	d->unkeyed.len = len;
+	return 0;
+}
 
+int nvm_sgl_add(struct nvm_dev *dev, struct nvm_sgl *sgl, void *addr,
+	size_t len)
+{
+	struct nvm_nvme_sgl_descriptor *d;
 	uint64_t phys;
 
+	if (len > UINT32_MAX) {
+		NVM_DEBUG("FAILED: len: %zu exceeds descriptor length", len);
+		errno = EINVAL;
+		return -1;
+	}
+
 	if (nvm_buf_vtophys(dev, addr, &phys)) {
 		return -1;
 	}
 
+	// Extend the previous descriptor when physically contiguous with it
+	if (sgl->ndescr) {
+		d = &sgl->descriptors[sgl_slot(sgl->ndescr - 1)];
+		if ((d->addr + d->unkeyed.len == phys) &&
+		    (d->unkeyed.len + len <= UINT32_MAX)) {
+			d->unkeyed.len += len;
+			sgl->len += len;
+			return 0;
+		}
+	}
+
+	while (sgl_slot(sgl->ndescr) >= sgl->nalloc) {
+		if (sgl_grow(dev, sgl)) {
+			return -1;
+		}
+	}
+
+	d = &sgl->descriptors[sgl_slot(sgl->ndescr)];
+	memset(d, 0, sizeof(*d));
+	d->unkeyed.type = NVM_NVME_SGL_DESCR_TYPE_DATA_BLOCK;
+	d->unkeyed.len = len;
 	d->addr = phys;
 
 	sgl->len += len;
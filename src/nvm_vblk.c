@@ -28,10 +28,12 @@
  */
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <errno.h>
 #include <liblightnvm.h>
 #include <nvm_dev.h>
 #include <nvm_vblk.h>
+#include <nvm_async.h>
 #include <nvm_omp.h>
 
 #define NVM_VBLK_CMD_OPTS (NVM_CMD_SYNC | NVM_CMD_VECTOR | NVM_CMD_PRP)
@@ -60,6 +62,18 @@ int nvm_vblk_set_async(struct nvm_vblk *vblk, uint32_t depth)
 	return 0;
 }
 
+int nvm_vblk_set_async_wait_mode(struct nvm_vblk *vblk,
+				 enum nvm_async_wait_mode mode)
+{
+	if (!vblk->async_ctx) {
+		NVM_DEBUG("FAILED: vblk is not async");
+		errno = EINVAL;
+		return -1;
+	}
+
+	return nvm_async_set_wait_mode(vblk->async_ctx, mode);
+}
+
 int nvm_vblk_set_scalar(struct nvm_vblk *vblk)
 {
 	vblk->flags &= ~NVM_CMD_VECTOR;
@@ -81,6 +95,184 @@ static void vblk_async_callback(struct nvm_ret *ret, void *opaque)
 	vblk->rets[--(vblk->retsp)] = ret;
 }
 
+/**
+ * Setup the device-format templates of the chunk addresses, the address of a
+ * sector in a chunk is its template plus the sector shifted into place
+ */
+static void vblk_tmpl_setup(struct nvm_vblk *vblk)
+{
+	struct nvm_addr blks[vblk->nblks ? vblk->nblks : 1];
+
+	if (nvm_dev_get_verid(vblk->dev) != NVM_SPEC_VERID_20)
+		return;
+
+	for (int i = 0; i < vblk->nblks; ++i) {
+		blks[i] = vblk->blks[i];
+		blks[i].l.sectr = 0;
+	}
+
+	nvm_addr_gen2dev_n(vblk->dev, blks, vblk->blks_dev, vblk->nblks);
+}
+
+/**
+ * Fill 'addrs' with the device-format addresses of 'naddrs' consecutive
+ * virtual sectors starting at 'sectr', striped over the chunks in units of
+ * WS_OPT sectors
+ */
+static inline void vblk_stripe_addrs(const struct nvm_vblk *vblk,
+				     size_t sectr, struct nvm_addr addrs[],
+				     size_t naddrs)
+{
+	const size_t WS_OPT = nvm_dev_get_ws_opt(vblk->dev);
+	const int ws_opt_sh = vblk->dev->addr_fns.ws_opt_sh;
+	const uint64_t sectr_sh = vblk->dev->lbaz.sectr;
+	const size_t wunit = ws_opt_sh < 0 ? sectr / WS_OPT : sectr >> ws_opt_sh;
+	const size_t wunit_ofz = sectr - wunit * WS_OPT;
+
+	size_t chunk = wunit % vblk->nblks;
+	size_t chunk_sectr = (wunit / vblk->nblks) * WS_OPT + wunit_ofz;
+	size_t wunit_left = WS_OPT - wunit_ofz;
+
+	for (size_t idx = 0; idx < naddrs; ++idx) {
+		addrs[idx].val = vblk->blks_dev[chunk] +
+				 ((uint64_t)chunk_sectr << sectr_sh);
+
+		++chunk_sectr;
+		if (--wunit_left)
+			continue;
+
+		// Next write-unit, the same round of the next chunk
+		wunit_left = WS_OPT;
+		if (++chunk == (size_t)vblk->nblks)
+			chunk = 0;
+		else
+			chunk_sectr -= WS_OPT;
+	}
+}
+
+/**
+ * Locate the WS_OPT aligned virtual sector 'sectr' as 'chunk' and sector
+ * within it, 'chunk_sectr', see vblk_stripe_addrs
+ */
+static inline void vblk_stripe_loc(const struct nvm_vblk *vblk, size_t sectr,
+				   size_t *chunk, size_t *chunk_sectr)
+{
+	const size_t WS_OPT = nvm_dev_get_ws_opt(vblk->dev);
+	const size_t wunit = sectr / WS_OPT;
+
+	*chunk = wunit % vblk->nblks;
+	*chunk_sectr = (wunit / vblk->nblks) * WS_OPT;
+}
+
+static void vblk_wcache_reset(struct nvm_vblk_wcache *wcache)
+{
+	for (int i = 0; i < 128; ++i) {
+		free(wcache->ring[i]);
+		wcache->ring[i] = NULL;
+		wcache->wp[i] = 0;
+	}
+}
+
+int nvm_vblk_set_wcache(struct nvm_vblk *vblk, int enable)
+{
+	const size_t WS_OPT = nvm_dev_get_ws_opt(vblk->dev);
+	const int mw_cunits = nvm_dev_get_mw_cunits(vblk->dev);
+
+	if (!enable) {
+		if (vblk->wcache)
+			vblk_wcache_reset(vblk->wcache);
+		free(vblk->wcache);
+		vblk->wcache = NULL;
+		return 0;
+	}
+
+	if (nvm_dev_get_verid(vblk->dev) != NVM_SPEC_VERID_20) {
+		NVM_DEBUG("FAILED: unsupported verid");
+		errno = ENOSYS;
+		return -1;
+	}
+	if (vblk->wcache || mw_cunits <= 0)
+		return 0;
+
+	vblk->wcache = calloc(1, sizeof(*vblk->wcache));
+	if (!vblk->wcache) {
+		NVM_DEBUG("FAILED: calloc wcache");
+		return -1;
+	}
+	vblk->wcache->nsectr = ((mw_cunits + WS_OPT - 1) / WS_OPT) * WS_OPT;
+
+	return 0;
+}
+
+/**
+ * Retain the 'count' bytes written at 'offset' of the vblk in the rings of
+ * their chunks, 'buf' is NULL for padding
+ */
+static void vblk_wcache_write(struct nvm_vblk *vblk, const void *buf,
+			      size_t count, size_t offset)
+{
+	struct nvm_vblk_wcache *wcache = vblk->wcache;
+	const struct nvm_geo *geo = nvm_dev_get_geo(vblk->dev);
+	const size_t WS_OPT = nvm_dev_get_ws_opt(vblk->dev);
+	const size_t stripe_nbytes = WS_OPT * geo->l.nbytes;
+	const size_t sectr_bgn = offset / geo->l.nbytes;
+
+	for (size_t ofz = 0; ofz < count; ofz += stripe_nbytes) {
+		size_t chunk, chunk_sectr;
+		char *slot;
+
+		vblk_stripe_loc(vblk, sectr_bgn + ofz / geo->l.nbytes, &chunk,
+				&chunk_sectr);
+
+		if (wcache->wp[chunk] < chunk_sectr + WS_OPT)
+			wcache->wp[chunk] = chunk_sectr + WS_OPT;
+
+		if (wcache->wp[chunk] >= geo->l.nsectr) {	// Chunk closed
+			free(wcache->ring[chunk]);
+			wcache->ring[chunk] = NULL;
+			continue;
+		}
+
+		if (!wcache->ring[chunk]) {
+			wcache->ring[chunk] = malloc(wcache->nsectr *
+						     geo->l.nbytes);
+			if (!wcache->ring[chunk]) {
+				NVM_DEBUG("FAILED: malloc ring, chunk: %zu",
+					  chunk);
+				continue;
+			}
+		}
+
+		slot = wcache->ring[chunk] +
+		       (chunk_sectr % wcache->nsectr) * geo->l.nbytes;
+		if (buf)
+			memcpy(slot, (const char *)buf + ofz, stripe_nbytes);
+		else
+			nvm_buf_fill(slot, stripe_nbytes);	// As padded
+	}
+}
+
+/**
+ * Get the retained copy of the stripe at the WS_OPT aligned virtual sector
+ * 'sectr', or NULL when the device must serve it
+ */
+static inline const char *vblk_wcache_hit(const struct nvm_vblk *vblk,
+					  size_t sectr)
+{
+	const struct nvm_vblk_wcache *wcache = vblk->wcache;
+	const struct nvm_geo *geo = nvm_dev_get_geo(vblk->dev);
+	size_t chunk, chunk_sectr;
+
+	vblk_stripe_loc(vblk, sectr, &chunk, &chunk_sectr);
+
+	if (!wcache->ring[chunk] || chunk_sectr >= wcache->wp[chunk] ||
+	    chunk_sectr + wcache->nsectr < wcache->wp[chunk])
+		return NULL;
+
+	return wcache->ring[chunk] +
+	       (chunk_sectr % wcache->nsectr) * geo->l.nbytes;
+}
+
 struct nvm_vblk* nvm_vblk_alloc(struct nvm_dev *dev, struct nvm_addr addrs[],
 				int naddrs)
 {
@@ -138,6 +330,8 @@ struct nvm_vblk* nvm_vblk_alloc(struct nvm_dev *dev, struct nvm_addr addrs[],
 		return NULL;
 	}
 
+	vblk_tmpl_setup(vblk);
+
 	return vblk;
 }
 
@@ -199,11 +393,19 @@ struct nvm_vblk *nvm_vblk_alloc_line(struct nvm_dev *dev, int ch_bgn,
 		}
 	}
 
+	vblk_tmpl_setup(vblk);
+
 	return vblk;
 }
 
 void nvm_vblk_free(struct nvm_vblk *vblk)
 {
+	if (vblk) {
+		nvm_vblk_set_readahead(vblk, 0);
+		nvm_vblk_set_buffered(vblk, 0);
+		nvm_vblk_set_wcache(vblk, 0);
+	}
+
 	free(vblk);
 }
 
@@ -300,6 +502,19 @@ ssize_t nvm_vblk_erase(struct nvm_vblk *vblk)
 		return vblk_erase_s12(vblk);
 
 	case NVM_SPEC_VERID_20:
+		if (vblk->rahead)	// Restart the window on the next read
+			vblk->rahead->pos = SIZE_MAX;
+		if (vblk->wbuf) {	// Drop what is staged
+			vblk->wbuf->nstaged = 0;
+			if (nvm_vblk_flush(vblk)) {
+				NVM_DEBUG("FAILED: nvm_vblk_flush");
+				return -1;	// Propagate errno
+			}
+			vblk->wbuf->ofz = 0;
+		}
+		if (vblk->wcache)
+			vblk_wcache_reset(vblk->wcache);
+
 		return vblk_erase_s20(vblk);
 
 	default:
@@ -320,13 +535,18 @@ static inline int _cmd_nspages(int nblks, int cmd_nspages_max)
 
 static inline int _vblk_async_greedy_reap(struct nvm_vblk *vblk)
 {
+	struct nvm_async_backoff bo = { 0 };
 	int r, nevents = 0;
 
-	// spin until something can be reaped
-	do {
+	// poll until something can be reaped, backing off as the ctx says
+	while (1) {
 		if (-1 == (nevents = nvm_async_poke(vblk->dev, vblk->async_ctx, 0)))
 			return -1;
-	} while (nevents == 0);
+		if (nevents)
+			break;
+
+		nvm_async_backoff(vblk->async_ctx, &bo);
+	}
 
 	// reap until empty
 	do {
@@ -358,20 +578,15 @@ static inline int vblk_io_async(struct nvm_vblk *vblk, const size_t vsectr_bgn,
 		.vblk = vblk,
 	};
 
-	size_t cnk_bgn = (vsectr_bgn / stripe_nsectrs) % vblk->nblks;
-	NVM_DEBUG("cnk_bgn: %ld", cnk_bgn);
-	for (size_t stripe = 0; stripe < nstripes; stripe++) {
-		size_t cnk_idx = (cnk_bgn + stripe) % vblk->nblks;
-		size_t cnk_off = (stripe / vblk->nblks) * stripe_nsectrs;
+	const int flags = vblk->flags | NVM_CMD_ADDR_DEV;
 
+	for (size_t stripe = 0; stripe < nstripes; stripe++) {
 		char *bufp = pad_buf ? pad_buf :
 			(char *)buf + (sectr_nbytes * stripe_nsectrs * stripe);
 
 		struct nvm_addr addrs[stripe_nsectrs];
-		for (size_t i = 0; i < stripe_nsectrs; i++) {
-			addrs[i].val = vblk->blks[cnk_idx].val;
-			addrs[i].l.sectr = cnk_off + i;
-		}
+		vblk_stripe_addrs(vblk, vsectr_bgn + stripe * stripe_nsectrs,
+				  addrs, stripe_nsectrs);
 
 		// this basically makes sure we never hit an EAGAIN below in
 		// the nvm_cmd_read/write call.
@@ -396,11 +611,9 @@ static inline int vblk_io_async(struct nvm_vblk *vblk, const size_t vsectr_bgn,
 		while(1) {
 			err = write ?
 				nvm_cmd_write(vblk->dev, addrs, stripe_nsectrs,
-					      bufp, meta_buf, vblk->flags,
-					      ret) :
+					      bufp, meta_buf, flags, ret) :
 				nvm_cmd_read(vblk->dev, addrs, stripe_nsectrs,
-					     bufp, meta_buf, vblk->flags,
-					     ret);
+					     bufp, meta_buf, flags, ret);
 
 			if (err < 0) {
 				if (errno == EAGAIN) {
@@ -587,32 +800,28 @@ static inline ssize_t vblk_sync_pread_s20(struct nvm_vblk *vblk, void *buf,
 		return -1;
 	}
 
-	const int VBLK_FLAGS = vblk->flags;
+	const int VBLK_FLAGS = vblk->flags | NVM_CMD_ADDR_DEV;
 
-	#pragma omp parallel for num_threads(NTHREADS) schedule(static,1) reduction(+:nerr) ordered if(NTHREADS>1)
-	for (size_t sectr_ofz = sectr_bgn; sectr_ofz <= sectr_end; sectr_ofz += cmd_nsectr) {
-		struct nvm_addr addrs[cmd_nsectr];
-		char *buf_off = (char*)buf + (sectr_ofz - sectr_bgn) * sectr_nbytes;
+	#pragma omp parallel num_threads(NTHREADS) reduction(+:nerr) if(NTHREADS>1)
+	{
+		nvm_dev_numa_bind(vblk->dev);
 
-		for (size_t idx = 0; idx < cmd_nsectr; ++idx) {
-			const size_t sectr = sectr_ofz + idx;
-			const size_t wunit = sectr / WS_OPT;
-			const size_t rnd = wunit / nchunks;
+		#pragma omp for schedule(static,1) ordered
+		for (size_t sectr_ofz = sectr_bgn; sectr_ofz <= sectr_end; sectr_ofz += cmd_nsectr) {
+			struct nvm_addr addrs[cmd_nsectr];
+			char *buf_off = (char*)buf + (sectr_ofz - sectr_bgn) * sectr_nbytes;
 
-			const size_t chunk = wunit % nchunks;
-			const size_t chunk_sectr = sectr % WS_OPT + rnd * WS_OPT;
+			vblk_stripe_addrs(vblk, sectr_ofz, addrs,
+					  VBLK_FLAGS & NVM_CMD_SCALAR ? 1 : cmd_nsectr);
 
-			addrs[idx].val = vblk->blks[chunk].val;
-			addrs[idx].l.sectr = chunk_sectr;
-
-			if (VBLK_FLAGS & NVM_CMD_SCALAR) break;
+			const ssize_t err = nvm_cmd_read(vblk->dev, addrs, cmd_nsectr,
+							 buf_off, NULL,
+							 VBLK_FLAGS, NULL);
+			if (err)
+				++nerr;
 		}
 
-		const ssize_t err = nvm_cmd_read(vblk->dev, addrs, cmd_nsectr,
-						 buf_off, NULL,
-						 VBLK_FLAGS, NULL);
-		if (err)
-			++nerr;
+		nvm_dev_numa_unbind();
 	}
 
 	if (nerr) {
@@ -697,40 +906,37 @@ static inline ssize_t vblk_sync_pwrite_s20(struct nvm_vblk *vblk,
 		}
 	}
 
-	const int VBLK_FLAGS = vblk->flags;
+	const int VBLK_FLAGS = vblk->flags | NVM_CMD_ADDR_DEV;
 
-	#pragma omp parallel for num_threads(NTHREADS) schedule(static,1) reduction(+:nerr) ordered if(NTHREADS>1)
-	for (size_t sectr_ofz = sectr_bgn; sectr_ofz <= sectr_end; sectr_ofz += cmd_nsectr) {
-		struct nvm_ret ret = { 0 };
+	#pragma omp parallel num_threads(NTHREADS) reduction(+:nerr) if(NTHREADS>1)
+	{
+		nvm_dev_numa_bind(vblk->dev);
 
-		struct nvm_addr addrs[cmd_nsectr];
-		char *buf_off;
+		#pragma omp for schedule(static,1) ordered
+		for (size_t sectr_ofz = sectr_bgn; sectr_ofz <= sectr_end; sectr_ofz += cmd_nsectr) {
+			struct nvm_ret ret = { 0 };
 
-		if (pad_buf)
-			buf_off = pad_buf;
-		else
-			buf_off = (char*)buf + (sectr_ofz - sectr_bgn) * sectr_nbytes;
+			struct nvm_addr addrs[cmd_nsectr];
+			char *buf_off;
 
-		for (size_t idx = 0; idx < cmd_nsectr; ++idx) {
-			const size_t sectr = sectr_ofz + idx;
-			const size_t wunit = sectr / WS_OPT;
-			const size_t rnd = wunit / nchunks;
+			if (pad_buf)
+				buf_off = pad_buf;
+			else
+				buf_off = (char*)buf + (sectr_ofz - sectr_bgn) * sectr_nbytes;
 
-			const size_t chunk = wunit % nchunks;
-			const size_t chunk_sectr = sectr % WS_OPT + rnd * WS_OPT;
+			vblk_stripe_addrs(vblk, sectr_ofz, addrs, cmd_nsectr);
 
-			addrs[idx].ppa = vblk->blks[chunk].ppa;
-			addrs[idx].l.sectr = chunk_sectr;
-		}
+			const ssize_t err = nvm_cmd_write(vblk->dev, addrs, cmd_nsectr,
+							  buf_off, meta_buf,
+							  VBLK_FLAGS, &ret);
+			if (err)
+				++nerr;
 
-		const ssize_t err = nvm_cmd_write(vblk->dev, addrs, cmd_nsectr,
-						  buf_off, meta_buf,
-						  VBLK_FLAGS, &ret);
-		if (err)
-			++nerr;
+			#pragma omp ordered
+			{}
+		}
 
-		#pragma omp ordered
-		{}
+		nvm_dev_numa_unbind();
 	}
 
 	nvm_buf_free(vblk->dev, pad_buf);
@@ -812,39 +1018,46 @@ static inline ssize_t vblk_pwrite_s12(struct nvm_vblk *vblk, const void *buf,
 		}
 	}
 
-	#pragma omp parallel for num_threads(NTHREADS) schedule(static,1) reduction(+:nerr) ordered if(NTHREADS>1)
-	for (size_t off = bgn; off < end; off += CMD_NSPAGES) {
-		struct nvm_ret ret = { 0 };
+	#pragma omp parallel num_threads(NTHREADS) reduction(+:nerr) if(NTHREADS>1)
+	{
+		nvm_dev_numa_bind(vblk->dev);
 
-		const int nspages = NVM_MIN(CMD_NSPAGES, (int)(end - off));
-		const int naddrs = nspages * SPAGE_NADDRS;
+		#pragma omp for schedule(static,1) ordered
+		for (size_t off = bgn; off < end; off += CMD_NSPAGES) {
+			struct nvm_ret ret = { 0 };
 
-		struct nvm_addr addrs[naddrs];
-		const char *buf_off;
+			const int nspages = NVM_MIN(CMD_NSPAGES, (int)(end - off));
+			const int naddrs = nspages * SPAGE_NADDRS;
 
-		if (padding_buf)
-			buf_off = padding_buf;
-		else
-			buf_off = (const char*)buf + (off - bgn) * geo->sector_nbytes * SPAGE_NADDRS;
+			struct nvm_addr addrs[naddrs];
+			const char *buf_off;
 
-		for (int i = 0; i < naddrs; ++i) {
-			const int spg = off + (i / SPAGE_NADDRS);
-			const int idx = spg % vblk->nblks;
-			const int pg = (spg / vblk->nblks) % geo->npages;
+			if (padding_buf)
+				buf_off = padding_buf;
+			else
+				buf_off = (const char*)buf + (off - bgn) * geo->sector_nbytes * SPAGE_NADDRS;
 
-			addrs[i].ppa = vblk->blks[idx].ppa;
-			addrs[i].g.pg = pg;
-			addrs[i].g.pl = (i / geo->nsectors) % geo->nplanes;
-			addrs[i].g.sec = i % geo->nsectors;
-		}
+			for (int i = 0; i < naddrs; ++i) {
+				const int spg = off + (i / SPAGE_NADDRS);
+				const int idx = spg % vblk->nblks;
+				const int pg = (spg / vblk->nblks) % geo->npages;
 
-		const ssize_t err = nvm_cmd_write(vblk->dev, addrs, naddrs,
-						   buf_off, meta, PMODE, &ret);
-		if (err)
-			++nerr;
+				addrs[i].ppa = vblk->blks[idx].ppa;
+				addrs[i].g.pg = pg;
+				addrs[i].g.pl = (i / geo->nsectors) % geo->nplanes;
+				addrs[i].g.sec = i % geo->nsectors;
+			}
+
+			const ssize_t err = nvm_cmd_write(vblk->dev, addrs, naddrs,
+							   buf_off, meta, PMODE, &ret);
+			if (err)
+				++nerr;
 
-		#pragma omp ordered
-		{}
+			#pragma omp ordered
+			{}
+		}
+
+		nvm_dev_numa_unbind();
 	}
 
 	nvm_buf_free(vblk->dev, padding_buf);
@@ -858,11 +1071,272 @@ static inline ssize_t vblk_pwrite_s12(struct nvm_vblk *vblk, const void *buf,
 	return count;
 }
 
+static void vblk_wbuf_callback(struct nvm_ret *ret, void *opaque)
+{
+	struct nvm_vblk_wbuf *wbuf = opaque;
+
+	if (ret->status)
+		++wbuf->nerr;
+}
+
+/**
+ * Wait for the stripe in flight, if any, and retain it in the write-back ring
+ */
+static int vblk_wbuf_wait(struct nvm_vblk *vblk)
+{
+	struct nvm_vblk_wbuf *wbuf = vblk->wbuf;
+
+	if (!wbuf->inflight)
+		return 0;
+
+	if (wbuf->ctx && nvm_async_wait(vblk->dev, wbuf->ctx) < 0) {
+		NVM_DEBUG("FAILED: nvm_async_wait");
+		return -1;	// Propagate errno
+	}
+	wbuf->inflight = 0;
+
+	if (wbuf->nerr) {
+		NVM_DEBUG("FAILED: nvm_cmd_write, nerr(%zu)", wbuf->nerr);
+		wbuf->nerr = 0;
+		errno = EIO;
+		return -1;
+	}
+
+	if (vblk->wcache)
+		vblk_wcache_write(vblk, wbuf->ring + (!wbuf->open) *
+				  wbuf->stripe_nbytes, wbuf->inflight_nbytes,
+				  wbuf->inflight_ofz);
+
+	return 0;
+}
+
+/**
+ * Write the first 'nunits' write-units of the open stripe asynchronously, once
+ * the stripe before it is done, and open the next. Without ASYNC support in
+ * the backend the stripe is written synchronously, in parallel over chunks.
+ */
+static int vblk_wbuf_submit(struct nvm_vblk *vblk, size_t nunits)
+{
+	struct nvm_vblk_wbuf *wbuf = vblk->wbuf;
+	const struct nvm_geo *geo = nvm_dev_get_geo(vblk->dev);
+	const size_t WS_OPT = nvm_dev_get_ws_opt(vblk->dev);
+	const size_t sectr_bgn = wbuf->ofz / geo->l.nbytes;
+	const int flags = (vblk->flags & ~NVM_CMD_SYNC) | NVM_CMD_ASYNC |
+			  NVM_CMD_ADDR_DEV;
+	char *stripe = wbuf->ring + wbuf->open * wbuf->stripe_nbytes;
+
+	if (vblk_wbuf_wait(vblk))
+		return -1;	// Propagate errno
+
+	if (!wbuf->ctx && vblk_sync_pwrite_s20(vblk, stripe,
+					       nunits * wbuf->unit_nbytes,
+					       wbuf->ofz) < 0)
+		++wbuf->nerr;
+
+	for (size_t unit = 0; wbuf->ctx && unit < nunits; ++unit) {
+		struct nvm_ret *ret = &wbuf->rets[unit];
+		struct nvm_addr addrs[WS_OPT];
+
+		memset(ret, 0, sizeof(*ret));
+		ret->async.ctx = wbuf->ctx;
+		ret->async.cb = vblk_wbuf_callback;
+		ret->async.cb_arg = wbuf;
+
+		vblk_stripe_addrs(vblk, sectr_bgn + unit * WS_OPT, addrs,
+				  WS_OPT);
+
+		if (nvm_cmd_write(vblk->dev, addrs, WS_OPT,
+				  stripe + unit * wbuf->unit_nbytes,
+				  wbuf->meta, flags, ret))
+			++wbuf->nerr;
+	}
+
+	wbuf->inflight = 1;
+	wbuf->inflight_ofz = wbuf->ofz;
+	wbuf->inflight_nbytes = nunits * wbuf->unit_nbytes;
+
+	wbuf->open = !wbuf->open;
+	wbuf->ofz += nunits * wbuf->unit_nbytes;
+	wbuf->nstaged = 0;
+
+	return 0;
+}
+
+/**
+ * Stage 'count' bytes of 'buf' at the write position, NULL for padding,
+ * writing out stripes as they fill. The write position only moves past bytes
+ * which are staged, when a stripe cannot be written out its bytes from this
+ * call are dropped again
+ */
+static ssize_t vblk_wbuf_write(struct nvm_vblk *vblk, const void *buf,
+			       size_t count)
+{
+	struct nvm_vblk_wbuf *wbuf = vblk->wbuf;
+	const char *src = buf;
+
+	if (vblk->pos_write + count > vblk->nbytes) {
+		NVM_DEBUG("FAILED: count: %zu exceeds vblk", count);
+		errno = ENOSPC;
+		return -1;
+	}
+
+	for (size_t left = count; left;) {
+		const size_t room = wbuf->stripe_nbytes - wbuf->nstaged;
+		const size_t nbytes = left < room ? left : room;
+		char *dst = wbuf->ring + wbuf->open * wbuf->stripe_nbytes +
+			    wbuf->nstaged;
+
+		if (src) {
+			memcpy(dst, src, nbytes);
+			src += nbytes;
+		} else {
+			nvm_buf_fill(dst, nbytes);
+		}
+		wbuf->nstaged += nbytes;
+		left -= nbytes;
+
+		if (wbuf->nstaged < wbuf->stripe_nbytes) {
+			vblk->pos_write += nbytes;
+			continue;
+		}
+
+		if (vblk_wbuf_submit(vblk, vblk->nblks)) {
+			wbuf->nstaged -= nbytes;
+			return -1;	// Propagate errno
+		}
+		vblk->pos_write += nbytes;
+	}
+
+	return count;
+}
+
+int nvm_vblk_set_buffered(struct nvm_vblk *vblk, int enable)
+{
+	const struct nvm_geo *geo = nvm_dev_get_geo(vblk->dev);
+	const size_t WS_OPT = nvm_dev_get_ws_opt(vblk->dev);
+	const int meta_mode = nvm_dev_get_meta_mode(vblk->dev);
+	struct nvm_vblk_wbuf *wbuf;
+	int err = 0;
+
+	if (!enable) {
+		if (!vblk->wbuf)
+			return 0;
+
+		err = nvm_vblk_flush(vblk);
+
+		if (vblk->wbuf->ctx)
+			nvm_async_term(vblk->dev, vblk->wbuf->ctx);
+		nvm_buf_free(vblk->dev, vblk->wbuf->ring);
+		nvm_buf_free(vblk->dev, vblk->wbuf->meta);
+		free(vblk->wbuf);
+		vblk->wbuf = NULL;
+
+		return err;
+	}
+
+	if (nvm_dev_get_verid(vblk->dev) != NVM_SPEC_VERID_20) {
+		NVM_DEBUG("FAILED: unsupported verid");
+		errno = ENOSYS;
+		return -1;
+	}
+	if (vblk->wbuf)
+		return 0;
+	if (vblk->pos_write % (WS_OPT * geo->l.nbytes)) {
+		NVM_DEBUG("FAILED: unaligned pos_write: %zu", vblk->pos_write);
+		errno = EINVAL;
+		return -1;
+	}
+
+	wbuf = calloc(1, sizeof(*wbuf));
+	if (!wbuf) {
+		NVM_DEBUG("FAILED: calloc wbuf");
+		return -1;
+	}
+	wbuf->unit_nbytes = WS_OPT * geo->l.nbytes;
+	wbuf->stripe_nbytes = wbuf->unit_nbytes * vblk->nblks;
+	wbuf->ofz = vblk->pos_write;
+
+	wbuf->ctx = nvm_async_init(vblk->dev, vblk->nblks, 0);
+	if (!wbuf->ctx && errno != ENOSYS) {
+		NVM_DEBUG("FAILED: nvm_async_init");
+		free(wbuf);
+		return -1;
+	}
+
+	wbuf->ring = nvm_buf_alloc(vblk->dev, 2 * wbuf->stripe_nbytes, NULL);
+	if (!wbuf->ring) {
+		NVM_DEBUG("FAILED: nvm_buf_alloc(ring)");
+		err = ENOMEM;
+		goto failed;
+	}
+
+	if (meta_mode != NVM_META_MODE_NONE) {
+		const size_t meta_tbytes = WS_OPT * geo->l.nbytes_oob;
+
+		wbuf->meta = nvm_buf_alloc(vblk->dev, meta_tbytes, NULL);
+		if (!wbuf->meta) {
+			NVM_DEBUG("FAILED: nvm_buf_alloc(meta)");
+			err = ENOMEM;
+			goto failed;
+		}
+
+		if (meta_mode == NVM_META_MODE_ALPHA) {
+			nvm_buf_fill(wbuf->meta, meta_tbytes);
+		} else {
+			for (size_t i = 0; i < meta_tbytes; ++i)
+				wbuf->meta[i] = 65 + (meta_tbytes % 20);
+		}
+	}
+
+	vblk->wbuf = wbuf;
+
+	return 0;
+
+failed:
+	nvm_buf_free(vblk->dev, wbuf->ring);
+	if (wbuf->ctx)
+		nvm_async_term(vblk->dev, wbuf->ctx);
+	free(wbuf);
+	errno = err;
+	return -1;
+}
+
+int nvm_vblk_flush(struct nvm_vblk *vblk)
+{
+	struct nvm_vblk_wbuf *wbuf = vblk->wbuf;
+	size_t nunits, pad_nbytes;
+
+	if (!wbuf)
+		return 0;
+
+	if (!wbuf->nstaged)
+		return vblk_wbuf_wait(vblk);
+
+	// Pad the last write-unit with synthetic data
+	nunits = (wbuf->nstaged + wbuf->unit_nbytes - 1) / wbuf->unit_nbytes;
+	pad_nbytes = nunits * wbuf->unit_nbytes - wbuf->nstaged;
+	if (pad_nbytes)
+		nvm_buf_fill(wbuf->ring + wbuf->open * wbuf->stripe_nbytes +
+			     wbuf->nstaged, pad_nbytes);
+
+	if (vblk_wbuf_submit(vblk, nunits))
+		return -1;	// Propagate errno
+	vblk->pos_write += pad_nbytes;
+
+	return vblk_wbuf_wait(vblk);
+}
 
 ssize_t nvm_vblk_pwrite(struct nvm_vblk *vblk, const void *buf, size_t count,
 			size_t offset)
 {
 	const int verid = nvm_dev_get_verid(nvm_vblk_get_dev(vblk));
+	ssize_t nbytes;
+
+	if (vblk->wbuf) {
+		NVM_DEBUG("FAILED: vblk is buffered, use nvm_vblk_write");
+		errno = EINVAL;
+		return -1;
+	}
 
 	switch (verid) {
 	case NVM_SPEC_VERID_12:
@@ -870,10 +1344,16 @@ ssize_t nvm_vblk_pwrite(struct nvm_vblk *vblk, const void *buf, size_t count,
 
 	case NVM_SPEC_VERID_20:
 		if (vblk->flags & NVM_CMD_ASYNC) {
-			return vblk_async_pwrite_s20(vblk, buf, count, offset);
+			nbytes = vblk_async_pwrite_s20(vblk, buf, count,
+						       offset);
 		} else {
-			return vblk_sync_pwrite_s20(vblk, buf, count, offset);
+			nbytes = vblk_sync_pwrite_s20(vblk, buf, count,
+						      offset);
 		}
+		if (nbytes > 0 && vblk->wcache)
+			vblk_wcache_write(vblk, buf, nbytes, offset);
+
+		return nbytes;
 
 	default:
 		NVM_DEBUG("FAILED: unsupported verid: %d", verid);
@@ -884,8 +1364,12 @@ ssize_t nvm_vblk_pwrite(struct nvm_vblk *vblk, const void *buf, size_t count,
 
 ssize_t nvm_vblk_write(struct nvm_vblk *vblk, const void *buf, size_t count)
 {
-	ssize_t nbytes = nvm_vblk_pwrite(vblk, buf, count, vblk->pos_write);
+	ssize_t nbytes;
+
+	if (vblk->wbuf)
+		return vblk_wbuf_write(vblk, buf, count);
 
+	nbytes = nvm_vblk_pwrite(vblk, buf, count, vblk->pos_write);
 	if (nbytes < 0)
 		return nbytes;		// Propagate errno
 
@@ -896,7 +1380,13 @@ ssize_t nvm_vblk_write(struct nvm_vblk *vblk, const void *buf, size_t count)
 
 ssize_t nvm_vblk_pad(struct nvm_vblk *vblk)
 {
-	return nvm_vblk_write(vblk, NULL, vblk->nbytes - vblk->pos_write);
+	ssize_t nbytes = nvm_vblk_write(vblk, NULL,
+					vblk->nbytes - vblk->pos_write);
+
+	if (nbytes < 0 || !vblk->wbuf)
+		return nbytes;
+
+	return nvm_vblk_flush(vblk) ? -1 : nbytes;
 }
 
 static inline ssize_t vblk_pread_s12(struct nvm_vblk *vblk, void *buf,
@@ -926,36 +1416,43 @@ static inline ssize_t vblk_pread_s12(struct nvm_vblk *vblk, void *buf,
 		return -1;
 	}
 
-	#pragma omp parallel for num_threads(NTHREADS) schedule(static,1) reduction(+:nerr) ordered if(NTHREADS>1)
-	for (size_t off = bgn; off < end; off += CMD_NSPAGES) {
-		struct nvm_ret ret = { 0 };
+	#pragma omp parallel num_threads(NTHREADS) reduction(+:nerr) if(NTHREADS>1)
+	{
+		nvm_dev_numa_bind(vblk->dev);
 
-		const int nspages = NVM_MIN(CMD_NSPAGES, (int)(end - off));
-		const int naddrs = nspages * SPAGE_NADDRS;
+		#pragma omp for schedule(static,1) ordered
+		for (size_t off = bgn; off < end; off += CMD_NSPAGES) {
+			struct nvm_ret ret = { 0 };
 
-		struct nvm_addr addrs[naddrs];
-		char *buf_off;
+			const int nspages = NVM_MIN(CMD_NSPAGES, (int)(end - off));
+			const int naddrs = nspages * SPAGE_NADDRS;
 
-		buf_off = (char*)buf + (off - bgn) * geo->sector_nbytes * SPAGE_NADDRS;
+			struct nvm_addr addrs[naddrs];
+			char *buf_off;
 
-		for (int i = 0; i < naddrs; ++i) {
-			const int spg = off + (i / SPAGE_NADDRS);
-			const int idx = spg % vblk->nblks;
-			const int pg = (spg / vblk->nblks) % geo->npages;
+			buf_off = (char*)buf + (off - bgn) * geo->sector_nbytes * SPAGE_NADDRS;
 
-			addrs[i].ppa = vblk->blks[idx].ppa;
-			addrs[i].g.pg = pg;
-			addrs[i].g.pl = (i / geo->nsectors) % geo->nplanes;
-			addrs[i].g.sec = i % geo->nsectors;
-		}
+			for (int i = 0; i < naddrs; ++i) {
+				const int spg = off + (i / SPAGE_NADDRS);
+				const int idx = spg % vblk->nblks;
+				const int pg = (spg / vblk->nblks) % geo->npages;
 
-		const ssize_t err = nvm_cmd_read(vblk->dev, addrs, naddrs,
-						 buf_off, NULL, PMODE, &ret);
-		if (err)
-			++nerr;
+				addrs[i].ppa = vblk->blks[idx].ppa;
+				addrs[i].g.pg = pg;
+				addrs[i].g.pl = (i / geo->nsectors) % geo->nplanes;
+				addrs[i].g.sec = i % geo->nsectors;
+			}
+
+			const ssize_t err = nvm_cmd_read(vblk->dev, addrs, naddrs,
+							 buf_off, NULL, PMODE, &ret);
+			if (err)
+				++nerr;
 
-		#pragma omp ordered
-		{}
+			#pragma omp ordered
+			{}
+		}
+
+		nvm_dev_numa_unbind();
 	}
 
 	if (nerr) {
@@ -966,6 +1463,297 @@ static inline ssize_t vblk_pread_s12(struct nvm_vblk *vblk, void *buf,
 	return count;
 }
 
+static inline ssize_t vblk_pread_s20(struct nvm_vblk *vblk, void *buf,
+				     size_t count, size_t offset)
+{
+	if (vblk->flags & NVM_CMD_ASYNC)
+		return vblk_async_pread_s20(vblk, buf, count, offset);
+
+	return vblk_sync_pread_s20(vblk, buf, count, offset);
+}
+
+/**
+ * Read with the stripes retained by the write-back ring copied from it, and
+ * the runs of stripes in between read from the device
+ */
+static inline ssize_t vblk_wcache_pread_s20(struct nvm_vblk *vblk, void *buf,
+					    size_t count, size_t offset)
+{
+	const struct nvm_geo *geo = nvm_dev_get_geo(vblk->dev);
+	const size_t WS_OPT = nvm_dev_get_ws_opt(vblk->dev);
+	const size_t stripe_nbytes = WS_OPT * geo->l.nbytes;
+	size_t run_bgn = count;
+
+	if ((count % stripe_nbytes) || (offset % stripe_nbytes))
+		return vblk_pread_s20(vblk, buf, count, offset); // EINVAL
+
+	for (size_t ofz = 0; ofz <= count; ofz += stripe_nbytes) {
+		const char *hit = NULL;
+
+		if (ofz < count) {
+			hit = vblk_wcache_hit(vblk,
+					      (offset + ofz) / geo->l.nbytes);
+			if (!hit) {
+				if (run_bgn == count)
+					run_bgn = ofz;
+				continue;
+			}
+		}
+
+		if (run_bgn < ofz) {
+			if (vblk_pread_s20(vblk, (char *)buf + run_bgn,
+					   ofz - run_bgn,
+					   offset + run_bgn) < 0)
+				return -1;	// Propagate errno
+
+			run_bgn = count;
+		}
+
+		if (hit)
+			memcpy((char *)buf + ofz, hit, stripe_nbytes);
+	}
+
+	return count;
+}
+
+static void vblk_rahead_callback(struct nvm_ret *ret, void *opaque)
+{
+	struct nvm_vblk_rahead_buf *rbuf = opaque;
+
+	if (ret->status)
+		++rbuf->nerr;
+
+	--rbuf->npending;
+}
+
+/**
+ * Read the stripe at 'next_ofz' into the buffer at 'tail', a read per
+ * write-unit, those retained by the write-back ring are copied from it.
+ * Without ASYNC support in the backend the stripe is read synchronously.
+ */
+static void vblk_rahead_issue(struct nvm_vblk *vblk)
+{
+	struct nvm_vblk_rahead *ra = vblk->rahead;
+	const struct nvm_geo *geo = nvm_dev_get_geo(vblk->dev);
+	const size_t WS_OPT = nvm_dev_get_ws_opt(vblk->dev);
+	const uint32_t idx = ra->tail % ra->nbufs;
+	const int flags = (vblk->flags & ~NVM_CMD_SYNC) | NVM_CMD_ASYNC |
+			  NVM_CMD_ADDR_DEV;
+	struct nvm_vblk_rahead_buf *rbuf = &ra->bufs[idx];
+	char *stripe = ra->ring + idx * ra->stripe_nbytes;
+
+	rbuf->ofz = ra->next_ofz;
+	rbuf->nbytes = vblk->nbytes - rbuf->ofz;
+	if (rbuf->nbytes > ra->stripe_nbytes)
+		rbuf->nbytes = ra->stripe_nbytes;
+	rbuf->npending = 0;
+	rbuf->nerr = 0;
+
+	ra->tail += 1;
+	ra->next_ofz += rbuf->nbytes;
+
+	if (!ra->ctx) {
+		ssize_t err = vblk->wcache ?
+			vblk_wcache_pread_s20(vblk, stripe, rbuf->nbytes,
+					      rbuf->ofz) :
+			vblk_sync_pread_s20(vblk, stripe, rbuf->nbytes,
+					    rbuf->ofz);
+		if (err < 0)
+			++rbuf->nerr;
+
+		return;
+	}
+
+	for (size_t ofz = 0; ofz < rbuf->nbytes; ofz += ra->unit_nbytes) {
+		const size_t sectr = (rbuf->ofz + ofz) / geo->l.nbytes;
+		struct nvm_ret *ret = &ra->rets[idx * vblk->nblks +
+						ofz / ra->unit_nbytes];
+		struct nvm_addr addrs[WS_OPT];
+
+		if (vblk->wcache) {
+			const char *hit = vblk_wcache_hit(vblk, sectr);
+
+			if (hit) {
+				memcpy(stripe + ofz, hit, ra->unit_nbytes);
+				continue;
+			}
+		}
+
+		memset(ret, 0, sizeof(*ret));
+		ret->async.ctx = ra->ctx;
+		ret->async.cb = vblk_rahead_callback;
+		ret->async.cb_arg = rbuf;
+
+		vblk_stripe_addrs(vblk, sectr, addrs, WS_OPT);
+
+		++rbuf->npending;
+		if (nvm_cmd_read(vblk->dev, addrs, WS_OPT, stripe + ofz, NULL,
+				 flags, ret)) {
+			--rbuf->npending;
+			++rbuf->nerr;
+		}
+	}
+}
+
+/**
+ * Drop the window, waiting for the reads in flight as they target the ring
+ */
+static int vblk_rahead_drop(struct nvm_vblk *vblk)
+{
+	struct nvm_vblk_rahead *ra = vblk->rahead;
+
+	ra->head = ra->tail;
+	ra->pos = SIZE_MAX;
+
+	if (ra->ctx && nvm_async_wait(vblk->dev, ra->ctx) < 0) {
+		NVM_DEBUG("FAILED: nvm_async_wait");
+		return -1;	// Propagate errno
+	}
+
+	return 0;
+}
+
+/**
+ * Get up to 'count' bytes at the read position from the ring, in 'buf', valid
+ * until the next call, keeping the window of reads ahead of it in flight
+ *
+ * @return Number of bytes in 'buf', 0 at the end of the vblk
+ */
+static ssize_t vblk_rahead_get(struct nvm_vblk *vblk, const void **buf,
+			       size_t count)
+{
+	struct nvm_vblk_rahead *ra = vblk->rahead;
+	struct nvm_vblk_rahead_buf *rbuf;
+	struct nvm_async_backoff bo = { 0 };
+	uint32_t idx;
+	size_t nbytes;
+
+	if (ra->pos != vblk->pos_read) {	// Not sequential, restart
+		if (vblk_rahead_drop(vblk))
+			return -1;	// Propagate errno
+
+		ra->pos = vblk->pos_read;
+		ra->next_ofz = ra->pos - ra->pos % ra->unit_nbytes;
+	}
+	if (!count || ra->pos >= vblk->nbytes)
+		return 0;
+
+	while (ra->tail - ra->head < ra->nbufs && ra->next_ofz < vblk->nbytes) {
+		if (!ra->ctx && ra->tail != ra->head)
+			break;		// Sync, nothing to gain
+
+		vblk_rahead_issue(vblk);
+	}
+
+	idx = ra->head % ra->nbufs;
+	rbuf = &ra->bufs[idx];
+	while (rbuf->npending) {
+		const int nevents = nvm_async_poke(vblk->dev, ra->ctx, 0);
+
+		if (nevents < 0) {
+			NVM_DEBUG("FAILED: nvm_async_poke");
+			return -1;	// Propagate errno
+		}
+		if (!nevents)
+			nvm_async_backoff(ra->ctx, &bo);
+	}
+	if (rbuf->nerr) {
+		NVM_DEBUG("FAILED: nvm_cmd_read, nerr(%u)", rbuf->nerr);
+		vblk_rahead_drop(vblk);
+		errno = EIO;
+		return -1;
+	}
+
+	nbytes = rbuf->ofz + rbuf->nbytes - ra->pos;
+	if (nbytes > count)
+		nbytes = count;
+
+	*buf = ra->ring + idx * ra->stripe_nbytes + (ra->pos - rbuf->ofz);
+
+	ra->pos += nbytes;
+	vblk->pos_read = ra->pos;
+	if (ra->pos == rbuf->ofz + rbuf->nbytes)
+		ra->head += 1;		// Consumed, reused next call
+
+	return nbytes;
+}
+
+int nvm_vblk_set_readahead(struct nvm_vblk *vblk, uint32_t nstripes)
+{
+	const struct nvm_geo *geo = nvm_dev_get_geo(vblk->dev);
+	const size_t WS_OPT = nvm_dev_get_ws_opt(vblk->dev);
+	struct nvm_vblk_rahead *ra = vblk->rahead;
+
+	if (ra) {
+		vblk_rahead_drop(vblk);
+
+		if (ra->ctx)
+			nvm_async_term(vblk->dev, ra->ctx);
+		nvm_buf_free(vblk->dev, ra->ring);
+		free(ra->rets);
+		free(ra->bufs);
+		free(ra);
+		vblk->rahead = NULL;
+	}
+	if (!nstripes)
+		return 0;
+
+	if (nvm_dev_get_verid(vblk->dev) != NVM_SPEC_VERID_20) {
+		NVM_DEBUG("FAILED: unsupported verid");
+		errno = ENOSYS;
+		return -1;
+	}
+
+	ra = calloc(1, sizeof(*ra));
+	if (!ra) {
+		NVM_DEBUG("FAILED: calloc rahead");
+		return -1;
+	}
+	ra->unit_nbytes = WS_OPT * geo->l.nbytes;
+	ra->stripe_nbytes = ra->unit_nbytes * vblk->nblks;
+	ra->nbufs = nstripes;
+	ra->pos = SIZE_MAX;
+
+	ra->bufs = calloc(nstripes, sizeof(*ra->bufs));
+	ra->rets = calloc((size_t)nstripes * vblk->nblks, sizeof(*ra->rets));
+	ra->ring = nvm_buf_alloc(vblk->dev, nstripes * ra->stripe_nbytes,
+				 NULL);
+	if (!ra->bufs || !ra->rets || !ra->ring) {
+		NVM_DEBUG("FAILED: allocating ring");
+		errno = ENOMEM;
+		goto failed;
+	}
+
+	ra->ctx = nvm_async_init(vblk->dev, nstripes * vblk->nblks, 0);
+	if (!ra->ctx && errno != ENOSYS) {
+		NVM_DEBUG("FAILED: nvm_async_init");
+		goto failed;
+	}
+
+	vblk->rahead = ra;
+
+	return 0;
+
+failed:
+	nvm_buf_free(vblk->dev, ra->ring);
+	free(ra->rets);
+	free(ra->bufs);
+	free(ra);
+	return -1;
+}
+
+ssize_t nvm_vblk_read_zc(struct nvm_vblk *vblk, const void **buf,
+			 size_t count)
+{
+	if (!vblk->rahead) {
+		NVM_DEBUG("FAILED: vblk has no read-ahead");
+		errno = EINVAL;
+		return -1;
+	}
+
+	return vblk_rahead_get(vblk, buf, count);
+}
+
 ssize_t nvm_vblk_pread(struct nvm_vblk *vblk, void *buf, size_t count,
 		       size_t offset)
 {
@@ -976,11 +1764,10 @@ ssize_t nvm_vblk_pread(struct nvm_vblk *vblk, void *buf, size_t count,
 		return vblk_pread_s12(vblk, buf, count, offset);
 
 	case NVM_SPEC_VERID_20:
-		if (vblk->flags & NVM_CMD_ASYNC) {
-			return vblk_async_pread_s20(vblk, buf, count, offset);
-		} else {
-			return vblk_sync_pread_s20(vblk, buf, count, offset);
-		}
+		if (vblk->wcache)
+			return vblk_wcache_pread_s20(vblk, buf, count, offset);
+
+		return vblk_pread_s20(vblk, buf, count, offset);
 
 	default:
 		NVM_DEBUG("FAILED: unsupported verid: %d", verid);
@@ -991,8 +1778,28 @@ ssize_t nvm_vblk_pread(struct nvm_vblk *vblk, void *buf, size_t count,
 
 ssize_t nvm_vblk_read(struct nvm_vblk *vblk, void *buf, size_t count)
 {
-	ssize_t nbytes = nvm_vblk_pread(vblk, buf, count, vblk->pos_read);
+	ssize_t nbytes;
+
+	if (vblk->rahead) {
+		size_t nread = 0;
+
+		while (nread < count) {
+			const void *src;
+
+			nbytes = vblk_rahead_get(vblk, &src, count - nread);
+			if (nbytes < 0)
+				return -1;	// Propagate `errno`
+			if (!nbytes)
+				break;		// End of the vblk
+
+			memcpy((char *)buf + nread, src, nbytes);
+			nread += nbytes;
+		}
+
+		return nread;
+	}
 
+	nbytes = nvm_vblk_pread(vblk, buf, count, vblk->pos_read);
 	if (nbytes < 0)
 		return nbytes;		// Propagate `errno`
 
@@ -159,6 +159,122 @@ void test_FMT_GEN_LPO_GEN(void)
 	conv_chunk_addresses(0);	///< gen -> lpo -> gen
 }
 
+#define CONV_NADDRS 67
+
+void test_FMT_GEN_DEV_GEN_N(void)
+{
+	struct nvm_addr addrs[CONV_NADDRS], act[CONV_NADDRS];
+	uint64_t conv[CONV_NADDRS];
+
+	// Device-format bit-patterns masked into valid fields by dev2gen
+	for (int i = 0; i < CONV_NADDRS; ++i)
+		addrs[i] = nvm_addr_dev2gen(DEV, i * 0x9E3779B97F4A7C15ULL);
+
+	nvm_addr_gen2dev_n(DEV, addrs, conv, CONV_NADDRS);
+	nvm_addr_dev2gen_n(DEV, conv, act, CONV_NADDRS);
+
+	for (int i = 0; i < CONV_NADDRS; ++i) {
+		CU_ASSERT_EQUAL(conv[i], nvm_addr_gen2dev(DEV, addrs[i]));
+		CU_ASSERT_EQUAL(act[i].val, addrs[i].val);
+	}
+}
+
+#define PAT_NCHUNKS 3
+
+static void pat_chunks(struct nvm_addr chunks[])
+{
+	for (int i = 0; i < PAT_NCHUNKS; ++i) {
+		chunks[i].val = 0;
+		chunks[i].l.pugrp = i % GEO->l.npugrp;
+		chunks[i].l.punit = (i / GEO->l.npugrp) % GEO->l.npunit;
+		chunks[i].l.chunk = i;
+	}
+}
+
+void test_PAT_HORZ_VERT(void)
+{
+	const size_t WS_OPT = nvm_dev_get_ws_opt(DEV);
+	struct nvm_addr chunks[PAT_NCHUNKS];
+	struct nvm_addr_pat horz, vert;
+	struct nvm_addr addrs[CONV_NADDRS];
+	size_t sectr = 0;
+	int n;
+
+	if (nvm_dev_get_verid(DEV) != NVM_SPEC_VERID_20) {
+		CU_PASS("device is not OCSSD 2.0; skipping test");
+		return;
+	}
+
+	pat_chunks(chunks);
+
+	CU_ASSERT_FATAL(!nvm_addr_pat_horz(&horz, DEV, chunks, PAT_NCHUNKS));
+	while ((n = nvm_addr_pat_next(&horz, addrs, CONV_NADDRS)) > 0) {
+		for (int i = 0; i < n; ++i, ++sectr) {
+			const size_t wunit = sectr / WS_OPT;
+			struct nvm_addr exp = chunks[wunit % PAT_NCHUNKS];
+
+			exp.l.sectr = (wunit / PAT_NCHUNKS) * WS_OPT +
+				      sectr % WS_OPT;
+			CU_ASSERT_EQUAL(addrs[i].val, exp.val);
+		}
+	}
+	CU_ASSERT_EQUAL(sectr, PAT_NCHUNKS * GEO->l.nsectr);
+
+	sectr = 0;
+	CU_ASSERT_FATAL(!nvm_addr_pat_vert(&vert, DEV, chunks, PAT_NCHUNKS));
+	while ((n = nvm_addr_pat_next(&vert, addrs, CONV_NADDRS)) > 0) {
+		for (int i = 0; i < n; ++i, ++sectr) {
+			struct nvm_addr exp = chunks[sectr / GEO->l.nsectr];
+
+			exp.l.sectr = sectr % GEO->l.nsectr;
+			CU_ASSERT_EQUAL(addrs[i].val, exp.val);
+		}
+	}
+	CU_ASSERT_EQUAL(sectr, PAT_NCHUNKS * GEO->l.nsectr);
+}
+
+void test_PAT_STRIDE_RAND(void)
+{
+	struct nvm_addr chunks[PAT_NCHUNKS];
+	struct nvm_addr addrs[CONV_NADDRS], again[CONV_NADDRS];
+	struct nvm_addr_pat pat;
+	size_t idx = 0;
+	int n;
+
+	if (nvm_dev_get_verid(DEV) != NVM_SPEC_VERID_20) {
+		CU_PASS("device is not OCSSD 2.0; skipping test");
+		return;
+	}
+
+	pat_chunks(chunks);
+
+	CU_ASSERT_FATAL(!nvm_addr_pat_stride(&pat, DEV, chunks, PAT_NCHUNKS,
+					     5));
+	while ((n = nvm_addr_pat_next(&pat, addrs, CONV_NADDRS)) > 0) {
+		for (int i = 0; i < n; ++i, ++idx) {
+			const size_t lin = idx * 5;
+			struct nvm_addr exp = chunks[lin / GEO->l.nsectr];
+
+			exp.l.sectr = lin % GEO->l.nsectr;
+			CU_ASSERT_EQUAL(addrs[i].val, exp.val);
+		}
+	}
+
+	CU_ASSERT_FATAL(!nvm_addr_pat_rand(&pat, DEV, chunks, PAT_NCHUNKS,
+					   CONV_NADDRS, 0xBEEF));
+	CU_ASSERT_EQUAL(nvm_addr_pat_next(&pat, addrs, CONV_NADDRS),
+			CONV_NADDRS);
+	CU_ASSERT_EQUAL(nvm_addr_pat_next(&pat, addrs, CONV_NADDRS), 0);
+
+	nvm_addr_pat_rewind(&pat);
+	CU_ASSERT_EQUAL(nvm_addr_pat_next(&pat, again, CONV_NADDRS),
+			CONV_NADDRS);
+	for (int i = 0; i < CONV_NADDRS; ++i) {
+		CU_ASSERT_EQUAL(addrs[i].val, again[i].val);
+		CU_ASSERT(!nvm_addr_check(addrs[i], DEV));
+	}
+}
+
 int main(int argc, char **argv)
 {
 	int err = 0;
@@ -173,8 +289,14 @@ int main(int argc, char **argv)
 		goto out;
 	if (!CU_add_test(pSuite, "fmt gen -> dev -> off -> dev -> gen", test_FMT_GEN_DEV_OFF_DEV_GEN))
 		goto out;
+	if (!CU_add_test(pSuite, "fmt gen -> dev -> gen (bulk)", test_FMT_GEN_DEV_GEN_N))
+		goto out;
 	if (!CU_add_test(pSuite, "fmt gen -> lpo -> gen", test_FMT_GEN_LPO_GEN))
 		goto out;
+	if (!CU_add_test(pSuite, "pat horz and vert", test_PAT_HORZ_VERT))
+		goto out;
+	if (!CU_add_test(pSuite, "pat stride and rand", test_PAT_STRIDE_RAND))
+		goto out;
 
 	switch(RMODE) {
 	case NVM_TEST_RMODE_AUTO:
@@ -33,6 +33,166 @@ static void test_BUF(void) {
 	}
 }
 
+static void test_BUF_VIRT_REALLOC(void) {
+	char *buf = NULL;
+
+	buf = nvm_buf_virt_alloc(PSEUDO_ALIGN, KB);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(buf);
+	memset(buf, 'A', KB);
+
+	for (size_t nbytes = 2 * KB; nbytes <= 4 * MB; nbytes *= 2) {
+		buf = nvm_buf_virt_realloc(buf, PSEUDO_ALIGN, nbytes);
+		CU_ASSERT_PTR_NOT_NULL_FATAL(buf);
+		CU_ASSERT(((uintptr_t)buf % PSEUDO_ALIGN) == 0);
+		CU_ASSERT(buf[0] == 'A' && buf[KB - 1] == 'A');
+	}
+
+	buf = nvm_buf_virt_realloc(buf, 16 * PSEUDO_ALIGN, KB);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(buf);
+	CU_ASSERT(((uintptr_t)buf % (16 * PSEUDO_ALIGN)) == 0);
+	CU_ASSERT(buf[0] == 'A' && buf[KB - 1] == 'A');
+
+	nvm_buf_virt_free(buf);
+}
+
+static void test_BUF_REALLOC(void) {
+	char *buf = NULL;
+
+	buf = nvm_buf_alloc(DEV, KB, NULL);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(buf);
+	memset(buf, 'A', KB);
+
+	for (size_t nbytes = 2 * KB; nbytes <= 128 * MB; nbytes *= 2) {
+		buf = nvm_buf_realloc(DEV, buf, nbytes, NULL);
+		CU_ASSERT_PTR_NOT_NULL_FATAL(buf);
+		CU_ASSERT(buf[0] == 'A' && buf[KB - 1] == 'A');
+	}
+
+	nvm_buf_free(DEV, buf);
+}
+
+static void test_BUF_POOL_TRIM(void) {
+	const int pooled = nvm_dev_get_be_id(DEV) == NVM_BE_IOCTL ||
+			   nvm_dev_get_be_id(DEV) == NVM_BE_LBD;
+	char *bufs[8];
+
+	for (int i = 0; i < 8; ++i) {
+		bufs[i] = nvm_buf_alloc(DEV, 4 * MB, NULL);
+		CU_ASSERT_PTR_NOT_NULL_FATAL(bufs[i]);
+		memset(bufs[i], 'A', 4 * MB);
+	}
+	for (int i = 0; i < 8; ++i)
+		nvm_buf_free(DEV, bufs[i]);
+
+	if (pooled)
+		CU_ASSERT(nvm_buf_pool_trim() >= 8 * 4 * MB);
+
+	bufs[0] = nvm_buf_alloc(DEV, 4 * MB, NULL);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(bufs[0]);
+	memset(bufs[0], 'A', 4 * MB);
+	nvm_buf_free(DEV, bufs[0]);
+}
+
+static void test_BUF_POOL_SLAB(void) {
+	const int pooled = nvm_dev_get_be_id(DEV) == NVM_BE_IOCTL ||
+			   nvm_dev_get_be_id(DEV) == NVM_BE_LBD;
+	uintptr_t windows[9];
+	int nwindows = 0;
+	char *bufs[9];
+
+	if (!pooled) {
+		CU_PASS("Nothing to test");
+		return;
+	}
+
+	// Classes of 4KB up to 1MB share 2MB slabs, taking two at most
+	nvm_buf_pool_trim();
+	for (int i = 0; i < 9; ++i) {
+		uintptr_t window;
+		int found = 0;
+
+		bufs[i] = nvm_buf_alloc(DEV, (4 * KB) << i, NULL);
+		CU_ASSERT_PTR_NOT_NULL_FATAL(bufs[i]);
+
+		window = (uintptr_t)bufs[i] / (2 * MB);
+		for (int j = 0; j < nwindows; ++j)
+			found |= windows[j] == window;
+		if (!found)
+			windows[nwindows++] = window;
+	}
+	CU_ASSERT(nwindows <= 2);
+
+	for (int i = 0; i < 9; ++i)
+		nvm_buf_free(DEV, bufs[i]);
+	CU_ASSERT(nvm_buf_pool_trim() <= 2 * 2 * MB);
+}
+
+static void test_BUF_FILL_DIFF(void) {
+	const size_t nbytes = 64 * MB + 13;
+	char *expected, *actual;
+
+	expected = nvm_buf_alloc(DEV, nbytes, NULL);
+	actual = nvm_buf_alloc(DEV, nbytes, NULL);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(expected);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(actual);
+
+	nvm_buf_fill(expected, nbytes);
+	CU_ASSERT(expected[0] == 'A');
+	CU_ASSERT(expected[nbytes - 1] == (char)('A' + (nbytes - 1) % 26));
+
+	memcpy(actual, expected, nbytes);
+	CU_ASSERT_EQUAL(nvm_buf_diff(expected, actual, nbytes), 0);
+
+	actual[0] ^= 0x1;
+	actual[MB + 7] ^= 0x80;
+	actual[nbytes - 1] ^= 0xFF;
+	CU_ASSERT_EQUAL(nvm_buf_diff(expected, actual, nbytes), 3);
+
+	nvm_buf_free(DEV, expected);
+	nvm_buf_free(DEV, actual);
+}
+
+static void test_BUF_PATTERN(void) {
+	const size_t nbytes = 64 * MB + 13;
+	const uint64_t seed = 0xDEADBEEF;
+	char *buf;
+
+	buf = nvm_buf_alloc(DEV, nbytes, NULL);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(buf);
+
+	nvm_buf_pattern_fill(buf, nbytes, seed, 3);
+	CU_ASSERT_EQUAL(nvm_buf_pattern_diff(buf, nbytes, seed, 3), 0);
+
+	// A sub-range verifies given its offset in the pattern stream
+	CU_ASSERT_EQUAL(nvm_buf_pattern_diff(buf + 101, KB, seed, 104), 0);
+	CU_ASSERT(nvm_buf_pattern_diff(buf, KB, seed + 1, 3) > 0);
+
+	buf[MB + 5] ^= 0x1;
+	CU_ASSERT_EQUAL(nvm_buf_pattern_diff(buf, nbytes, seed, 3), 1);
+
+	nvm_buf_free(DEV, buf);
+}
+
+static void test_BUF_SET_PATTERN(void) {
+	struct nvm_buf_set *bufs = NULL;
+
+	bufs = nvm_buf_set_alloc_pattern(DEV, 4 * MB, 4 * KB, 0x1234);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(bufs);
+	CU_ASSERT_PTR_EQUAL(bufs->read, bufs->write);
+	CU_ASSERT_PTR_EQUAL(bufs->read_meta, bufs->write_meta);
+
+	nvm_buf_set_fill(bufs);
+	CU_ASSERT_EQUAL(nvm_buf_set_diff(bufs), 0);
+
+	bufs->read[42] ^= 0x1;
+	CU_ASSERT_EQUAL(nvm_buf_set_diff(bufs), 1);
+
+	bufs->read_meta[7] ^= 0x1;
+	CU_ASSERT_EQUAL(nvm_buf_set_diff(bufs), 2);
+
+	nvm_buf_set_free(bufs);
+}
+
 static void test_BUF_SET(void) {
 
 	for (size_t i = 0; i < nbsizes; ++i) {
@@ -44,6 +204,28 @@ static void test_BUF_SET(void) {
 	}
 }
 
+static void test_BUF_SET_META_ONLY(void) {
+	struct nvm_buf_set *bufs = NULL;
+
+	// read and write are both NULL, yet it is not a pattern set
+	bufs = nvm_buf_set_alloc(DEV, 0, 4 * KB);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(bufs);
+	CU_ASSERT(!bufs->pattern);
+
+	// The meta read is cleared by the fill, every byte of it differs
+	nvm_buf_set_fill(bufs);
+	CU_ASSERT(memcmp(bufs->write_meta, bufs->read_meta, 4 * KB) != 0);
+	CU_ASSERT_EQUAL(nvm_buf_set_diff(bufs), 4 * KB);
+
+	memcpy(bufs->read_meta, bufs->write_meta, 4 * KB);
+	CU_ASSERT_EQUAL(nvm_buf_set_diff(bufs), 0);
+
+	bufs->read_meta[4 * KB - 1] ^= 0x80;
+	CU_ASSERT_EQUAL(nvm_buf_set_diff(bufs), 1);
+
+	nvm_buf_set_free(bufs);
+}
+
 int main(int argc, char **argv)
 {
 	int err = 0;
@@ -58,9 +240,33 @@ int main(int argc, char **argv)
 	if (!CU_add_test(pSuite, "BUF", test_BUF))
 		goto out;
 
+	if (!CU_add_test(pSuite, "BUF_VIRT_REALLOC", test_BUF_VIRT_REALLOC))
+		goto out;
+
+	if (!CU_add_test(pSuite, "BUF_REALLOC", test_BUF_REALLOC))
+		goto out;
+
+	if (!CU_add_test(pSuite, "BUF_POOL_TRIM", test_BUF_POOL_TRIM))
+		goto out;
+
+	if (!CU_add_test(pSuite, "BUF_POOL_SLAB", test_BUF_POOL_SLAB))
+		goto out;
+
+	if (!CU_add_test(pSuite, "BUF_FILL_DIFF", test_BUF_FILL_DIFF))
+		goto out;
+
+	if (!CU_add_test(pSuite, "BUF_PATTERN", test_BUF_PATTERN))
+		goto out;
+
 	if (!CU_add_test(pSuite, "BUF_SET", test_BUF_SET))
 		goto out;
 
+	if (!CU_add_test(pSuite, "BUF_SET_PATTERN", test_BUF_SET_PATTERN))
+		goto out;
+
+	if (!CU_add_test(pSuite, "BUF_SET_META_ONLY", test_BUF_SET_META_ONLY))
+		goto out;
+
 	switch(RMODE) {
 	case NVM_TEST_RMODE_AUTO:
 		CU_automated_run_tests();
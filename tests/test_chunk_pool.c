@@ -0,0 +1,461 @@
+/**
+ * Tests of the pool of chunks erased in the background, nvm_chunk_pool
+ *
+ * Requires / Depends on:
+ *
+ *  - Nothing, the pool runs on an in-memory backend which reports chunks and
+ *    erases them when the test says so
+ *
+ * Verifies:
+ *
+ *  - Free chunks are handed out, returned chunks are erased before reuse
+ *  - Returned chunks are erased in the background up to the target per PU
+ *  - Gets fail with ENOSPC once the PU has no chunks left
+ *  - Gets wait for a background erase of the last chunk of the PU
+ *  - Erases ahead of need wait for the device to be idle
+ *  - On NVM_BE_SPDK, creation fails when the ASYNC context of the thread
+ *    cannot be initialized, instead of erasing on the qpair of SYNC commands
+ */
+#include <pthread.h>
+#include <unistd.h>
+#include "test_intf.c"
+#include <nvm_dev.h>
+#include <nvm_be.h>
+#include <nvm_chunk_pool.h>
+
+#define NCHUNK 4
+
+static pthread_mutex_t ERASE_LOCK = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ERASE_COND = PTHREAD_COND_INITIALIZER;
+static int NERASES;		///< Erases dispatched
+static int ERASING;		///< Whether an erase is held
+static int HOLD;		///< Hold erases until cleared
+static int FAIL;		///< Fail erases with EIO
+static uint32_t NFREE;		///< Chunks reported as free, from the first
+
+static int fake_vector_erase(struct nvm_dev *NVM_UNUSED(dev),
+			     struct nvm_addr NVM_UNUSED(addrs[]),
+			     int NVM_UNUSED(naddrs), void *NVM_UNUSED(meta),
+			     uint16_t NVM_UNUSED(flags),
+			     struct nvm_ret *NVM_UNUSED(ret))
+{
+	int err;
+
+	pthread_mutex_lock(&ERASE_LOCK);
+	NERASES += 1;
+	ERASING = 1;
+	pthread_cond_broadcast(&ERASE_COND);
+	while (HOLD)
+		pthread_cond_wait(&ERASE_COND, &ERASE_LOCK);
+	ERASING = 0;
+	err = FAIL;
+	pthread_mutex_unlock(&ERASE_LOCK);
+
+	if (err) {
+		errno = EIO;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int fake_vector_read(struct nvm_dev *NVM_UNUSED(dev),
+			    struct nvm_addr *NVM_UNUSED(addrs),
+			    int NVM_UNUSED(naddrs), void *NVM_UNUSED(data),
+			    void *NVM_UNUSED(meta), uint16_t NVM_UNUSED(flags),
+			    struct nvm_ret *NVM_UNUSED(ret))
+{
+	return 0;
+}
+
+static struct nvm_spec_rprt *fake_rprt(struct nvm_dev *dev,
+				       struct nvm_addr *NVM_UNUSED(addr),
+				       int NVM_UNUSED(opt),
+				       struct nvm_ret *NVM_UNUSED(ret))
+{
+	struct nvm_spec_rprt *rprt;
+
+	rprt = nvm_buf_alloc(dev, sizeof(*rprt) + NCHUNK *
+			     sizeof(rprt->descr[0]), NULL);
+	if (!rprt)
+		return NULL;
+
+	memset(rprt, 0, sizeof(*rprt) + NCHUNK * sizeof(rprt->descr[0]));
+	rprt->ndescr = NCHUNK;
+	for (uint32_t i = 0; i < NCHUNK; ++i) {
+		rprt->descr[i].cs = i < NFREE ? NVM_CHUNK_STATE_FREE :
+						NVM_CHUNK_STATE_CLOSED;
+	}
+
+	return rprt;
+}
+
+// Buffers are allocated as on NVM_BE_IOCTL, erases are synchronous
+static struct nvm_be FAKE_BE = {
+	.id = NVM_BE_IOCTL,
+	.name = "FAKE",
+
+	.rprt = fake_rprt,
+	.vector_erase = fake_vector_erase,
+	.vector_read = fake_vector_read,
+};
+
+static struct nvm_async_ctx *fake_async_init(struct nvm_dev *NVM_UNUSED(dev),
+					     uint32_t NVM_UNUSED(depth),
+					     uint16_t NVM_UNUSED(flags))
+{
+	errno = EBUSY;
+	return NULL;
+}
+
+// Out of qpairs for ASYNC contexts
+static struct nvm_be FAKE_BE_SPDK = {
+	.id = NVM_BE_SPDK,
+	.name = "FAKE_SPDK",
+
+	.rprt = fake_rprt,
+	.vector_erase = fake_vector_erase,
+	.vector_read = fake_vector_read,
+	.async_init = fake_async_init,
+};
+
+static struct nvm_dev FAKE_DEV;
+
+static struct nvm_chunk_pool *pool_setup(uint32_t nfree, uint32_t nready,
+					 uint64_t throttle_usec)
+{
+	struct nvm_chunk_pool *pool;
+
+	memset(&FAKE_DEV, 0, sizeof(FAKE_DEV));
+	FAKE_DEV.verid = NVM_SPEC_VERID_20;
+	FAKE_DEV.geo.verid = NVM_SPEC_VERID_20;
+	FAKE_DEV.geo.l.npugrp = 1;
+	FAKE_DEV.geo.l.npunit = 1;
+	FAKE_DEV.geo.l.nchunk = NCHUNK;
+	FAKE_DEV.geo.l.nbytes = 4096;
+	FAKE_DEV.cmd_opts = NVM_CMD_VECTOR;
+	FAKE_DEV.numa_node = -1;
+	FAKE_DEV.be = &FAKE_BE;
+
+	NERASES = 0;
+	ERASING = 0;
+	HOLD = 0;
+	FAIL = 0;
+	NFREE = nfree;
+
+	pool = nvm_chunk_pool_create(&FAKE_DEV, nready);
+	if (!pool) {
+		CU_FAIL("nvm_chunk_pool_create");
+		return NULL;
+	}
+	if (nvm_chunk_pool_set_throttle(pool, throttle_usec)) {
+		CU_FAIL("nvm_chunk_pool_set_throttle");
+		nvm_chunk_pool_destroy(pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
+static uint32_t pool_nready(struct nvm_chunk_pool *pool)
+{
+	uint32_t nready;
+
+	pthread_mutex_lock(&pool->lock);
+	nready = pool->pus[0].nready;
+	pthread_mutex_unlock(&pool->lock);
+
+	return nready;
+}
+
+/**
+ * Wait for up to a second for PU 0 to have 'nready' erased chunks
+ */
+static int pool_wait_nready(struct nvm_chunk_pool *pool, uint32_t nready)
+{
+	for (int i = 0; i < 1000; ++i) {
+		if (pool_nready(pool) == nready)
+			return 0;
+		usleep(1000);
+	}
+
+	return -1;
+}
+
+static int pool_get(struct nvm_chunk_pool *pool, struct nvm_addr *addr)
+{
+	addr->val = 0;
+
+	return nvm_chunk_pool_get(pool, addr);
+}
+
+static int nerases(void)
+{
+	int n;
+
+	pthread_mutex_lock(&ERASE_LOCK);
+	n = NERASES;
+	pthread_mutex_unlock(&ERASE_LOCK);
+
+	return n;
+}
+
+static void test_CHUNK_POOL_GET_PUT(void)
+{
+	struct nvm_chunk_pool *pool = pool_setup(2, 0, 0);
+	struct nvm_addr addrs[2], addr;
+
+	if (!pool)
+		return;
+
+	for (int i = 0; i < 2; ++i) {
+		if (pool_get(pool, &addrs[i])) {
+			CU_FAIL("nvm_chunk_pool_get");
+			goto exit;
+		}
+		CU_ASSERT(addrs[i].l.chunk < 2);
+	}
+	CU_ASSERT_NOT_EQUAL(addrs[0].l.chunk, addrs[1].l.chunk);
+	CU_ASSERT_EQUAL(nerases(), 0);
+
+	// Returned, then erased inline as no chunk is kept ready
+	CU_ASSERT_EQUAL(nvm_chunk_pool_put(pool, addrs[0]), 0);
+	CU_ASSERT_EQUAL(pool_get(pool, &addr), 0);
+	CU_ASSERT_EQUAL(addr.l.chunk, addrs[0].l.chunk);
+	CU_ASSERT_EQUAL(nerases(), 1);
+
+	addr.l.chunk = NCHUNK;
+	CU_ASSERT_EQUAL(nvm_chunk_pool_put(pool, addr), -1);
+	CU_ASSERT_EQUAL(errno, EINVAL);
+
+	addr.val = 0;
+	addr.l.punit = 1;
+	CU_ASSERT_EQUAL(nvm_chunk_pool_get(pool, &addr), -1);
+	CU_ASSERT_EQUAL(errno, EINVAL);
+
+exit:
+	nvm_chunk_pool_destroy(pool);
+}
+
+static void test_CHUNK_POOL_REFILL(void)
+{
+	struct nvm_chunk_pool *pool = pool_setup(0, 2, 0);
+	struct nvm_addr addr = { .val = 0 };
+
+	if (!pool)
+		return;
+
+	for (uint32_t i = 0; i < 3; ++i) {
+		addr.l.chunk = i;
+		if (nvm_chunk_pool_put(pool, addr)) {
+			CU_FAIL("nvm_chunk_pool_put");
+			goto exit;
+		}
+	}
+	if (pool_wait_nready(pool, 2)) {
+		CU_FAIL("pool_wait_nready");
+		goto exit;
+	}
+	usleep(10000);
+	CU_ASSERT_EQUAL(nerases(), 2);	// No more than the target
+
+	// Handed out erased, the thread refills behind it
+	CU_ASSERT_EQUAL(pool_get(pool, &addr), 0);
+	CU_ASSERT_EQUAL(pool_wait_nready(pool, 2), 0);
+	CU_ASSERT_EQUAL(nerases(), 3);
+
+exit:
+	nvm_chunk_pool_destroy(pool);
+}
+
+static void test_CHUNK_POOL_EXHAUSTION(void)
+{
+	struct nvm_chunk_pool *pool = pool_setup(1, 0, 0);
+	struct nvm_addr addr;
+
+	if (!pool)
+		return;
+
+	CU_ASSERT_EQUAL(pool_get(pool, &addr), 0);
+	CU_ASSERT_EQUAL(pool_get(pool, &addr), -1);
+	CU_ASSERT_EQUAL(errno, ENOSPC);
+
+	// A chunk failing its erase is dropped
+	FAIL = 1;
+	addr.l.chunk = 0;
+	CU_ASSERT_EQUAL(nvm_chunk_pool_put(pool, addr), 0);
+	CU_ASSERT_EQUAL(pool_get(pool, &addr), -1);
+	CU_ASSERT_EQUAL(errno, ENOSPC);
+	CU_ASSERT_EQUAL(nerases(), 1);
+	CU_ASSERT_EQUAL(pool->nfailed, 1);
+
+	nvm_chunk_pool_destroy(pool);
+}
+
+struct getter {
+	struct nvm_chunk_pool *pool;
+	struct nvm_addr addr;
+	int err;
+	int done;
+};
+
+static void *getter(void *arg)
+{
+	struct getter *get = arg;
+
+	get->err = pool_get(get->pool, &get->addr);
+	__atomic_store_n(&get->done, 1, __ATOMIC_SEQ_CST);
+
+	return NULL;
+}
+
+static void test_CHUNK_POOL_WAIT_ERASING(void)
+{
+	struct nvm_chunk_pool *pool = pool_setup(0, 1, 0);
+	struct getter get = { .pool = pool };
+	struct nvm_addr addr = { .val = 0 };
+	pthread_t thread;
+
+	if (!pool)
+		return;
+
+	// The last chunk of the PU is held in a background erase
+	HOLD = 1;
+	addr.l.chunk = 2;
+	if (nvm_chunk_pool_put(pool, addr)) {
+		CU_FAIL("nvm_chunk_pool_put");
+		goto exit;
+	}
+	pthread_mutex_lock(&ERASE_LOCK);
+	while (!ERASING)
+		pthread_cond_wait(&ERASE_COND, &ERASE_LOCK);
+	pthread_mutex_unlock(&ERASE_LOCK);
+
+	if (pthread_create(&thread, NULL, getter, &get)) {
+		CU_FAIL("pthread_create");
+		goto exit;
+	}
+	usleep(10000);
+	CU_ASSERT_EQUAL(__atomic_load_n(&get.done, __ATOMIC_SEQ_CST), 0);
+
+	pthread_mutex_lock(&ERASE_LOCK);
+	HOLD = 0;
+	pthread_cond_broadcast(&ERASE_COND);
+	pthread_mutex_unlock(&ERASE_LOCK);
+
+	pthread_join(thread, NULL);
+	CU_ASSERT_EQUAL(get.err, 0);
+	CU_ASSERT_EQUAL(get.addr.l.chunk, 2);
+	CU_ASSERT_EQUAL(nerases(), 1);
+
+exit:
+	pthread_mutex_lock(&ERASE_LOCK);
+	HOLD = 0;
+	pthread_cond_broadcast(&ERASE_COND);
+	pthread_mutex_unlock(&ERASE_LOCK);
+	nvm_chunk_pool_destroy(pool);
+}
+
+static void test_CHUNK_POOL_IDLE(void)
+{
+	struct nvm_chunk_pool *pool = pool_setup(1, 2, 20000);
+	struct nvm_addr addr = { .val = 0 };
+
+	if (!pool)
+		return;
+
+	addr.l.chunk = 3;
+	if (nvm_chunk_pool_put(pool, addr)) {
+		CU_FAIL("nvm_chunk_pool_put");
+		goto exit;
+	}
+
+	// The PU has an erased chunk, nothing is erased while reads go on
+	for (int i = 0; i < 100; ++i) {
+		struct nvm_addr raddr = { .val = 0 };
+
+		if (nvm_cmd_read(&FAKE_DEV, &raddr, 1, NULL, NULL, 0x0,
+				 NULL)) {
+			CU_FAIL("nvm_cmd_read");
+			goto exit;
+		}
+		usleep(1000);
+	}
+	CU_ASSERT_EQUAL(nerases(), 0);
+
+	// Then it is, once the device is left idle
+	CU_ASSERT_EQUAL(pool_wait_nready(pool, 2), 0);
+	CU_ASSERT_EQUAL(nerases(), 1);
+
+exit:
+	nvm_chunk_pool_destroy(pool);
+}
+
+static void test_CHUNK_POOL_SPDK_CTX(void)
+{
+	struct nvm_chunk_pool *pool = pool_setup(NCHUNK, 1, 0);
+
+	if (!pool)
+		return;
+	nvm_chunk_pool_destroy(pool);
+
+	FAKE_DEV.be = &FAKE_BE_SPDK;
+	errno = 0;
+
+	pool = nvm_chunk_pool_create(&FAKE_DEV, 1);
+	CU_ASSERT_PTR_NULL(pool);
+	CU_ASSERT_EQUAL(errno, EBUSY);
+
+	nvm_chunk_pool_destroy(pool);
+}
+
+int main(int argc, char **argv)
+{
+	int err = 0;
+
+	CU_pSuite pSuite = suite_create("nvm_chunk_pool", argc, argv, 1);
+	if (!pSuite)
+		goto out;
+
+	if (!CU_add_test(pSuite, "CHUNK_POOL_GET_PUT", test_CHUNK_POOL_GET_PUT))
+		goto out;
+
+	if (!CU_add_test(pSuite, "CHUNK_POOL_REFILL", test_CHUNK_POOL_REFILL))
+		goto out;
+
+	if (!CU_add_test(pSuite, "CHUNK_POOL_EXHAUSTION",
+			 test_CHUNK_POOL_EXHAUSTION))
+		goto out;
+
+	if (!CU_add_test(pSuite, "CHUNK_POOL_WAIT_ERASING",
+			 test_CHUNK_POOL_WAIT_ERASING))
+		goto out;
+
+	if (!CU_add_test(pSuite, "CHUNK_POOL_IDLE", test_CHUNK_POOL_IDLE))
+		goto out;
+
+	if (!CU_add_test(pSuite, "CHUNK_POOL_SPDK_CTX",
+			 test_CHUNK_POOL_SPDK_CTX))
+		goto out;
+
+	switch(RMODE) {
+	case NVM_TEST_RMODE_AUTO:
+		CU_automated_run_tests();
+		break;
+
+	default:
+		CU_basic_set_mode(RMODE);
+		CU_basic_run_tests();
+		break;
+	}
+
+out:
+	err = CU_get_error() || \
+	      CU_get_number_of_suites_failed() || \
+	      CU_get_number_of_tests_failed() || \
+	      CU_get_number_of_failures();
+
+	CU_cleanup_registry();
+
+	return err;
+}
@@ -0,0 +1,110 @@
+/**
+ * Tests of the control word encoded in commands
+ *
+ * Requires / Depends on:
+ *
+ *  - Nothing, commands are set up on an in-memory device and never submitted
+ *
+ * Verifies:
+ *
+ *  - Options in NVM_CMD_MASK_LIB, e.g. NVM_CMD_PRIO_HIGH which shares its bit
+ *    with FUA, never reach the control word
+ *  - Plane-mode flags are encoded as given
+ */
+#include "test_intf.c"
+#include <nvm_dev.h>
+#include <nvm_be.h>
+#include <nvm_cmd.h>
+
+static struct nvm_be FAKE_BE = {
+	.id = NVM_BE_IOCTL,
+	.name = "FAKE",
+};
+
+static struct nvm_dev FAKE_DEV;
+
+static void fake_dev_setup(void)
+{
+	memset(&FAKE_DEV, 0, sizeof(FAKE_DEV));
+	FAKE_DEV.verid = NVM_SPEC_VERID_12;
+	FAKE_DEV.geo.verid = NVM_SPEC_VERID_12;
+	FAKE_DEV.geo.g.sector_nbytes = 4096;
+	FAKE_DEV.geo.g.meta_nbytes = 16;
+	FAKE_DEV.numa_node = -1;
+	FAKE_DEV.be = &FAKE_BE;
+}
+
+static uint16_t s12_control(int flags)
+{
+	struct nvm_addr addr = { .val = 0 };
+	struct nvm_ret ret = { 0 };
+	struct nvm_cmd_wrap *wrap;
+	uint16_t control;
+
+	fake_dev_setup();
+
+	wrap = nvm_cmd_wrap_setup(&FAKE_DEV, NVM_DOPC_VECTOR_READ, NULL, NULL,
+				  &addr, NULL, 1, flags | NVM_CMD_ADDR_DEV,
+				  &ret);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(wrap);
+
+	control = wrap->cmd.s12.control;
+	nvm_cmd_wrap_term(wrap);
+
+	return control;
+}
+
+static void test_CMD_CONTROL_S12(void)
+{
+	const int pmode = NVM_FLAG_PMODE_QUAD;
+
+	CU_ASSERT_EQUAL(s12_control(0), 0);
+	CU_ASSERT_EQUAL(s12_control(pmode), pmode);
+	CU_ASSERT_EQUAL(s12_control(NVM_CMD_PRIO_HIGH), 0);
+	CU_ASSERT_EQUAL(s12_control(pmode | NVM_CMD_PRIO_HIGH), pmode);
+}
+
+static void test_CMD_CONTROL_MASK_LIB(void)
+{
+	CU_ASSERT_EQUAL(nvm_cmd_control(NVM_CMD_MASK_LIB), 0);
+	CU_ASSERT_EQUAL(nvm_cmd_control(NVM_CMD_PRIO_HIGH) & (0x1 << 14), 0);
+	CU_ASSERT_EQUAL(nvm_cmd_control(NVM_CMD_ADDR_DEV | NVM_FLAG_SCRBL),
+			NVM_FLAG_SCRBL);
+}
+
+int main(int argc, char **argv)
+{
+	int err = 0;
+
+	CU_pSuite pSuite = suite_create("nvm_cmd_control", argc, argv, 1);
+	if (!pSuite)
+		goto out;
+
+	if (!CU_add_test(pSuite, "CMD_CONTROL_S12", test_CMD_CONTROL_S12))
+		goto out;
+
+	if (!CU_add_test(pSuite, "CMD_CONTROL_MASK_LIB",
+			 test_CMD_CONTROL_MASK_LIB))
+		goto out;
+
+	switch(RMODE) {
+	case NVM_TEST_RMODE_AUTO:
+		CU_automated_run_tests();
+		break;
+
+	default:
+		CU_basic_set_mode(RMODE);
+		CU_basic_run_tests();
+		break;
+	}
+
+out:
+	err = CU_get_error() || \
+	      CU_get_number_of_suites_failed() || \
+	      CU_get_number_of_tests_failed() || \
+	      CU_get_number_of_failures();
+
+	CU_cleanup_registry();
+
+	return err;
+}
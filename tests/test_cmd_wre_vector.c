@@ -633,6 +633,217 @@ void test_EWR_S20_RWMETA1_EMETA1(void)
 	}
 }
 
+/**
+ * Write all of the chunk, 'buf' holds WS_MIN sectors written over and over,
+ * such that none of them are held back by the device, see mw_cunits
+ */
+static int rcache_write_chunk(struct nvm_addr chunk_addr, char *buf)
+{
+	const int naddrs = nvm_dev_get_ws_min(DEV);
+	struct nvm_addr addrs[naddrs];
+	struct nvm_ret ret;
+
+	for (size_t sectr = 0; sectr < GEO->l.nsectr; sectr += naddrs) {
+		for (int i = 0; i < naddrs; ++i) {
+			addrs[i].val = chunk_addr.val;
+			addrs[i].l.sectr = sectr + i;
+		}
+		if (nvm_cmd_write(DEV, addrs, naddrs, buf, NULL, 0x0, &ret))
+			return -1;
+	}
+
+	return 0;
+}
+
+void test_RCACHE_S20(void)
+{
+	const int naddrs = nvm_dev_get_ws_min(DEV);
+	struct nvm_addr addrs[naddrs];
+	struct nvm_buf_set *bufs = NULL;
+	struct nvm_rcache_stats stats = { 0 };
+	struct nvm_addr chunk_addr = { .val = 0 };
+	struct nvm_ret ret;
+
+	if (nvm_dev_get_verid(DEV) != NVM_SPEC_VERID_20) {
+		CU_PASS("Nothing to test");
+		return;
+	}
+
+	if (nvm_cmd_rprt_arbs(DEV, NVM_CHUNK_STATE_FREE, 1, &chunk_addr)) {
+		CU_FAIL("nvm_cmd_rprt_arbs");
+		return;
+	}
+	for (int i = 0; i < naddrs; ++i) {
+		addrs[i].val = chunk_addr.val;
+		addrs[i].l.sectr = i;
+	}
+
+	bufs = nvm_buf_set_alloc(DEV, naddrs * GEO->l.nbytes, 0);
+	if (!bufs) {
+		CU_FAIL("nvm_buf_set_alloc");
+		goto out;
+	}
+	nvm_buf_set_fill(bufs);
+
+	if (nvm_dev_set_rcache(DEV, 1 << 22, NVM_RCACHE_S3FIFO)) {
+		CU_FAIL("nvm_dev_set_rcache");
+		goto out;
+	}
+
+	// Written, its head read from the device, then from the cache
+	if (rcache_write_chunk(chunk_addr, bufs->write)) {
+		CU_FAIL("Write failure");
+		goto out;
+	}
+	for (int rd = 0; rd < 2; ++rd) {
+		memset(bufs->read, 0, bufs->nbytes);
+		if (nvm_cmd_read(DEV, addrs, naddrs, bufs->read, NULL,
+				 NVM_CMD_SYNC, &ret)) {
+			CU_FAIL("Read failure");
+			goto out;
+		}
+		if (nvm_buf_diff(bufs->read, bufs->write, bufs->nbytes)) {
+			CU_FAIL("Read failure: buffer mismatch");
+			goto out;
+		}
+	}
+	if (nvm_dev_get_rcache_stats(DEV, &stats) || stats.nhits != 1) {
+		CU_FAIL("Read was not served by the cache");
+		goto out;
+	}
+
+	// Erased and rewritten, the cached sectors must not be served
+	if (nvm_cmd_erase(DEV, &chunk_addr, 1, NULL, 0x0, &ret)) {
+		CU_FAIL("Erase failure");
+		goto out;
+	}
+	memset(bufs->write, 'x', bufs->nbytes);
+	if (rcache_write_chunk(chunk_addr, bufs->write)) {
+		CU_FAIL("Write failure");
+		goto out;
+	}
+	if (nvm_cmd_read(DEV, addrs, naddrs, bufs->read, NULL, NVM_CMD_SYNC,
+			 &ret)) {
+		CU_FAIL("Read failure");
+		goto out;
+	}
+	if (nvm_buf_diff(bufs->read, bufs->write, bufs->nbytes)) {
+		CU_FAIL("Read failure: stale sectors from the cache");
+		goto out;
+	}
+
+	if (nvm_cmd_erase(DEV, &chunk_addr, 1, NULL, 0x0, &ret))
+		CU_FAIL("Erase failure");
+
+out:
+	nvm_dev_set_rcache(DEV, 0, NVM_RCACHE_CLOCK);
+	nvm_buf_set_free(bufs);
+}
+
+/**
+ * A read done while an ASYNC write is in flight may see sectors the write is
+ * changing, it must not fill the cache. The write goes to a second chunk, as
+ * the sectors read must be readable, and fills resume once it has completed
+ */
+void test_RCACHE_S20_ASYNC_WR(void)
+{
+	const int naddrs = nvm_dev_get_ws_min(DEV);
+	struct nvm_addr addrs[naddrs], wr_addrs[naddrs];
+	struct nvm_buf_set *bufs = NULL;
+	struct nvm_async_ctx *ctx = NULL;
+	struct nvm_rcache_stats stats = { 0 };
+	struct nvm_addr chunk_addrs[2] = { { .val = 0 } };
+	struct nvm_ret ret, aret;
+	uint64_t ninserts;
+
+	if (nvm_dev_get_verid(DEV) != NVM_SPEC_VERID_20) {
+		CU_PASS("Nothing to test");
+		return;
+	}
+
+	if (nvm_cmd_rprt_arbs(DEV, NVM_CHUNK_STATE_FREE, 2, chunk_addrs)) {
+		CU_FAIL("nvm_cmd_rprt_arbs");
+		return;
+	}
+	for (int i = 0; i < naddrs; ++i) {
+		addrs[i].val = chunk_addrs[0].val;
+		addrs[i].l.sectr = i;
+		wr_addrs[i].val = chunk_addrs[1].val;
+		wr_addrs[i].l.sectr = i;
+	}
+
+	ctx = nvm_async_init(DEV, 1, 0x0);
+	if (!ctx) {
+		CU_PASS("ASYNC not supported by backend");
+		return;
+	}
+
+	bufs = nvm_buf_set_alloc(DEV, naddrs * GEO->l.nbytes, 0);
+	if (!bufs) {
+		CU_FAIL("nvm_buf_set_alloc");
+		goto out;
+	}
+	nvm_buf_set_fill(bufs);
+
+	if (rcache_write_chunk(chunk_addrs[0], bufs->write)) {
+		CU_FAIL("Write failure");
+		goto out;
+	}
+	if (nvm_dev_set_rcache(DEV, 1 << 22, NVM_RCACHE_CLOCK)) {
+		CU_FAIL("nvm_dev_set_rcache");
+		goto out;
+	}
+
+	// Read the head of the first chunk while the write is in flight
+	memset(&aret, 0, sizeof(aret));
+	aret.async.ctx = ctx;
+	if (nvm_cmd_write(DEV, wr_addrs, naddrs, bufs->write, NULL,
+			  NVM_CMD_ASYNC, &aret)) {
+		CU_FAIL("Write failure");
+		goto out;
+	}
+	if (nvm_cmd_read(DEV, addrs, naddrs, bufs->read, NULL, NVM_CMD_SYNC,
+			 &ret)) {
+		CU_FAIL("Read failure");
+		goto out;
+	}
+	if (nvm_async_wait(DEV, ctx) < 0 || aret.status) {
+		CU_FAIL("nvm_async_wait");
+		goto out;
+	}
+	if (nvm_buf_diff(bufs->read, bufs->write, bufs->nbytes)) {
+		CU_FAIL("Read failure: buffer mismatch");
+		goto out;
+	}
+	if (nvm_dev_get_rcache_stats(DEV, &stats) || stats.ninserts) {
+		CU_FAIL("Read during the write filled the cache");
+		goto out;
+	}
+	ninserts = stats.ninserts;
+
+	// With the write done, the same read fills the cache
+	if (nvm_cmd_read(DEV, addrs, naddrs, bufs->read, NULL, NVM_CMD_SYNC,
+			 &ret)) {
+		CU_FAIL("Read failure");
+		goto out;
+	}
+	if (nvm_dev_get_rcache_stats(DEV, &stats) ||
+	    stats.ninserts != ninserts + naddrs) {
+		CU_FAIL("Read after the write did not fill the cache");
+		goto out;
+	}
+
+	for (int i = 0; i < 2; ++i) {
+		if (nvm_cmd_erase(DEV, &chunk_addrs[i], 1, NULL, 0x0, &ret))
+			CU_FAIL("Erase failure");
+	}
+
+out:
+	nvm_dev_set_rcache(DEV, 0, NVM_RCACHE_CLOCK);
+	nvm_buf_set_free(bufs);
+	nvm_async_term(DEV, ctx);
+}
+
 int main(int argc, char **argv)
 {
 	int err = 0;
@@ -650,6 +861,11 @@ int main(int argc, char **argv)
 		goto out;
 	if (!CU_add_test(pSuite, "EWR_S20_RWMETA1_EMETA1", test_EWR_S20_RWMETA1_EMETA1))
 		goto out;
+	if (!CU_add_test(pSuite, "RCACHE_S20", test_RCACHE_S20))
+		goto out;
+	if (!CU_add_test(pSuite, "RCACHE_S20_ASYNC_WR",
+			 test_RCACHE_S20_ASYNC_WR))
+		goto out;
 
 	if (!CU_add_test(pSuite, "EWR S12 - META NADDR QUAD", test_EWR_S12_NADDR_META0_QUAD))
 		goto out;
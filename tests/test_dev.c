@@ -47,6 +47,25 @@ void test_DEV_OPEN_CLOSE_MULTI_N(void)
 	}
 }
 
+// Verify that NUMA binding is opt-in and validated
+void test_DEV_NUMA_BIND(void)
+{
+	struct nvm_dev *dev;
+
+	dev = nvm_dev_open(NVM_DEV_PATH);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(dev);
+
+	CU_ASSERT_EQUAL(nvm_dev_get_numa_bind(dev), 0);
+	CU_ASSERT_EQUAL(nvm_dev_set_numa_bind(dev, 1), 0);
+	CU_ASSERT_EQUAL(nvm_dev_get_numa_bind(dev), 1);
+	CU_ASSERT_EQUAL(nvm_dev_set_numa_bind(dev, 2), -1);
+	CU_ASSERT_EQUAL(errno, EINVAL);
+	CU_ASSERT_EQUAL(nvm_dev_set_numa_bind(dev, 0), 0);
+	CU_ASSERT_EQUAL(nvm_dev_get_numa_bind(dev), 0);
+
+	nvm_dev_close(dev);
+}
+
 int main(int argc, char **argv)
 {
 	int err = 0;
@@ -61,6 +80,8 @@ int main(int argc, char **argv)
 		goto out;
 	if (!CU_add_test(pSuite, "nvm_dev_[open|close] multi-n", test_DEV_OPEN_CLOSE_MULTI_N))
 		goto out;
+	if (!CU_add_test(pSuite, "nvm_dev_[get|set]_numa_bind", test_DEV_NUMA_BIND))
+		goto out;
 
 	switch(RMODE) {
 	case NVM_TEST_RMODE_AUTO:
@@ -0,0 +1,220 @@
+/**
+ * Minimal test of nvm_ftl
+ *
+ * Requires / Depends on:
+ *
+ *  - That the device may be formatted, its contents are dropped
+ *  - nvm_buf
+ *
+ * Verifies:
+ *
+ *  - Blocks read back as written, whether staged or on the device
+ *  - Trimmed blocks read as zeros
+ *  - Blocks read back as written after closing and recovering the FTL
+ *  - Blocks flushed after the last checkpoint read back as written after
+ *    recovering from a process exiting without closing the FTL
+ */
+#include <sys/wait.h>
+#include <unistd.h>
+#include "test_intf.c"
+
+static int ftl_verify(struct nvm_ftl *ftl, struct nvm_buf_set *bufs,
+		      uint64_t nlbas)
+{
+	memset(bufs->read, 0, bufs->nbytes);
+	if (nvm_ftl_read(ftl, 0, nlbas, bufs->read)) {
+		CU_FAIL("nvm_ftl_read");
+		return -1;
+	}
+	if (nvm_buf_diff(bufs->read, bufs->write, bufs->nbytes)) {
+		CU_FAIL("buffer mismatch");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void test_FTL_WR_RECOVER(void)
+{
+	const uint32_t nlbas = 4 * nvm_dev_get_ws_opt(DEV) *
+			       GEO->l.npugrp * GEO->l.npunit + 1;
+	const uint32_t ntrim = nvm_dev_get_ws_opt(DEV);
+	struct nvm_buf_set *bufs = NULL;
+	struct nvm_ftl *ftl = NULL;
+
+	if (nvm_dev_get_verid(DEV) != NVM_SPEC_VERID_20) {
+		CU_PASS("Nothing to test");
+		return;
+	}
+
+	bufs = nvm_buf_set_alloc(DEV, nlbas * GEO->l.nbytes, 0);
+	if (!bufs) {
+		CU_FAIL("nvm_buf_set_alloc");
+		return;
+	}
+	nvm_buf_set_fill(bufs);
+
+	ftl = nvm_ftl_open(DEV, NVM_FTL_FORMAT);
+	if (!ftl) {
+		CU_FAIL("nvm_ftl_open");
+		goto exit;
+	}
+	if (nvm_ftl_get_nlbas(ftl) < nlbas) {
+		CU_FAIL("nvm_ftl_get_nlbas: too small");
+		goto exit;
+	}
+
+	// Partially staged, then all of it on the device
+	if (nvm_ftl_write(ftl, 0, nlbas, bufs->write)) {
+		CU_FAIL("nvm_ftl_write");
+		goto exit;
+	}
+	if (ftl_verify(ftl, bufs, nlbas))
+		goto exit;
+	if (nvm_ftl_flush(ftl)) {
+		CU_FAIL("nvm_ftl_flush");
+		goto exit;
+	}
+	if (ftl_verify(ftl, bufs, nlbas))
+		goto exit;
+
+	if (nvm_ftl_trim(ftl, 0, ntrim)) {
+		CU_FAIL("nvm_ftl_trim");
+		goto exit;
+	}
+	memset(bufs->write, 0, ntrim * GEO->l.nbytes);
+	if (ftl_verify(ftl, bufs, nlbas))
+		goto exit;
+
+	if (nvm_ftl_close(ftl)) {
+		ftl = NULL;
+		CU_FAIL("nvm_ftl_close");
+		goto exit;
+	}
+
+	ftl = nvm_ftl_open(DEV, 0x0);
+	if (!ftl) {
+		CU_FAIL("nvm_ftl_open: recovery");
+		goto exit;
+	}
+	if (ftl_verify(ftl, bufs, nlbas))
+		goto exit;
+
+	CU_PASS("Success");
+
+exit:
+	if (ftl && nvm_ftl_close(ftl))
+		CU_FAIL("nvm_ftl_close");
+	nvm_buf_set_free(bufs);
+}
+
+/**
+ * Format, write and flush in a child exiting without a checkpoint, then
+ * recover by rolling forward from OOB
+ */
+static void test_FTL_WR_RFWD(void)
+{
+	const uint32_t nlbas = 2 * nvm_dev_get_ws_opt(DEV) *
+			       GEO->l.npugrp * GEO->l.npunit + 1;
+	struct nvm_buf_set *bufs = NULL;
+	struct nvm_ftl *ftl = NULL;
+	int status;
+	pid_t pid;
+
+	if (nvm_dev_get_verid(DEV) != NVM_SPEC_VERID_20) {
+		CU_PASS("Nothing to test");
+		return;
+	}
+	if (GEO->l.nbytes_oob < 2 * sizeof(uint32_t)) {
+		CU_PASS("Nothing to test: no OOB to roll forward from");
+		return;
+	}
+
+	// The child shares the device handle, which only these backends allow
+	switch (nvm_dev_get_be_id(DEV)) {
+	case NVM_BE_IOCTL:
+	case NVM_BE_LBD:
+		break;
+
+	default:
+		CU_PASS("Nothing to test: backend does not survive fork");
+		return;
+	}
+
+	bufs = nvm_buf_set_alloc(DEV, nlbas * GEO->l.nbytes, 0);
+	if (!bufs) {
+		CU_FAIL("nvm_buf_set_alloc");
+		return;
+	}
+	nvm_buf_set_fill(bufs);
+
+	pid = fork();
+	if (pid < 0) {
+		CU_FAIL("fork");
+		goto exit;
+	}
+	if (!pid) {
+		// Only the checkpoint of the format is on the device on exit
+		ftl = nvm_ftl_open(DEV, NVM_FTL_FORMAT);
+		if (!ftl || nvm_ftl_get_nlbas(ftl) < nlbas ||
+		    nvm_ftl_write(ftl, 0, nlbas, bufs->write) ||
+		    nvm_ftl_flush(ftl))
+			_exit(1);
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+	    WEXITSTATUS(status)) {
+		CU_FAIL("child: nvm_ftl_open, nvm_ftl_write or nvm_ftl_flush");
+		goto exit;
+	}
+
+	ftl = nvm_ftl_open(DEV, 0x0);
+	if (!ftl) {
+		CU_FAIL("nvm_ftl_open: recovery");
+		goto exit;
+	}
+	if (ftl_verify(ftl, bufs, nlbas))
+		goto exit;
+
+	CU_PASS("Success");
+
+exit:
+	if (ftl && nvm_ftl_close(ftl))
+		CU_FAIL("nvm_ftl_close");
+	nvm_buf_set_free(bufs);
+}
+
+int main(int argc, char **argv)
+{
+	int err = 0;
+
+	CU_pSuite pSuite = suite_create("nvm_ftl", argc, argv, 0);
+	if (!pSuite)
+		goto out;
+
+	if (!CU_ADD_TEST(pSuite, test_FTL_WR_RECOVER))
+		goto out;
+	if (!CU_ADD_TEST(pSuite, test_FTL_WR_RFWD))
+		goto out;
+
+	switch(RMODE) {
+	case NVM_TEST_RMODE_AUTO:
+		CU_automated_run_tests();
+		break;
+
+	default:
+		CU_basic_set_mode(RMODE);
+		CU_basic_run_tests();
+		break;
+	}
+
+out:
+	err = CU_get_error() || \
+	      CU_get_number_of_suites_failed() || \
+	      CU_get_number_of_tests_failed() || \
+	      CU_get_number_of_failures();
+
+	CU_cleanup_registry();
+
+	return err;
+}
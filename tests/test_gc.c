@@ -0,0 +1,183 @@
+/**
+ * Minimal test of nvm_gc
+ *
+ * Requires / Depends on:
+ *
+ *  - That the device has two free chunks
+ *  - nvm_cmd_rprt_arbs
+ *  - nvm_cmd_write
+ *  - nvm_cmd_read
+ *  - nvm_buf
+ *
+ * Verifies:
+ *
+ *  - The chunk set is picked with its valid sectors, less the invalidated one
+ *  - Moves are refused when the budget is exhausted, unless urgent
+ *  - Valid sectors read back as written after a move, by vector copy or by
+ *    read and write depending on the backend
+ *
+ * The source chunk is written with a constructed payload, every other sector
+ * marked valid, and its valid sectors moved to the destination chunk which is
+ * padded to its end
+ */
+#include "test_intf.c"
+
+#define SRC 0
+#define DST 1
+#define NCHUNKS 2
+
+static void test_GC_PICK_MOVE(void)
+{
+	const size_t io_nsectr = nvm_dev_get_ws_opt(DEV);
+	const size_t nwords = (GEO->l.nsectr + 63) / 64;
+	size_t bufs_nbytes = GEO->l.nsectr * GEO->l.nbytes;
+	struct nvm_buf_set *bufs = NULL;
+	struct nvm_addr chunks[NCHUNKS];
+	struct nvm_addr *src = NULL, *dst = NULL;
+	uint64_t *bitmap = NULL;
+	struct nvm_gc *gc = NULL;
+	struct nvm_addr victim;
+	int nvalid;
+
+	if (nvm_dev_get_verid(DEV) != NVM_SPEC_VERID_20) {
+		CU_PASS("Nothing to test");
+		return;
+	}
+
+	if (nvm_cmd_rprt_arbs(DEV, NVM_CHUNK_STATE_FREE, NCHUNKS, chunks)) {
+		CU_FAIL("nvm_cmd_rprt_arbs");
+		return;
+	}
+
+	bufs = nvm_buf_set_alloc(DEV, bufs_nbytes, 0);
+	src = calloc(GEO->l.nsectr, sizeof(*src));
+	dst = calloc(GEO->l.nsectr, sizeof(*dst));
+	bitmap = calloc(nwords, sizeof(*bitmap));
+	if (!bufs || !src || !dst || !bitmap) {
+		CU_FAIL("allocation");
+		goto exit;
+	}
+	nvm_buf_set_fill(bufs);
+
+	for (size_t sectr = 0; sectr < GEO->l.nsectr; sectr += io_nsectr) {
+		const size_t buf_ofz = sectr * GEO->l.nbytes;
+		struct nvm_addr addrs[io_nsectr];
+
+		for (size_t idx = 0; idx < io_nsectr; ++idx) {
+			addrs[idx] = chunks[SRC];
+			addrs[idx].l.sectr = sectr + idx;
+		}
+
+		if (nvm_cmd_write(DEV, addrs, io_nsectr, bufs->write + buf_ofz,
+				  NULL, 0x0, NULL)) {
+			CU_FAIL("nvm_cmd_write");
+			goto exit;
+		}
+	}
+
+	gc = nvm_gc_create(DEV, NVM_GC_COST_BENEFIT);
+	if (!gc) {
+		CU_FAIL("nvm_gc_create");
+		goto exit;
+	}
+
+	for (size_t sectr = 0; sectr < GEO->l.nsectr; sectr += 2)
+		bitmap[sectr / 64] |= 1ULL << (sectr % 64);
+	if (nvm_gc_set_chunk(gc, chunks[SRC], bitmap)) {
+		CU_FAIL("nvm_gc_set_chunk");
+		goto exit;
+	}
+	if (nvm_gc_invalidate(gc, chunks[SRC])) {	// Sector zero
+		CU_FAIL("nvm_gc_invalidate");
+		goto exit;
+	}
+
+	nvalid = nvm_gc_pick(gc, GEO->l.nsectr, &victim);
+	if (nvalid != (int)(GEO->l.nsectr + 1) / 2 - 1 ||
+	    victim.val != chunks[SRC].val) {
+		CU_FAIL("nvm_gc_pick");
+		goto exit;
+	}
+	if (nvm_gc_get_valid(gc, victim, src) != nvalid) {
+		CU_FAIL("nvm_gc_get_valid");
+		goto exit;
+	}
+
+	for (size_t sectr = 0; sectr < GEO->l.nsectr; ++sectr) {
+		dst[sectr] = chunks[DST];
+		dst[sectr].l.sectr = sectr;
+	}
+
+	nvm_gc_set_budget(gc, 1);
+	if (!nvm_gc_move(gc, src, nvalid, dst, GEO->l.nsectr, 0x0) ||
+	    errno != EAGAIN) {
+		CU_FAIL("nvm_gc_move: not throttled");
+		goto exit;
+	}
+	if (nvm_gc_move(gc, src, nvalid, dst, GEO->l.nsectr, NVM_GC_URGENT)) {
+		CU_FAIL("nvm_gc_move");
+		goto exit;
+	}
+
+	for (size_t sectr = 0; sectr < GEO->l.nsectr; sectr += io_nsectr) {
+		const size_t buf_ofz = sectr * GEO->l.nbytes;
+
+		if (nvm_cmd_read(DEV, dst + sectr, io_nsectr,
+				 bufs->read + buf_ofz, NULL, 0x0, NULL)) {
+			CU_FAIL("nvm_cmd_read");
+			goto exit;
+		}
+	}
+
+	for (int idx = 0; idx < nvalid; ++idx) {
+		const size_t ofz = src[idx].l.sectr * GEO->l.nbytes;
+
+		if (nvm_buf_diff(bufs->read + idx * GEO->l.nbytes,
+				 bufs->write + ofz, GEO->l.nbytes)) {
+			CU_FAIL("buffer mismatch");
+			goto exit;
+		}
+	}
+
+	CU_PASS("Success");
+
+exit:
+	nvm_gc_destroy(gc);
+	free(bitmap);
+	free(dst);
+	free(src);
+	nvm_buf_set_free(bufs);
+}
+
+int main(int argc, char **argv)
+{
+	int err = 0;
+
+	CU_pSuite pSuite = suite_create("nvm_gc", argc, argv, 0);
+	if (!pSuite)
+		goto out;
+
+	if (!CU_ADD_TEST(pSuite, test_GC_PICK_MOVE))
+		goto out;
+
+	switch(RMODE) {
+	case NVM_TEST_RMODE_AUTO:
+		CU_automated_run_tests();
+		break;
+
+	default:
+		CU_basic_set_mode(RMODE);
+		CU_basic_run_tests();
+		break;
+	}
+
+out:
+	err = CU_get_error() || \
+	      CU_get_number_of_suites_failed() || \
+	      CU_get_number_of_tests_failed() || \
+	      CU_get_number_of_failures();
+
+	CU_cleanup_registry();
+
+	return err;
+}
@@ -0,0 +1,480 @@
+/**
+ * Tests of the PU-aware scheduler of ASYNC contexts created with
+ * NVM_ASYNC_SCHED
+ *
+ * Requires / Depends on:
+ *
+ *  - Nothing, commands are dispatched to an in-memory backend which records
+ *    them and completes them when the test says so
+ *
+ * Verifies:
+ *
+ *  - In-flight commands per PU are bounded by nvm_async_set_pu_depth
+ *  - In-flight writes per PU are bounded by nvm_async_set_pu_depth_wr
+ *  - High-priority commands are dispatched before queued normal ones
+ *  - A normal command waits for no more than NVM_SCHED_HIGH_BURST
+ *    high-priority dispatches, also when those would be dispatched on submit
+ *  - Commands failing dispatch from the queue complete as aborted
+ *  - Queued commands are cancelled by nvm_async_cancel
+ */
+#include "test_intf.c"
+#include <nvm_dev.h>
+#include <nvm_be.h>
+#include <nvm_async.h>
+#include <nvm_sched.h>
+
+#define NCMDS 32
+
+static struct nvm_ret *DISPATCHED[NCMDS];	///< In dispatch order
+static int NDISPATCHED;
+static struct nvm_ret *COMPLETED[NCMDS];	///< In completion order
+static int NCOMPLETED;
+static int FAIL;				///< Fail dispatches with EIO
+
+static int fake_submit(struct nvm_ret *ret)
+{
+	if (FAIL) {
+		errno = EIO;
+		return -1;
+	}
+
+	ret->async.ctx->outstanding += 1;
+	DISPATCHED[NDISPATCHED++] = ret;
+
+	return 0;
+}
+
+static int fake_vector_erase(struct nvm_dev *NVM_UNUSED(dev),
+			     struct nvm_addr NVM_UNUSED(addrs[]),
+			     int NVM_UNUSED(naddrs), void *NVM_UNUSED(meta),
+			     uint16_t NVM_UNUSED(flags), struct nvm_ret *ret)
+{
+	return fake_submit(ret);
+}
+
+static int fake_vector_write(struct nvm_dev *NVM_UNUSED(dev),
+			     struct nvm_addr *NVM_UNUSED(addrs),
+			     int NVM_UNUSED(naddrs),
+			     const void *NVM_UNUSED(data),
+			     const void *NVM_UNUSED(meta),
+			     uint16_t NVM_UNUSED(flags), struct nvm_ret *ret)
+{
+	return fake_submit(ret);
+}
+
+static int fake_vector_read(struct nvm_dev *NVM_UNUSED(dev),
+			    struct nvm_addr *NVM_UNUSED(addrs),
+			    int NVM_UNUSED(naddrs), void *NVM_UNUSED(data),
+			    void *NVM_UNUSED(meta), uint16_t NVM_UNUSED(flags),
+			    struct nvm_ret *ret)
+{
+	return fake_submit(ret);
+}
+
+static struct nvm_async_ctx *fake_async_init(struct nvm_dev *NVM_UNUSED(dev),
+					     uint32_t depth,
+					     uint16_t NVM_UNUSED(flags))
+{
+	struct nvm_async_ctx *ctx = calloc(1, sizeof(*ctx));
+
+	if (!ctx)
+		return NULL;
+
+	ctx->depth = depth;
+	ctx->efd = -1;
+
+	return ctx;
+}
+
+static int fake_async_term(struct nvm_dev *NVM_UNUSED(dev),
+			   struct nvm_async_ctx *ctx)
+{
+	free(ctx);
+
+	return 0;
+}
+
+static int fake_async_poke(struct nvm_dev *NVM_UNUSED(dev),
+			   struct nvm_async_ctx *NVM_UNUSED(ctx),
+			   uint32_t NVM_UNUSED(max))
+{
+	return 0;
+}
+
+static struct nvm_be FAKE_BE = {
+	.id = NVM_BE_ANY,
+	.name = "FAKE",
+
+	.vector_erase = fake_vector_erase,
+	.vector_write = fake_vector_write,
+	.vector_read = fake_vector_read,
+
+	.async_init = fake_async_init,
+	.async_term = fake_async_term,
+	.async_poke = fake_async_poke,
+	.async_cancel = nvm_be_nosys_async_cancel,
+};
+
+static struct nvm_dev FAKE_DEV;
+
+static void cb(struct nvm_ret *ret, void *NVM_UNUSED(cb_arg))
+{
+	COMPLETED[NCOMPLETED++] = ret;
+}
+
+/**
+ * Complete the dispatched command of 'ret' as the device would
+ */
+static void fake_cpl(struct nvm_ret *ret)
+{
+	ret->async.ctx->outstanding -= 1;
+	ret->status = 0;
+	ret->async.cb(ret, ret->async.cb_arg);
+}
+
+static struct nvm_async_ctx *sched_setup(uint32_t pu_depth,
+					 uint32_t pu_depth_wr)
+{
+	struct nvm_async_ctx *ctx;
+
+	memset(&FAKE_DEV, 0, sizeof(FAKE_DEV));
+	FAKE_DEV.geo.l.npugrp = 2;
+	FAKE_DEV.geo.l.npunit = 2;
+	FAKE_DEV.cmd_opts = NVM_CMD_VECTOR;
+	FAKE_DEV.be = &FAKE_BE;
+
+	NDISPATCHED = 0;
+	NCOMPLETED = 0;
+	FAIL = 0;
+
+	ctx = nvm_async_init(&FAKE_DEV, NCMDS, NVM_ASYNC_SCHED);
+	if (!ctx) {
+		CU_FAIL("nvm_async_init");
+		return NULL;
+	}
+	if (nvm_async_set_pu_depth(ctx, pu_depth) ||
+	    nvm_async_set_pu_depth_wr(ctx, pu_depth_wr)) {
+		CU_FAIL("nvm_async_set_pu_depth");
+		nvm_async_term(&FAKE_DEV, ctx);
+		return NULL;
+	}
+
+	return ctx;
+}
+
+/**
+ * Submit a one-sector command to PU 0 on 'ctx'
+ */
+static int sched_submit(struct nvm_async_ctx *ctx, enum nvm_cmd_desc_opc opc,
+			uint16_t flags, struct nvm_ret *ret)
+{
+	struct nvm_addr addr = { .val = 0 };
+	struct nvm_cmd_desc cmd = {
+		.opc = opc, .addrs = &addr, .naddrs = 1, .ret = ret,
+	};
+
+	memset(ret, 0, sizeof(*ret));
+	ret->async.ctx = ctx;
+	ret->async.cb = cb;
+
+	if (nvm_cmd_submit_batch(&FAKE_DEV, ctx, &cmd, 1, flags) != 1)
+		return -1;
+
+	return 0;
+}
+
+static void test_SCHED_PU_DEPTH(void)
+{
+	struct nvm_async_ctx *ctx = sched_setup(2, 1);
+	struct nvm_ret rets[4];
+
+	if (!ctx)
+		return;
+
+	for (int i = 0; i < 4; ++i) {
+		if (sched_submit(ctx, NVM_CMD_DESC_READ, 0x0, &rets[i])) {
+			CU_FAIL("sched_submit");
+			goto exit;
+		}
+	}
+	CU_ASSERT_EQUAL(NDISPATCHED, 2);
+	CU_ASSERT_EQUAL(nvm_async_get_outstanding(ctx), 4);
+
+	fake_cpl(&rets[0]);
+	CU_ASSERT_EQUAL(nvm_async_poke(&FAKE_DEV, ctx, 0), 0);
+	CU_ASSERT_EQUAL(NDISPATCHED, 3);
+	CU_ASSERT_PTR_EQUAL(DISPATCHED[2], &rets[2]);
+	CU_ASSERT_EQUAL(nvm_async_get_outstanding(ctx), 3);
+
+	for (int i = 1; i < 4; ++i) {
+		fake_cpl(&rets[i]);
+		nvm_async_poke(&FAKE_DEV, ctx, 0);
+	}
+	CU_ASSERT_EQUAL(NDISPATCHED, 4);
+	CU_ASSERT_EQUAL(NCOMPLETED, 4);
+	CU_ASSERT_EQUAL(nvm_async_get_outstanding(ctx), 0);
+
+exit:
+	nvm_async_term(&FAKE_DEV, ctx);
+}
+
+static void test_SCHED_PU_DEPTH_WR(void)
+{
+	struct nvm_async_ctx *ctx = sched_setup(2, 1);
+	struct nvm_ret rets[3];
+
+	if (!ctx)
+		return;
+
+	if (sched_submit(ctx, NVM_CMD_DESC_WRITE, 0x0, &rets[0]) ||
+	    sched_submit(ctx, NVM_CMD_DESC_READ, 0x0, &rets[1]) ||
+	    sched_submit(ctx, NVM_CMD_DESC_ERASE, 0x0, &rets[2])) {
+		CU_FAIL("sched_submit");
+		goto exit;
+	}
+
+	// The read goes along with the write, the erase waits for the write
+	CU_ASSERT_EQUAL(NDISPATCHED, 2);
+	CU_ASSERT_PTR_EQUAL(DISPATCHED[1], &rets[1]);
+
+	fake_cpl(&rets[1]);
+	nvm_async_poke(&FAKE_DEV, ctx, 0);
+	CU_ASSERT_EQUAL(NDISPATCHED, 2);
+
+	fake_cpl(&rets[0]);
+	nvm_async_poke(&FAKE_DEV, ctx, 0);
+	CU_ASSERT_EQUAL(NDISPATCHED, 3);
+	CU_ASSERT_PTR_EQUAL(DISPATCHED[2], &rets[2]);
+
+	fake_cpl(&rets[2]);
+	CU_ASSERT_EQUAL(nvm_async_get_outstanding(ctx), 0);
+
+exit:
+	nvm_async_term(&FAKE_DEV, ctx);
+}
+
+static void test_SCHED_PRIO(void)
+{
+	struct nvm_async_ctx *ctx = sched_setup(1, 1);
+	struct nvm_ret rets[3];
+
+	if (!ctx)
+		return;
+
+	if (sched_submit(ctx, NVM_CMD_DESC_READ, 0x0, &rets[0]) ||
+	    sched_submit(ctx, NVM_CMD_DESC_READ, 0x0, &rets[1]) ||
+	    sched_submit(ctx, NVM_CMD_DESC_READ, NVM_CMD_PRIO_HIGH,
+			 &rets[2])) {
+		CU_FAIL("sched_submit");
+		goto exit;
+	}
+	CU_ASSERT_EQUAL(NDISPATCHED, 1);
+
+	for (int i = 0; i < 3; ++i) {
+		fake_cpl(DISPATCHED[i]);
+		nvm_async_poke(&FAKE_DEV, ctx, 0);
+	}
+
+	CU_ASSERT_EQUAL(NDISPATCHED, 3);
+	CU_ASSERT_PTR_EQUAL(DISPATCHED[1], &rets[2]);
+	CU_ASSERT_PTR_EQUAL(DISPATCHED[2], &rets[1]);
+	CU_ASSERT_EQUAL(nvm_async_get_outstanding(ctx), 0);
+
+exit:
+	nvm_async_term(&FAKE_DEV, ctx);
+}
+
+static void test_SCHED_STARVATION(void)
+{
+	const int nhigh = NVM_SCHED_HIGH_BURST + 4;
+	struct nvm_async_ctx *ctx = sched_setup(1, 1);
+	struct nvm_ret rets[2 + NVM_SCHED_HIGH_BURST + 4];
+	int normal = -1;
+
+	if (!ctx)
+		return;
+
+	if (sched_submit(ctx, NVM_CMD_DESC_READ, 0x0, &rets[0]) ||
+	    sched_submit(ctx, NVM_CMD_DESC_READ, 0x0, &rets[1])) {
+		CU_FAIL("sched_submit");
+		goto exit;
+	}
+	for (int i = 0; i < nhigh; ++i) {
+		if (sched_submit(ctx, NVM_CMD_DESC_READ, NVM_CMD_PRIO_HIGH,
+				 &rets[2 + i])) {
+			CU_FAIL("sched_submit");
+			goto exit;
+		}
+	}
+
+	for (int i = 0; i < 2 + nhigh; ++i) {
+		fake_cpl(DISPATCHED[i]);
+		nvm_async_poke(&FAKE_DEV, ctx, 0);
+	}
+	CU_ASSERT_EQUAL(NDISPATCHED, 2 + nhigh);
+
+	for (int i = 0; i < NDISPATCHED; ++i) {
+		if (DISPATCHED[i] == &rets[1])
+			normal = i;
+	}
+	CU_ASSERT_EQUAL(normal, 1 + NVM_SCHED_HIGH_BURST);
+
+exit:
+	nvm_async_term(&FAKE_DEV, ctx);
+}
+
+/**
+ * High-priority reads admitted by their PU are dispatched on submit, they must
+ * also stop at the burst bound while a normal write waits for the write bound
+ */
+static void test_SCHED_STARVATION_SUBMIT(void)
+{
+	struct nvm_async_ctx *ctx = sched_setup(NCMDS, 1);
+	struct nvm_ret rets[2 + NVM_SCHED_HIGH_BURST + 1];
+
+	if (!ctx)
+		return;
+
+	if (sched_submit(ctx, NVM_CMD_DESC_WRITE, 0x0, &rets[0]) ||
+	    sched_submit(ctx, NVM_CMD_DESC_WRITE, 0x0, &rets[1])) {
+		CU_FAIL("sched_submit");
+		goto exit;
+	}
+	for (int i = 0; i < NVM_SCHED_HIGH_BURST + 1; ++i) {
+		if (sched_submit(ctx, NVM_CMD_DESC_READ, NVM_CMD_PRIO_HIGH,
+				 &rets[2 + i])) {
+			CU_FAIL("sched_submit");
+			goto exit;
+		}
+	}
+	CU_ASSERT_EQUAL(NDISPATCHED, 1 + NVM_SCHED_HIGH_BURST);
+
+	fake_cpl(&rets[0]);
+	nvm_async_poke(&FAKE_DEV, ctx, 0);
+	CU_ASSERT_EQUAL(NDISPATCHED, 3 + NVM_SCHED_HIGH_BURST);
+	CU_ASSERT_PTR_EQUAL(DISPATCHED[1 + NVM_SCHED_HIGH_BURST], &rets[1]);
+
+	for (int i = 1; i < NDISPATCHED; ++i)
+		fake_cpl(DISPATCHED[i]);
+	CU_ASSERT_EQUAL(nvm_async_get_outstanding(ctx), 0);
+
+exit:
+	nvm_async_term(&FAKE_DEV, ctx);
+}
+
+static void test_SCHED_DRAIN(void)
+{
+	struct nvm_async_ctx *ctx = sched_setup(1, 1);
+	struct nvm_ret rets[2];
+
+	if (!ctx)
+		return;
+
+	if (sched_submit(ctx, NVM_CMD_DESC_READ, 0x0, &rets[0]) ||
+	    sched_submit(ctx, NVM_CMD_DESC_READ, 0x0, &rets[1])) {
+		CU_FAIL("sched_submit");
+		goto exit;
+	}
+
+	FAIL = 1;
+	fake_cpl(&rets[0]);
+	CU_ASSERT_EQUAL(nvm_async_poke(&FAKE_DEV, ctx, 0), 1);
+
+	CU_ASSERT_EQUAL(NDISPATCHED, 1);
+	CU_ASSERT_EQUAL(NCOMPLETED, 2);
+	CU_ASSERT_PTR_EQUAL(COMPLETED[1], &rets[1]);
+	CU_ASSERT_EQUAL(rets[1].status, NVM_RET_STATUS_ABORTED);
+	CU_ASSERT_PTR_EQUAL(rets[1].async.cb, cb);
+	CU_ASSERT_EQUAL(nvm_async_get_outstanding(ctx), 0);
+
+exit:
+	nvm_async_term(&FAKE_DEV, ctx);
+}
+
+static void test_SCHED_CANCEL(void)
+{
+	struct nvm_async_ctx *ctx = sched_setup(1, 1);
+	struct nvm_ret rets[3];
+
+	if (!ctx)
+		return;
+
+	for (int i = 0; i < 3; ++i) {
+		if (sched_submit(ctx, NVM_CMD_DESC_READ, 0x0, &rets[i])) {
+			CU_FAIL("sched_submit");
+			goto exit;
+		}
+	}
+
+	CU_ASSERT_EQUAL(nvm_async_cancel(&FAKE_DEV, ctx, &rets[1]), 0);
+	CU_ASSERT_EQUAL(NCOMPLETED, 1);
+	CU_ASSERT_EQUAL(rets[1].status, NVM_RET_STATUS_ABORTED);
+	CU_ASSERT_EQUAL(nvm_async_get_outstanding(ctx), 2);
+
+	// In flight on a backend which cannot abort it
+	CU_ASSERT_EQUAL(nvm_async_cancel(&FAKE_DEV, ctx, &rets[0]), -1);
+	CU_ASSERT_EQUAL(errno, ENOENT);
+
+	fake_cpl(&rets[0]);
+	nvm_async_poke(&FAKE_DEV, ctx, 0);
+	CU_ASSERT_EQUAL(NDISPATCHED, 2);
+	CU_ASSERT_PTR_EQUAL(DISPATCHED[1], &rets[2]);
+
+	fake_cpl(&rets[2]);
+	CU_ASSERT_EQUAL(nvm_async_get_outstanding(ctx), 0);
+
+exit:
+	nvm_async_term(&FAKE_DEV, ctx);
+}
+
+int main(int argc, char **argv)
+{
+	int err = 0;
+
+	CU_pSuite pSuite = suite_create("nvm_sched", argc, argv, 1);
+	if (!pSuite)
+		goto out;
+
+	if (!CU_add_test(pSuite, "SCHED_PU_DEPTH", test_SCHED_PU_DEPTH))
+		goto out;
+
+	if (!CU_add_test(pSuite, "SCHED_PU_DEPTH_WR", test_SCHED_PU_DEPTH_WR))
+		goto out;
+
+	if (!CU_add_test(pSuite, "SCHED_PRIO", test_SCHED_PRIO))
+		goto out;
+
+	if (!CU_add_test(pSuite, "SCHED_STARVATION", test_SCHED_STARVATION))
+		goto out;
+
+	if (!CU_add_test(pSuite, "SCHED_STARVATION_SUBMIT",
+			 test_SCHED_STARVATION_SUBMIT))
+		goto out;
+
+	if (!CU_add_test(pSuite, "SCHED_DRAIN", test_SCHED_DRAIN))
+		goto out;
+
+	if (!CU_add_test(pSuite, "SCHED_CANCEL", test_SCHED_CANCEL))
+		goto out;
+
+	switch(RMODE) {
+	case NVM_TEST_RMODE_AUTO:
+		CU_automated_run_tests();
+		break;
+
+	default:
+		CU_basic_set_mode(RMODE);
+		CU_basic_run_tests();
+		break;
+	}
+
+out:
+	err = CU_get_error() || \
+	      CU_get_number_of_suites_failed() || \
+	      CU_get_number_of_tests_failed() || \
+	      CU_get_number_of_failures();
+
+	CU_cleanup_registry();
+
+	return err;
+}
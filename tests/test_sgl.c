@@ -118,6 +118,102 @@ static void _test_sgl(size_t nsectr_w, size_t nsectr_r, uint16_t flags)
 }
 
 
+#define CHAIN_NREC 64	///< Records gathered per sector, chains segments
+
+/**
+ * Gathers each sector from records interleaved across two buffers, giving
+ * more descriptors than fit a single segment, and reads it back through a
+ * single contiguous, hence single descriptor, SGL
+ */
+static void test_sgl_chain(void)
+{
+	const size_t nbytes = WS_OPT * SECTOR_SIZE;
+	const size_t rec_nbytes = SECTOR_SIZE / CHAIN_NREC;
+	const size_t nrecs = WS_OPT * CHAIN_NREC;
+
+	struct nvm_sgl_pool *pool;
+	struct nvm_sgl *sgl;
+	struct nvm_addr addr;
+	char *buf_w, *buf_r, *exp;
+	int rc;
+
+	if (nvm_cmd_rprt_arbs(DEV, NVM_CHUNK_STATE_FREE, 1, &addr)) {
+		CU_FAIL("nvm_cmd_rprt_arbs");
+		return;
+	}
+
+	pool = nvm_sgl_pool_create(DEV);
+	buf_w = nvm_buf_alloc(DEV, nbytes, NULL);
+	buf_r = nvm_buf_alloc(DEV, nbytes, NULL);
+	exp = malloc(nbytes);
+	CU_ASSERT_FATAL(pool && buf_w && buf_r && exp);
+
+	nvm_buf_fill(buf_w, nbytes);
+
+	sgl = nvm_sgl_alloc(pool);
+	for (size_t i = 0; i < nrecs; ++i) {
+		const size_t half = (i % 2) * (nbytes / 2);
+		char *rec = buf_w + half + (i / 2) * rec_nbytes;
+
+		memcpy(exp + i * rec_nbytes, rec, rec_nbytes);
+		CU_ASSERT_FATAL(!nvm_sgl_add(DEV, sgl, rec, rec_nbytes));
+	}
+
+	rc = nvm_cmd_write(DEV, &addr, WS_OPT, sgl, NULL,
+			   NVM_CMD_SCALAR | NVM_CMD_SGL, NULL);
+	CU_ASSERT(rc == 0);
+	nvm_sgl_free(pool, sgl);
+
+	sgl = nvm_sgl_alloc(pool);
+	for (size_t i = 0; i < WS_OPT; ++i) {
+		nvm_sgl_add(DEV, sgl, buf_r + i * SECTOR_SIZE, SECTOR_SIZE);
+	}
+
+	rc = nvm_cmd_read(DEV, &addr, WS_OPT, sgl, NULL,
+			  NVM_CMD_SCALAR | NVM_CMD_SGL, NULL);
+	CU_ASSERT(rc == 0);
+	nvm_sgl_free(pool, sgl);
+
+	CU_ASSERT(memcmp(buf_r, exp, nbytes) == 0);
+
+	free(exp);
+	nvm_buf_free(DEV, buf_r);
+	nvm_buf_free(DEV, buf_w);
+	nvm_sgl_pool_destroy(pool);
+}
+
+#define POOL_NSGLS 128
+#define POOL_NROUNDS 1000
+
+/**
+ * Allocates and frees SGLs concurrently from a pre-populated pool
+ */
+static void test_sgl_pool_threads(void)
+{
+	struct nvm_sgl_pool *pool = nvm_sgl_pool_create_nsgls(DEV, POOL_NSGLS);
+	int nfailed = 0;
+
+	CU_ASSERT_FATAL(pool != NULL);
+
+	#pragma omp parallel for reduction(+:nfailed)
+	for (int round = 0; round < POOL_NROUNDS; ++round) {
+		struct nvm_sgl *sgls[POOL_NSGLS / 8];
+
+		for (int i = 0; i < POOL_NSGLS / 8; ++i) {
+			sgls[i] = nvm_sgl_alloc(pool);
+			nfailed += !sgls[i];
+		}
+		for (int i = 0; i < POOL_NSGLS / 8; ++i) {
+			if (sgls[i])
+				nvm_sgl_free(pool, sgls[i]);
+		}
+	}
+
+	CU_ASSERT(nfailed == 0);
+
+	nvm_sgl_pool_destroy(pool);
+}
+
 #define MAKE_TEST(type, name, nsectr_w, nsectr_r, flags)                      \
 	static void test_sgl_ ## type ## _ ## name (void)                     \
 	{                                                                     \
@@ -140,6 +236,9 @@ int main(int argc, char **argv)
 	if (!pSuite)
 		goto out;
 
+	if (!CU_add_test(pSuite, "pool: {threads: ON}", test_sgl_pool_threads))
+		goto out;
+
 	switch (BE_ID) {
 	case NVM_BE_NOCD:
 	case NVM_BE_SPDK:
@@ -152,6 +251,9 @@ int main(int argc, char **argv)
 			goto out;
 		if (!CU_add_test(pSuite, "simple: {mode: VECTOR; nsectr: NSECTR; metadata: ON}", test_sgl_vector_nsectr_meta))
 			goto out;
+
+		if (!CU_add_test(pSuite, "chain: {mode: SCALAR; nsectr: WS_OPT; metadata: OFF}", test_sgl_chain))
+			goto out;
 	}
 
 	switch(RMODE) {
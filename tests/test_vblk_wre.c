@@ -152,6 +152,261 @@ void test_VBLK_EWR_SCALAR_ASYNC(void)
 	CU_ASSERT(!vblk_ewr(addrs, naddrs, NVM_CMD_SCALAR | NVM_CMD_ASYNC));
 }
 
+/**
+ * Allocate a virtual block over a free chunk of every PU of an OCSSD 2.0
+ * device, and a filled buffer-set of 'nunits' optimal write-units per chunk
+ *
+ * @return The number of chunks in the virtual block, 0 when there is nothing
+ * to test and -1 on failure, with nothing allocated
+ */
+static int vblk_s20_setup(size_t nunits, struct nvm_vblk **vblk,
+			  struct nvm_buf_set **bufs)
+{
+	struct nvm_addr addrs[0x1000] = { 0 };
+	const size_t naddrs = GEO->l.npugrp * GEO->l.npunit;
+	const size_t unit = nvm_dev_get_ws_opt(DEV) * GEO->l.nbytes;
+
+	*vblk = NULL;
+	*bufs = NULL;
+
+	if (nvm_dev_get_verid(DEV) != NVM_SPEC_VERID_20) {
+		CU_PASS("Nothing to test");
+		return 0;
+	}
+
+	if (nvm_cmd_rprt_arbs(DEV, NVM_CHUNK_STATE_FREE, naddrs, addrs)) {
+		CU_FAIL("FAILED: nvm_cmd_rprt_arbs");
+		return -1;
+	}
+
+	*vblk = nvm_vblk_alloc(DEV, addrs, naddrs);
+	if (!*vblk) {
+		CU_FAIL("FAILED: Allocating vblk");
+		return -1;
+	}
+
+	*bufs = nvm_buf_set_alloc(DEV, nunits * unit * naddrs, 0);
+	if (!*bufs) {
+		CU_FAIL("FAILED: Allocating nvm_buf_set");
+		nvm_vblk_free(*vblk);
+		*vblk = NULL;
+		return -1;
+	}
+	nvm_buf_set_fill(*bufs);
+
+	return naddrs;
+}
+
+/**
+ * Erase and free what vblk_s20_setup allocated
+ */
+static void vblk_s20_teardown(struct nvm_vblk *vblk, struct nvm_buf_set *bufs)
+{
+	if (vblk && nvm_vblk_erase(vblk) < 0)
+		CU_FAIL("FAILED: nvm_vblk_erase");
+
+	nvm_vblk_free(vblk);
+	nvm_buf_set_free(bufs);
+}
+
+void test_VBLK_WCACHE_WR(void)
+{
+	struct nvm_buf_set *bufs = NULL;
+	struct nvm_vblk *vblk = NULL;
+	size_t nbytes = 0;
+	int naddrs;
+
+	// One write-unit per chunk, not yet readable from the device
+	naddrs = vblk_s20_setup(1, &vblk, &bufs);
+	if (naddrs <= 0)
+		return;
+	nbytes = nvm_dev_get_ws_opt(DEV) * GEO->l.nbytes * naddrs;
+
+	if (nvm_vblk_set_wcache(vblk, 1)) {
+		CU_FAIL("FAILED: nvm_vblk_set_wcache");
+		goto out;
+	}
+
+	if (nvm_vblk_write(vblk, bufs->write, nbytes) < 0) {
+		CU_FAIL("FAILED: nvm_vblk_write");
+		goto out;
+	}
+	if (nvm_vblk_read(vblk, bufs->read, nbytes) < 0) {
+		CU_FAIL("FAILED: nvm_vblk_read");
+		goto out;
+	}
+	if (nvm_buf_diff(bufs->write, bufs->read, nbytes)) {
+		CU_FAIL("FAILED: nvm_buf_diff");
+		goto out;
+	}
+
+out:
+	vblk_s20_teardown(vblk, bufs);
+}
+
+void test_VBLK_BUFFERED_WR(void)
+{
+	struct nvm_buf_set *bufs = NULL;
+	struct nvm_vblk *vblk = NULL;
+	size_t nbytes = 0;
+	size_t piece = 0;
+	size_t unit = 0;
+	int naddrs;
+
+	// Room for two stripes and a bit, and for reading back the padded unit
+	naddrs = vblk_s20_setup(4, &vblk, &bufs);
+	if (naddrs <= 0)
+		return;
+
+	if (nvm_vblk_set_buffered(vblk, 1)) {
+		CU_FAIL("FAILED: nvm_vblk_set_buffered");
+		goto out;
+	}
+
+	// Two stripes and a bit, in pieces unaligned to anything
+	unit = nvm_dev_get_ws_opt(DEV) * GEO->l.nbytes;
+	nbytes = unit * naddrs * 2 + GEO->l.nbytes;
+	piece = GEO->l.nbytes + 7;
+
+	for (size_t ofz = 0; ofz < nbytes; ofz += piece) {
+		const size_t count = NVM_MIN(piece, nbytes - ofz);
+
+		if (nvm_vblk_write(vblk, bufs->write + ofz, count) < 0) {
+			CU_FAIL("FAILED: nvm_vblk_write");
+			goto out;
+		}
+	}
+	if (nvm_vblk_flush(vblk)) {
+		CU_FAIL("FAILED: nvm_vblk_flush");
+		goto out;
+	}
+
+	// The last mw_cunits sectors of a chunk are only readable once it is
+	// written past them
+	if (nvm_vblk_pad(vblk) < 0) {
+		CU_FAIL("FAILED: nvm_vblk_pad");
+		goto out;
+	}
+	if (nvm_vblk_pread(vblk, bufs->read, unit * (naddrs * 2 + 1), 0) < 0) {
+		CU_FAIL("FAILED: nvm_vblk_pread");
+		goto out;
+	}
+	if (nvm_buf_diff(bufs->write, bufs->read, nbytes)) {
+		CU_FAIL("FAILED: nvm_buf_diff");
+		goto out;
+	}
+
+out:
+	vblk_s20_teardown(vblk, bufs);
+}
+
+void test_VBLK_READAHEAD(void)
+{
+	struct nvm_buf_set *bufs = NULL;
+	struct nvm_vblk *vblk = NULL;
+	size_t nbytes = 0;
+	size_t piece = 0;
+	int naddrs;
+
+	// Four stripes, read back in pieces unaligned to anything
+	naddrs = vblk_s20_setup(4, &vblk, &bufs);
+	if (naddrs <= 0)
+		return;
+	nbytes = nvm_dev_get_ws_opt(DEV) * GEO->l.nbytes * naddrs * 4;
+	piece = GEO->l.nbytes + 7;
+
+	if (nvm_vblk_write(vblk, bufs->write, nbytes) < 0) {
+		CU_FAIL("FAILED: nvm_vblk_write");
+		goto out;
+	}
+	if (nvm_vblk_pad(vblk) < 0) {	// Make the mw_cunits tail readable
+		CU_FAIL("FAILED: nvm_vblk_pad");
+		goto out;
+	}
+	if (nvm_vblk_set_readahead(vblk, 2)) {
+		CU_FAIL("FAILED: nvm_vblk_set_readahead");
+		goto out;
+	}
+
+	for (size_t ofz = 0; ofz < nbytes;) {
+		const void *src = NULL;
+		ssize_t nread;
+
+		nread = nvm_vblk_read_zc(vblk, &src, NVM_MIN(piece,
+							    nbytes - ofz));
+		if (nread <= 0) {
+			CU_FAIL("FAILED: nvm_vblk_read_zc");
+			goto out;
+		}
+		memcpy(bufs->read + ofz, src, nread);
+		ofz += nread;
+	}
+	if (nvm_buf_diff(bufs->write, bufs->read, nbytes)) {
+		CU_FAIL("FAILED: nvm_buf_diff");
+		goto out;
+	}
+
+out:
+	vblk_s20_teardown(vblk, bufs);
+}
+
+void test_VBLK_APPEND(void)
+{
+	struct nvm_buf_set *bufs = NULL;
+	struct nvm_append *app = NULL;
+	struct nvm_vblk *vblk = NULL;
+	size_t vofs[0x1000] = { 0 };
+	size_t nbytes = 0;
+	size_t rec_nbytes = 0;
+	int naddrs;
+
+	// One record of a third of a sector per chunk, each committed on its
+	// own, thus at most a write-unit each
+	naddrs = vblk_s20_setup(1, &vblk, &bufs);
+	if (naddrs <= 0)
+		return;
+	nbytes = nvm_dev_get_ws_opt(DEV) * GEO->l.nbytes * naddrs;
+	rec_nbytes = GEO->l.nbytes / 3;
+
+	app = nvm_append_create(vblk, 100);
+	if (!app) {
+		CU_FAIL("FAILED: nvm_append_create");
+		goto out;
+	}
+	for (int i = 0; i < naddrs; ++i) {
+		struct nvm_append_loc loc;
+
+		if (nvm_append(app, bufs->write + i * rec_nbytes, rec_nbytes,
+			       &loc)) {
+			CU_FAIL("FAILED: nvm_append");
+			goto out;
+		}
+		vofs[i] = loc.vofs;
+	}
+	nvm_append_destroy(app);
+	app = NULL;
+
+	if (nvm_vblk_pad(vblk) < 0) {	// Make the mw_cunits tail readable
+		CU_FAIL("FAILED: nvm_vblk_pad");
+		goto out;
+	}
+	if (nvm_vblk_pread(vblk, bufs->read, nbytes, 0) < 0) {
+		CU_FAIL("FAILED: nvm_vblk_pread");
+		goto out;
+	}
+	for (int i = 0; i < naddrs; ++i) {
+		if (nvm_buf_diff(bufs->write + i * rec_nbytes,
+				 bufs->read + vofs[i], rec_nbytes)) {
+			CU_FAIL("FAILED: nvm_buf_diff");
+			goto out;
+		}
+	}
+
+out:
+	nvm_append_destroy(app);
+	vblk_s20_teardown(vblk, bufs);
+}
+
 int main(int argc, char **argv)
 {
 	int err = 0;
@@ -175,6 +430,14 @@ int main(int argc, char **argv)
 				goto out;
 			if (!CU_add_test(pSuite, "VBLK EWR S20 SCALAR/SYNC", test_VBLK_EWR_SCALAR_SYNC))
 				goto out;
+			if (!CU_add_test(pSuite, "VBLK WCACHE WR", test_VBLK_WCACHE_WR))
+				goto out;
+			if (!CU_add_test(pSuite, "VBLK BUFFERED WR", test_VBLK_BUFFERED_WR))
+				goto out;
+			if (!CU_add_test(pSuite, "VBLK READAHEAD", test_VBLK_READAHEAD))
+				goto out;
+			if (!CU_add_test(pSuite, "VBLK APPEND", test_VBLK_APPEND))
+				goto out;
 	}
 
 	switch(RMODE) {